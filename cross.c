@@ -1,5 +1,10 @@
 // ffi_multiplatform_assembly.c
 
+// Expose POSIX/GNU extensions (MAP_ANONYMOUS, syscall numbers) even when compiling with -std=c11
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdbool.h> // For bool type
 #include <stddef.h>  // For offsetof, size_t
 #include <string.h>  // For memcpy
@@ -10,6 +15,8 @@
 #include <float.h>   // For FLT_MAX, DBL_MAX, etc.
 #include <limits.h>  // For INT_MIN, INT_MAX, CHAR_MIN, CHAR_MAX, etc.
 #include <wchar.h>   // For wchar_t, WCHAR_MIN, WCHAR_MAX
+#include <errno.h>   // For errno (raw syscall error translation)
+#include <time.h>    // For clock_gettime (benchmark timer)
 
 // --- Platform Detection ---
 #if defined(_WIN64)
@@ -26,6 +33,12 @@
     // For mmap (Linux specific for executable memory)
     #include <sys/mman.h> // For mmap, munmap
     #include <unistd.h>  // For sysconf(_SC_PAGESIZE)
+    #include <dlfcn.h>   // For dlopen, dlsym (library bindings)
+    #if defined(__linux__)
+        #include <sys/syscall.h> // For SYS_* numbers used by raw syscall trampolines
+        #include <elf.h>         // For the in-memory ELF objects registered with GDB
+        #include <unwind.h>      // For _Unwind_Backtrace (trampoline unwind info test)
+    #endif
 #elif defined(__APPLE__)
     #define FFI_OS_MACOS
     #if defined(__x86_64__)
@@ -36,10 +49,155 @@
     // For mmap (macOS specific for executable memory)
     #include <sys/mman.h> // For mmap, munmap
     #include <unistd.h>  // For sysconf(_SC_PAGESIZE)
+    #include <dlfcn.h>   // For dlopen, dlsym (library bindings)
 #else
     #error "Unsupported platform for FFI."
 #endif
 
+// x86 intrinsics for the runtime-dispatched bulk conversion helpers (needs GCC/Clang target attributes)
+#if defined(FFI_ARCH_X64) && defined(__GNUC__)
+    #include <immintrin.h>
+    #include <cpuid.h>
+    #define FFI_HAVE_X86_TARGET_ATTR 1
+#endif
+
+// C99 complex types (optional in C11; MSVC's <complex.h> uses incompatible struct types)
+#if !defined(__STDC_NO_COMPLEX__) && !defined(_MSC_VER)
+    #include <complex.h>
+    #define FFI_HAVE_COMPLEX 1
+#endif
+
+// Pointer-sized atomics for handles shared across threads (GCC/Clang builtins, Interlocked* on MSVC)
+#if defined(__GNUC__) || defined(__clang__)
+    #define FFI_ATOMIC_LOAD_PTR(slot) __atomic_load_n((slot), __ATOMIC_ACQUIRE)
+    #define FFI_ATOMIC_CAS_PTR(slot, expected, desired) \
+        __atomic_compare_exchange_n((slot), &(expected), (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#elif defined(_MSC_VER)
+    #define FFI_ATOMIC_LOAD_PTR(slot) InterlockedCompareExchangePointer((PVOID volatile*)(slot), NULL, NULL)
+    #define FFI_ATOMIC_CAS_PTR(slot, expected, desired) \
+        (InterlockedCompareExchangePointer((PVOID volatile*)(slot), (desired), (expected)) == (expected))
+#else
+    #error "FFI needs pointer-sized atomics (GCC/Clang builtins or MSVC Interlocked*)."
+#endif
+
+// 64-bit counter atomics for statistics, ring positions and completion flags shared across threads,
+// and 32-bit atomics for futex words. Exchanges on 32-bit words are sequentially consistent.
+#if defined(__GNUC__) || defined(__clang__)
+    #define FFI_ATOMIC_LOAD_I64(slot) __atomic_load_n((slot), __ATOMIC_ACQUIRE)
+    #define FFI_ATOMIC_STORE_I64(slot, value) __atomic_store_n((slot), (value), __ATOMIC_RELEASE)
+    #define FFI_ATOMIC_ADD_I64(slot, value) __atomic_fetch_add((slot), (value), __ATOMIC_ACQ_REL)
+    #define FFI_ATOMIC_CAS_I64(slot, expected, desired) \
+        __atomic_compare_exchange_n((slot), &(expected), (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+    #define FFI_ATOMIC_LOAD_U32(slot) __atomic_load_n((slot), __ATOMIC_ACQUIRE)
+    #define FFI_ATOMIC_XCHG_U32(slot, value) __atomic_exchange_n((slot), (value), __ATOMIC_SEQ_CST)
+    #define FFI_ATOMIC_CAS_U32(slot, expected, desired) \
+        __atomic_compare_exchange_n((slot), &(expected), (desired), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+    #define FFI_ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+    #define FFI_ATOMIC_LOAD_I64(slot) InterlockedOr64((volatile LONG64*)(slot), 0)
+    #define FFI_ATOMIC_STORE_I64(slot, value) ((void)InterlockedExchange64((volatile LONG64*)(slot), (value)))
+    #define FFI_ATOMIC_ADD_I64(slot, value) InterlockedExchangeAdd64((volatile LONG64*)(slot), (value))
+    #define FFI_ATOMIC_CAS_I64(slot, expected, desired) \
+        (InterlockedCompareExchange64((volatile LONG64*)(slot), (desired), (expected)) == (expected))
+    #define FFI_ATOMIC_LOAD_U32(slot) ((uint32_t)InterlockedOr((volatile LONG*)(slot), 0))
+    #define FFI_ATOMIC_XCHG_U32(slot, value) ((uint32_t)InterlockedExchange((volatile LONG*)(slot), (LONG)(value)))
+    #define FFI_ATOMIC_CAS_U32(slot, expected, desired) \
+        (InterlockedCompareExchange((volatile LONG*)(slot), (LONG)(desired), (LONG)(expected)) == (LONG)(expected))
+    #define FFI_ATOMIC_FENCE() MemoryBarrier()
+#endif
+
+// Per-thread storage (epochs, thread identity markers)
+#ifdef _MSC_VER
+    #define FFI_THREAD_LOCAL __declspec(thread)
+#else
+    #define FFI_THREAD_LOCAL _Thread_local
+#endif
+
+// Threads, mutexes and condition variables for the worker pools (Win32 on Windows, pthreads elsewhere)
+#ifdef FFI_OS_WIN64
+    typedef HANDLE ffi_thread_t;
+    typedef SRWLOCK ffi_mutex_t;
+    typedef CONDITION_VARIABLE ffi_cond_t;
+    #define FFI_THREAD_FUNC(name, arg) static DWORD WINAPI name(LPVOID arg)
+    #define FFI_THREAD_RETURN 0
+    #define ffi_thread_start(thread, func, arg) ((*(thread) = CreateThread(NULL, 0, (func), (arg), 0, NULL)) != NULL)
+    #define ffi_thread_join(thread) ((void)WaitForSingleObject((thread), INFINITE), (void)CloseHandle(thread))
+    #define FFI_MUTEX_INITIALIZER SRWLOCK_INIT
+    #define ffi_mutex_init(mutex) InitializeSRWLock(mutex)
+    #define ffi_mutex_destroy(mutex) ((void)(mutex))
+    #define ffi_mutex_lock(mutex) AcquireSRWLockExclusive(mutex)
+    #define ffi_mutex_unlock(mutex) ReleaseSRWLockExclusive(mutex)
+    #define ffi_cond_init(cond) InitializeConditionVariable(cond)
+    #define ffi_cond_destroy(cond) ((void)(cond))
+    #define ffi_cond_wait(cond, mutex) ((void)SleepConditionVariableSRW((cond), (mutex), INFINITE, 0))
+    #define ffi_cond_signal(cond) WakeConditionVariable(cond)
+    #define ffi_cond_broadcast(cond) WakeAllConditionVariable(cond)
+    #define ffi_thread_yield() ((void)SwitchToThread())
+#else
+    #include <pthread.h>
+    #include <sched.h> // For sched_yield
+    typedef pthread_t ffi_thread_t;
+    typedef pthread_mutex_t ffi_mutex_t;
+    typedef pthread_cond_t ffi_cond_t;
+    #define FFI_THREAD_FUNC(name, arg) static void* name(void* arg)
+    #define FFI_THREAD_RETURN NULL
+    #define ffi_thread_start(thread, func, arg) (pthread_create((thread), NULL, (func), (arg)) == 0)
+    #define ffi_thread_join(thread) ((void)pthread_join((thread), NULL))
+    #define FFI_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+    #define ffi_mutex_init(mutex) ((void)pthread_mutex_init((mutex), NULL))
+    #define ffi_mutex_destroy(mutex) ((void)pthread_mutex_destroy(mutex))
+    #define ffi_mutex_lock(mutex) ((void)pthread_mutex_lock(mutex))
+    #define ffi_mutex_unlock(mutex) ((void)pthread_mutex_unlock(mutex))
+    #define ffi_cond_init(cond) ((void)pthread_cond_init((cond), NULL))
+    #define ffi_cond_destroy(cond) ((void)pthread_cond_destroy(cond))
+    #define ffi_cond_wait(cond, mutex) ((void)pthread_cond_wait((cond), (mutex)))
+    #define ffi_cond_signal(cond) ((void)pthread_cond_signal(cond))
+    #define ffi_cond_broadcast(cond) ((void)pthread_cond_broadcast(cond))
+    #define ffi_thread_yield() ((void)sched_yield())
+#endif
+
+// Futex wait/wake on a 32-bit word: futex(2) on Linux; elsewhere a mutex and condition variable
+// (an FFI_ParkingLot shared by every word of one owner) stand in for the kernel wait queue.
+typedef struct {
+    ffi_mutex_t lock;
+    ffi_cond_t cond;
+} FFI_ParkingLot;
+
+#ifdef FFI_OS_LINUX
+    #include <linux/futex.h> // For FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#endif
+
+/**
+ * @brief Sleeps while `*word == expected`. May return spuriously; callers re-check in a loop.
+ */
+static void ffi_futex_wait(uint32_t* word, uint32_t expected, FFI_ParkingLot* lot) {
+#if defined(FFI_OS_LINUX) && defined(__linux__)
+    (void)lot;
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#else
+    ffi_mutex_lock(&lot->lock);
+    if (FFI_ATOMIC_LOAD_U32(word) == expected) {
+        ffi_cond_wait(&lot->cond, &lot->lock);
+    }
+    ffi_mutex_unlock(&lot->lock);
+#endif
+}
+
+/**
+ * @brief Wakes the threads sleeping on `word`. Change the word before calling this.
+ */
+static void ffi_futex_wake(uint32_t* word, FFI_ParkingLot* lot) {
+#if defined(FFI_OS_LINUX) && defined(__linux__)
+    (void)lot;
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+    ffi_mutex_lock(&lot->lock);
+    ffi_cond_broadcast(&lot->cond);
+    ffi_mutex_unlock(&lot->lock);
+#endif
+}
+
 // Enable FFI_TESTING to use double_tap.h macros
 #define FFI_TESTING 1
 #include "double_tap.h" // Include the Double TAP testing framework
@@ -71,8 +229,21 @@ typedef enum {
     FFI_TYPE_SLLONG,    // Explicit signed long long
     FFI_TYPE_INT128,    // New: 128-bit signed integer (GCC/Clang extension, or struct on MSVC)
     FFI_TYPE_UINT128,   // New: 128-bit unsigned integer (GCC/Clang extension, or struct on MSVC)
+    FFI_TYPE_FLOAT16,   // IEEE 754 binary16 (_Float16), exchanged as its 16-bit pattern
+    FFI_TYPE_BFLOAT16,  // bfloat16 (__bf16), exchanged as its 16-bit pattern
+    FFI_TYPE_FLOAT_COMPLEX,  // float _Complex (real part first, as in C)
+    FFI_TYPE_DOUBLE_COMPLEX, // double _Complex (real part first, as in C)
+    FFI_TYPE_LONG_DOUBLE,    // long double (x87 80-bit extended on x86-64 System V)
 } FFI_Type;
 
+// Calling convention the generated trampoline uses to reach its target.
+typedef enum {
+    FFI_ABI_DEFAULT = 0, // Native C calling convention of the host platform
+    FFI_ABI_SYSCALL,     // Raw Linux x86-64 `syscall` instruction, bypassing the libc wrapper
+    FFI_ABI_SYSV,        // x86-64 System V (Linux/macOS), selectable explicitly
+    FFI_ABI_WIN64,       // x86-64 Microsoft x64; on non-Windows hosts reaches __attribute__((ms_abi)) code
+} FFI_ABI;
+
 // FFI_Argument structure defines how arguments are represented generically.
 typedef struct {
     void* value_ptr; // Pointer to the actual value (e.g., &my_int_var)
@@ -81,18 +252,46 @@ typedef struct {
 // Generic function pointer type for trampoline and target functions
 typedef void (*GenericFuncPtr)(void);
 typedef void (*GenericTrampolinePtr)(FFI_Argument* args, int num_args, void* return_buffer_ptr);
+// Precompiled tier-0 call shim: integer arguments widened to 64 bits, floating-point ones as doubles.
+typedef void (*FFI_Tier0Shim)(GenericFuncPtr fn, const uint64_t* ints, const double* fps, int ret_class, void* ret);
 
 // Structure to hold a function's signature metadata AND its trampoline code
 typedef struct FFI_FunctionSignature {
     const char* debug_name; // For easier identification in debug prints
     FFI_Type return_type;
     int num_params;
+    int num_fixed_params;   // Parameters before a variadic `...`; equals num_params for prototyped targets
     FFI_Type* param_types;  // Array of expected argument types (can be NULL for no args)
     GenericFuncPtr func_ptr;         // Pointer to the actual C function implementation
     size_t trampoline_size; // Size of the generated trampoline code
     GenericTrampolinePtr trampoline_code;  // Pointer to the dynamically generated executable code
+    FFI_ABI abi;            // Calling convention used to reach the target
+    long syscall_number;    // Kernel syscall number (only meaningful for FFI_ABI_SYSCALL)
+    struct FFI_FunctionSignature* retired_next; // Link in the list awaiting reclamation after destroy
+    int64_t retired_epoch;  // Global epoch when destroy_ffi_function() retired it
+    FFI_Tier0Shim tier0_shim; // Serves calls until promotion to JIT code (NULL if never tier 0)
+    int tier0_ret_class;    // FFI_TIER0_RET_* of the return type
+    int64_t tier0_calls;    // Calls served by tier 0 so far
+    int64_t tier_up_at;     // Tier-0 calls that trigger promotion
+    uint32_t tier_state;    // FFI_TIER_* promotion progress, guarded by g_ffi_tier_lock
+    struct FFI_FunctionSignature* tier_next; // Link in the background compiler's queue
+    struct FFI_CallStats* call_stats; // Counters the trampoline updates (NULL when not instrumented)
+    int64_t code_size;      // Bytes emitted into the trampoline (0 until it is generated)
+    int64_t id;             // Process-unique handle number, reported by the USDT probes
+    uint32_t trace_named;   // Set once the name is in the call-trace name table
+    uint32_t record_generation; // Recording whose log already has this handle's signature record
 } FFI_FunctionSignature;
 
+// A call validated once against its signature, owning its argument and return storage.
+// Meant to be owned by one thread at a time; keep one per thread for concurrent callers.
+typedef struct FFI_PreparedCall {
+    GenericTrampolinePtr trampoline; // Bound trampoline of `sig`, resolved at prepare time
+    FFI_Argument* args;              // One entry per parameter, each pointing at its own slot
+    int num_args;
+    void* return_value;              // 16-byte aligned slot large enough for any FFI_Type
+    FFI_FunctionSignature* sig;      // Must outlive the prepared call
+} FFI_PreparedCall;
+
 // Define parameter types for the functions (static const to avoid multiple definitions if in header)
 static FFI_Type identity_int_params[] = { FFI_TYPE_INT };
 static FFI_Type add_two_ints_params[] = { FFI_TYPE_INT, FFI_TYPE_INT };
@@ -141,6 +340,31 @@ static FFI_Type identity_sllong_params[] = { FFI_TYPE_SLLONG };
 static FFI_Type identity_int128_params[] = { FFI_TYPE_INT128 };
 static FFI_Type identity_uint128_params[] = { FFI_TYPE_UINT128 };
 
+// NEW: Parameter type arrays for Win64 (ms_abi) targets
+static FFI_Type ms_mixed_positional_params[] = { FFI_TYPE_INT, FFI_TYPE_DOUBLE, FFI_TYPE_INT, FFI_TYPE_FLOAT,
+                                                 FFI_TYPE_DOUBLE, FFI_TYPE_FLOAT, FFI_TYPE_LLONG };
+static FFI_Type ms_int128_sub_params[] = { FFI_TYPE_INT128, FFI_TYPE_INT, FFI_TYPE_INT, FFI_TYPE_INT, FFI_TYPE_INT128 };
+
+// NEW: Parameter type arrays for half-precision targets
+static FFI_Type f16_scaled_product_params[] = { FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_INT };
+static FFI_Type f16_sum_ten_params[] = { FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16,
+                                         FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16 };
+static FFI_Type bf16_scale_params[] = { FFI_TYPE_BFLOAT16, FFI_TYPE_FLOAT };
+static FFI_Type ms_f16_axpy_params[] = { FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_FLOAT16, FFI_TYPE_DOUBLE, FFI_TYPE_FLOAT16 };
+
+// NEW: Parameter type arrays for complex and long double targets
+static FFI_Type ld_muladd_params[] = { FFI_TYPE_LONG_DOUBLE, FFI_TYPE_LONG_DOUBLE, FFI_TYPE_LONG_DOUBLE };
+static FFI_Type dc_multiply_params[] = { FFI_TYPE_DOUBLE_COMPLEX, FFI_TYPE_DOUBLE_COMPLEX };
+static FFI_Type fc_scale_params[] = { FFI_TYPE_FLOAT_COMPLEX, FFI_TYPE_FLOAT };
+static FFI_Type dc_straddle_params[] = { FFI_TYPE_DOUBLE, FFI_TYPE_DOUBLE, FFI_TYPE_DOUBLE, FFI_TYPE_DOUBLE, FFI_TYPE_DOUBLE,
+                                         FFI_TYPE_DOUBLE, FFI_TYPE_DOUBLE, FFI_TYPE_DOUBLE_COMPLEX, FFI_TYPE_DOUBLE, FFI_TYPE_DOUBLE };
+static FFI_Type i128_stack_alignment_params[] = { FFI_TYPE_LONG, FFI_TYPE_LONG, FFI_TYPE_LONG, FFI_TYPE_LONG, FFI_TYPE_LONG,
+                                                  FFI_TYPE_INT128, FFI_TYPE_LONG, FFI_TYPE_LONG, FFI_TYPE_INT128 };
+
+// NEW: Parameter type arrays for raw syscall trampolines
+static FFI_Type syscall_read_write_params[] = { FFI_TYPE_INT, FFI_TYPE_POINTER, FFI_TYPE_SIZE_T };
+static FFI_Type syscall_float_params[] = { FFI_TYPE_DOUBLE };
+
 
 // --- Assembly Instruction Component Defines (x86-64 System V & Win64) ---
 #ifdef FFI_ARCH_X64
@@ -154,6 +378,12 @@ static FFI_Type identity_uint128_params[] = { FFI_TYPE_UINT128 };
 #define OPCODE_MOV_IMM64_RAX 0xB8 // MOV RAX, imm64
 #define OPCODE_CALL_RM64    0xFF // CALL r/m64 (ModR/M 0xD0 for RAX, R/M group 2 for CALL)
 #define OPCODE_RET          0xC3
+#define OPCODE_MOV_IMM32_EAX 0xB8 // MOV EAX, imm32 (zero-extends into RAX)
+#define OPCODE_SYSCALL_BYTE  0x05 // Second byte of SYSCALL (0x0F 0x05)
+#define OPCODE_CMP_RAX_IMM32 0x3D // REX.W + 3D id -> CMP RAX, imm32 (sign-extended)
+#define OPCODE_JB_REL8       0x72 // JB rel8 (unsigned below)
+#define OPCODE_ALU_IMM32_RM64 0x81 // SUB/ADD r/m64, imm32 (same group encoding as 0x83, for frames > 127 bytes)
+#define OPCODE_LEA_R64_M     0x8D // REX.W + 8D /r -> LEA r64, m
 #define OPCODE_PUSH_R12_BYTE 0x54 // Actual byte for PUSH R12 (used with REX.B)
 #define OPCODE_POP_R12_BYTE  0x5C // Actual byte for POP R12 (used with REX.B)
 #define OPCODE_PUSH_R14_BYTE 0x56 // Actual byte for PUSH R14 (used with REX.B)
@@ -173,6 +403,10 @@ static FFI_Type identity_uint128_params[] = { FFI_TYPE_UINT128 };
 #define OPCODE_XORPS        0x57 // XORPS XMM, XMM
 #define OPCODE_MOVD_XMM_GPR 0x7E // MOVD r/m32, XMM (0x0F 0x7E /r)
 #define OPCODE_MOVQ_XMM_GPR 0x7E // MOVQ r/m64, XMM (REX.W + 0x0F 0x7E /r)
+#define OPCODE_MOVD_GPR_XMM 0x6E // MOVD XMM, r/m32 (0x66 0x0F 0x6E /r)
+#define OPCODE_MOVZX_R_RM16 0xB7 // MOVZX r32/r64, r/m16 (0x0F 0xB7 /r)
+#define OPCODE_MOVDQU_RM_XMM 0x7F // MOVDQU m128, XMM (0xF3 0x0F 0x7F /r)
+#define OPCODE_FSTP_M80     0xDB // FSTP m80fp (0xDB /7)
 
 // REX Prefixes
 #define REX_W_PREFIX        0x48 // REX.W: 64-bit operand size
@@ -314,6 +548,277 @@ static FFI_Type identity_uint128_params[] = { FFI_TYPE_UINT128 };
 #endif // FFI_ARCH_ARM64
 
 
+// --- Half-Precision Conversion Helpers ---
+// FFI_TYPE_FLOAT16 and FFI_TYPE_BFLOAT16 values are exchanged as raw 16-bit patterns, so callers
+// without compiler support for _Float16/__bf16 can still build arguments and read results.
+
+/**
+ * @brief Converts IEEE 754 binary16 bits to a float (exact).
+ * @param bits The binary16 bit pattern.
+ * @return The equivalent float value.
+ */
+float ffi_f16_bits_to_float(uint16_t bits) {
+    uint32_t sign = (uint32_t)(bits & 0x8000) << 16;
+    uint32_t exponent = (bits >> 10) & 0x1F;
+    uint32_t mantissa = bits & 0x3FF;
+    uint32_t result;
+    if (exponent == 0x1F) {
+        result = sign | 0x7F800000 | (mantissa << 13); // Inf/NaN, payload preserved
+    } else if (exponent != 0) {
+        result = sign | ((exponent + 112) << 23) | (mantissa << 13); // Rebias 15 -> 127
+    } else if (mantissa == 0) {
+        result = sign; // +/-0
+    } else {
+        // Subnormal: normalize the mantissa into an ordinary float
+        exponent = 113;
+        while ((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        result = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+    float value;
+    memcpy(&value, &result, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Converts a float to IEEE 754 binary16 bits, rounding to nearest-even.
+ * Matches VCVTPS2PH with round-to-nearest: overflow goes to infinity, NaNs stay quiet NaNs.
+ * @param value The float to convert.
+ * @return The binary16 bit pattern.
+ */
+uint16_t ffi_float_to_f16_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+
+    if (magnitude >= 0x7F800000) { // Inf or NaN
+        uint32_t nan_payload = (magnitude > 0x7F800000) ? (0x200 | ((magnitude >> 13) & 0x3FF)) : 0;
+        return (uint16_t)(sign | 0x7C00 | nan_payload);
+    }
+    if (magnitude >= 0x477FF000) { // >= 65520 rounds past the largest half (65504)
+        return (uint16_t)(sign | 0x7C00);
+    }
+    if (magnitude < 0x38800000) { // Below 2^-14: subnormal half or zero
+        if (magnitude <= 0x33000000) { // <= 2^-25 rounds (ties-to-even) to zero
+            return (uint16_t)sign;
+        }
+        uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - (magnitude >> 23);
+        uint32_t half_mantissa = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+            half_mantissa++; // May carry into the smallest normal, which is the correct encoding
+        }
+        return (uint16_t)(sign | half_mantissa);
+    }
+    uint32_t half = (magnitude >> 13) - (112 << 10); // Rebias 127 -> 15
+    uint32_t remainder = magnitude & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        half++; // A mantissa carry correctly bumps the exponent
+    }
+    return (uint16_t)(sign | half);
+}
+
+/**
+ * @brief Converts bfloat16 bits to a float (exact: bfloat16 is the top half of a float).
+ * @param bits The bfloat16 bit pattern.
+ * @return The equivalent float value.
+ */
+float ffi_bf16_bits_to_float(uint16_t bits) {
+    uint32_t result = (uint32_t)bits << 16;
+    float value;
+    memcpy(&value, &result, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Converts a float to bfloat16 bits, rounding to nearest-even. NaNs stay quiet NaNs.
+ * @param value The float to convert.
+ * @return The bfloat16 bit pattern.
+ */
+uint16_t ffi_float_to_bf16_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000) {
+        return (uint16_t)((bits >> 16) | 0x40);
+    }
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+}
+
+// Bulk conversions pick the widest available instruction set at runtime. Only the converting
+// kernels carry target attributes, so the rest of the file still builds for baseline x86-64.
+// binary16 uses AVX-512F/F16C VCVTPH2PS/VCVTPS2PH; bfloat16 uses integer shifts and adds
+// (AVX2/AVX-512F). VCVTNEPS2BF16 is deliberately not used: it flushes denormals, so results
+// would differ from the scalar path depending on the CPU.
+#ifdef FFI_HAVE_X86_TARGET_ATTR
+__attribute__((target("avx512f")))
+static size_t ffi_f16_to_f32_avx512(const uint16_t* src, float* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(src + i))));
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t ffi_f16_to_f32_f16c(const uint16_t* src, float* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static size_t ffi_f32_to_f16_avx512(const float* src, uint16_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i half = _mm512_cvtps_ph(_mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256((__m256i*)(dst + i), half);
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t ffi_f32_to_f16_f16c(const float* src, uint16_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128((__m128i*)(dst + i), half);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static size_t ffi_bf16_to_f32_avx512(const uint16_t* src, float* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + i)));
+        _mm512_storeu_si512((void*)(dst + i), _mm512_slli_epi32(wide, 16));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t ffi_bf16_to_f32_avx2(const uint16_t* src, float* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_slli_epi32(wide, 16));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t ffi_f32_to_bf16_avx2(const float* src, uint16_t* dst, size_t count) {
+    const __m256i rounding_bias = _mm256_set1_epi32(0x7FFF);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i abs_mask = _mm256_set1_epi32(0x7FFFFFFF);
+    const __m256i infinity = _mm256_set1_epi32(0x7F800000);
+    const __m256i quiet_bit = _mm256_set1_epi32(0x40);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i packed[2];
+        for (int half = 0; half < 2; ++half) {
+            __m256i bits = _mm256_loadu_si256((const __m256i*)(src + i + 8 * half));
+            __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+            __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(rounding_bias, lsb)), 16);
+            __m256i quiet_nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16), quiet_bit);
+            __m256i is_nan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, abs_mask), infinity);
+            packed[half] = _mm256_blendv_epi8(rounded, quiet_nan, is_nan);
+        }
+        // packus works per 128-bit lane; restore element order afterwards.
+        __m256i result = _mm256_permute4x64_epi64(_mm256_packus_epi32(packed[0], packed[1]), 0xD8);
+        _mm256_storeu_si256((__m256i*)(dst + i), result);
+    }
+    return i;
+}
+#endif // FFI_HAVE_X86_TARGET_ATTR
+
+/**
+ * @brief Converts an array of binary16 values to floats.
+ * @param src Source binary16 bit patterns.
+ * @param dst Destination floats (may not overlap `src`).
+ * @param count Number of elements.
+ */
+void ffi_f16_to_f32_array(const uint16_t* src, float* dst, size_t count) {
+    size_t done = 0;
+#ifdef FFI_HAVE_X86_TARGET_ATTR
+    if (__builtin_cpu_supports("avx512f")) {
+        done = ffi_f16_to_f32_avx512(src, dst, count);
+    } else if (__builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx")) {
+        done = ffi_f16_to_f32_f16c(src, dst, count);
+    }
+#endif
+    for (size_t i = done; i < count; ++i) {
+        dst[i] = ffi_f16_bits_to_float(src[i]);
+    }
+}
+
+/**
+ * @brief Converts an array of floats to binary16 values (round to nearest-even).
+ * @param src Source floats.
+ * @param dst Destination binary16 bit patterns (may not overlap `src`).
+ * @param count Number of elements.
+ */
+void ffi_f32_to_f16_array(const float* src, uint16_t* dst, size_t count) {
+    size_t done = 0;
+#ifdef FFI_HAVE_X86_TARGET_ATTR
+    if (__builtin_cpu_supports("avx512f")) {
+        done = ffi_f32_to_f16_avx512(src, dst, count);
+    } else if (__builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx")) {
+        done = ffi_f32_to_f16_f16c(src, dst, count);
+    }
+#endif
+    for (size_t i = done; i < count; ++i) {
+        dst[i] = ffi_float_to_f16_bits(src[i]);
+    }
+}
+
+/**
+ * @brief Converts an array of bfloat16 values to floats.
+ * @param src Source bfloat16 bit patterns.
+ * @param dst Destination floats (may not overlap `src`).
+ * @param count Number of elements.
+ */
+void ffi_bf16_to_f32_array(const uint16_t* src, float* dst, size_t count) {
+    size_t done = 0;
+#ifdef FFI_HAVE_X86_TARGET_ATTR
+    if (__builtin_cpu_supports("avx512f")) {
+        done = ffi_bf16_to_f32_avx512(src, dst, count);
+    } else if (__builtin_cpu_supports("avx2")) {
+        done = ffi_bf16_to_f32_avx2(src, dst, count);
+    }
+#endif
+    for (size_t i = done; i < count; ++i) {
+        dst[i] = ffi_bf16_bits_to_float(src[i]);
+    }
+}
+
+/**
+ * @brief Converts an array of floats to bfloat16 values (round to nearest-even).
+ * @param src Source floats.
+ * @param dst Destination bfloat16 bit patterns (may not overlap `src`).
+ * @param count Number of elements.
+ */
+void ffi_f32_to_bf16_array(const float* src, uint16_t* dst, size_t count) {
+    size_t done = 0;
+#ifdef FFI_HAVE_X86_TARGET_ATTR
+    if (__builtin_cpu_supports("avx2")) {
+        done = ffi_f32_to_bf16_avx2(src, dst, count);
+    }
+#endif
+    for (size_t i = done; i < count; ++i) {
+        dst[i] = ffi_float_to_bf16_bits(src[i]);
+    }
+}
+
+
 // --- Foreign Functions (Implementations) ---
 // Example foreign function: adds two integers (minimal version)
 int add_two_ints(int a, int b) {
@@ -565,2663 +1070,11578 @@ uint128_struct uint128_identity_minimal(uint128_struct val) {
 }
 #endif
 
+// NEW: Half-precision targets (GCC 12+/Clang on x86-64 provide _Float16)
+#if defined(FFI_ARCH_X64) && defined(__FLT16_MAX__)
+#define FFI_HAVE_FLOAT16_TARGETS 1
 
-// --- Runtime Assembly Generation and Execution Functions (Platform Agnostic) ---
+_Float16 f16_scaled_product(_Float16 a, _Float16 b, int scale) {
+    return (_Float16)(a * b * (_Float16)scale);
+}
 
-/**
- * @brief Abstracts platform-specific memory allocation for executable memory.
- * @param size The number of bytes to allocate.
- * @return A pointer to the allocated memory, or NULL on failure.
- */
-void* ffi_create_executable_memory(size_t size) {
-#ifdef FFI_OS_LINUX
-    long page_size_long = sysconf(_SC_PAGESIZE);
-    size_t page_size = (size_t)page_size_long;
-    size_t aligned_size = (size + page_size - 1) & ~(page_size - 1);
-    void* mem = mmap(NULL, aligned_size,
-                     PROT_READ | PROT_WRITE | PROT_EXEC,
-                     MAP_PRIVATE | MAP_ANONYMOUS,
-                     -1, 0);
-    if (mem == MAP_FAILED) {
-        perror("mmap failed");
-        BAIL_OUT("Failed to allocate executable memory with mmap.");
-    }
-    diag("Allocated executable memory at %p (size: %zu bytes) using mmap.", mem, aligned_size);
-    return mem;
-#elif defined(FFI_OS_WIN64)
-    // VirtualAlloc allocates memory on page boundaries already
-    void* mem = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
-    if (mem == NULL) {
-        diag("VirtualAlloc failed with error: %lu", GetLastError());
-        BAIL_OUT("Failed to allocate executable memory with VirtualAlloc.");
-    }
-    diag("Allocated executable memory at %p (size: %zu bytes) using VirtualAlloc.", mem, size);
-    return mem;
-#elif defined(FFI_OS_MACOS)
-    long page_size_long = sysconf(_SC_PAGESIZE);
-    size_t page_size = (size_t)page_size_long;
-    size_t aligned_size = (size + page_size - 1) & ~(page_size - 1);
-    void* mem = mmap(NULL, aligned_size,
-                     PROT_READ | PROT_WRITE | PROT_EXEC,
-                     MAP_PRIVATE | MAP_ANONYMOUS,
-                     -1, 0);
-    if (mem == MAP_FAILED) {
-        perror("mmap failed");
-        BAIL_OUT("Failed to allocate executable memory with mmap.");
-    }
-    diag("Allocated executable memory at %p (size: %zu bytes) using mmap (macOS).", mem, aligned_size);
-    return mem;
+// Ten SSE-class arguments: eight fill XMM0-XMM7 and the last two go to the stack.
+float f16_sum_ten(_Float16 x0, _Float16 x1, _Float16 x2, _Float16 x3, _Float16 x4,
+                  _Float16 x5, _Float16 x6, _Float16 x7, _Float16 x8, _Float16 x9) {
+    return (float)x0 + (float)x1 + (float)x2 + (float)x3 + (float)x4 +
+           (float)x5 + (float)x6 + (float)x7 + (float)x8 + (float)x9 * 100.0f;
+}
+
+// __bf16 shares _Float16's calling convention (low 16 bits of an XMM register). Compilers
+// without an arithmetic __bf16 (GCC < 13) model it with a _Float16 carrier holding raw bits.
+#if defined(__BFLT16_MAX__)
+typedef __bf16 ffi_test_bf16;
 #else
-    BAIL_OUT("ffi_create_executable_memory: Unsupported OS.");
-    return NULL;
+typedef _Float16 ffi_test_bf16;
 #endif
+
+ffi_test_bf16 bf16_scale(ffi_test_bf16 x, float factor) {
+    uint16_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = ffi_float_to_bf16_bits(ffi_bf16_bits_to_float(bits) * factor);
+    memcpy(&x, &bits, sizeof(bits));
+    return x;
 }
+#endif
 
-/**
- * @brief Abstracts platform-specific memory deallocation for executable memory.
- * @param mem Pointer to the memory to free.
- * @param size The size of the allocated memory.
- */
-void ffi_free_executable_memory(void* mem, size_t size) {
-    if (mem) {
-#ifdef FFI_OS_LINUX
-        long page_size_long = sysconf(_SC_PAGESIZE);
-        size_t page_size = (size_t)page_size_long;
-        size_t aligned_size = (size + page_size - 1) & ~(page_size - 1);
-        if (munmap(mem, aligned_size) == -1) {
-            perror("munmap failed");
-            diag("WARNING: Failed to free executable memory at %p (Linux).", mem);
-        } else {
-            diag("Freed executable memory at %p (Linux).", mem);
-        }
-#elif defined(FFI_OS_WIN64)
-        if (VirtualFree(mem, 0, MEM_RELEASE) == 0) {
-            diag("VirtualFree failed with error: %lu", GetLastError());
-            diag("WARNING: Failed to free executable memory at %p (Win64).", mem);
-        } else {
-            diag("Freed executable memory at %p (Win64).", mem);
-        }
-#elif defined(FFI_OS_MACOS)
-        long page_size_long = sysconf(_SC_PAGESIZE);
-        size_t page_size = (size_t)page_size_long;
-        size_t aligned_size = (size + page_size - 1) & ~(page_size - 1);
-        if (munmap(mem, aligned_size) == -1) {
-            perror("munmap failed");
-            diag("WARNING: Failed to free executable memory at %p (macOS).", mem);
-        } else {
-            diag("Freed executable memory at %p (macOS).", mem);
-        }
+// NEW: Complex and long double targets for the System V generator
+#if defined(FFI_ARCH_X64) && !defined(FFI_OS_WIN64)
+#define FFI_HAVE_SYSV_EXTENDED_TARGETS 1
+
+// Classified X87: all three arguments live on the stack, the result comes back in ST(0).
+long double ld_muladd(long double a, long double b, long double c) {
+    return a * b + c;
+}
+
+#ifdef FFI_HAVE_COMPLEX
+double _Complex dc_multiply(double _Complex a, double _Complex b) {
+    return a * b;
+}
+
+float _Complex fc_scale(float _Complex z, float factor) {
+    return z * factor;
+}
+
+// d0-d6 take XMM0-XMM6; `z` needs two XMMs but only XMM7 is left, so it goes to the stack,
+// d7 still takes XMM7 and `tail` follows `z` on the stack. Distinct weights expose any mix-up.
+double dc_straddle(double d0, double d1, double d2, double d3, double d4, double d5, double d6,
+                   double _Complex z, double d7, double tail) {
+    return d0 + 2 * d1 + 3 * d2 + 4 * d3 + 5 * d4 + 6 * d5 + 7 * d6 + 8 * d7 +
+           100 * creal(z) + 1000 * cimag(z) + 10000 * tail;
+}
+#endif
+
+#ifdef __SIZEOF_INT128__
+// a-e take RDI..R8, `v` cannot fit in R9 alone and goes to [rsp], `f` takes R9, `g` follows at
+// [rsp + 16] and `w` is padded up to the next 16-byte boundary at [rsp + 32].
+__int128 i128_stack_alignment(long a, long b, long c, long d, long e, __int128 v, long f, long g, __int128 w) {
+    return v * 2 + w + (a + b + c + d + e) + (__int128)f * 10 + (__int128)g * 100;
+}
+#endif
+#endif
+
+// NEW: Quiet native-ABI add, the benchmark baseline (add_two_ints logs on every call)
+int quiet_add_two_ints(int a, int b) {
+    return a + b;
+}
+
+// NEW: Thread-affine target: returns an address unique to the calling thread and counts calls
+// without atomics, so concurrent callers would lose updates.
+static FFI_THREAD_LOCAL int g_affine_thread_marker;
+static int g_affine_calls;
+
+void* affine_thread_marker(int increment) {
+    g_affine_calls += increment;
+    return (void*)&g_affine_thread_marker;
+}
+
+// NEW: Blocks the calling thread for `ms` milliseconds, standing in for a blocking I/O call
+int blocking_sleep_ms(int ms) {
+#ifdef FFI_OS_WIN64
+    Sleep((DWORD)ms);
 #else
-        diag("WARNING: ffi_free_executable_memory: Unsupported OS. Memory at %p not freed.", mem);
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
 #endif
+    return ms;
+}
+
+// NEW: Variadic target: averages `count` doubles (va_start needs the caller's vector-register count)
+double variadic_average(int count, ...) {
+    va_list args;
+    va_start(args, count);
+    double sum = 0.0;
+    for (int i = 0; i < count; ++i) {
+        sum += va_arg(args, double);
     }
+    va_end(args);
+    return count > 0 ? sum / count : 0.0;
+}
+
+// NEW: Microsoft x64 ABI targets, reachable from any x86-64 GCC/Clang build via FFI_ABI_WIN64
+#if defined(FFI_ARCH_X64) && defined(__GNUC__)
+#define FFI_HAVE_MS_ABI_TARGETS 1
+#define FFI_MS_ABI __attribute__((ms_abi))
+
+FFI_MS_ABI int ms_add_two_ints(int a, int b) {
+    return a + b;
+}
+
+// Every argument sits in its own positional slot: a->RCX, b->XMM1, c->R8, d->XMM3, e/f/g on the stack.
+FFI_MS_ABI double ms_mixed_positional(int a, double b, int c, float d, double e, float f, long long g) {
+    return (double)a + b + (double)c + (double)d + e + (double)f + (double)g;
+}
+
+// 128-bit values are passed by reference: `a` through RCX, `b` through a pointer in the 5th stack slot.
+FFI_MS_ABI __int128 ms_int128_sub(__int128 a, int pad1, int pad2, int pad3, __int128 b) {
+    return a - b + pad1 + pad2 + pad3;
+}
+
+#ifdef FFI_HAVE_FLOAT16_TARGETS
+// ms_abi passes _Float16 like a 16-bit integer: a->RCX, b->RDX, c->R8, d->XMM3, e on the stack; result in AX.
+FFI_MS_ABI _Float16 ms_f16_axpy(_Float16 a, _Float16 b, _Float16 c, double d, _Float16 e) {
+    return (_Float16)(a * b + c + (_Float16)d + e);
+}
+#endif
+
+// Reports RBP mod 16 inside the callee; 0 means the caller's CALL site was 16-byte aligned.
+FFI_MS_ABI int ms_frame_misalignment(void) {
+    return (int)((uintptr_t)__builtin_frame_address(0) & 15);
 }
+#endif
+
+
+// --- Logging ---
+// Library diagnostics go through leveled macros instead of calling diag()/note() directly.
+// A message is only formatted when its level passes both the compile-time ceiling
+// (FFI_LOG_MAX_LEVEL) and the runtime threshold (ffi_set_log_level()); otherwise its
+// arguments are not even evaluated. Build with -DFFI_LOG_MAX_LEVEL=0 to compile every
+// call site out, leaving the invoke path free of stdio, malloc and vsnprintf.
+
+typedef enum {
+    FFI_LOG_LEVEL_OFF = 0, // Nothing is logged
+    FFI_LOG_LEVEL_ERROR,   // Failures and warnings
+    FFI_LOG_LEVEL_INFO,    // Handle lifecycle: creation, code generation, memory mapping
+    FFI_LOG_LEVEL_TRACE,   // Per-invoke argument dumps and trampoline hex dumps
+} FFI_LogLevel;
+
+// Highest level compiled in (0-3). Call sites above it are dead code.
+#ifndef FFI_LOG_MAX_LEVEL
+#define FFI_LOG_MAX_LEVEL 3
+#endif
 
 /**
- * @brief Flushes the instruction cache for a given memory range.
- * This is crucial after writing executable code.
- * @param addr The start address of the memory range.
- * @param len The length of the memory range.
+ * @brief Receives a log message that passed the level checks.
+ * The message is not pre-formatted: the sink decides whether and where to format it.
  */
-void ffi_flush_instruction_cache(void* addr, size_t len) {
-#if defined(__GNUC__) || defined(__clang__)
-    // For GCC/Clang on Linux/macOS/ARM, __builtin___clear_cache is available.
-    // It's a no-op on x86-64 as instruction cache coherency is handled by hardware.
-    // But it's essential for ARM.
-    __builtin___clear_cache((char*)addr, (char*)addr + len);
-    diag("Instruction cache flushed for %p - %p (GCC/Clang builtin).", addr, (char*)addr + len);
-#elif defined(FFI_OS_WIN64)
-    // For Windows, use FlushInstructionCache
-    if (!FlushInstructionCache(GetCurrentProcess(), addr, len)) {
-        diag("WARNING: FlushInstructionCache failed with error: %lu", GetLastError());
+typedef void (*FFI_LogSink)(FFI_LogLevel level, const char* fmt, va_list args, void* user_data);
+
+static void ffi_default_log_sink(FFI_LogLevel level, const char* fmt, va_list args, void* user_data);
+
+// The threshold is read on every log call site with a plain atomic load. The sink and its data
+// are swapped and called under g_ffi_log_lock, so a sink (and the TAP streams behind the
+// default one) only ever sees one message at a time, whichever threads are logging.
+static uint32_t g_ffi_log_level = FFI_LOG_MAX_LEVEL;
+static ffi_mutex_t g_ffi_log_lock = FFI_MUTEX_INITIALIZER;
+static FFI_LogSink g_ffi_log_sink = ffi_default_log_sink;
+static void* g_ffi_log_sink_data = NULL;
+
+#define ffi_log_enabled(level) ((level) <= FFI_LOG_MAX_LEVEL && (uint32_t)(level) <= FFI_ATOMIC_LOAD_U32(&g_ffi_log_level))
+#define ffi_log_at(level, ...) \
+    do { if (ffi_log_enabled(level)) ffi_log_write((level), __VA_ARGS__); } while (0)
+#define ffi_log_error(...) ffi_log_at(FFI_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define ffi_log_info(...)  ffi_log_at(FFI_LOG_LEVEL_INFO, __VA_ARGS__)
+#define ffi_log_trace(...) ffi_log_at(FFI_LOG_LEVEL_TRACE, __VA_ARGS__)
+
+/**
+ * @brief Default sink: errors and info go to the TAP diagnostic stream, traces to notes.
+ */
+static void ffi_default_log_sink(FFI_LogLevel level, const char* fmt, va_list args, void* user_data) {
+    (void)user_data;
+    char message[1024];
+    vsnprintf(message, sizeof(message), fmt, args);
+#if FFI_TESTING
+    if (level == FFI_LOG_LEVEL_TRACE) {
+        note("%s", message);
     } else {
-        diag("Instruction cache flushed for %p - %p (Win64).", addr, (char*)addr + len);
+        diag("%s", message);
     }
 #else
-    diag("WARNING: Instruction cache flush not implemented for this platform.");
+    (void)level;
+    fprintf(stderr, "%s\n", message);
 #endif
 }
 
-
-#ifdef FFI_ARCH_X64
 /**
- * @brief Generates x86-64 System V ABI trampoline bytes.
- * @param code_buffer Pointer to the memory where the assembly bytes will be written.
- * @param sig A pointer to the FFI_FunctionSignature.
- * @return The size of the generated assembly code in bytes.
+ * @brief Hands one message to the current sink. Call through the ffi_log_* macros so the
+ * level check happens before any argument is evaluated.
  */
-size_t generate_x86_64_sysv_trampoline(unsigned char* code_buffer, FFI_FunctionSignature* sig) {
-    unsigned char *current_code_ptr = code_buffer;
-    long target_addr_val;
-
-    // The trampoline itself will be called by C with this signature:
-    // void (*GenericTrampoline)(FFI_Argument* args, int num_args, void* return_buffer_ptr)
-    // Register mapping for this trampoline call (System V):
-    // %rdi: FFI_Argument* args (base address of the FFI_Argument array)
-    // %rsi: int num_args (number of arguments in the array)
-    // %rdx: void* return_buffer_ptr (pointer to where the return value should be stored)
+static void ffi_log_write(FFI_LogLevel level, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ffi_mutex_lock(&g_ffi_log_lock);
+    g_ffi_log_sink(level, fmt, args, g_ffi_log_sink_data);
+    ffi_mutex_unlock(&g_ffi_log_lock);
+    va_end(args);
+}
 
-    // --- CET Compliance: endbr64 ---
-    *current_code_ptr++ = 0xF3;
-    *current_code_ptr++ = 0x0F;
-    *current_code_ptr++ = 0x1E;
-    *current_code_ptr++ = OPCODE_END_BRANCH_64; // 0xFA
+/**
+ * @brief Sets the runtime log threshold. Levels above FFI_LOG_MAX_LEVEL stay compiled out.
+ * @param level The most verbose level to emit (FFI_LOG_LEVEL_OFF silences the library).
+ */
+void ffi_set_log_level(FFI_LogLevel level) {
+    FFI_ATOMIC_XCHG_U32(&g_ffi_log_level, (uint32_t)level);
+}
 
-    // --- Prologue ---
-    // push %rbp
-    *current_code_ptr++ = OPCODE_PUSH_RBP;
+/**
+ * @brief Routes library log messages to `sink` instead of the TAP streams.
+ * Calls to the sink are serialized, so it needs no locking of its own, but it must not log
+ * through the library itself.
+ * @param sink The receiver, or NULL to restore the default sink.
+ * @param user_data Passed through to every sink call.
+ */
+void ffi_set_log_sink(FFI_LogSink sink, void* user_data) {
+    ffi_mutex_lock(&g_ffi_log_lock);
+    g_ffi_log_sink = sink ? sink : ffi_default_log_sink;
+    g_ffi_log_sink_data = sink ? user_data : NULL;
+    ffi_mutex_unlock(&g_ffi_log_lock);
+}
 
-    // mov %rsp, %rbp
-    *current_code_ptr++ = REX_W_PREFIX;
-    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64
-    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RSP << 3) | MODRM_REG_RBP;
 
-    // Save callee-saved registers that we'll use: R12, R14
-    // System V callee-saved: RBX, RBP, R12, R13, R14, R15
-    // We are using R14 (for args_ptr) and R12 (for return_buffer_ptr) as callee-saved.
-    // R10 and R11 are caller-saved, so we don't need to save/restore them unless we need their values across calls.
-    // In this trampoline, R10 and R11 are scratch, so no explicit save/restore for them.
-    // R14 (args pointer from rdi)
-    *current_code_ptr++ = REX_PUSH_POP_R14_PREFIX; // 0x41
-    *current_code_ptr++ = OPCODE_PUSH_R14_BYTE;    // 0x56
+// --- Perf Map ---
+// Linux `perf` cannot symbolize anonymous executable memory, so samples inside trampolines
+// show up as [unknown]. The JIT convention it understands is /tmp/perf-<pid>.map: one
+// "START SIZE name" line (hex, no 0x prefix) per code region, read when the profile is
+// reported. Once enabled, every trampoline that ffi_build_trampoline() publishes, whether
+// eager, lazily resolved or tier-promoted, appends "ffi:<debug_name> <signature>", where the
+// signature uses the codes of the Signature Strings section.
+//
+// Lines go through a large stdio buffer and reach the file on ffi_perf_map_flush(), when the
+// buffer fills, when the mode is disabled, or at normal process exit.
+//
+// The format has no way to retire an entry, so freed code must not be recycled: while the map
+// is in use, ffi_free_executable_memory() drops the pages and makes them PROT_NONE instead of
+// unmapping them. No later trampoline can land on an address the file already names, and a
+// stray call through a destroyed handle faults instead of running whatever replaced it. The
+// cost is one reserved (not resident) page and one kernel mapping per destroyed trampoline,
+// so the quarantine is a FIFO of at most FFI_PERF_MAP_QUARANTINE_MAX ranges, well below the
+// default vm.max_map_count of 65530. Past that the oldest range is unmapped, and a process
+// that keeps churning trampolines may see a recycled address attributed to an older entry.
+// Disabling the mode unmaps the whole quarantine. Trampolines never move, so there is no
+// relocation to record.
+
+#define FFI_PERF_MAP_BUFFER_SIZE 65536
+#define FFI_PERF_MAP_SIGNATURE_MAX 256 // Fits FFI_SIGNATURE_MAX_PARAMS codes plus "..."
+#define FFI_TRAMPOLINE_SYMBOL_MAX (FFI_PERF_MAP_SIGNATURE_MAX + 136) // "ffi:", 127-char name, space
+
+static ffi_mutex_t g_ffi_perf_map_lock = FFI_MUTEX_INITIALIZER;
+static FILE* g_ffi_perf_map_file = NULL;         // Guarded by g_ffi_perf_map_lock
+static char g_ffi_perf_map_path[64];
+static char* g_ffi_perf_map_buffer = NULL;       // Owned by the stdio stream while it is open
+static uint32_t g_ffi_perf_map_enabled = 0;      // Fast-path check for the code generator
+static uint32_t g_ffi_perf_map_quarantine = 0;   // Set while enabled: freed code is quarantined
+static uint32_t g_ffi_perf_map_used = 0;         // Set on first enable and never cleared
+
+#define FFI_PERF_MAP_QUARANTINE_MAX 4096 // Freed ranges held PROT_NONE at once
+
+// Quarantined ranges, oldest first. Guarded by g_ffi_perf_map_lock.
+typedef struct {
+    void* mem;
+    size_t size;
+} FFI_QuarantinedRange;
 
-    // mov %rdi, %r14 (Save args pointer from rdi to r14 for later use in argument marshalling)
-    *current_code_ptr++ = REX_WB_PREFIX; // 0x49 (W=1, B=1 for R14)
-    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64 (store rdi to r14)
-    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RDI << 3) | MODRM_REG_R14_CODE; // 0xCE
+static FFI_QuarantinedRange g_ffi_perf_map_held[FFI_PERF_MAP_QUARANTINE_MAX];
+static size_t g_ffi_perf_map_held_first = 0;
+static size_t g_ffi_perf_map_held_count = 0;
 
-    // R12 (return_buffer_ptr from rdx)
-    *current_code_ptr++ = REX_PUSH_POP_R12_PREFIX; // 0x41
-    *current_code_ptr++ = OPCODE_PUSH_R12_BYTE;    // 0x54
+static void ffi_perf_map_release_quarantine_locked(void);
 
-    // mov %rdx, %r12 (Save return_buffer_ptr from rdx to r12)
-    *current_code_ptr++ = REX_WB_PREFIX; // 0x49 (W=1, B=1 for R12)
-    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64 (store rdx to r12)
-    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RDX << 3) | MODRM_REG_R12_CODE; // 0xEA
+/**
+ * @brief Returns the signature-string code of `type` (the inverse of g_ffi_signature_codes).
+ * The explicitly signed aliases share the code of their plain type; unknown types give '?'.
+ */
+static char ffi_signature_type_code(FFI_Type type) {
+    switch (type) {
+        case FFI_TYPE_VOID: return 'v';
+        case FFI_TYPE_BOOL: return 'B';
+        case FFI_TYPE_CHAR: return 'c';
+        case FFI_TYPE_UCHAR: return 'C';
+        case FFI_TYPE_SCHAR: return 'a';
+        case FFI_TYPE_SHORT: case FFI_TYPE_SSHORT: return 's';
+        case FFI_TYPE_USHORT: return 'S';
+        case FFI_TYPE_INT: case FFI_TYPE_SINT: return 'i';
+        case FFI_TYPE_UINT: return 'I';
+        case FFI_TYPE_LONG: case FFI_TYPE_SLONG: return 'j';
+        case FFI_TYPE_ULONG: return 'J';
+        case FFI_TYPE_LLONG: case FFI_TYPE_SLLONG: return 'l';
+        case FFI_TYPE_ULLONG: return 'L';
+        case FFI_TYPE_SIZE_T: return 'z';
+        case FFI_TYPE_WCHAR: return 'w';
+        case FFI_TYPE_POINTER: return 'p';
+        case FFI_TYPE_FLOAT: return 'f';
+        case FFI_TYPE_DOUBLE: return 'd';
+        case FFI_TYPE_LONG_DOUBLE: return 'g';
+        case FFI_TYPE_FLOAT16: return 'e';
+        case FFI_TYPE_BFLOAT16: return 'E';
+        case FFI_TYPE_FLOAT_COMPLEX: return 'k';
+        case FFI_TYPE_DOUBLE_COMPLEX: return 'K';
+        case FFI_TYPE_INT128: return 'x';
+        case FFI_TYPE_UINT128: return 'X';
+        default: return '?';
+    }
+}
 
-    // --- Determine Stack Arguments and Calculate Total Stack Space ---
-    int num_gp_regs_used = 0;
-    int num_xmm_regs_used = 0;
-    int num_stack_args = 0; // Number of 8-byte slots needed on stack
+/**
+ * @brief Writes the canonical signature string of `sig` (e.g. "i(ii)", "d(i...dd)") to `buf`.
+ * @param size Capacity of `buf`, at least 1.
+ * @return The length of the full string; the output is truncated (and still terminated) if
+ *         that is not less than `size`, like snprintf().
+ */
+static size_t ffi_format_signature(const FFI_FunctionSignature* sig, char* buf, size_t size) {
+    size_t len = 0, pos = 0;
+#define FFI_FORMAT_PUT(ch) do { if (pos + 1 < size) { buf[pos++] = (ch); } len++; } while (0)
+    FFI_FORMAT_PUT(ffi_signature_type_code(sig->return_type));
+    FFI_FORMAT_PUT('(');
+    for (int i = 0; i < sig->num_params; i++) {
+        if (i == sig->num_fixed_params) {
+            FFI_FORMAT_PUT('.'); FFI_FORMAT_PUT('.'); FFI_FORMAT_PUT('.');
+        }
+        FFI_FORMAT_PUT(ffi_signature_type_code(sig->param_types[i]));
+    }
+    FFI_FORMAT_PUT(')');
+#undef FFI_FORMAT_PUT
+    buf[pos] = '\0';
+    return len;
+}
 
-    for (int i = 0; i < sig->num_params; ++i) {
-        FFI_Type param_type = sig->param_types[i];
-        if (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE) {
-            if (num_xmm_regs_used < 8) { // System V has 8 XMM registers (XMM0-XMM7)
-                num_xmm_regs_used++;
-            } else {
-                num_stack_args++;
-            }
-        } else if (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128) {
-            // 128-bit integers consume two GPRs or 16 bytes on stack
-            // System V GPRs: RDI, RSI, RDX, RCX, R8, R9 (6 registers)
-            if (num_gp_regs_used <= 4) { // If num_gp_regs_used is 5, we only have R9 left, so it spills.
-                num_gp_regs_used += 2; // Consumes two GPRs
-            } else {
-                num_stack_args += 2; // Consumes 16 bytes on stack
-            }
-        } else { // All other types (integers, bool, char, pointer, wchar_t, size_t) go to GPRs
-            if (num_gp_regs_used < 6) { // System V has 6 GPRs
-                num_gp_regs_used++;
-            } else {
-                num_stack_args++;
-            }
+/**
+ * @brief Starts or stops appending trampoline symbols to /tmp/perf-<pid>.map.
+ * Only trampolines generated while enabled are recorded; disabling flushes and closes the file
+ * and releases the quarantined code, whose addresses may then be reused.
+ * @return True on success, false if the file cannot be opened or the platform has no perf.
+ */
+bool ffi_set_perf_map(bool enabled) {
+#if defined(FFI_OS_LINUX)
+    bool result = true;
+    ffi_mutex_lock(&g_ffi_perf_map_lock);
+    if (enabled && g_ffi_perf_map_file == NULL) {
+        snprintf(g_ffi_perf_map_path, sizeof(g_ffi_perf_map_path), "/tmp/perf-%ld.map", (long)getpid());
+        FILE* file = fopen(g_ffi_perf_map_path, "a");
+        char* buffer = (char*)malloc(FFI_PERF_MAP_BUFFER_SIZE);
+        if (file == NULL || buffer == NULL) {
+            ffi_log_error("ERROR: Cannot open perf map '%s': %s", g_ffi_perf_map_path,
+                          file == NULL ? strerror(errno) : "out of memory");
+            if (file) fclose(file);
+            free(buffer);
+            result = false;
+        } else {
+            setvbuf(file, buffer, _IOFBF, FFI_PERF_MAP_BUFFER_SIZE);
+            g_ffi_perf_map_file = file;
+            g_ffi_perf_map_buffer = buffer;
+            FFI_ATOMIC_XCHG_U32(&g_ffi_perf_map_used, 1u);
+            FFI_ATOMIC_XCHG_U32(&g_ffi_perf_map_quarantine, 1u);
+            FFI_ATOMIC_XCHG_U32(&g_ffi_perf_map_enabled, 1u);
+            ffi_log_info("Recording trampoline symbols in '%s'.", g_ffi_perf_map_path);
         }
+    } else if (!enabled && g_ffi_perf_map_file != NULL) {
+        FFI_ATOMIC_XCHG_U32(&g_ffi_perf_map_enabled, 0u);
+        FFI_ATOMIC_XCHG_U32(&g_ffi_perf_map_quarantine, 0u);
+        fclose(g_ffi_perf_map_file);
+        free(g_ffi_perf_map_buffer);
+        g_ffi_perf_map_file = NULL;
+        g_ffi_perf_map_buffer = NULL;
+        ffi_perf_map_release_quarantine_locked();
+    }
+    ffi_mutex_unlock(&g_ffi_perf_map_lock);
+    return result;
+#else
+    if (enabled) {
+        ffi_log_error("ERROR: perf map files are only supported on Linux.");
+        return false;
     }
+    return true;
+#endif
+}
 
-    size_t final_stack_subtraction = 0;
+/**
+ * @brief Writes buffered perf map lines to the file, e.g. before handing it to `perf report`
+ * while the process is still running.
+ */
+void ffi_perf_map_flush(void) {
+    ffi_mutex_lock(&g_ffi_perf_map_lock);
+    if (g_ffi_perf_map_file != NULL) {
+        fflush(g_ffi_perf_map_file);
+    }
+    ffi_mutex_unlock(&g_ffi_perf_map_lock);
+}
 
-    // Calculate the total size needed for stack arguments.
-    size_t stack_args_total_size = (size_t)num_stack_args * 8;
+/**
+ * @brief Returns the perf map path of this process, or NULL if the mode was never enabled.
+ */
+const char* ffi_perf_map_path(void) {
+    return FFI_ATOMIC_LOAD_U32(&g_ffi_perf_map_used) ? g_ffi_perf_map_path : NULL;
+}
 
-    // After push RBP, push R14, push R12, RSP is 24 bytes lower than initial (16-aligned) RSP.
-    // So, RSP is currently 8-byte aligned.
-    // We need RSP to be 8-byte aligned BEFORE the CALL so that after CALL pushes 8 bytes,
-    // RSP is 16-byte aligned inside the callee.
-    // This means final_stack_subtraction must be a multiple of 16.
-  if (num_stack_args > 0) {
-        final_stack_subtraction = stack_args_total_size;
-        // Ensure final_stack_subtraction is a multiple of 16
-        while ((final_stack_subtraction % 16) != 0) {
-            final_stack_subtraction++;
+/**
+ * @brief Writes the profiler symbol of a trampoline, "ffi:<debug_name> <signature>", to `buf`.
+ * Control characters in the debug name are replaced so the symbol stays on one line.
+ */
+static void ffi_trampoline_symbol_name(const FFI_FunctionSignature* sig, char* buf, size_t size) {
+    char signature[FFI_PERF_MAP_SIGNATURE_MAX];
+    ffi_format_signature(sig, signature, sizeof(signature));
+    snprintf(buf, size, "ffi:%.127s %s", sig->debug_name ? sig->debug_name : "anonymous", signature);
+    for (char* p = buf; *p; p++) {
+        if ((unsigned char)*p < 0x20 || *p == 0x7f) {
+            *p = '_';
         }
-    } else { // No stack arguments
-        // RSP is already 8-byte aligned after pushes. No need to subtract more.
-        final_stack_subtraction = 0;
     }
-    // The 32-byte shadow space (red zone) is implicitly available and not allocated by the caller.
+}
 
-    if (final_stack_subtraction > 0) {
-        *current_code_ptr++ = REX_W_PREFIX; // REX.W prefix for 64-bit operation
-        *current_code_ptr++ = OPCODE_SUB_IMM8_RSP; // 0x83 (SUB r/m64, imm8)
-        *current_code_ptr++ = (MOD_REGISTER << 6) | (0x05 << 3) | MODRM_REG_RSP; // Mod=11, Reg=Group 5 (SUB), R/M=RSP (0x04) -> 0xEC
-        *current_code_ptr++ = (unsigned char)final_stack_subtraction; // imm8
+/**
+ * @brief Appends the perf map line of a freshly generated trampoline, if the mode is on.
+ */
+static void ffi_perf_map_record(const FFI_FunctionSignature* sig, const void* code, size_t code_size) {
+    if (!FFI_ATOMIC_LOAD_U32(&g_ffi_perf_map_enabled)) {
+        return;
+    }
+    char name[FFI_TRAMPOLINE_SYMBOL_MAX];
+    ffi_trampoline_symbol_name(sig, name, sizeof(name));
+    ffi_mutex_lock(&g_ffi_perf_map_lock);
+    if (g_ffi_perf_map_file != NULL) {
+        fprintf(g_ffi_perf_map_file, "%lx %zx %s\n", (unsigned long)(uintptr_t)code, code_size, name);
     }
+    ffi_mutex_unlock(&g_ffi_perf_map_lock);
+}
 
-    // IMPORTANT: Ensure AL is set to 0 for non-variadic functions (ABI compliance).
-    // This must be done regardless of stack arguments.
-    *current_code_ptr++ = 0xB0; // MOV AL, imm8
-    *current_code_ptr++ = 0x00; // imm8 = 0
+// --- Jitdump ---
+// A perf map names trampolines but carries no code, so `perf annotate` cannot attribute samples
+// to individual instructions. The jitdump format (tools/perf/util/jitdump.h) can: a header,
+// then one timestamped JIT_CODE_LOAD record per trampoline with its name and a copy of its
+// bytes. `perf inject --jit` turns each record into a small ELF image that perf report and
+// annotate use like any other DSO:
+//
+//   perf record -k mono ./app && perf inject --jit -i perf.data -o perf.jit.data
+//
+// perf only finds the file because the process maps it executable, which leaves an MMAP event
+// naming jit-<pid>.dump in perf.data. The file is created in $JITDUMPDIR, or /tmp when unset.
+//
+// Timestamps use CLOCK_MONOTONIC, matching `-k mono`. Because every load is timestamped, perf
+// inject attributes a sample to whichever trampoline occupied the address at that moment, so
+// freed and reused addresses need no quarantine. The format has no unload record; trampolines
+// never move, so no JIT_CODE_MOVE records are written. JIT_CODE_CLOSE ends the stream when the
+// mode is disabled. The cost per trampoline is one lock and a ~100-byte buffered write plus its
+// code, small enough to leave enabled in production.
+
+#define FFI_JITDUMP_MAGIC 0x4A695444u // "JiTD" in host byte order
+#define FFI_JITDUMP_VERSION 1u
+#define FFI_JITDUMP_CODE_LOAD 0u
+#define FFI_JITDUMP_CODE_CLOSE 3u
+#ifdef FFI_ARCH_ARM64
+#define FFI_JITDUMP_ELF_MACH 183u // EM_AARCH64
+#else
+#define FFI_JITDUMP_ELF_MACH 62u  // EM_X86_64
+#endif
 
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;  // Size of this header
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} FFI_JitdumpHeader;
 
-    // --- Argument Marshalling ---
-    int gp_reg_idx = 0;
-    int xmm_reg_idx = 0;
-    int stack_arg_current_idx = 0; // 0-indexed counter for arguments going to stack
+typedef struct {
+    uint32_t id;          // FFI_JITDUMP_CODE_*
+    uint32_t total_size;  // Including this prefix, the name and the code bytes
+    uint64_t timestamp;
+} FFI_JitdumpRecordPrefix;
 
-    // Array of GPR argument registers in order: RDI, RSI, RDX, RCX, R8, R9
-    unsigned char gp_arg_regs[] = { MODRM_REG_RDI, MODRM_REG_RSI, MODRM_REG_RDX, MODRM_REG_RCX, MODRM_REG_R8_CODE, MODRM_REG_R9_CODE };
-    bool gp_arg_regs_needs_rex_r[] = { false, false, false, false, true, true }; // R8, R9 need REX.R
+// Followed by the NUL-terminated symbol name and then `code_size` bytes of code.
+typedef struct {
+    FFI_JitdumpRecordPrefix prefix;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;  // Unique per load record
+} FFI_JitdumpCodeLoad;
+
+static ffi_mutex_t g_ffi_jitdump_lock = FFI_MUTEX_INITIALIZER;
+static FILE* g_ffi_jitdump_file = NULL;       // Guarded by g_ffi_jitdump_lock
+static char* g_ffi_jitdump_buffer = NULL;
+static void* g_ffi_jitdump_marker = NULL;     // Executable mapping of the file that perf sees
+static size_t g_ffi_jitdump_marker_size = 0;
+static uint64_t g_ffi_jitdump_code_index = 0; // Guarded by g_ffi_jitdump_lock
+static uint32_t g_ffi_jitdump_enabled = 0;
+static char g_ffi_jitdump_path[512];
 
-    if (sig->num_params > 0 && sig->param_types != NULL) {
-        for (int i = 0; i < sig->num_params; ++i) {
-            FFI_Type param_type = sig->param_types[i];
+#ifdef FFI_OS_LINUX
+static uint64_t ffi_jitdump_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+#endif
 
-            // Load args[i].value_ptr into R10 (temporary register for base address)
-            size_t current_arg_value_ptr_offset = (size_t)i * sizeof(FFI_Argument);
-            *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT; // 0x4D (W=1, R=1, B=1)
-            *current_code_ptr++ = OPCODE_MOV_R64_RM64; // mov r64, r/m64 (LOAD from memory)
-            *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R10_CODE << 3) | MODRM_REG_R14_CODE); // Mod=01, Reg=R10, R/M=R14_CODE
-            *current_code_ptr++ = (unsigned char)current_arg_value_ptr_offset; // disp8
+/**
+ * @brief Starts or stops writing trampoline load records to $JITDUMPDIR/jit-<pid>.dump.
+ * Enabling truncates the file and writes the header; disabling appends JIT_CODE_CLOSE, flushes
+ * and closes it. Only trampolines generated while enabled are recorded.
+ * @return True on success, false if the file cannot be created or the platform has no perf.
+ */
+bool ffi_set_jitdump(bool enabled) {
+#ifdef FFI_OS_LINUX
+    bool result = true;
+    ffi_mutex_lock(&g_ffi_jitdump_lock);
+    if (enabled && g_ffi_jitdump_file == NULL) {
+        const char* dir = getenv("JITDUMPDIR");
+        snprintf(g_ffi_jitdump_path, sizeof(g_ffi_jitdump_path), "%s/jit-%ld.dump",
+                 (dir && *dir) ? dir : "/tmp", (long)getpid());
+        FILE* file = fopen(g_ffi_jitdump_path, "w+");
+        char* buffer = (char*)malloc(FFI_PERF_MAP_BUFFER_SIZE);
+        size_t marker_size = (size_t)sysconf(_SC_PAGESIZE);
+        void* marker = MAP_FAILED;
+        if (file != NULL) {
+            marker = mmap(NULL, marker_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(file), 0);
+        }
+        if (file == NULL || buffer == NULL || marker == MAP_FAILED) {
+            ffi_log_error("ERROR: Cannot create jitdump file '%s': %s", g_ffi_jitdump_path,
+                          buffer == NULL ? "out of memory" : strerror(errno));
+            if (file) fclose(file);
+            free(buffer);
+            result = false;
+        } else {
+            setvbuf(file, buffer, _IOFBF, FFI_PERF_MAP_BUFFER_SIZE);
+            FFI_JitdumpHeader header = {
+                .magic = FFI_JITDUMP_MAGIC, .version = FFI_JITDUMP_VERSION,
+                .total_size = (uint32_t)sizeof(FFI_JitdumpHeader), .elf_mach = FFI_JITDUMP_ELF_MACH,
+                .pid = (uint32_t)getpid(), .timestamp = ffi_jitdump_timestamp(),
+            };
+            fwrite(&header, sizeof(header), 1, file);
+            g_ffi_jitdump_file = file;
+            g_ffi_jitdump_buffer = buffer;
+            g_ffi_jitdump_marker = marker;
+            g_ffi_jitdump_marker_size = marker_size;
+            FFI_ATOMIC_XCHG_U32(&g_ffi_jitdump_enabled, 1u);
+            ffi_log_info("Recording trampoline code in '%s'.", g_ffi_jitdump_path);
+        }
+    } else if (!enabled && g_ffi_jitdump_file != NULL) {
+        FFI_ATOMIC_XCHG_U32(&g_ffi_jitdump_enabled, 0u);
+        FFI_JitdumpRecordPrefix close_record = {
+            .id = FFI_JITDUMP_CODE_CLOSE, .total_size = (uint32_t)sizeof(FFI_JitdumpRecordPrefix),
+            .timestamp = ffi_jitdump_timestamp(),
+        };
+        fwrite(&close_record, sizeof(close_record), 1, g_ffi_jitdump_file);
+        fclose(g_ffi_jitdump_file);
+        free(g_ffi_jitdump_buffer);
+        munmap(g_ffi_jitdump_marker, g_ffi_jitdump_marker_size);
+        g_ffi_jitdump_file = NULL;
+        g_ffi_jitdump_buffer = NULL;
+        g_ffi_jitdump_marker = NULL;
+    }
+    ffi_mutex_unlock(&g_ffi_jitdump_lock);
+    return result;
+#else
+    if (enabled) {
+        ffi_log_error("ERROR: jitdump files are only supported on Linux.");
+        return false;
+    }
+    return true;
+#endif
+}
 
-            bool is_current_param_xmm_type = (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE);
-            bool is_current_param_int128_type = (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128);
-            bool goes_to_reg = false;
-            bool to_stack = false;
+/**
+ * @brief Writes buffered jitdump records to the file.
+ */
+void ffi_jitdump_flush(void) {
+    ffi_mutex_lock(&g_ffi_jitdump_lock);
+    if (g_ffi_jitdump_file != NULL) {
+        fflush(g_ffi_jitdump_file);
+    }
+    ffi_mutex_unlock(&g_ffi_jitdump_lock);
+}
 
-            if (is_current_param_xmm_type) {
-                if (xmm_reg_idx < 8) { // 8 XMM registers for System V
-                    goes_to_reg = true;
-                    // MOVSS/MOVSD XMMn, [R10]
-                    unsigned char xmm_prefix = (param_type == FFI_TYPE_FLOAT) ? PREFIX_MOVSS : PREFIX_MOVSD;
-                    unsigned char xmm_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT; // REX.B for R10 as base
-                    // XMM0-XMM7 do not need REX.R bit.
-                    *current_code_ptr++ = xmm_prefix;
-                    *current_code_ptr++ = xmm_rex_prefix;
-                    *current_code_ptr++ = 0x0F;
-                    *current_code_ptr++ = OPCODE_XMM_MOV_XMM_RM; // 0x10
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE + xmm_reg_idx << 3) | MODRM_REG_R10_CODE);
-                    xmm_reg_idx++;
-                } else {
-                    to_stack = true;
-                }
-            } else if (is_current_param_int128_type) {
-                // 128-bit integers need two GPRs
-                if (gp_reg_idx <= 4) { // Check if there are at least two registers remaining (R9 is gp_reg_idx 5)
-                    goes_to_reg = true;
-                    // Load lower 64 bits from [R10] into first GPR
-                    unsigned char dest_reg_low = gp_arg_regs[gp_reg_idx];
-                    bool needs_rex_r_low = gp_arg_regs_needs_rex_r[gp_reg_idx];
-                    unsigned char rex_prefix_low = REX_W_PREFIX | REX_B_BIT;
-                    if (needs_rex_r_low) rex_prefix_low |= REX_R_BIT;
-                    *current_code_ptr++ = rex_prefix_low;
-                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV reg, [mem]
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (dest_reg_low << 3) | MODRM_REG_R10_CODE);
+/**
+ * @brief Returns the jitdump path of this process, or NULL if the mode was never enabled.
+ */
+const char* ffi_jitdump_path(void) {
+    ffi_mutex_lock(&g_ffi_jitdump_lock);
+    const char* path = g_ffi_jitdump_path[0] ? g_ffi_jitdump_path : NULL;
+    ffi_mutex_unlock(&g_ffi_jitdump_lock);
+    return path;
+}
 
-                    // Load upper 64 bits from [R10 + 8] into second GPR
-                    unsigned char dest_reg_high = gp_arg_regs[gp_reg_idx + 1];
-                    bool needs_rex_r_high = gp_arg_regs_needs_rex_r[gp_reg_idx + 1];
-                    unsigned char rex_prefix_high = REX_W_PREFIX | REX_B_BIT;
-                    if (needs_rex_r_high) rex_prefix_high |= REX_R_BIT;
-                    *current_code_ptr++ = rex_prefix_high;
-                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV reg, [mem]
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (dest_reg_high << 3) | MODRM_REG_R10_CODE);
-                    *current_code_ptr++ = 0x08; // disp8 = 8 (for upper 64 bits)
+/**
+ * @brief Appends the JIT_CODE_LOAD record of a freshly generated trampoline, if the mode is on.
+ */
+static void ffi_jitdump_record_load(const FFI_FunctionSignature* sig, const void* code, size_t code_size) {
+#ifdef FFI_OS_LINUX
+    if (!FFI_ATOMIC_LOAD_U32(&g_ffi_jitdump_enabled)) {
+        return;
+    }
+    char name[FFI_TRAMPOLINE_SYMBOL_MAX];
+    ffi_trampoline_symbol_name(sig, name, sizeof(name));
+    size_t name_size = strlen(name) + 1;
+    FFI_JitdumpCodeLoad record = {
+        .prefix = { .id = FFI_JITDUMP_CODE_LOAD,
+                    .total_size = (uint32_t)(sizeof(FFI_JitdumpCodeLoad) + name_size + code_size),
+                    .timestamp = ffi_jitdump_timestamp() },
+        .pid = (uint32_t)getpid(),
+#if defined(__linux__)
+        .tid = (uint32_t)syscall(SYS_gettid),
+#endif
+        .vma = (uint64_t)(uintptr_t)code,
+        .code_addr = (uint64_t)(uintptr_t)code,
+        .code_size = (uint64_t)code_size,
+    };
+    ffi_mutex_lock(&g_ffi_jitdump_lock);
+    if (g_ffi_jitdump_file != NULL) {
+        record.code_index = g_ffi_jitdump_code_index++;
+        fwrite(&record, sizeof(record), 1, g_ffi_jitdump_file);
+        fwrite(name, 1, name_size, g_ffi_jitdump_file);
+        fwrite(code, 1, code_size, g_ffi_jitdump_file);
+    }
+    ffi_mutex_unlock(&g_ffi_jitdump_lock);
+#else
+    (void)sig; (void)code; (void)code_size;
+#endif
+}
 
-                    gp_reg_idx += 2; // Consume two GPRs
-                } else {
-                    to_stack = true;
-                }
-            } else { // All other types (integers, bool, char, pointer, wchar_t, size_t)
-                if (gp_reg_idx < 6) { // 6 GPRs for System V
-                    goes_to_reg = true;
-                    unsigned char dest_reg_code = gp_arg_regs[gp_reg_idx];
-                    bool use_rex_r_for_dest_reg = gp_arg_regs_needs_rex_r[gp_reg_idx];
-                    unsigned char current_opcode;
-                    unsigned char modrm = (unsigned char)((MOD_INDIRECT << 6) | (dest_reg_code << 3) | MODRM_REG_R10_CODE);
-                    unsigned char final_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT;
-                    if (use_rex_r_for_dest_reg) final_rex_prefix |= REX_R_BIT;
+// --- GDB JIT Interface ---
+// GDB and LLDB learn about generated code through a protocol built from two well-known symbols.
+// __jit_debug_descriptor heads a doubly linked list of in-memory object files, and
+// __jit_debug_register_code() is an empty function the debugger puts a breakpoint on. To
+// publish or withdraw an object, the runtime links or unlinks its entry, sets action_flag and
+// relevant_entry, and calls the function. The debugger then reads the object's symbols.
+//
+// Each object is a minimal ELF relocatable file with no code bytes. It has one SHT_NOBITS
+// .text section per trampoline, placed at the trampoline's address, and one function symbol
+// named like the perf map entry ("ffi:<debug_name> <signature>"). Backtraces and `info symbol`
+// then resolve PCs inside trampolines.
+//
+// With a debugger attached, every registration is a breakpoint stop, so new trampolines are
+// queued and registered `batch_size` at a time as one object. ffi_gdb_jit_flush() registers a
+// partial batch. Code is deregistered when its memory is actually freed (after epoch
+// reclamation), not at destroy_ffi_function(), because a reader may still be running it until
+// then. A free finds its symbol through an address map and only marks it dead; the last
+// trampoline of an object unregisters it. Objects that still name dead trampolines are rebuilt
+// at the next flush, which is also the earliest a new trampoline at a reused address can be
+// registered. Tearing down N trampolines thus costs N/batch_size debugger stops, not N
+// object rebuilds.
+
+#if defined(FFI_OS_LINUX) && defined(__linux__)
+#define FFI_HAVE_GDB_JIT 1
+#endif
 
-                    switch (param_type) {
-                        case FFI_TYPE_BOOL:
-                        case FFI_TYPE_CHAR:
-                        case FFI_TYPE_UCHAR:
-                            current_opcode = 0xB6; // MOVZX r64, r/m8
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_SCHAR:
-                            current_opcode = 0xBE; // MOVSX r64, r/m8
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_SHORT:
-                        case FFI_TYPE_SSHORT:
-                            current_opcode = 0xBF; // MOVSX r64, r/m16
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_USHORT:
-                            current_opcode = 0xB7; // MOVZX r64, r/m16
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_INT:
-                        case FFI_TYPE_SINT:
-                        case FFI_TYPE_WCHAR:
-                            current_opcode = 0x63; // MOVSXD r64, r/m32
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_UINT:
-                            current_opcode = OPCODE_MOV_R64_RM64; // MOV r32, r/m32 (zero-extends)
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_LONG:
-                        case FFI_TYPE_ULONG:
-                        case FFI_TYPE_LLONG:
-                        case FFI_TYPE_ULLONG:
-                        case FFI_TYPE_POINTER:
-                        case FFI_TYPE_SIZE_T:    // size_t is typically 64-bit on x86-64
-                        case FFI_TYPE_SLONG:
-                        case FFI_TYPE_SLLONG:
-                            current_opcode = OPCODE_MOV_R64_RM64; // MOV r64, r/m64
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        default: return 0; // Error
-                    }
-                    gp_reg_idx++;
-                } else {
-                    to_stack = true;
-                }
-            }
-
-            if (to_stack) {
-                if (is_current_param_int128_type) {
-                    // Corrected 128-bit to stack: Load both halves into scratch registers first
-                    // Load lower 64 bits into R11
-                    *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT; // REX.W for 64-bit, REX.R for R11, REX.B for R10
-                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV R11, [R10]
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
-
-                    // Load upper 64 bits into R13
-                    *current_code_ptr++ = REX_PUSH_POP_R13_PREFIX | REX_W_PREFIX | REX_R_BIT; // REX.B for R10, REX.R for R13
-                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV R13, [R10 + 8]
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R13_CODE << 3) | MODRM_REG_R10_CODE);
-                    *current_code_ptr++ = 0x08; // disp8 = 8
-
-                    // Store R11 to [RSP + offset_low]
-                    size_t stack_offset_low = (size_t)stack_arg_current_idx * 8;
-                    *current_code_ptr++ = REX_W_PREFIX | REX_R_BIT; // REX.W for 64-bit, REX.R for R11
-                    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // MOV [RSP + offset_low], R11
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R11_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_RSP;
-                    *current_code_ptr++ = (unsigned char)stack_offset_low;
-
-                    // Store R13 to [RSP + offset_high]
-                    size_t stack_offset_high = (size_t)(stack_arg_current_idx + 1) * 8;
-                    *current_code_ptr++ = REX_W_PREFIX | REX_R_BIT; // REX.W for 64-bit, REX.R for R13
-                    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // MOV [RSP + offset_high], R13
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R13_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_RSP;
-                    *current_code_ptr++ = (unsigned char)stack_offset_high;
-
-                    stack_arg_current_idx += 2; // Consumes two stack slots
-                } else if (is_current_param_xmm_type) {
-                    // Load float/double from (R10) into XMM7 (scratch register, MODRM_REG_XMM7_CODE)
-                    unsigned char xmm_prefix = (param_type == FFI_TYPE_FLOAT) ? PREFIX_MOVSS : PREFIX_MOVSD;
-                    *current_code_ptr++ = xmm_prefix;
-                    *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_R_BIT | REX_B_BIT); // REX.R for XMM7
-                    *current_code_ptr++ = 0x0F;
-                    *current_code_ptr++ = OPCODE_XMM_MOV_XMM_RM; // 0x10
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM7_CODE << 3) | MODRM_REG_R10_CODE);
+enum { FFI_GDB_JIT_NOACTION = 0, FFI_GDB_JIT_REGISTER_FN, FFI_GDB_JIT_UNREGISTER_FN };
 
-                    // Store float/double from XMM7 to (RSP + stack_offset_from_rsp_base)
-                    size_t stack_offset_from_rsp_base = (size_t)stack_arg_current_idx * 8;
-                    *current_code_ptr++ = xmm_prefix;
-                    *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_R_BIT); // REX.R for XMM7
-                    *current_code_ptr++ = 0x0F;
-                    *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM; // 0x11
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_XMM7_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_RSP;
-                    *current_code_ptr++ = (unsigned char)stack_offset_from_rsp_base;
-                    stack_arg_current_idx++;
-                } else { // GPR types to stack
-                    size_t stack_offset_from_rsp_base = (size_t)stack_arg_current_idx * 8;
-                    // Load the value from (R10) into R11 (temporary register)
-                    unsigned char load_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT | REX_R_BIT; // R10 is base, R11 is dest (R11's code is 0x03, needs REX.R)
-                    unsigned char load_opcode;
-                    unsigned char load_modrm = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+typedef struct FFI_GdbJitCodeEntry {
+    struct FFI_GdbJitCodeEntry* next_entry;
+    struct FFI_GdbJitCodeEntry* prev_entry;
+    const char* symfile_addr;
+    uint64_t symfile_size;
+} FFI_GdbJitCodeEntry;
 
-                    switch (param_type) {
-                        case FFI_TYPE_BOOL: case FFI_TYPE_CHAR: case FFI_TYPE_UCHAR:
-                            load_opcode = 0xB6; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_SCHAR:
-                            load_opcode = 0xBE; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_SHORT: case FFI_TYPE_SSHORT:
-                            load_opcode = 0xBF; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_USHORT:
-                            load_opcode = 0xB7; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_INT: case FFI_TYPE_SINT: case FFI_TYPE_WCHAR:
-                            load_opcode = 0x63; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_UINT:
-                            load_opcode = OPCODE_MOV_R64_RM64;
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_LONG: case FFI_TYPE_ULONG: case FFI_TYPE_LLONG: case FFI_TYPE_ULLONG:
-                        case FFI_TYPE_POINTER: case FFI_TYPE_SIZE_T: case FFI_TYPE_SLONG: case FFI_TYPE_SLLONG:
-                            load_opcode = OPCODE_MOV_R64_RM64; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        default: return 0; // Error
-                    }
+typedef struct {
+    uint32_t version;
+    uint32_t action_flag;
+    FFI_GdbJitCodeEntry* relevant_entry;
+    FFI_GdbJitCodeEntry* first_entry;
+} FFI_GdbJitDescriptor;
+
+#ifdef FFI_HAVE_GDB_JIT
+// The names, layout and version are fixed by the debugger protocol.
+__attribute__((noinline, used)) void __jit_debug_register_code(void) {
+    __asm__ volatile("" ::: "memory");
+}
+FFI_GdbJitDescriptor __jit_debug_descriptor = { 1, FFI_GDB_JIT_NOACTION, NULL, NULL };
+#endif
 
-                    // Step 2: Store the value from R11 to (RSP + stack_offset_from_rsp_base)
-                    unsigned char store_rex_prefix = REX_W_PREFIX | REX_R_BIT;
-                    *current_code_ptr++ = store_rex_prefix;
-                    *current_code_ptr++ = OPCODE_MOV_RM64_R64;
-                    unsigned char store_modrm_mod = (stack_offset_from_rsp_base == 0) ? MOD_INDIRECT : MOD_DISP8;
-                    *current_code_ptr++ = (unsigned char)((store_modrm_mod << 6) | (MODRM_REG_R11_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_RSP;
-                    if (stack_offset_from_rsp_base != 0) {
-                        *current_code_ptr++ = (unsigned char)stack_offset_from_rsp_base;
-                    }
-                    stack_arg_current_idx++;
-                }
-            }
+// Symbols stay where they were queued: the pending array becomes its object's symbol array
+// as is, so the address map can point into it.
+typedef struct FFI_GdbJitSymbol {
+    uintptr_t addr;
+    size_t size;
+    char* name;                        // NULL once the trampoline has been freed
+    struct FFI_GdbJitObject* object;   // NULL while the symbol is still queued
+    struct FFI_GdbJitSymbol* next;     // Address map bucket chain
+} FFI_GdbJitSymbol;
+
+typedef struct FFI_GdbJitObject {
+    FFI_GdbJitCodeEntry entry;   // First member: list entries cast back to their object
+    FFI_GdbJitSymbol* symbols;
+    int count;
+    int live;                    // Symbols whose trampoline has not been freed
+    bool stale;                  // The registered image still names freed trampolines
+    struct FFI_GdbJitObject* prev_stale;
+    struct FFI_GdbJitObject* next_stale;
+} FFI_GdbJitObject;
+
+#define FFI_GDB_JIT_DEFAULT_BATCH 64
+#define FFI_GDB_JIT_BUCKETS 1024
+
+// All guarded by g_ffi_gdb_jit_lock, which also serializes every debugger notification.
+static ffi_mutex_t g_ffi_gdb_jit_lock = FFI_MUTEX_INITIALIZER;
+static FFI_GdbJitSymbol* g_ffi_gdb_jit_pending = NULL; // Trampolines waiting for the next batch
+static int g_ffi_gdb_jit_pending_count = 0;
+static int g_ffi_gdb_jit_pending_capacity = 0; // Batch size when the pending array was allocated
+static int g_ffi_gdb_jit_pending_live = 0;
+static FFI_GdbJitObject* g_ffi_gdb_jit_stale = NULL; // Objects to rebuild at the next flush
+static FFI_GdbJitSymbol* g_ffi_gdb_jit_buckets[FFI_GDB_JIT_BUCKETS]; // Live symbols by address
+static int g_ffi_gdb_jit_batch = FFI_GDB_JIT_DEFAULT_BATCH;
+static uint32_t g_ffi_gdb_jit_enabled = 0;
+static uint32_t g_ffi_gdb_jit_used = 0; // Set on first enable: frees must check for registrations
+
+#ifdef FFI_HAVE_GDB_JIT
+/**
+ * @brief Builds the ELF image describing the live trampolines among `count` symbols (see the
+ * section comment).
+ * @return A malloc'd image of `*image_size` bytes, or NULL if out of memory.
+ */
+static char* ffi_gdb_jit_build_image(const FFI_GdbJitSymbol* symbols, int count, size_t* image_size) {
+    static const char shstrtab[] = "\0.shstrtab\0.strtab\0.symtab\0.text";
+    enum { SHSTR_SHSTRTAB = 1, SHSTR_STRTAB = 11, SHSTR_SYMTAB = 19, SHSTR_TEXT = 27 };
+    enum { SEC_SHSTRTAB = 1, SEC_STRTAB, SEC_SYMTAB, SEC_FIRST_TEXT };
+
+    size_t strtab_size = 1;
+    int live = 0;
+    for (int i = 0; i < count; i++) {
+        if (symbols[i].name != NULL) {
+            strtab_size += strlen(symbols[i].name) + 1;
+            live++;
         }
     }
+    size_t shstrtab_offset = sizeof(Elf64_Ehdr);
+    size_t strtab_offset = shstrtab_offset + sizeof(shstrtab);
+    size_t symtab_offset = (strtab_offset + strtab_size + 7) & ~(size_t)7;
+    size_t symtab_size = (size_t)(live + 1) * sizeof(Elf64_Sym);
+    size_t shdr_offset = symtab_offset + symtab_size;
+    int num_sections = SEC_FIRST_TEXT + live;
+    size_t total = shdr_offset + (size_t)num_sections * sizeof(Elf64_Shdr);
+
+    char* image = (char*)calloc(1, total);
+    if (image == NULL) {
+        return NULL;
+    }
+    Elf64_Ehdr* ehdr = (Elf64_Ehdr*)(void*)image;
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_type = ET_REL;
+#ifdef FFI_ARCH_ARM64
+    ehdr->e_machine = EM_AARCH64;
+#else
+    ehdr->e_machine = EM_X86_64;
+#endif
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_shoff = shdr_offset;
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_shentsize = sizeof(Elf64_Shdr);
+    ehdr->e_shnum = (Elf64_Half)num_sections;
+    ehdr->e_shstrndx = SEC_SHSTRTAB;
+    memcpy(image + shstrtab_offset, shstrtab, sizeof(shstrtab));
+
+    Elf64_Sym* syms = (Elf64_Sym*)(void*)(image + symtab_offset);
+    Elf64_Shdr* shdrs = (Elf64_Shdr*)(void*)(image + shdr_offset);
+    size_t name_offset = 1;
+    for (int i = 0, n = 0; i < count; i++) {
+        if (symbols[i].name == NULL) {
+            continue;
+        }
+        size_t name_size = strlen(symbols[i].name) + 1;
+        memcpy(image + strtab_offset + name_offset, symbols[i].name, name_size);
+        syms[n + 1].st_name = (Elf64_Word)name_offset;
+        syms[n + 1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+        syms[n + 1].st_shndx = (Elf64_Section)(SEC_FIRST_TEXT + n);
+        syms[n + 1].st_value = 0; // Section-relative; the section sits at the trampoline
+        syms[n + 1].st_size = symbols[i].size;
+        name_offset += name_size;
+
+        Elf64_Shdr* text = &shdrs[SEC_FIRST_TEXT + n++];
+        text->sh_name = SHSTR_TEXT;
+        text->sh_type = SHT_NOBITS;
+        text->sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+        text->sh_addr = (Elf64_Addr)symbols[i].addr;
+        text->sh_size = symbols[i].size;
+        text->sh_addralign = 16;
+    }
+    shdrs[SEC_SHSTRTAB] = (Elf64_Shdr){ .sh_name = SHSTR_SHSTRTAB, .sh_type = SHT_STRTAB,
+                                        .sh_offset = shstrtab_offset, .sh_size = sizeof(shstrtab), .sh_addralign = 1 };
+    shdrs[SEC_STRTAB] = (Elf64_Shdr){ .sh_name = SHSTR_STRTAB, .sh_type = SHT_STRTAB,
+                                      .sh_offset = strtab_offset, .sh_size = strtab_size, .sh_addralign = 1 };
+    shdrs[SEC_SYMTAB] = (Elf64_Shdr){ .sh_name = SHSTR_SYMTAB, .sh_type = SHT_SYMTAB,
+                                      .sh_offset = symtab_offset, .sh_size = symtab_size,
+                                      .sh_link = SEC_STRTAB, .sh_info = 1, // Every symbol but the null one is global
+                                      .sh_addralign = 8, .sh_entsize = sizeof(Elf64_Sym) };
+    *image_size = total;
+    return image;
+}
 
+/**
+ * @brief Links `object` into the descriptor list and tells an attached debugger to load it.
+ */
+static void ffi_gdb_jit_register_locked(FFI_GdbJitObject* object) {
+    FFI_GdbJitCodeEntry* entry = &object->entry;
+    entry->prev_entry = NULL;
+    entry->next_entry = __jit_debug_descriptor.first_entry;
+    if (entry->next_entry) {
+        entry->next_entry->prev_entry = entry;
+    }
+    __jit_debug_descriptor.first_entry = entry;
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_descriptor.action_flag = FFI_GDB_JIT_REGISTER_FN;
+    __jit_debug_register_code();
+}
 
-    // --- Call Target Function ---
-    // movabs RAX, <target_func_address>
-    // Write REX.W prefix (0x48)
-    *current_code_ptr++ = REX_W_PREFIX;
-    // Write MOV RAX, imm64 opcode (0xB8)
-    *current_code_ptr++ = OPCODE_MOV_IMM64_RAX;
-
-    target_addr_val = (long)(uintptr_t)sig->func_ptr; // Get the 64-bit address as a long (cast through uintptr_t)
-    // Write the 8-byte target function address
-    memcpy(current_code_ptr, &target_addr_val, 8);
-    current_code_ptr += 8;
+/**
+ * @brief Unlinks `object` from the descriptor list and tells an attached debugger to drop it.
+ * The image stays allocated; the caller frees or rebuilds it afterwards.
+ */
+static void ffi_gdb_jit_unregister_locked(FFI_GdbJitObject* object) {
+    FFI_GdbJitCodeEntry* entry = &object->entry;
+    if (entry->prev_entry) {
+        entry->prev_entry->next_entry = entry->next_entry;
+    } else {
+        __jit_debug_descriptor.first_entry = entry->next_entry;
+    }
+    if (entry->next_entry) {
+        entry->next_entry->prev_entry = entry->prev_entry;
+    }
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_descriptor.action_flag = FFI_GDB_JIT_UNREGISTER_FN;
+    __jit_debug_register_code();
+}
 
-    // call RAX
-    *current_code_ptr++ = OPCODE_CALL_RM64; // CALL r/m64
-    *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (0x02 << 3) | MODRM_REG_RAX);
+/**
+ * @brief (Re)builds the image of `object` from its symbols and registers it.
+ * @return False if out of memory; the object is then left unregistered.
+ */
+static bool ffi_gdb_jit_publish_locked(FFI_GdbJitObject* object) {
+    size_t image_size = 0;
+    char* image = ffi_gdb_jit_build_image(object->symbols, object->count, &image_size);
+    if (image == NULL) {
+        ffi_log_error("ERROR: Out of memory building the GDB JIT object for %d trampolines.", object->count);
+        return false;
+    }
+    object->entry.symfile_addr = image;
+    object->entry.symfile_size = image_size;
+    ffi_gdb_jit_register_locked(object);
+    return true;
+}
 
-    // --- Return Value Handling ---
-    // Store return value (from EAX/RAX or XMM0) into (R12)
-    if (sig->return_type != FFI_TYPE_VOID) {
-        switch (sig->return_type) {
-            case FFI_TYPE_BOOL:
-            case FFI_TYPE_CHAR:
-            case FFI_TYPE_UCHAR:
-            case FFI_TYPE_SCHAR:
-                // movb AL, [R12]
-                *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41 (for R12 as base)
-                *current_code_ptr++ = 0x88; // MOV r/m8, r8 (AL is 8-bit part of RAX)
-                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                *current_code_ptr++ = SIB_BYTE_R12_BASE;
-                break;
-            case FFI_TYPE_SHORT:
-            case FFI_TYPE_USHORT:
-            case FFI_TYPE_SSHORT:
-                // movw AX, [R12]
-                *current_code_ptr++ = 0x66; // Operand-size override prefix for 16-bit
-                *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41 (for R12 as base)
-                *current_code_ptr++ = 0x89; // MOV r/m16, r16 (AX is 16-bit part of RAX)
-                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                *current_code_ptr++ = SIB_BYTE_R12_BASE;
-                break;
-            case FFI_TYPE_INT:
-            case FFI_TYPE_UINT:
-            case FFI_TYPE_SINT:
-            case FFI_TYPE_WCHAR: // wchar_t is typically 32-bit on Linux
-                // movl EAX, [R12]
-                *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41
-                *current_code_ptr++ = OPCODE_MOV_RM64_R64;   // 0x89
-                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                *current_code_ptr++ = SIB_BYTE_R12_BASE;
-                break;
-            case FFI_TYPE_LONG:
-            case FFI_TYPE_ULONG:
-            case FFI_TYPE_LLONG:
-            case FFI_TYPE_ULLONG:
-            case FFI_TYPE_POINTER:
-            case FFI_TYPE_SIZE_T: // size_t is typically 64-bit on x86-64
-            case FFI_TYPE_SLONG:
-            case FFI_TYPE_SLLONG:
-                // movq RAX, [R12]
-                *current_code_ptr++ = REX_WB_PREFIX;         // 0x49
-                *current_code_ptr++ = OPCODE_MOV_RM64_R64;   // 0x89
-                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                *current_code_ptr++ = SIB_BYTE_R12_BASE;
-                break;
-            case FFI_TYPE_FLOAT:
-                // movss XMM0, [R12]
-                *current_code_ptr++ = PREFIX_MOVSS;          // 0xF3
-                *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_B_BIT); // 0x41
-                *current_code_ptr++ = 0x0F;
-                *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM; // 0x11
-                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                *current_code_ptr++ = SIB_BYTE_R12_BASE;
-                break;
-            case FFI_TYPE_DOUBLE:
-                // movsd XMM0, [R12]
-                *current_code_ptr++ = PREFIX_MOVSD;          // 0xF2
-                *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_B_BIT); // 0x41
-                *current_code_ptr++ = 0x0F;
-                *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM; // 0x11
-                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                *current_code_ptr++ = SIB_BYTE_R12_BASE;
-                break;
-            case FFI_TYPE_INT128:
-            case FFI_TYPE_UINT128:
-                // Return value in RDX:RAX (RAX is lower 64, RDX is upper 64)
-                // Store RAX (lower) to [R12]
-                *current_code_ptr++ = REX_WB_PREFIX; // 0x49
-                *current_code_ptr++ = OPCODE_MOV_RM64_R64; // 0x89
-                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+static size_t ffi_gdb_jit_bucket(uintptr_t addr) {
+    return (addr >> 12) % FFI_GDB_JIT_BUCKETS;
+}
 
-                // Store RDX (upper) to [R12 + 8]
-                *current_code_ptr++ = REX_WB_PREFIX; // 0x49
-                *current_code_ptr++ = OPCODE_MOV_RM64_R64; // 0x89
-                *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_RDX << 3) | RM_SIB_BYTE_FOLLOWS);
-                *current_code_ptr++ = SIB_BYTE_R12_BASE;
-                *current_code_ptr++ = 0x08; // disp8 = 8
-                break;
-            default: // This default case catches FFI_TYPE_UNKNOWN or any other unsupported type for return
-                return 0; // Indicate error
+/**
+ * @brief Removes the live symbol at `addr` from the address map.
+ * @return The symbol, or NULL if no live symbol has that address.
+ */
+static FFI_GdbJitSymbol* ffi_gdb_jit_unmap_locked(uintptr_t addr) {
+    for (FFI_GdbJitSymbol** link = &g_ffi_gdb_jit_buckets[ffi_gdb_jit_bucket(addr)]; *link; link = &(*link)->next) {
+        if ((*link)->addr == addr) {
+            FFI_GdbJitSymbol* symbol = *link;
+            *link = symbol->next;
+            return symbol;
         }
     }
+    return NULL;
+}
 
-    // --- Epilogue ---
-    // Reverse stack alignment only if space was allocated
-    if (final_stack_subtraction > 0) {
-        *current_code_ptr++ = REX_W_PREFIX; // REX.W prefix for 64-bit operation
-        *current_code_ptr++ = OPCODE_ADD_IMM8_RSP; // 0x83 (ADD r/m64, imm8)
-        *current_code_ptr++ = (MOD_REGISTER << 6) | (0x00 << 3) | MODRM_REG_RSP; // Mod=11, Reg=Group 0 (ADD), R/M=RSP (0x04) -> 0xC4
-        *current_code_ptr++ = (unsigned char)final_stack_subtraction; // imm8
+static void ffi_gdb_jit_unstale_locked(FFI_GdbJitObject* object) {
+    if (!object->stale) {
+        return;
     }
+    if (object->prev_stale) {
+        object->prev_stale->next_stale = object->next_stale;
+    } else {
+        g_ffi_gdb_jit_stale = object->next_stale;
+    }
+    if (object->next_stale) {
+        object->next_stale->prev_stale = object->prev_stale;
+    }
+    object->stale = false;
+}
 
-    // Pop R12 to restore its original value
-    *current_code_ptr++ = REX_PUSH_POP_R12_PREFIX; // 0x41
-    *current_code_ptr++ = OPCODE_POP_R12_BYTE;     // 0x5C
-
-    // Pop R14 to restore original RDI (args pointer)
-    *current_code_ptr++ = REX_PUSH_POP_R14_PREFIX;
-    *current_code_ptr++ = OPCODE_POP_R14_BYTE;
-
-    // pop RBP
-    *current_code_ptr++ = OPCODE_POP_RBP;
+/**
+ * @brief Frees an unregistered object, first dropping its live symbols from the address map.
+ */
+static void ffi_gdb_jit_free_object(FFI_GdbJitObject* object) {
+    for (int i = 0; i < object->count; i++) {
+        if (object->symbols[i].name != NULL) {
+            ffi_gdb_jit_unmap_locked(object->symbols[i].addr);
+            free(object->symbols[i].name);
+        }
+    }
+    free(object->symbols);
+    free((void*)object->entry.symfile_addr);
+    free(object);
+}
 
-    // ret
-    *current_code_ptr++ = OPCODE_RET;
+/**
+ * @brief Rebuilds the objects that name freed trampolines, then registers the pending
+ * trampolines as one object. Must hold g_ffi_gdb_jit_lock.
+ */
+static void ffi_gdb_jit_flush_locked(void) {
+    while (g_ffi_gdb_jit_stale != NULL) {
+        FFI_GdbJitObject* object = g_ffi_gdb_jit_stale;
+        ffi_gdb_jit_unstale_locked(object);
+        ffi_gdb_jit_unregister_locked(object);
+        free((void*)object->entry.symfile_addr);
+        object->entry.symfile_addr = NULL;
+        if (!ffi_gdb_jit_publish_locked(object)) {
+            ffi_gdb_jit_free_object(object);
+        }
+    }
+    if (g_ffi_gdb_jit_pending_live == 0) {
+        return;
+    }
+    FFI_GdbJitObject* object = (FFI_GdbJitObject*)calloc(1, sizeof(FFI_GdbJitObject));
+    if (object == NULL) {
+        ffi_log_error("ERROR: Out of memory registering trampolines with the debugger.");
+        return;
+    }
+    object->symbols = g_ffi_gdb_jit_pending;
+    object->count = g_ffi_gdb_jit_pending_count;
+    object->live = g_ffi_gdb_jit_pending_live;
+    for (int i = 0; i < object->count; i++) {
+        object->symbols[i].object = object;
+    }
+    g_ffi_gdb_jit_pending = NULL;
+    g_ffi_gdb_jit_pending_count = 0;
+    g_ffi_gdb_jit_pending_capacity = 0;
+    g_ffi_gdb_jit_pending_live = 0;
+    if (!ffi_gdb_jit_publish_locked(object)) {
+        ffi_gdb_jit_free_object(object);
+    }
+}
+#endif
 
-    return (size_t)(current_code_ptr - code_buffer);
+/**
+ * @brief Starts or stops registering trampolines with debuggers through the GDB JIT interface.
+ * Disabling registers the partial batch; objects already registered stay until their code is
+ * freed.
+ * @param batch_size Trampolines per registered object; 0 keeps the current size (default 64),
+ *        1 registers every trampoline as soon as it is generated.
+ * @return True on success, false if the platform has no GDB JIT support.
+ */
+bool ffi_set_gdb_jit(bool enabled, int batch_size) {
+#ifdef FFI_HAVE_GDB_JIT
+    ffi_mutex_lock(&g_ffi_gdb_jit_lock);
+    if (!enabled) {
+        ffi_gdb_jit_flush_locked();
+    }
+    if (batch_size > 0 && batch_size != g_ffi_gdb_jit_batch) {
+        ffi_gdb_jit_flush_locked(); // The pending array was sized for the old batch
+        if (g_ffi_gdb_jit_pending_count == 0) {
+            free(g_ffi_gdb_jit_pending);
+            g_ffi_gdb_jit_pending = NULL;
+            g_ffi_gdb_jit_pending_capacity = 0;
+        }
+        g_ffi_gdb_jit_batch = batch_size;
+    }
+    FFI_ATOMIC_XCHG_U32(&g_ffi_gdb_jit_used, 1u);
+    FFI_ATOMIC_XCHG_U32(&g_ffi_gdb_jit_enabled, enabled ? 1u : 0u);
+    ffi_mutex_unlock(&g_ffi_gdb_jit_lock);
+    return true;
+#else
+    (void)batch_size;
+    if (enabled) {
+        ffi_log_error("ERROR: The GDB JIT interface is only supported on Linux.");
+        return false;
+    }
+    return true;
+#endif
 }
 
 /**
- * @brief Generates x86-64 Microsoft x64 ABI trampoline bytes (Win64).
- * @param code_buffer Pointer to the memory where the assembly bytes will be written.
- * @param sig A pointer to the FFI_FunctionSignature.
- * @return The size of the generated assembly code in bytes.
+ * @brief Registers the trampolines still waiting for a full batch, e.g. at the end of a bulk
+ * binding pass or before attaching a debugger, and drops freed trampolines from the objects
+ * that still name them.
  */
-size_t generate_x86_64_win64_trampoline(unsigned char* code_buffer, FFI_FunctionSignature* sig) {
-    unsigned char *current_code_ptr = code_buffer;
-    long target_addr_val;
+void ffi_gdb_jit_flush(void) {
+#ifdef FFI_HAVE_GDB_JIT
+    ffi_mutex_lock(&g_ffi_gdb_jit_lock);
+    ffi_gdb_jit_flush_locked();
+    ffi_mutex_unlock(&g_ffi_gdb_jit_lock);
+#endif
+}
 
-    // The trampoline itself will be called by C with this signature:
-    // void (*GenericTrampoline)(FFI_Argument* args, int num_args, void* return_buffer_ptr)
-    // Register mapping for this trampoline call (Win64):
-    // %rcx: FFI_Argument* args (base address of the FFI_Argument array)
-    // %rdx: int num_args (number of arguments in the array)
-    // %r8:  void* return_buffer_ptr (pointer to where the return value should be stored)
+/**
+ * @brief Queues a freshly generated trampoline for registration, if the interface is on.
+ */
+static void ffi_gdb_jit_record(const FFI_FunctionSignature* sig, const void* code, size_t code_size) {
+#ifdef FFI_HAVE_GDB_JIT
+    if (!FFI_ATOMIC_LOAD_U32(&g_ffi_gdb_jit_enabled)) {
+        return;
+    }
+    char name[FFI_TRAMPOLINE_SYMBOL_MAX];
+    ffi_trampoline_symbol_name(sig, name, sizeof(name));
+    size_t name_size = strlen(name) + 1;
+    char* owned_name = (char*)malloc(name_size);
+    if (owned_name == NULL) {
+        return;
+    }
+    memcpy(owned_name, name, name_size);
+    ffi_mutex_lock(&g_ffi_gdb_jit_lock);
+    if (g_ffi_gdb_jit_pending == NULL) {
+        g_ffi_gdb_jit_pending = (FFI_GdbJitSymbol*)malloc((size_t)g_ffi_gdb_jit_batch * sizeof(FFI_GdbJitSymbol));
+        g_ffi_gdb_jit_pending_capacity = g_ffi_gdb_jit_pending ? g_ffi_gdb_jit_batch : 0;
+    }
+    // Writes are checked against the array's own size: a flush that failed for lack of memory
+    // can leave it in place after the batch size has changed.
+    if (g_ffi_gdb_jit_pending_count >= g_ffi_gdb_jit_pending_capacity) {
+        free(owned_name);
+    } else {
+        FFI_GdbJitSymbol* symbol = &g_ffi_gdb_jit_pending[g_ffi_gdb_jit_pending_count++];
+        size_t bucket = ffi_gdb_jit_bucket((uintptr_t)code);
+        *symbol = (FFI_GdbJitSymbol){ (uintptr_t)code, code_size, owned_name, NULL, g_ffi_gdb_jit_buckets[bucket] };
+        g_ffi_gdb_jit_buckets[bucket] = symbol;
+        g_ffi_gdb_jit_pending_live++;
+        if (g_ffi_gdb_jit_pending_count >= g_ffi_gdb_jit_batch) {
+            ffi_gdb_jit_flush_locked();
+        }
+    }
+    ffi_mutex_unlock(&g_ffi_gdb_jit_lock);
+#else
+    (void)sig; (void)code; (void)code_size;
+#endif
+}
 
-    // --- Prologue ---
-    // push %rbp
-    *current_code_ptr++ = OPCODE_PUSH_RBP;
+/**
+ * @brief Withdraws the trampoline at `code` from the debugger before its memory is released.
+ * Its object is unregistered with its last trampoline, and otherwise rebuilt at the next flush.
+ */
+static void ffi_gdb_jit_forget(const void* code) {
+#ifdef FFI_HAVE_GDB_JIT
+    if (!FFI_ATOMIC_LOAD_U32(&g_ffi_gdb_jit_used)) {
+        return;
+    }
+    ffi_mutex_lock(&g_ffi_gdb_jit_lock);
+    FFI_GdbJitSymbol* symbol = ffi_gdb_jit_unmap_locked((uintptr_t)code);
+    if (symbol != NULL) {
+        free(symbol->name);
+        symbol->name = NULL;
+        FFI_GdbJitObject* object = symbol->object;
+        if (object == NULL) {
+            if (--g_ffi_gdb_jit_pending_live == 0) {
+                g_ffi_gdb_jit_pending_count = 0; // Only freed entries are queued; reuse the array
+            }
+        } else if (--object->live == 0) {
+            ffi_gdb_jit_unstale_locked(object);
+            ffi_gdb_jit_unregister_locked(object);
+            ffi_gdb_jit_free_object(object);
+        } else if (!object->stale) {
+            object->stale = true;
+            object->prev_stale = NULL;
+            object->next_stale = g_ffi_gdb_jit_stale;
+            if (g_ffi_gdb_jit_stale) {
+                g_ffi_gdb_jit_stale->prev_stale = object;
+            }
+            g_ffi_gdb_jit_stale = object;
+        }
+    }
+    ffi_mutex_unlock(&g_ffi_gdb_jit_lock);
+#else
+    (void)code;
+#endif
+}
 
-    // mov %rsp, %rbp
-    *current_code_ptr++ = REX_W_PREFIX;
-    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64
-    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RSP << 3) | MODRM_REG_RBP;
+// --- Unwind Info ---
+// Generated frames have no unwind tables, so DWARF unwinders (libgcc's _Unwind_Backtrace,
+// C++ exceptions thrown through a callback, perf --call-graph=dwarf, gdb without frame
+// pointers) stop at the first trampoline. With unwind info enabled, every generated x86-64
+// trampoline gets an .eh_frame fragment that is handed to libgcc's __register_frame() as soon
+// as the code exists. The fragment is one CIE, one FDE and a zero terminator. Unwinding
+// through a handle's very first call works, so unlike debugger symbols these are not batched.
+// libgcc 12 and later keep registered frames in a b-tree, so each registration costs
+// O(log n) and parses only its own FDE.
+//
+// Both x86-64 generators (System V, which also serves raw syscalls, and Win64) open with the
+// same shape and close with a single epilogue at the end of the code:
+//
+//    0  endbr64                      size-6  pop  B
+//    4  push %rbp     CFA=rsp+16     size-4  pop  A
+//    5  mov %rsp,%rbp CFA=rbp+16     size-2  pop  %rbp   CFA=rsp+8
+//    8  push A        A at CFA-24    size-1  ret
+//   13  push B        B at CFA-32
+//
+// A and B are R14/R12 for System V and R13/R14 for Win64. Any `sub/add %rsp` in between leaves
+// the rbp-based CFA unaffected, so an FDE describing these rows is exact at every instruction.
+// The layout is checked against the emitted bytes rather than assumed. Manual trampolines and
+// anything else that does not match get no unwind info, and a warning is logged.
+
+#if defined(FFI_ARCH_X64) && defined(FFI_OS_LINUX) && defined(__GNUC__)
+#define FFI_HAVE_UNWIND_INFO 1
+// libgcc entry points; not declared by any public header. begin points at an .eh_frame
+// section terminated by a zero length word.
+extern void __register_frame(void* begin);
+extern void __deregister_frame(void* begin);
+#endif
 
-    // Save callee-saved registers that we'll use: RBX, RDI, RSI, R12, R13, R14, R15
-    // We need to save RCX (args), RDX (num_args), R8 (return_buffer_ptr) if we need them after pushing other args.
-    // However, for simplicity, we'll just save R13 (for args_ptr) and R14 (for return_buffer_ptr)
-    // and move the incoming RCX and R8 into them.
-    // R13 (args pointer from rcx)
-    *current_code_ptr++ = REX_PUSH_POP_R13_PREFIX; // 0x41
-    *current_code_ptr++ = OPCODE_PUSH_R13_BYTE;    // 0x55 (REX.B for R13, 0x55 is PUSH RBP, but with REX.B it's PUSH R13)
+#define FFI_UNWIND_BUCKETS 1024
+#define FFI_EH_FRAME_MAX 96 // CIE (24) + FDE (at most 64) + terminator (4), rounded up
 
-    // mov %rcx, %r13 (Save args pointer from rcx to r13)
-    *current_code_ptr++ = REX_WB_PREFIX; // 0x49 (W=1, B=1 for R13)
-    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64 (store rcx to r13)
-    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RCX << 3) | MODRM_REG_R13_CODE; // 0xCB
+typedef struct FFI_UnwindRecord {
+    const void* code;
+    struct FFI_UnwindRecord* next;
+    uint64_t eh_frame[FFI_EH_FRAME_MAX / 8]; // 8-byte aligned, as the unwinder expects
+} FFI_UnwindRecord;
 
-    // R14 (return_buffer_ptr from r8)
-    *current_code_ptr++ = REX_PUSH_POP_R14_PREFIX; // 0x41
-    *current_code_ptr++ = OPCODE_PUSH_R14_BYTE;    // 0x56
+// Registered fragments by trampoline address (each trampoline starts its own page). Guarded by
+// g_ffi_unwind_lock.
+static ffi_mutex_t g_ffi_unwind_lock = FFI_MUTEX_INITIALIZER;
+static FFI_UnwindRecord* g_ffi_unwind_buckets[FFI_UNWIND_BUCKETS];
+static uint32_t g_ffi_unwind_enabled = 0;
+static uint32_t g_ffi_unwind_used = 0; // Set on first enable: frees must check for registrations
 
-    // mov %r8, %r14 (Save return_buffer_ptr from r8 to r14)
-    *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT; // 0x4D (W=1, R=1 for R8, B=1 for R14)
-    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64 (store r8 to r14)
-    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_R8_CODE << 3) | MODRM_REG_R14_CODE; // 0xC6
+static size_t ffi_unwind_bucket(const void* code) {
+    return ((uintptr_t)code >> 12) % FFI_UNWIND_BUCKETS;
+}
 
-    // --- Determine Stack Arguments and Calculate Total Stack Space ---
-    int num_gp_regs_used = 0;
-    int num_xmm_regs_used = 0;
-    int num_stack_args = 0; // Number of 8-byte slots needed on stack
+/**
+ * @brief Writes the .eh_frame fragment describing an x86-64 trampoline to `out`.
+ * @param out At least FFI_EH_FRAME_MAX bytes, 8-byte aligned.
+ * @return The fragment size, or 0 if the code does not have the expected prologue/epilogue.
+ */
+static size_t ffi_unwind_build_eh_frame(const unsigned char* code, size_t code_size, unsigned char* out) {
+    static const unsigned char prologue[] = { 0xF3, 0x0F, 0x1E, 0xFA, 0x55, 0x48, 0x89, 0xE5, 0x41 };
+    if (code_size < 24 || memcmp(code, prologue, sizeof(prologue)) != 0 || code[13] != 0x41 ||
+        (code[9] & 0xF8) != 0x50 || (code[14] & 0xF8) != 0x50 ||
+        code[code_size - 6] != 0x41 || code[code_size - 5] != (unsigned char)(0x58 | (code[14] & 7)) ||
+        code[code_size - 4] != 0x41 || code[code_size - 3] != (unsigned char)(0x58 | (code[9] & 7)) ||
+        code[code_size - 2] != 0x5D || code[code_size - 1] != OPCODE_RET) {
+        return 0;
+    }
+    const unsigned char reg_a = (unsigned char)(8 + (code[9] & 7));   // DWARF numbers R8-R15 as 8-15
+    const unsigned char reg_b = (unsigned char)(8 + (code[14] & 7));
+    enum { DW_CFA_nop = 0x00, DW_CFA_advance_loc1 = 0x02, DW_CFA_def_cfa = 0x0C, DW_CFA_def_cfa_register = 0x0D,
+           DW_CFA_def_cfa_offset = 0x0E, DW_CFA_advance_loc = 0x40, DW_CFA_offset = 0x80, DW_CFA_restore = 0xC0 };
+    enum { DW_REG_RBP = 6, DW_REG_RSP = 7, DW_REG_RA = 16 };
+
+    size_t len = 0;
+    // CIE: version 1, augmentation "zR" with absolute FDE pointers, code alignment 1, data
+    // alignment -8; on entry CFA = rsp+8 and the return address is at CFA-8.
+    static const unsigned char cie[] = {
+        20, 0, 0, 0,  0, 0, 0, 0,  1, 'z', 'R', 0,  1, 0x78, DW_REG_RA,  1, 0x00,
+        DW_CFA_def_cfa, DW_REG_RSP, 8,  DW_CFA_offset | DW_REG_RA, 1,  DW_CFA_nop, DW_CFA_nop,
+    };
+    memcpy(out, cie, sizeof(cie));
+    len = sizeof(cie);
+
+    size_t fde = len;
+    uint32_t cie_pointer = (uint32_t)(fde + 4); // Distance back to the CIE from this field
+    uint64_t pc_begin = (uint64_t)(uintptr_t)code, pc_range = code_size;
+    memcpy(out + fde + 4, &cie_pointer, 4);
+    memcpy(out + fde + 8, &pc_begin, 8);
+    memcpy(out + fde + 16, &pc_range, 8);
+    len = fde + 24;
+    out[len++] = 0; // No augmentation data
+    const unsigned char rows[] = {
+        DW_CFA_advance_loc | 5, DW_CFA_def_cfa_offset, 16, DW_CFA_offset | DW_REG_RBP, 2,
+        DW_CFA_advance_loc | 3, DW_CFA_def_cfa_register, DW_REG_RBP,
+        DW_CFA_advance_loc | 2, (unsigned char)(DW_CFA_offset | reg_a), 3,
+        DW_CFA_advance_loc | 5, (unsigned char)(DW_CFA_offset | reg_b), 4,
+    };
+    memcpy(out + len, rows, sizeof(rows));
+    len += sizeof(rows);
+    size_t to_epilogue = code_size - 4 - 15; // From the last prologue row to after `pop B`
+    if (to_epilogue > 255) {
+        uint16_t delta = (uint16_t)to_epilogue;
+        out[len++] = 0x03; // DW_CFA_advance_loc2
+        memcpy(out + len, &delta, 2);
+        len += 2;
+    } else {
+        out[len++] = DW_CFA_advance_loc1;
+        out[len++] = (unsigned char)to_epilogue;
+    }
+    const unsigned char epilogue[] = {
+        (unsigned char)(DW_CFA_restore | reg_b),
+        DW_CFA_advance_loc | 2, (unsigned char)(DW_CFA_restore | reg_a),
+        DW_CFA_advance_loc | 1, DW_CFA_def_cfa, DW_REG_RSP, 8, DW_CFA_restore | DW_REG_RBP,
+    };
+    memcpy(out + len, epilogue, sizeof(epilogue));
+    len += sizeof(epilogue);
+    while ((len - fde) % 8 != 0) {
+        out[len++] = DW_CFA_nop;
+    }
+    uint32_t fde_length = (uint32_t)(len - fde - 4);
+    memcpy(out + fde, &fde_length, 4);
+    memset(out + len, 0, 4); // Terminator
+    return len + 4;
+}
 
-    // Win64 GPRs: RCX, RDX, R8, R9 (4 registers)
-    // Win64 XMMs: XMM0, XMM1, XMM2, XMM3 (4 registers)
+/**
+ * @brief Enables or disables unwind info for trampolines generated afterwards.
+ * Fragments already registered stay until their code is freed.
+ * @return True on success, false if the platform has no supported unwinder registration.
+ */
+bool ffi_set_unwind_info(bool enabled) {
+#ifdef FFI_HAVE_UNWIND_INFO
+    if (enabled) {
+        FFI_ATOMIC_XCHG_U32(&g_ffi_unwind_used, 1u);
+    }
+    FFI_ATOMIC_XCHG_U32(&g_ffi_unwind_enabled, enabled ? 1u : 0u);
+    return true;
+#else
+    if (enabled) {
+        ffi_log_error("ERROR: Trampoline unwind info is only supported on x86-64 Linux with libgcc.");
+        return false;
+    }
+    return true;
+#endif
+}
 
-    // First, check if a return buffer pointer is needed for structs > 8 bytes.
-    // If so, it consumes RCX (the first argument register)
-    bool return_struct_by_pointer = false;
-    if (sig->return_type == FFI_TYPE_INT128 || sig->return_type == FFI_TYPE_UINT128) {
-        // On Win64, __int128 is typically returned by reference (pointer in RCX)
-        return_struct_by_pointer = true;
-        num_gp_regs_used++; // RCX is used for return buffer pointer
-    } else if (sig->return_type == FFI_TYPE_UNKNOWN) {
-        // Handle other struct types if they were added. For now, only 128-bit.
-        // For structs > 8 bytes, Win64 returns by pointer.
-        // This FFI doesn't currently support arbitrary structs, so we assume 128-bit is the only case.
+/**
+ * @brief Builds and registers the unwind info of a freshly generated trampoline, if enabled.
+ */
+static void ffi_unwind_register(const FFI_FunctionSignature* sig, const void* code, size_t code_size) {
+#ifdef FFI_HAVE_UNWIND_INFO
+    if (!FFI_ATOMIC_LOAD_U32(&g_ffi_unwind_enabled)) {
+        return;
+    }
+    FFI_UnwindRecord* record = (FFI_UnwindRecord*)malloc(sizeof(FFI_UnwindRecord));
+    if (record == NULL) {
+        ffi_log_error("ERROR: Out of memory for the unwind info of '%s'.", sig->debug_name);
+        return;
+    }
+    if (ffi_unwind_build_eh_frame((const unsigned char*)code, code_size, (unsigned char*)record->eh_frame) == 0) {
+        ffi_log_error("WARNING: No unwind info for '%s': unrecognized prologue or epilogue.", sig->debug_name);
+        free(record);
+        return;
+    }
+    record->code = code;
+    __register_frame(record->eh_frame);
+    ffi_mutex_lock(&g_ffi_unwind_lock);
+    size_t bucket = ffi_unwind_bucket(code);
+    record->next = g_ffi_unwind_buckets[bucket];
+    g_ffi_unwind_buckets[bucket] = record;
+    ffi_mutex_unlock(&g_ffi_unwind_lock);
+#else
+    (void)sig; (void)code; (void)code_size;
+#endif
+}
+
+/**
+ * @brief Deregisters the unwind info of the trampoline at `code` before its memory is released.
+ */
+static void ffi_unwind_forget(const void* code) {
+#ifdef FFI_HAVE_UNWIND_INFO
+    if (!FFI_ATOMIC_LOAD_U32(&g_ffi_unwind_used)) {
+        return;
     }
+    FFI_UnwindRecord* found = NULL;
+    ffi_mutex_lock(&g_ffi_unwind_lock);
+    for (FFI_UnwindRecord** link = &g_ffi_unwind_buckets[ffi_unwind_bucket(code)]; *link; link = &(*link)->next) {
+        if ((*link)->code == code) {
+            found = *link;
+            *link = found->next;
+            break;
+        }
+    }
+    ffi_mutex_unlock(&g_ffi_unwind_lock);
+    if (found) {
+        __deregister_frame(found->eh_frame);
+        free(found);
+    }
+#else
+    (void)code;
+#endif
+}
 
-    for (int i = 0; i < sig->num_params; ++i) {
-        FFI_Type param_type = sig->param_types[i];
-        if (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE) {
-            if (num_xmm_regs_used < 4) { // Win64 has 4 XMM registers
-                num_xmm_regs_used++;
-            } else {
-                num_stack_args++;
-            }
-        } else if (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128) {
-            // 128-bit integers consume two GPRs or 16 bytes on stack
-            // On Win64, 128-bit values are passed as two 64-bit arguments.
-            if (num_gp_regs_used <= 2) { // If num_gp_regs_used is 3, we only have R9 left, so it spills.
-                num_gp_regs_used += 2; // Consumes two GPRs
-            } else {
-                num_stack_args += 2; // Consumes 16 bytes on stack
-            }
-        } else { // All other types (integers, bool, char, pointer, wchar_t, size_t) go to GPRs
-            if (num_gp_regs_used < 4) { // Win64 has 4 GPRs
-                num_gp_regs_used++;
-            } else {
-                num_stack_args++;
+// Objects written by different threads are kept on separate cache lines of this size.
+#define FFI_CACHE_LINE_SIZE 64
+
+// --- Call Instrumentation ---
+// Instrumentation lives in the generated code, so call sites need no wrapping. It is chosen when
+// a handle is created (ffi_set_call_instrumentation()) and is fixed for that handle's life:
+//
+//   FFI_INSTRUMENT_OFF    Nothing is emitted; the trampoline is byte-for-byte the plain one.
+//   FFI_INSTRUMENT_COUNT  `lock inc` of the handle's call counter on entry.
+//   FFI_INSTRUMENT_TIME   The counter, plus RDTSC before argument marshalling and RDTSCP after
+//                         the return value is stored. The trampoline passes the difference in
+//                         TSC ticks to ffi_call_stats_record(), which adds it to the calling
+//                         thread's histogram for the handle. Some hypervisors hide RDTSCP, so
+//                         selecting this mode checks CPUID first and falls back to LFENCE; RDTSC.
+//
+// The counter sits in its own cache line, away from the read-mostly signature. Histograms are
+// log-linear in the style of HdrHistogram. Values below 16 ticks get exact buckets; above that,
+// every power of two is split into 8 buckets, so a bucket is within 12.5% of any value in it.
+// Each thread owns its histograms and updates them with plain loads and stores. Readers
+// snapshot them with atomic loads and merge across threads without stopping writers. Histograms
+// survive their thread, so a snapshot still covers calls from threads that have since exited.
+// They are released with the handle's memory.
+//
+// Both are implemented by the x86-64 System V generator (the default on Linux and macOS) only.
+// Handles whose trampoline comes from another generator or from manual bytes get no stats, so
+// ffi_call_count() reports -1 for them rather than a count that never moves.
+
+#define FFI_HIST_SUB_BITS 3
+#define FFI_HIST_SUB (1 << FFI_HIST_SUB_BITS)
+#define FFI_HIST_BUCKETS ((64 - FFI_HIST_SUB_BITS) * FFI_HIST_SUB + FFI_HIST_SUB) // 496
+
+typedef enum {
+    FFI_INSTRUMENT_OFF = 0,
+    FFI_INSTRUMENT_COUNT,
+    FFI_INSTRUMENT_TIME,
+} FFI_InstrumentMode;
+
+// Latencies of one handle's calls, in TSC ticks.
+typedef struct {
+    int64_t count;
+    int64_t total_ticks;
+    int64_t min_ticks;  // INT64_MAX while count is 0
+    int64_t max_ticks;
+    int64_t buckets[FFI_HIST_BUCKETS];
+} FFI_CallHistogram;
+
+// Per-handle instrumentation state, referenced by absolute address from the trampoline.
+typedef struct FFI_CallStats {
+    int64_t calls;              // Incremented by the trampoline with `lock inc`
+    uint32_t id;                // Index of this handle in every thread's histogram table
+    FFI_InstrumentMode mode;
+    char pad[FFI_CACHE_LINE_SIZE - 16];
+} FFI_CallStats;
+
+// One thread's histograms, indexed by FFI_CallStats::id.
+typedef struct FFI_InstrThread {
+    FFI_CallHistogram** histograms;   // Grown and cleared under g_ffi_instr_lock
+    uint32_t capacity;
+    struct FFI_InstrThread* next;
+} FFI_InstrThread;
+
+static ffi_mutex_t g_ffi_instr_lock = FFI_MUTEX_INITIALIZER;
+static FFI_InstrThread* g_ffi_instr_threads = NULL; // Guarded by g_ffi_instr_lock
+static uint32_t g_ffi_instr_next_id = 0;           // Guarded by g_ffi_instr_lock
+static uint32_t g_ffi_instr_mode = FFI_INSTRUMENT_OFF;
+static uint32_t g_ffi_instr_rdtscp = 0; // CPUID 0x80000001:EDX[27], read when FFI_INSTRUMENT_TIME is selected
+static FFI_THREAD_LOCAL FFI_InstrThread* t_ffi_instr_thread = NULL;
+
+static void* ffi_aligned_malloc(size_t alignment, size_t size);
+static void ffi_aligned_free(void* mem);
+
+static bool ffi_cpu_has_rdtscp(void) {
+#ifdef FFI_HAVE_X86_TARGET_ATTR
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000001u, &eax, &ebx, &ecx, &edx) && (edx & (1u << 27)) != 0; // EDX[27]: RDTSCP
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Selects the instrumentation generated into trampolines of handles created afterwards.
+ */
+void ffi_set_call_instrumentation(FFI_InstrumentMode mode) {
+    if (mode == FFI_INSTRUMENT_TIME) {
+        FFI_ATOMIC_XCHG_U32(&g_ffi_instr_rdtscp, ffi_cpu_has_rdtscp() ? 1u : 0u);
+    }
+    FFI_ATOMIC_XCHG_U32(&g_ffi_instr_mode, (uint32_t)mode);
+}
+
+static int ffi_hist_bucket(uint64_t ticks) {
+    int msb = 63;
+#if defined(__GNUC__) || defined(__clang__)
+    msb = 63 - __builtin_clzll(ticks | 1);
+#else
+    while (msb > 0 && !(ticks >> msb)) msb--;
+#endif
+    int shift = msb > FFI_HIST_SUB_BITS ? msb - FFI_HIST_SUB_BITS : 0;
+    return (shift << FFI_HIST_SUB_BITS) + (int)(ticks >> shift);
+}
+
+static uint64_t ffi_hist_bucket_lower(int bucket) {
+    if (bucket < 2 * FFI_HIST_SUB) {
+        return (uint64_t)bucket;
+    }
+    int shift = (bucket >> FFI_HIST_SUB_BITS) - 1;
+    return (uint64_t)(bucket - (shift << FFI_HIST_SUB_BITS)) << shift;
+}
+
+/**
+ * @brief Tells whether generate_generic_trampoline() picks the System V generator, the only
+ * one that emits instrumentation, for `abi`.
+ */
+static bool ffi_call_stats_supported(FFI_ABI abi) {
+#if defined(FFI_ARCH_X64) && !defined(FFI_OS_WIN64)
+    return abi != FFI_ABI_WIN64;
+#else
+    (void)abi;
+    return false;
+#endif
+}
+
+/**
+ * @brief Attaches instrumentation state to a new handle if the current mode asks for it and
+ * its trampoline will be generated by a generator that supports it.
+ * @return False if out of memory.
+ */
+static bool ffi_call_stats_attach(FFI_FunctionSignature* sig, bool generated) {
+    FFI_InstrumentMode mode = (FFI_InstrumentMode)FFI_ATOMIC_LOAD_U32(&g_ffi_instr_mode);
+    sig->call_stats = NULL;
+    if (mode == FFI_INSTRUMENT_OFF || !generated || !ffi_call_stats_supported(sig->abi)) {
+        return true;
+    }
+    FFI_CallStats* stats = (FFI_CallStats*)ffi_aligned_malloc(FFI_CACHE_LINE_SIZE, sizeof(FFI_CallStats));
+    if (stats == NULL) {
+        ffi_log_error("ERROR: Out of memory for the call statistics of '%s'.", sig->debug_name);
+        return false;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->mode = mode;
+    ffi_mutex_lock(&g_ffi_instr_lock);
+    stats->id = g_ffi_instr_next_id++;
+    ffi_mutex_unlock(&g_ffi_instr_lock);
+    sig->call_stats = stats;
+    return true;
+}
+
+/**
+ * @brief Frees a handle's instrumentation state and every thread's histogram of it.
+ * Only called once no trampoline of the handle can run (after epoch reclamation).
+ */
+static void ffi_call_stats_release(FFI_CallStats* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    ffi_mutex_lock(&g_ffi_instr_lock);
+    for (FFI_InstrThread* thread = g_ffi_instr_threads; thread; thread = thread->next) {
+        if (stats->id < thread->capacity) {
+            free(thread->histograms[stats->id]);
+            thread->histograms[stats->id] = NULL;
+        }
+    }
+    ffi_mutex_unlock(&g_ffi_instr_lock);
+    ffi_aligned_free(stats);
+}
+
+/**
+ * @brief Creates the calling thread's histogram for `stats` (first timed call on this thread).
+ */
+static FFI_CallHistogram* ffi_call_stats_histogram_slow(FFI_CallStats* stats) {
+    FFI_CallHistogram* histogram = NULL;
+    ffi_mutex_lock(&g_ffi_instr_lock);
+    FFI_InstrThread* thread = t_ffi_instr_thread;
+    if (thread == NULL) {
+        thread = (FFI_InstrThread*)calloc(1, sizeof(FFI_InstrThread));
+        if (thread != NULL) {
+            thread->next = g_ffi_instr_threads;
+            g_ffi_instr_threads = thread;
+            t_ffi_instr_thread = thread;
+        }
+    }
+    if (thread != NULL && stats->id >= thread->capacity) {
+        uint32_t capacity = thread->capacity ? thread->capacity : 16;
+        while (capacity <= stats->id) capacity *= 2;
+        FFI_CallHistogram** grown = (FFI_CallHistogram**)realloc(thread->histograms, capacity * sizeof(*grown));
+        if (grown != NULL) {
+            memset(grown + thread->capacity, 0, (capacity - thread->capacity) * sizeof(*grown));
+            thread->histograms = grown;
+            thread->capacity = capacity;
+        }
+    }
+    if (thread != NULL && stats->id < thread->capacity) {
+        histogram = thread->histograms[stats->id];
+        if (histogram == NULL) {
+            histogram = (FFI_CallHistogram*)calloc(1, sizeof(FFI_CallHistogram));
+            if (histogram != NULL) {
+                histogram->min_ticks = INT64_MAX;
+                thread->histograms[stats->id] = histogram;
             }
         }
     }
+    ffi_mutex_unlock(&g_ffi_instr_lock);
+    return histogram;
+}
 
-    // Win64 ABI requires 32 bytes of "shadow space" (for the first 4 arguments, even if not used)
-    // plus space for any additional stack arguments.
-    // The total stack space to subtract must be 16-byte aligned.
-    size_t total_stack_alloc = 32; // Minimum 32 bytes for shadow space
-    total_stack_alloc += (size_t)num_stack_args * 8; // Add space for spilled arguments
+// Single-writer update: the owning thread is the only one storing, readers load atomically.
+#define FFI_HIST_BUMP(slot, delta) FFI_ATOMIC_STORE_I64((slot), FFI_ATOMIC_LOAD_I64(slot) + (delta))
 
-    // Ensure total_stack_alloc is 16-byte aligned.
-    // RSP is 8-byte aligned after push RBP, push R13, push R14 (24 bytes pushed).
-    // So current RSP is 8-byte aligned.
-    // We need RSP to be 16-byte aligned *before* the CALL.
-    // (24 + total_stack_alloc) % 16 == 0
-    // (8 + total_stack_alloc) % 16 == 0
-    if (((8 + total_stack_alloc) % 16) != 0) {
-        total_stack_alloc += 8; // Add 8 bytes for alignment
+/**
+ * @brief Adds one timed call to the calling thread's histogram. Called by timed trampolines.
+ */
+static void ffi_call_stats_record(FFI_CallStats* stats, uint64_t ticks) {
+    FFI_InstrThread* thread = t_ffi_instr_thread;
+    FFI_CallHistogram* histogram = (thread && stats->id < thread->capacity) ? thread->histograms[stats->id] : NULL;
+    if (histogram == NULL && (histogram = ffi_call_stats_histogram_slow(stats)) == NULL) {
+        return;
     }
+    int64_t value = ticks > (uint64_t)INT64_MAX ? INT64_MAX : (int64_t)ticks;
+    FFI_HIST_BUMP(&histogram->buckets[ffi_hist_bucket((uint64_t)value)], 1);
+    FFI_HIST_BUMP(&histogram->total_ticks, value);
+    if (value < FFI_ATOMIC_LOAD_I64(&histogram->min_ticks)) FFI_ATOMIC_STORE_I64(&histogram->min_ticks, value);
+    if (value > FFI_ATOMIC_LOAD_I64(&histogram->max_ticks)) FFI_ATOMIC_STORE_I64(&histogram->max_ticks, value);
+    FFI_HIST_BUMP(&histogram->count, 1);
+}
 
-    if (total_stack_alloc > 0) {
-        *current_code_ptr++ = REX_W_PREFIX; // REX.W prefix for 64-bit operation
-        *current_code_ptr++ = OPCODE_SUB_IMM8_RSP; // 0x83 (SUB r/m64, imm8)
-        *current_code_ptr++ = (MOD_REGISTER << 6) | (0x05 << 3) | MODRM_REG_RSP; // Mod=11, Reg=Group 5 (SUB), R/M=RSP (0x04) -> 0xEC
-        *current_code_ptr++ = (unsigned char)total_stack_alloc; // imm8
+/**
+ * @brief Adds the samples of `src` to `dst` (e.g. to combine handles or snapshots over time).
+ */
+void ffi_call_histogram_merge(FFI_CallHistogram* dst, const FFI_CallHistogram* src) {
+    for (int i = 0; i < FFI_HIST_BUCKETS; i++) {
+        dst->buckets[i] += FFI_ATOMIC_LOAD_I64(&src->buckets[i]);
     }
+    dst->count += FFI_ATOMIC_LOAD_I64(&src->count);
+    dst->total_ticks += FFI_ATOMIC_LOAD_I64(&src->total_ticks);
+    int64_t min = FFI_ATOMIC_LOAD_I64(&src->min_ticks), max = FFI_ATOMIC_LOAD_I64(&src->max_ticks);
+    if (min < dst->min_ticks) dst->min_ticks = min;
+    if (max > dst->max_ticks) dst->max_ticks = max;
+}
 
-    // --- Argument Marshalling ---
-    int gp_reg_idx = 0;
-    int xmm_reg_idx = 0;
-    int stack_arg_current_idx = 0; // 0-indexed counter for arguments going to stack
+/**
+ * @brief Returns the number of calls that went through the handle's instrumented trampoline.
+ * @return The count, or -1 if the handle was created without instrumentation.
+ */
+int64_t ffi_call_count(const FFI_FunctionSignature* sig) {
+    return sig->call_stats ? FFI_ATOMIC_LOAD_I64(&sig->call_stats->calls) : -1;
+}
 
-    // Array of GPR argument registers in order for Win64: RCX, RDX, R8, R9
-    unsigned char gp_arg_regs[] = { MODRM_REG_RCX, MODRM_REG_RDX, MODRM_REG_R8_CODE, MODRM_REG_R9_CODE };
-    bool gp_arg_regs_needs_rex_r[] = { false, false, true, true }; // R8, R9 need REX.R
+/**
+ * @brief Merges every thread's latency histogram of a timed handle into `out`.
+ * Safe while other threads keep calling it; the result is then a consistent-enough snapshot
+ * (a sample may be counted in a bucket but not yet in `count`).
+ * @return False if the handle was not created with FFI_INSTRUMENT_TIME.
+ */
+bool ffi_call_histogram_snapshot(const FFI_FunctionSignature* sig, FFI_CallHistogram* out) {
+    memset(out, 0, sizeof(*out));
+    out->min_ticks = INT64_MAX;
+    if (sig->call_stats == NULL || sig->call_stats->mode != FFI_INSTRUMENT_TIME) {
+        return false;
+    }
+    uint32_t id = sig->call_stats->id;
+    ffi_mutex_lock(&g_ffi_instr_lock);
+    for (FFI_InstrThread* thread = g_ffi_instr_threads; thread; thread = thread->next) {
+        if (id < thread->capacity && thread->histograms[id] != NULL) {
+            ffi_call_histogram_merge(out, thread->histograms[id]);
+        }
+    }
+    ffi_mutex_unlock(&g_ffi_instr_lock);
+    return true;
+}
 
-    // If returning a struct by pointer, the return buffer pointer is the first argument (RCX)
-    if (return_struct_by_pointer) {
-        // mov %r14, %rcx (Move saved return_buffer_ptr from R14 to RCX)
-        *current_code_ptr++ = REX_WB_PREFIX; // 0x49 (W=1, B=1 for R14)
-        *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64 (store r14 to rcx)
-        *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_R14_CODE << 3) | MODRM_REG_RCX; // 0xCE
-        gp_reg_idx++; // RCX is now used for the return buffer pointer
+/**
+ * @brief Returns the latency at `percentile` (0-100): the upper end of the bucket holding that
+ * rank, capped at the largest recorded value. Returns 0 for an empty histogram.
+ */
+uint64_t ffi_call_histogram_percentile(const FFI_CallHistogram* histogram, double percentile) {
+    int64_t total = 0;
+    for (int i = 0; i < FFI_HIST_BUCKETS; i++) {
+        total += histogram->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
     }
+    int64_t rank = (int64_t)(percentile / 100.0 * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    int64_t seen = 0;
+    for (int i = 0; i < FFI_HIST_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = i + 1 < FFI_HIST_BUCKETS ? ffi_hist_bucket_lower(i + 1) - 1 : UINT64_MAX;
+            return upper < (uint64_t)histogram->max_ticks ? upper : (uint64_t)histogram->max_ticks;
+        }
+    }
+    return (uint64_t)histogram->max_ticks;
+}
 
-    if (sig->num_params > 0 && sig->param_types != NULL) {
-        for (int i = 0; i < sig->num_params; ++i) {
-            FFI_Type param_type = sig->param_types[i];
+// --- Runtime Statistics ---
+// Process-wide counters for the code heap and the binding registry. Creation, reclamation and
+// library paths update them with relaxed atomic adds. ffi_runtime_stats() reads them into a
+// snapshot, and ffi_runtime_stats_json() formats the snapshot for tooling.
+// `./cross --stats-json <file>` writes one after the test run or the benchmarks, so the
+// numbers can be compared release over release.
+//
+// Every trampoline has its own page-rounded mapping (see ffi_create_executable_memory()), so
+// internal fragmentation is the unused tail of those pages: 1 - live code bytes / reserved
+// bytes. Pages quarantined for the perf map are counted separately, since they keep their
+// address range but no longer hold memory.
 
-            // Load args[i].value_ptr into R10 (temporary register for base address)
-            size_t current_arg_value_ptr_offset = (size_t)i * sizeof(FFI_Argument);
-            *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT; // 0x4D (W=1, R=1, B=1)
-            *current_code_ptr++ = OPCODE_MOV_R64_RM64; // mov r64, r/m64 (LOAD from memory)
-            *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R10_CODE << 3) | MODRM_REG_R13_CODE); // Mod=01, Reg=R10, R/M=R13_CODE
-            *current_code_ptr++ = (unsigned char)current_arg_value_ptr_offset; // disp8
+#define FFI_ABI_COUNT (FFI_ABI_WIN64 + 1)
 
-            bool is_current_param_xmm_type = (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE);
-            bool is_current_param_int128_type = (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128);
-            bool goes_to_reg = false;
-            bool to_stack = false;
+typedef struct {
+    int64_t handles_created;     // FFI_FunctionSignature objects returned to callers
+    int64_t handles_destroyed;   // Passed to destroy_ffi_function()
+    int64_t handles_freed;       // Reclaimed after their grace period
+    int64_t trampolines_live;    // Generated trampolines currently mapped
+    int64_t code_bytes_emitted;  // Machine code written over the process lifetime
+    int64_t code_bytes_live;     // Machine code in trampolines currently mapped
+    int64_t bytes_reserved;      // Executable pages currently mapped
+    int64_t bytes_quarantined;   // Pages kept PROT_NONE for the perf map
+    int64_t icache_flushes;
+    int64_t icache_bytes_flushed;
+    int64_t abi_trampolines[FFI_ABI_COUNT]; // Generated over the process lifetime, per FFI_ABI
+    int64_t abi_code_bytes[FFI_ABI_COUNT];
+    int64_t libraries_open;
+    int64_t library_bindings;    // Table entries of open libraries
+    int64_t library_resolved;    // Entries of open libraries whose resolver has run
+    int64_t origin_ns;           // First handle creation, the start of the lifetime rates
+} FFI_RuntimeCounters;
+
+static FFI_RuntimeCounters g_ffi_counters;
+
+// A point-in-time view of the counters, with derived values filled in.
+typedef struct {
+    uint64_t timestamp_ns;          // Monotonic clock at the snapshot
+    double interval_seconds;        // Window the rates are computed over
+    int64_t handles_live;           // Created and not yet freed, including those awaiting reclamation
+    int64_t handles_pending_free;   // Destroyed, waiting for their grace period
+    int64_t handles_created;
+    int64_t handles_destroyed;
+    double creations_per_second;
+    double destructions_per_second;
+    int64_t trampolines_live;
+    int64_t code_bytes_emitted;
+    int64_t code_bytes_live;
+    int64_t bytes_reserved;
+    int64_t bytes_quarantined;
+    double fragmentation;           // Share of reserved bytes not holding live code (0 when none reserved)
+    int64_t icache_flushes;
+    int64_t icache_bytes_flushed;
+    int64_t abi_trampolines[FFI_ABI_COUNT];
+    double abi_average_size[FFI_ABI_COUNT]; // Mean emitted bytes per trampoline (0 when none)
+    int64_t signatures_interned;
+    int64_t libraries_open;
+    int64_t library_bindings;
+    int64_t library_resolved;
+} FFI_RuntimeStats;
+
+static const char* const g_ffi_abi_names[FFI_ABI_COUNT] = { "default", "syscall", "sysv", "win64" };
+
+size_t ffi_signature_count(void);
 
-            if (is_current_param_xmm_type) {
-                if (xmm_reg_idx < 4) { // 4 XMM registers for Win64
-                    goes_to_reg = true;
-                    // MOVSS/MOVSD XMMn, [R10]
-                    unsigned char xmm_prefix = (param_type == FFI_TYPE_FLOAT) ? PREFIX_MOVSS : PREFIX_MOVSD;
-                    unsigned char xmm_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT; // REX.B for R10 as base
-                    if (xmm_reg_idx >= 4) xmm_rex_prefix |= REX_R_BIT; // For XMM4-XMM7, not applicable here
-                    *current_code_ptr++ = xmm_prefix;
-                    *current_code_ptr++ = xmm_rex_prefix;
-                    *current_code_ptr++ = 0x0F;
-                    *current_code_ptr++ = OPCODE_XMM_MOV_XMM_RM; // 0x10
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE + xmm_reg_idx << 3) | MODRM_REG_R10_CODE);
-                    xmm_reg_idx++;
-                } else {
-                    to_stack = true;
-                }
-            } else if (is_current_param_int128_type) {
-                // 128-bit integers are passed as two 64-bit arguments on Win64
-                if (num_gp_regs_used <= 2) { // Check if there are at least two registers remaining (R9 is gp_reg_idx 3)
-                    goes_to_reg = true;
-                    // Load lower 64 bits from [R10] into first GPR
-                    unsigned char dest_reg_low = gp_arg_regs[gp_reg_idx];
-                    bool needs_rex_r_low = gp_arg_regs_needs_rex_r[gp_reg_idx];
-                    unsigned char rex_prefix_low = REX_W_PREFIX | REX_B_BIT;
-                    if (needs_rex_r_low) rex_prefix_low |= REX_R_BIT;
-                    *current_code_ptr++ = rex_prefix_low;
-                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV reg, [mem]
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (dest_reg_low << 3) | MODRM_REG_R10_CODE);
+/**
+ * @brief Reads a monotonic clock. @return Nanoseconds from an arbitrary fixed origin.
+ */
+static uint64_t ffi_stats_now_ns(void) {
+#ifdef FFI_OS_WIN64
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
 
-                    // Load upper 64 bits from [R10 + 8] into second GPR
-                    unsigned char dest_reg_high = gp_arg_regs[gp_reg_idx + 1];
-                    bool needs_rex_r_high = gp_arg_regs_needs_rex_r[gp_reg_idx + 1];
-                    unsigned char rex_prefix_high = REX_W_PREFIX | REX_B_BIT;
-                    if (needs_rex_r_high) rex_prefix_high |= REX_R_BIT;
-                    *current_code_ptr++ = rex_prefix_high;
-                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV reg, [mem]
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (dest_reg_high << 3) | MODRM_REG_R10_CODE);
-                    *current_code_ptr++ = 0x08; // disp8 = 8 (for upper 64 bits)
+static void ffi_stats_handle_created(void) {
+    if (FFI_ATOMIC_ADD_I64(&g_ffi_counters.handles_created, 1) == 0) {
+        int64_t unset = 0;
+        FFI_ATOMIC_CAS_I64(&g_ffi_counters.origin_ns, unset, (int64_t)ffi_stats_now_ns());
+    }
+}
 
-                    gp_reg_idx += 2; // Consumes two GPRs
-                } else {
-                    to_stack = true;
-                }
-            } else { // All other types (integers, bool, char, pointer, wchar_t, size_t)
-                if (gp_reg_idx < 4) { // 4 GPRs for Win64
-                    goes_to_reg = true;
-                    unsigned char dest_reg_code = gp_arg_regs[gp_reg_idx];
-                    bool use_rex_r_for_dest_reg = gp_arg_regs_needs_rex_r[gp_reg_idx];
-                    unsigned char current_opcode;
-                    unsigned char modrm = (unsigned char)((MOD_INDIRECT << 6) | (dest_reg_code << 3) | MODRM_REG_R10_CODE);
-                    unsigned char final_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT;
-                    if (use_rex_r_for_dest_reg) final_rex_prefix |= REX_R_BIT;
+static void ffi_stats_trampoline_built(FFI_ABI abi, size_t code_size) {
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.trampolines_live, 1);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.code_bytes_emitted, (int64_t)code_size);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.code_bytes_live, (int64_t)code_size);
+    if ((int)abi >= 0 && (int)abi < FFI_ABI_COUNT) {
+        FFI_ATOMIC_ADD_I64(&g_ffi_counters.abi_trampolines[abi], 1);
+        FFI_ATOMIC_ADD_I64(&g_ffi_counters.abi_code_bytes[abi], (int64_t)code_size);
+    }
+}
 
-                    switch (param_type) {
-                        case FFI_TYPE_BOOL:
-                        case FFI_TYPE_CHAR:
-                        case FFI_TYPE_UCHAR:
-                            current_opcode = 0xB6; // MOVZX r64, r/m8
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_SCHAR:
-                            current_opcode = 0xBE; // MOVSX r64, r/m8
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_SHORT:
-                        case FFI_TYPE_SSHORT:
-                            current_opcode = 0xBF; // MOVSX r64, r/m16
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_USHORT:
-                            current_opcode = 0xB7; // MOVZX r64, r/m16
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_INT:
-                        case FFI_TYPE_SINT:
-                        case FFI_TYPE_WCHAR: // wchar_t is typically 16-bit on Win64, so it's handled as short
-                            // For Win64, wchar_t is 2 bytes. It should be zero-extended to 64-bit.
-                            current_opcode = 0xB7; // MOVZX r64, r/m16
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_UINT:
-                            current_opcode = OPCODE_MOV_R64_RM64; // MOV r32, r/m32 (zero-extends)
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_LONG: // long is 32-bit on Win64
-                        case FFI_TYPE_ULONG:
-                        case FFI_TYPE_SLONG:
-                            current_opcode = 0x63; // MOVSXD r64, r/m32 (for signed)
-                            if (param_type == FFI_TYPE_ULONG) { // For unsigned long, it's MOV r32, r/m32
-                                current_opcode = OPCODE_MOV_R64_RM64;
-                            }
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        case FFI_TYPE_LLONG:
-                        case FFI_TYPE_ULLONG:
-                        case FFI_TYPE_POINTER:
-                        case FFI_TYPE_SIZE_T: // size_t is 64-bit on Win64
-                        case FFI_TYPE_SLLONG:
-                            current_opcode = OPCODE_MOV_R64_RM64; // MOV r64, r/m64
-                            final_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
-                            break;
-                        default: return 0; // Error
-                    }
-                    gp_reg_idx++;
-                } else {
-                    to_stack = true;
-                }
-            }
-
-            if (to_stack) {
-                // Stack arguments are placed at RSP + shadow_space + (stack_arg_current_idx * 8)
-                size_t stack_offset_from_rsp_base = 32 + (size_t)stack_arg_current_idx * 8; // 32 for shadow space
-
-                if (is_current_param_int128_type) {
-                    // Load lower 64 bits into R11
-                    *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT; // REX.W for 64-bit, REX.R for R11, REX.B for R10
-                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV R11, [R10]
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
-
-                    // Load upper 64 bits into R12 (using R12 as scratch temporarily)
-                    *current_code_ptr++ = REX_PUSH_POP_R12_PREFIX | REX_W_PREFIX | REX_R_BIT; // REX.B for R10, REX.R for R12
-                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV R12, [R10 + 8]
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R12_CODE << 3) | MODRM_REG_R10_CODE);
-                    *current_code_ptr++ = 0x08; // disp8 = 8
-
-                    // Store R11 to [RSP + offset_low]
-                    size_t stack_offset_low = stack_offset_from_rsp_base;
-                    *current_code_ptr++ = REX_W_PREFIX | REX_R_BIT; // REX.W for 64-bit, REX.R for R11
-                    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // MOV [RSP + offset_low], R11
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R11_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_RSP;
-                    *current_code_ptr++ = (unsigned char)stack_offset_low;
-
-                    // Store R12 to [RSP + offset_high]
-                    size_t stack_offset_high = stack_offset_from_rsp_base + 8;
-                    *current_code_ptr++ = REX_W_PREFIX | REX_R_BIT; // REX.W for 64-bit, REX.R for R12
-                    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // MOV [RSP + offset_high], R12
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R12_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_RSP;
-                    *current_code_ptr++ = (unsigned char)stack_offset_high;
-
-                    stack_arg_current_idx += 2; // Consumes two stack slots
-                } else if (is_current_param_xmm_type) {
-                    // Load float/double from (R10) into XMM7 (scratch register)
-                    unsigned char xmm_prefix = (param_type == FFI_TYPE_FLOAT) ? PREFIX_MOVSS : PREFIX_MOVSD;
-                    *current_code_ptr++ = xmm_prefix;
-                    *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_R_BIT | REX_B_BIT); // REX.R for XMM7
-                    *current_code_ptr++ = 0x0F;
-                    *current_code_ptr++ = OPCODE_XMM_MOV_XMM_RM; // 0x10
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM7_CODE << 3) | MODRM_REG_R10_CODE);
+static void ffi_stats_trampoline_freed(size_t code_size) {
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.trampolines_live, -1);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.code_bytes_live, -(int64_t)code_size);
+}
 
-                    // Store float/double from XMM7 to (RSP + stack_offset_from_rsp_base)
-                    *current_code_ptr++ = xmm_prefix;
-                    *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_R_BIT); // REX.R for XMM7
-                    *current_code_ptr++ = 0x0F;
-                    *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM; // 0x11
-                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_XMM7_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_RSP;
-                    *current_code_ptr++ = (unsigned char)stack_offset_from_rsp_base;
-                    stack_arg_current_idx++;
-                } else { // GPR types to stack
-                    // Load the value from (R10) into R11 (temporary register)
-                    unsigned char load_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT | REX_R_BIT; // R10 is base, R11 is dest (R11's code is 0x03, needs REX.R)
-                    unsigned char load_opcode;
-                    unsigned char load_modrm = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+/**
+ * @brief Takes a snapshot of the runtime counters.
+ * @param out Receives the snapshot.
+ * @param since An earlier snapshot to compute creation/destruction rates against, or NULL to
+ * average them over the time since the first handle was created.
+ */
+void ffi_runtime_stats(FFI_RuntimeStats* out, const FFI_RuntimeStats* since) {
+    memset(out, 0, sizeof(*out));
+    out->timestamp_ns = ffi_stats_now_ns();
+    int64_t freed = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.handles_freed);
+    out->handles_destroyed = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.handles_destroyed);
+    out->handles_created = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.handles_created);
+    out->handles_live = out->handles_created - freed;
+    out->handles_pending_free = out->handles_destroyed - freed;
+    out->trampolines_live = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.trampolines_live);
+    out->code_bytes_emitted = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.code_bytes_emitted);
+    out->code_bytes_live = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.code_bytes_live);
+    out->bytes_reserved = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.bytes_reserved);
+    out->bytes_quarantined = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.bytes_quarantined);
+    if (out->bytes_reserved > 0) {
+        out->fragmentation = 1.0 - (double)out->code_bytes_live / (double)out->bytes_reserved;
+    }
+    out->icache_flushes = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.icache_flushes);
+    out->icache_bytes_flushed = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.icache_bytes_flushed);
+    for (int abi = 0; abi < FFI_ABI_COUNT; abi++) {
+        out->abi_trampolines[abi] = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.abi_trampolines[abi]);
+        if (out->abi_trampolines[abi] > 0) {
+            out->abi_average_size[abi] = (double)FFI_ATOMIC_LOAD_I64(&g_ffi_counters.abi_code_bytes[abi]) /
+                                         (double)out->abi_trampolines[abi];
+        }
+    }
+    out->signatures_interned = (int64_t)ffi_signature_count();
+    out->libraries_open = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.libraries_open);
+    out->library_bindings = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.library_bindings);
+    out->library_resolved = FFI_ATOMIC_LOAD_I64(&g_ffi_counters.library_resolved);
+
+    uint64_t start_ns = since ? since->timestamp_ns : (uint64_t)FFI_ATOMIC_LOAD_I64(&g_ffi_counters.origin_ns);
+    if (start_ns != 0 && out->timestamp_ns > start_ns) {
+        out->interval_seconds = (double)(out->timestamp_ns - start_ns) / 1e9;
+        out->creations_per_second = (double)(out->handles_created - (since ? since->handles_created : 0)) / out->interval_seconds;
+        out->destructions_per_second = (double)(out->handles_destroyed - (since ? since->handles_destroyed : 0)) / out->interval_seconds;
+    }
+}
 
-                    switch (param_type) {
-                        case FFI_TYPE_BOOL: case FFI_TYPE_CHAR: case FFI_TYPE_UCHAR:
-                            load_opcode = 0xB6; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_SCHAR:
-                            load_opcode = 0xBE; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_SHORT: case FFI_TYPE_SSHORT:
-                            load_opcode = 0xBF; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_USHORT:
-                            load_opcode = 0xB7; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_INT: case FFI_TYPE_SINT:
-                        case FFI_TYPE_LONG: case FFI_TYPE_ULONG: case FFI_TYPE_SLONG: // 32-bit on Win64
-                            load_opcode = 0x63; load_rex_prefix |= REX_W_PREFIX;
-                            if (param_type == FFI_TYPE_ULONG) { // For unsigned long, it's MOV r32, r/m32
-                                load_opcode = OPCODE_MOV_R64_RM64;
-                                load_rex_prefix &= ~REX_W_PREFIX; // Clear W bit for 32-bit move
-                            }
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_WCHAR: // wchar_t is 16-bit on Win64
-                            load_opcode = 0xB7; load_rex_prefix |= REX_W_PREFIX; // MOVZX r64, r/m16
-                            *current_code_ptr++ = 0x66; *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        case FFI_TYPE_LLONG: case FFI_TYPE_ULLONG:
-                        case FFI_TYPE_POINTER: case FFI_TYPE_SIZE_T: case FFI_TYPE_SLLONG:
-                            load_opcode = OPCODE_MOV_R64_RM64; load_rex_prefix |= REX_W_PREFIX;
-                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
-                            break;
-                        default: return 0; // Error
-                    }
+/**
+ * @brief Formats a snapshot as a JSON object.
+ * @return The length of the full document, as snprintf() does; it was truncated if that is
+ * not less than `size`.
+ */
+int ffi_runtime_stats_json(const FFI_RuntimeStats* stats, char* buf, size_t size) {
+    size_t len = 0;
+#define FFI_JSON_APPEND(...)                                                                 \
+    do {                                                                                     \
+        int n = snprintf(buf + (len < size ? len : size), len < size ? size - len : 0, __VA_ARGS__); \
+        if (n > 0) len += (size_t)n;                                                         \
+    } while (0)
+    FFI_JSON_APPEND("{\n  \"handles\": {\"live\": %lld, \"pending_free\": %lld, \"created\": %lld, \"destroyed\": %lld, "
+                    "\"creations_per_second\": %.3f, \"destructions_per_second\": %.3f, \"interval_seconds\": %.6f},\n",
+                    (long long)stats->handles_live, (long long)stats->handles_pending_free, (long long)stats->handles_created,
+                    (long long)stats->handles_destroyed, stats->creations_per_second, stats->destructions_per_second,
+                    stats->interval_seconds);
+    FFI_JSON_APPEND("  \"code_heap\": {\"trampolines_live\": %lld, \"code_bytes_emitted\": %lld, \"code_bytes_live\": %lld, "
+                    "\"bytes_reserved\": %lld, \"bytes_quarantined\": %lld, \"fragmentation\": %.4f, "
+                    "\"icache_flushes\": %lld, \"icache_bytes_flushed\": %lld},\n",
+                    (long long)stats->trampolines_live, (long long)stats->code_bytes_emitted, (long long)stats->code_bytes_live,
+                    (long long)stats->bytes_reserved, (long long)stats->bytes_quarantined, stats->fragmentation,
+                    (long long)stats->icache_flushes, (long long)stats->icache_bytes_flushed);
+    FFI_JSON_APPEND("  \"trampolines_by_abi\": {");
+    for (int abi = 0; abi < FFI_ABI_COUNT; abi++) {
+        FFI_JSON_APPEND("%s\"%s\": {\"count\": %lld, \"average_size\": %.1f}", abi ? ", " : "", g_ffi_abi_names[abi],
+                        (long long)stats->abi_trampolines[abi], stats->abi_average_size[abi]);
+    }
+    FFI_JSON_APPEND("},\n  \"registry\": {\"signatures_interned\": %lld, \"libraries_open\": %lld, "
+                    "\"library_bindings\": %lld, \"library_bindings_resolved\": %lld}\n}\n",
+                    (long long)stats->signatures_interned, (long long)stats->libraries_open,
+                    (long long)stats->library_bindings, (long long)stats->library_resolved);
+#undef FFI_JSON_APPEND
+    return (int)len;
+}
 
-                    // Step 2: Store the value from R11 to (RSP + stack_offset_from_rsp_base)
-                    unsigned char store_rex_prefix = REX_W_PREFIX | REX_R_BIT;
-                    *current_code_ptr++ = store_rex_prefix;
-                    *current_code_ptr++ = OPCODE_MOV_RM64_R64;
-                    unsigned char store_modrm_mod = (stack_offset_from_rsp_base == 0) ? MOD_INDIRECT : MOD_DISP8;
-                    *current_code_ptr++ = (unsigned char)((store_modrm_mod << 6) | (MODRM_REG_R11_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_RSP;
-                    if (stack_offset_from_rsp_base != 0) {
-                        *current_code_ptr++ = (unsigned char)stack_offset_from_rsp_base;
-                    }
-                    stack_arg_current_idx++;
-                }
-            }
-        }
+/**
+ * @brief Writes a snapshot of the runtime counters to `path` as JSON.
+ * @return True on success.
+ */
+bool ffi_runtime_stats_write_json(const char* path) {
+    FFI_RuntimeStats stats;
+    ffi_runtime_stats(&stats, NULL);
+    int len = ffi_runtime_stats_json(&stats, NULL, 0);
+    char* json = (char*)malloc((size_t)len + 1);
+    FILE* file = json ? fopen(path, "w") : NULL;
+    if (file == NULL) {
+        ffi_log_error("ERROR: Cannot write runtime statistics to '%s'.", path);
+        free(json);
+        return false;
     }
+    ffi_runtime_stats_json(&stats, json, (size_t)len + 1);
+    bool written = fputs(json, file) >= 0;
+    written = (fclose(file) == 0) && written;
+    free(json);
+    return written;
+}
 
-    // --- Call Target Function ---
-    // movabs RAX, <target_func_address>
-    *current_code_ptr++ = REX_W_PREFIX; // REX.W prefix for 64-bit operation
-    *current_code_ptr++ = OPCODE_MOV_IMM64_RAX;
+// --- Trampoline Disassembler ---
+// A small decoder for the instructions the generators emit, so trampoline dumps read as
+// assembly without piping bytes through objdump. It covers the forms the x86-64 generators
+// produce: moves including movsx/movzx/movsxd, movss/movsd/movd/movq, push/pop, lea, the ALU
+// and shift groups, call/jmp/jcc, ret, syscall, endbr64, rdtsc/rdtscp/lfence, fld/fstp m80. On
+// AArch64 it covers ldr/str in all index modes, stp/ldp, movz/movn/movk, add/sub immediate,
+// register mov, blr/br/ret and svc. The output is Intel syntax on x86-64 and always names the
+// memory operand size, e.g. `mov qword [r12], rax`.
+//
+// Anything else decodes as `(bad)` on x86-64 (one byte) or `.inst 0x...` on AArch64, and
+// is counted as unknown. Relative branch targets print as `.+N`, an offset from the start of the
+// branch. The test suite checks that generated trampolines decode without unknowns.
 
-    target_addr_val = (long)(uintptr_t)sig->func_ptr; // Get the 64-bit address as a long
-    memcpy(current_code_ptr, &target_addr_val, 8);
-    current_code_ptr += 8;
+typedef struct {
+    int instructions;   // Decoded instructions, unknown ones included
+    size_t bytes;       // Bytes covered
+    int unknown;        // Bytes (x86-64) or words (AArch64) that did not decode
+} FFI_DisasmSummary;
+
+static const char* const g_ffi_x86_gpr64[16] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                                 "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+static const char* const g_ffi_x86_gpr32[16] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                                 "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+static const char* const g_ffi_x86_gpr16[16] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+                                                 "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
+static const char* const g_ffi_x86_gpr8[16] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                                "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+static const char* const g_ffi_x86_gpr8_legacy[8] = { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" };
+static const char* const g_ffi_x86_xmm[16] = { "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+                                               "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15" };
+static const char* const g_ffi_x86_alu[8] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+static const char* const g_ffi_x86_shift[8] = { "rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar" };
+static const char* const g_ffi_x86_cc[16] = { "o", "no", "b", "ae", "e", "ne", "be", "a",
+                                              "s", "ns", "p", "np", "l", "ge", "le", "g" };
+
+// Operand kinds for ffi_disasm_x86_modrm(): a GPR of a byte width, or an XMM register.
+#define FFI_DISASM_XMM 16
+
+static const char* ffi_disasm_x86_reg(int reg, int kind, unsigned rex) {
+    switch (kind) {
+        case 1: return rex ? g_ffi_x86_gpr8[reg] : (reg < 8 ? g_ffi_x86_gpr8_legacy[reg] : g_ffi_x86_gpr8[reg]);
+        case 2: return g_ffi_x86_gpr16[reg];
+        case 4: return g_ffi_x86_gpr32[reg];
+        case FFI_DISASM_XMM: return g_ffi_x86_xmm[reg];
+        default: return g_ffi_x86_gpr64[reg];
+    }
+}
 
-    // call RAX
-    *current_code_ptr++ = OPCODE_CALL_RM64; // CALL r/m64
-    *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (0x02 << 3) | MODRM_REG_RAX);
+static const char* ffi_disasm_x86_size(int bytes) {
+    switch (bytes) {
+        case 1: return "byte";
+        case 2: return "word";
+        case 4: return "dword";
+        case 10: return "tword";
+        case 16: return "oword";
+        default: return "qword";
+    }
+}
 
-    // --- Return Value Handling ---
-    // Store return value (from EAX/RAX or XMM0) into (R14)
-    if (sig->return_type != FFI_TYPE_VOID) {
-        if (return_struct_by_pointer) {
-            // If returning by pointer, the target function returns the pointer in RAX.
-            // We don't need to do anything here as the target function already wrote to [R14].
-            // We just need to ensure the original return_buffer_ptr is in R14.
-            // (The target function wrote to RCX, which was our R14).
-            // So, no explicit mov here.
+/**
+ * @brief Decodes a ModR/M operand (with SIB and displacement) starting at code[*pos].
+ * @param rm_kind Register kind of the r/m operand when it is a register (1/2/4/8 or FFI_DISASM_XMM).
+ * @param mem_bytes Size named for a memory operand.
+ * @param rm_text Receives the r/m operand.
+ * @return The ModR/M.reg field extended by REX.R, or -1 if the bytes run out.
+ */
+static int ffi_disasm_x86_modrm(const unsigned char* code, size_t avail, size_t* pos, unsigned rex, int rm_kind,
+                                int mem_bytes, char* rm_text, size_t rm_text_size) {
+    if (*pos >= avail) return -1;
+    unsigned modrm = code[(*pos)++];
+    int mod = (int)(modrm >> 6), reg = (int)((modrm >> 3) & 7) | ((rex & 4) ? 8 : 0), rm = (int)(modrm & 7);
+    if (mod == 3) {
+        snprintf(rm_text, rm_text_size, "%s", ffi_disasm_x86_reg(rm | ((rex & 1) ? 8 : 0), rm_kind, rex));
+        return reg;
+    }
+    char base[24] = "", index[32] = "";
+    bool rip = false, no_base = false;
+    if (rm == 4) {
+        if (*pos >= avail) return -1;
+        unsigned sib = code[(*pos)++];
+        int scale = 1 << (sib >> 6), idx = (int)((sib >> 3) & 7) | ((rex & 2) ? 8 : 0), b = (int)(sib & 7);
+        if (idx != 4) {
+            snprintf(index, sizeof(index), scale > 1 ? "%s*%d" : "%s", g_ffi_x86_gpr64[idx], scale);
+        } else if ((sib & 7) != 4) {
+            snprintf(index, sizeof(index), "riz*%d", scale); // A SIB byte the base did not need
+        }
+        if (b == 5 && mod == 0) {
+            no_base = true;
         } else {
-            switch (sig->return_type) {
-                case FFI_TYPE_BOOL:
-                case FFI_TYPE_CHAR:
-                case FFI_TYPE_UCHAR:
-                case FFI_TYPE_SCHAR:
-                    // movb [R14], AL
-                    *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41 (for R14 as base)
-                    *current_code_ptr++ = 0x88; // MOV r/m8, r8 (AL is 8-bit part of RAX)
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_R14_BASE;
-                    break;
-                case FFI_TYPE_SHORT:
-                case FFI_TYPE_USHORT:
-                case FFI_TYPE_SSHORT:
-                case FFI_TYPE_WCHAR: // wchar_t is 16-bit on Win64
-                    // movw [R14], AX
-                    *current_code_ptr++ = 0x66; // Operand-size override prefix for 16-bit
-                    *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41 (for R14 as base)
-                    *current_code_ptr++ = 0x89; // MOV r/m16, r16 (AX is 16-bit part of RAX)
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_R14_BASE;
-                    break;
-                case FFI_TYPE_INT:
-                case FFI_TYPE_UINT:
-                case FFI_TYPE_SINT:
-                case FFI_TYPE_LONG: // 32-bit on Win64
-                case FFI_TYPE_ULONG:
-                case FFI_TYPE_SLONG:
-                    // movl [R14], EAX
-                    *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41
-                    *current_code_ptr++ = OPCODE_MOV_RM64_R64;   // 0x89
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_R14_BASE;
-                    break;
-                case FFI_TYPE_LLONG:
-                case FFI_TYPE_ULLONG:
-                case FFI_TYPE_POINTER:
-                case FFI_TYPE_SIZE_T:
-                case FFI_TYPE_SLLONG:
-                    // movq [R14], RAX
-                    *current_code_ptr++ = REX_WB_PREFIX;         // 0x49
-                    *current_code_ptr++ = OPCODE_MOV_RM64_R64;   // 0x89
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_R14_BASE;
-                    break;
-                case FFI_TYPE_FLOAT:
-                    // movss [R14], XMM0
-                    *current_code_ptr++ = PREFIX_MOVSS;          // 0xF3
-                    *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_B_BIT); // 0x41
-                    *current_code_ptr++ = 0x0F;
-                    *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM; // 0x11
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_R14_BASE;
-                    break;
-                case FFI_TYPE_DOUBLE:
-                    // movsd [R14], XMM0
-                    *current_code_ptr++ = PREFIX_MOVSD;          // 0xF2
-                    *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_B_BIT); // 0x41
-                    *current_code_ptr++ = 0x0F;
-                    *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM; // 0x11
-                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
-                    *current_code_ptr++ = SIB_BYTE_R14_BASE;
-                    break;
-                default: // This default case catches FFI_TYPE_UNKNOWN or any other unsupported type for return
-                    return 0; // Indicate error
-            }
+            snprintf(base, sizeof(base), "%s", g_ffi_x86_gpr64[b | ((rex & 1) ? 8 : 0)]);
         }
+    } else if (rm == 5 && mod == 0) {
+        rip = true;
+    } else {
+        snprintf(base, sizeof(base), "%s", g_ffi_x86_gpr64[rm | ((rex & 1) ? 8 : 0)]);
     }
-
-    // --- Epilogue ---
-    // Reverse stack alignment
-    if (total_stack_alloc > 0) {
-        *current_code_ptr++ = REX_W_PREFIX; // REX.W prefix for 64-bit operation
-        *current_code_ptr++ = OPCODE_ADD_IMM8_RSP; // 0x83 (ADD r/m64, imm8)
-        *current_code_ptr++ = (MOD_REGISTER << 6) | (0x00 << 3) | MODRM_REG_RSP; // Mod=11, Reg=Group 0 (ADD), R/M=RSP (0x04) -> 0xC4
-        *current_code_ptr++ = (unsigned char)total_stack_alloc; // imm8
+    int64_t disp = 0;
+    size_t disp_bytes = (mod == 1) ? 1 : (mod == 2 || rip || no_base) ? 4 : 0;
+    if (*pos + disp_bytes > avail) return -1;
+    if (disp_bytes == 1) {
+        disp = (int8_t)code[*pos];
+    } else if (disp_bytes == 4) {
+        int32_t d32;
+        memcpy(&d32, code + *pos, 4);
+        disp = d32;
+    }
+    *pos += disp_bytes;
+    char disp_text[24] = "";
+    if (disp != 0 || (!base[0] && !index[0] && !rip)) {
+        snprintf(disp_text, sizeof(disp_text), "%s0x%llx", disp < 0 ? "-" : ((base[0] || index[0] || rip) ? "+" : ""),
+                 (unsigned long long)(disp < 0 ? -(uint64_t)disp : (uint64_t)disp));
     }
+    snprintf(rm_text, rm_text_size, "%s [%s%s%s%s]", ffi_disasm_x86_size(mem_bytes), rip ? "rip" : base,
+             (base[0] && index[0]) ? "+" : "", index, disp_text);
+    return reg;
+}
 
-    // Pop R14 to restore its original value
-    *current_code_ptr++ = REX_PUSH_POP_R14_PREFIX; // 0x41
-    *current_code_ptr++ = OPCODE_POP_R14_BYTE;     // 0x5E
+/**
+ * @brief Decodes one x86-64 instruction (see ffi_disasm_x86_64()).
+ * @param sse_66 Set when a 0x66 prefix was consumed as an SSE mandatory prefix.
+ */
+static size_t ffi_disasm_x86_64_insn(const unsigned char* code, size_t avail, char* text, size_t text_size, bool* sse_66) {
+    size_t pos = 0;
+    bool p66 = false, pf2 = false, pf3 = false, lock = false;
+    for (; pos < avail && pos < 4; ++pos) {
+        unsigned char b = code[pos];
+        if (b == 0x66) p66 = true;
+        else if (b == 0xF2) pf2 = true;
+        else if (b == 0xF3) pf3 = true;
+        else if (b == 0xF0) lock = true;
+        else break;
+    }
+    unsigned rex = 0;
+    if (pos < avail && (code[pos] & 0xF0) == 0x40) {
+        rex = code[pos++];
+    }
+    if (pos >= avail) return 0;
+    const unsigned op = code[pos++];
+    const int osz = (rex & 8) ? 8 : p66 ? 2 : 4;
+    const char* lock_text = lock ? "lock " : "";
+    char rm[64];
+    int reg;
+
+    if (op >= 0x50 && op <= 0x5F) { // push/pop r64
+        snprintf(text, text_size, "%s %s", op < 0x58 ? "push" : "pop", g_ffi_x86_gpr64[(op & 7) | ((rex & 1) ? 8 : 0)]);
+        return pos;
+    }
+    if (op < 0x40 && (op & 7) < 4) { // ALU r/m, reg and reg, r/m
+        int size = (op & 1) ? osz : 1;
+        if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, size, size, rm, sizeof(rm))) < 0) return 0;
+        const char* r = ffi_disasm_x86_reg(reg, size, rex);
+        if (op & 2) snprintf(text, text_size, "%s %s, %s", g_ffi_x86_alu[op >> 3], r, rm);
+        else snprintf(text, text_size, "%s%s %s, %s", lock_text, g_ffi_x86_alu[op >> 3], rm, r);
+        return pos;
+    }
+    if (op < 0x40 && (op & 7) == 5) { // ALU rax, imm32
+        if (pos + 4 > avail) return 0;
+        int32_t imm;
+        memcpy(&imm, code + pos, 4);
+        snprintf(text, text_size, "%s %s, 0x%llx", g_ffi_x86_alu[op >> 3], ffi_disasm_x86_reg(0, osz, rex),
+                 osz == 8 ? (unsigned long long)(int64_t)imm : (unsigned long long)(uint32_t)imm);
+        return pos + 4;
+    }
+    if (op >= 0xB0 && op <= 0xBF) { // mov reg, imm (movabs with REX.W)
+        int r = (op & 7) | ((rex & 1) ? 8 : 0), size = op < 0xB8 ? 1 : osz;
+        size_t imm_bytes = (size == 8) ? 8 : (size_t)size;
+        if (pos + imm_bytes > avail) return 0;
+        uint64_t imm = 0;
+        memcpy(&imm, code + pos, imm_bytes);
+        snprintf(text, text_size, "%s %s, 0x%llx", size == 8 ? "movabs" : "mov", ffi_disasm_x86_reg(r, size, rex),
+                 (unsigned long long)imm);
+        return pos + imm_bytes;
+    }
+    if (op >= 0x70 && op <= 0x7F) { // jcc rel8
+        if (pos + 1 > avail) return 0;
+        snprintf(text, text_size, "j%s .%+d", g_ffi_x86_cc[op & 15], (int)(int8_t)code[pos] + (int)pos + 1);
+        return pos + 1;
+    }
+    switch (op) {
+        case 0x88: case 0x89: case 0x8A: case 0x8B: case 0x8D: case 0x63: case 0x84: case 0x85: {
+            int size = (op == 0x88 || op == 0x8A || op == 0x84) ? 1 : osz;
+            if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, op == 0x63 ? 4 : size, op == 0x63 ? 4 : size, rm, sizeof(rm))) < 0) return 0;
+            const char* r = ffi_disasm_x86_reg(reg, size, rex);
+            if (op == 0x8D) snprintf(text, text_size, "lea %s, %s", r, strchr(rm, '[') ? strchr(rm, '[') : rm);
+            else if (op == 0x63) snprintf(text, text_size, "movsxd %s, %s", r, rm);
+            else if (op == 0x84 || op == 0x85) snprintf(text, text_size, "test %s, %s", rm, r);
+            else if (op & 2) snprintf(text, text_size, "mov %s, %s", r, rm);
+            else snprintf(text, text_size, "mov %s, %s", rm, r);
+            return pos;
+        }
+        case 0xC6: case 0xC7: case 0x80: case 0x81: case 0x83: case 0xC1: case 0xD1: case 0xD3: {
+            int size = (op == 0xC6 || op == 0x80) ? 1 : osz;
+            if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, size, size, rm, sizeof(rm))) < 0) return 0;
+            size_t imm_bytes = (op == 0x83 || op == 0xC1 || op == 0x80 || op == 0xC6) ? 1 : (op == 0xD1 || op == 0xD3) ? 0 : (size == 2 ? 2 : 4);
+            if (pos + imm_bytes > avail) return 0;
+            int64_t imm = 0;
+            if (imm_bytes == 1) imm = (op == 0xC1) ? code[pos] : (int8_t)code[pos];
+            else if (imm_bytes == 2) { int16_t v; memcpy(&v, code + pos, 2); imm = v; }
+            else if (imm_bytes == 4) { int32_t v; memcpy(&v, code + pos, 4); imm = v; }
+            pos += imm_bytes;
+            const char* mnemonic = (op == 0xC6 || op == 0xC7) ? "mov" : (op >= 0xC1) ? g_ffi_x86_shift[reg & 7] : g_ffi_x86_alu[reg & 7];
+            if ((op == 0xC6 || op == 0xC7) && (reg & 7) != 0) return 0;
+            if (op == 0xD1) snprintf(text, text_size, "%s %s, 1", mnemonic, rm);
+            else if (op == 0xD3) snprintf(text, text_size, "%s %s, cl", mnemonic, rm);
+            else snprintf(text, text_size, "%s%s %s, %s0x%llx", (op == 0xC6 || op == 0xC7) ? "" : lock_text, mnemonic, rm,
+                          imm < 0 ? "-" : "", (unsigned long long)(imm < 0 ? -(uint64_t)imm : (uint64_t)imm));
+            return pos;
+        }
+        case 0xFE: case 0xFF: {
+            int size = op == 0xFE ? 1 : osz;
+            size_t modrm_at = pos;
+            if (modrm_at >= avail) return 0;
+            int group = (code[modrm_at] >> 3) & 7;
+            bool branch = op == 0xFF && (group == 2 || group == 4 || group == 6);
+            if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, branch ? 8 : size, branch ? 8 : size, rm, sizeof(rm))) < 0) return 0;
+            static const char* const ff_group[8] = { "inc", "dec", "call", NULL, "jmp", NULL, "push", NULL };
+            if (ff_group[group] == NULL || (op == 0xFE && group > 1)) return 0;
+            snprintf(text, text_size, "%s%s %s", group <= 1 ? lock_text : "", ff_group[group], rm);
+            return pos;
+        }
+        case 0xE8: case 0xE9: {
+            if (pos + 4 > avail) return 0;
+            int32_t rel;
+            memcpy(&rel, code + pos, 4);
+            snprintf(text, text_size, "%s .%+lld", op == 0xE8 ? "call" : "jmp", (long long)rel + (long long)pos + 4);
+            return pos + 4;
+        }
+        case 0xEB:
+            if (pos + 1 > avail) return 0;
+            snprintf(text, text_size, "jmp .%+d", (int)(int8_t)code[pos] + (int)pos + 1);
+            return pos + 1;
+        case 0xC3: snprintf(text, text_size, "ret"); return pos;
+        case 0x90: snprintf(text, text_size, pf3 ? "pause" : "nop"); return pos;
+        case 0xCC: snprintf(text, text_size, "int3"); return pos;
+        case 0x98: snprintf(text, text_size, (rex & 8) ? "cdqe" : "cwde"); return pos;
+        case 0x99: snprintf(text, text_size, (rex & 8) ? "cqo" : "cdq"); return pos;
+        case 0xDB: {
+            if (pos >= avail) return 0;
+            int group = (code[pos] >> 3) & 7;
+            if ((code[pos] >> 6) == 3 || (group != 5 && group != 7)) return 0;
+            if (ffi_disasm_x86_modrm(code, avail, &pos, rex, 8, 10, rm, sizeof(rm)) < 0) return 0;
+            snprintf(text, text_size, "%s %s", group == 5 ? "fld" : "fstp", rm);
+            return pos;
+        }
+        case 0x0F:
+            break;
+        default:
+            return 0;
+    }
 
-    // Pop R13 to restore its original value
-    *current_code_ptr++ = REX_PUSH_POP_R13_PREFIX; // 0x41
-    *current_code_ptr++ = OPCODE_POP_R13_BYTE;     // 0x5D
+    // Two-byte opcodes
+    if (pos >= avail) return 0;
+    const unsigned op2 = code[pos++];
+    if (op2 == 0x05) { snprintf(text, text_size, "syscall"); return pos; }
+    if (op2 == 0x0B) { snprintf(text, text_size, "ud2"); return pos; }
+    if (op2 == 0x31) { snprintf(text, text_size, "rdtsc"); return pos; }
+    if (op2 == 0x01 && pos < avail && code[pos] == 0xF9) { snprintf(text, text_size, "rdtscp"); return pos + 1; }
+    if (op2 == 0xAE && pos < avail && code[pos] == 0xE8) { snprintf(text, text_size, "lfence"); return pos + 1; }
+    if (op2 == 0x1E && pf3 && pos < avail && (code[pos] == 0xFA || code[pos] == 0xFB)) {
+        snprintf(text, text_size, code[pos] == 0xFA ? "endbr64" : "endbr32");
+        return pos + 1;
+    }
+    if (op2 >= 0x80 && op2 <= 0x8F) { // jcc rel32
+        if (pos + 4 > avail) return 0;
+        int32_t rel;
+        memcpy(&rel, code + pos, 4);
+        snprintf(text, text_size, "j%s .%+lld", g_ffi_x86_cc[op2 & 15], (long long)rel + (long long)pos + 4);
+        return pos + 4;
+    }
+    if (op2 == 0xB6 || op2 == 0xB7 || op2 == 0xBE || op2 == 0xBF) {
+        int src = (op2 & 1) ? 2 : 1;
+        if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, src, src, rm, sizeof(rm))) < 0) return 0;
+        snprintf(text, text_size, "%s %s, %s", op2 < 0xBE ? "movzx" : "movsx", ffi_disasm_x86_reg(reg, osz, rex), rm);
+        return pos;
+    }
+    if (op2 == 0x1F) {
+        if (ffi_disasm_x86_modrm(code, avail, &pos, rex, osz, osz, rm, sizeof(rm)) < 0) return 0;
+        snprintf(text, text_size, "nop %s", rm);
+        return pos;
+    }
+    if ((op2 == 0x10 || op2 == 0x11) && (pf3 || pf2)) { // movss/movsd
+        int size = pf3 ? 4 : 8;
+        if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, FFI_DISASM_XMM, size, rm, sizeof(rm))) < 0) return 0;
+        const char* mnemonic = pf3 ? "movss" : "movsd";
+        if (op2 == 0x10) snprintf(text, text_size, "%s %s, %s", mnemonic, g_ffi_x86_xmm[reg], rm);
+        else snprintf(text, text_size, "%s %s, %s", mnemonic, rm, g_ffi_x86_xmm[reg]);
+        return pos;
+    }
+    if ((op2 == 0x10 || op2 == 0x11 || op2 == 0x57) && !pf2 && !pf3) { // movups/movupd, xorps/xorpd
+        if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, FFI_DISASM_XMM, 16, rm, sizeof(rm))) < 0) return 0;
+        *sse_66 = p66;
+        const char* mnemonic = op2 == 0x57 ? (p66 ? "xorpd" : "xorps") : (p66 ? "movupd" : "movups");
+        if (op2 == 0x11) snprintf(text, text_size, "%s %s, %s", mnemonic, rm, g_ffi_x86_xmm[reg]);
+        else snprintf(text, text_size, "%s %s, %s", mnemonic, g_ffi_x86_xmm[reg], rm);
+        return pos;
+    }
+    if ((op2 == 0x6E || op2 == 0x7E) && p66) { // movd/movq between XMM and GPR or memory
+        int size = (rex & 8) ? 8 : 4;
+        *sse_66 = p66;
+        if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, size, size, rm, sizeof(rm))) < 0) return 0;
+        const char* mnemonic = size == 8 ? "movq" : "movd";
+        if (op2 == 0x6E) snprintf(text, text_size, "%s %s, %s", mnemonic, g_ffi_x86_xmm[reg], rm);
+        else snprintf(text, text_size, "%s %s, %s", mnemonic, rm, g_ffi_x86_xmm[reg]);
+        return pos;
+    }
+    if ((op2 == 0x7E && pf3) || (op2 == 0xD6 && p66)) { // movq xmm, xmm/m64 and movq m64, xmm
+        if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, FFI_DISASM_XMM, 8, rm, sizeof(rm))) < 0) return 0;
+        *sse_66 = p66;
+        if (op2 == 0x7E) snprintf(text, text_size, "movq %s, %s", g_ffi_x86_xmm[reg], rm);
+        else snprintf(text, text_size, "movq %s, %s", rm, g_ffi_x86_xmm[reg]);
+        return pos;
+    }
+    if ((op2 == 0x6F || op2 == 0x7F) && (pf3 || p66)) { // movdqu/movdqa
+        if ((reg = ffi_disasm_x86_modrm(code, avail, &pos, rex, FFI_DISASM_XMM, 16, rm, sizeof(rm))) < 0) return 0;
+        *sse_66 = p66;
+        const char* mnemonic = pf3 ? "movdqu" : "movdqa";
+        if (op2 == 0x6F) snprintf(text, text_size, "%s %s, %s", mnemonic, g_ffi_x86_xmm[reg], rm);
+        else snprintf(text, text_size, "%s %s, %s", mnemonic, rm, g_ffi_x86_xmm[reg]);
+        return pos;
+    }
+    return 0;
+}
 
-    // pop RBP
-    *current_code_ptr++ = OPCODE_POP_RBP;
+/**
+ * @brief Decodes one x86-64 instruction.
+ * A 0x66 prefix that REX.W overrides is shown as `data16`, as objdump does, since it is a
+ * wasted byte in generated code.
+ * @param text Receives the instruction in Intel syntax.
+ * @return Its length in bytes, or 0 if it is not in the supported subset (or runs past `avail`).
+ */
+size_t ffi_disasm_x86_64(const unsigned char* code, size_t avail, char* text, size_t text_size) {
+    bool sse_66 = false;
+    size_t length = ffi_disasm_x86_64_insn(code, avail, text, text_size, &sse_66);
+    bool p66 = false;
+    size_t pos = 0;
+    for (; pos < length && (code[pos] == 0x66 || code[pos] == 0xF2 || code[pos] == 0xF3 || code[pos] == 0xF0); ++pos) {
+        p66 = p66 || code[pos] == 0x66;
+    }
+    if (length > 0 && p66 && !sse_66 && pos < length && (code[pos] & 0xF8) == 0x48) {
+        size_t used = strlen(text);
+        if (used + 7 < text_size) {
+            memmove(text + 7, text, used + 1);
+            memcpy(text, "data16 ", 7);
+        }
+    }
+    return length;
+}
 
-    // ret
-    *current_code_ptr++ = OPCODE_RET;
+static const char* const g_ffi_arm64_x[32] = {
+    "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15",
+    "x16", "x17", "x18", "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29", "x30", "xzr" };
+static const char* const g_ffi_arm64_w[32] = {
+    "w0", "w1", "w2", "w3", "w4", "w5", "w6", "w7", "w8", "w9", "w10", "w11", "w12", "w13", "w14", "w15",
+    "w16", "w17", "w18", "w19", "w20", "w21", "w22", "w23", "w24", "w25", "w26", "w27", "w28", "w29", "w30", "wzr" };
+
+// Register 31 is the stack pointer in address and add/sub operands, the zero register elsewhere.
+static const char* ffi_disasm_arm64_reg(unsigned reg, bool x, bool sp) {
+    if (reg == 31 && sp) return x ? "sp" : "wsp";
+    return x ? g_ffi_arm64_x[reg] : g_ffi_arm64_w[reg];
+}
 
-    return (size_t)(current_code_ptr - code_buffer);
+/**
+ * @brief Decodes one AArch64 instruction word.
+ * @return True if it is in the supported subset; otherwise `text` holds `.inst 0x...`.
+ */
+bool ffi_disasm_arm64(uint32_t insn, char* text, size_t text_size) {
+    const unsigned rd = insn & 31, rn = (insn >> 5) & 31;
+    if ((insn & 0x3B000000) == 0x39000000 || (insn & 0x3B200000) == 0x38000000) { // ldr/str family
+        const unsigned size = insn >> 30, opc = (insn >> 22) & 3;
+        const bool vector = (insn >> 26) & 1, unsigned_offset = (insn & 0x01000000) != 0;
+        unsigned scale = size;
+        char reg_text[8];
+        const char* mnemonic;
+        if (vector) {
+            static const char prefixes[4] = { 'b', 'h', 's', 'd' };
+            if (opc >= 2) { if (size != 0) goto unknown; scale = 4; }
+            snprintf(reg_text, sizeof(reg_text), "%c%u", opc >= 2 ? 'q' : prefixes[size], rd);
+            mnemonic = (opc & 1) ? "ldr" : "str";
+        } else {
+            static const char* const loads[4][4] = { { "strb", "ldrb", "ldrsb", "ldrsb" }, { "strh", "ldrh", "ldrsh", "ldrsh" },
+                                                     { "str", "ldr", "ldrsw", NULL }, { "str", "ldr", NULL, NULL } };
+            mnemonic = loads[size][opc];
+            if (mnemonic == NULL) goto unknown;
+            bool x = size == 3 || opc == 2 || (size == 2 && opc == 2);
+            snprintf(reg_text, sizeof(reg_text), "%s", ffi_disasm_arm64_reg(rd, x, false));
+        }
+        const char* base = ffi_disasm_arm64_reg(rn, true, true);
+        if (unsigned_offset) {
+            unsigned offset = ((insn >> 10) & 0xFFF) << scale;
+            if (offset) snprintf(text, text_size, "%s %s, [%s, #%u]", mnemonic, reg_text, base, offset);
+            else snprintf(text, text_size, "%s %s, [%s]", mnemonic, reg_text, base);
+            return true;
+        }
+        int imm9 = (int)((insn >> 12) & 0x1FF);
+        if (imm9 & 0x100) imm9 -= 0x200;
+        switch ((insn >> 10) & 3) {
+            case 0: // Unscaled: ldur/stur
+                if (imm9) snprintf(text, text_size, "%.2su%s %s, [%s, #%d]", mnemonic, mnemonic + 2, reg_text, base, imm9);
+                else snprintf(text, text_size, "%.2su%s %s, [%s]", mnemonic, mnemonic + 2, reg_text, base);
+                return true;
+            case 1: snprintf(text, text_size, "%s %s, [%s], #%d", mnemonic, reg_text, base, imm9); return true;
+            case 3: snprintf(text, text_size, "%s %s, [%s, #%d]!", mnemonic, reg_text, base, imm9); return true;
+            default: goto unknown;
+        }
+    }
+    if ((insn & 0x3A000000) == 0x28000000 && ((insn >> 23) & 3) != 0) { // stp/ldp
+        const unsigned opc = insn >> 30, index = (insn >> 23) & 3, rt2 = (insn >> 10) & 31;
+        const bool vector = (insn >> 26) & 1, load = (insn >> 22) & 1;
+        if (opc == 3 || (!vector && opc == 1)) goto unknown;
+        int scale = vector ? 2 + (int)opc : (opc == 2 ? 3 : 2);
+        int imm7 = (int)((insn >> 15) & 0x7F);
+        if (imm7 & 0x40) imm7 -= 0x80;
+        int offset = imm7 * (1 << scale);
+        char r1[8], r2[8];
+        if (vector) {
+            static const char prefixes[3] = { 's', 'd', 'q' };
+            snprintf(r1, sizeof(r1), "%c%u", prefixes[opc], rd);
+            snprintf(r2, sizeof(r2), "%c%u", prefixes[opc], rt2);
+        } else {
+            snprintf(r1, sizeof(r1), "%s", ffi_disasm_arm64_reg(rd, opc == 2, false));
+            snprintf(r2, sizeof(r2), "%s", ffi_disasm_arm64_reg(rt2, opc == 2, false));
+        }
+        const char* mnemonic = load ? "ldp" : "stp";
+        const char* base = ffi_disasm_arm64_reg(rn, true, true);
+        if (index == 1) snprintf(text, text_size, "%s %s, %s, [%s], #%d", mnemonic, r1, r2, base, offset);
+        else if (index == 3) snprintf(text, text_size, "%s %s, %s, [%s, #%d]!", mnemonic, r1, r2, base, offset);
+        else if (offset) snprintf(text, text_size, "%s %s, %s, [%s, #%d]", mnemonic, r1, r2, base, offset);
+        else snprintf(text, text_size, "%s %s, %s, [%s]", mnemonic, r1, r2, base);
+        return true;
+    }
+    if ((insn & 0x1F800000) == 0x12800000) { // movn/movz/movk
+        static const char* const names[4] = { "movn", NULL, "movz", "movk" };
+        const char* mnemonic = names[(insn >> 29) & 3];
+        const bool x = insn >> 31;
+        const unsigned hw = (insn >> 21) & 3, imm16 = (insn >> 5) & 0xFFFF;
+        if (mnemonic == NULL || (!x && hw >= 2)) goto unknown;
+        if (hw) snprintf(text, text_size, "%s %s, #0x%x, lsl #%u", mnemonic, ffi_disasm_arm64_reg(rd, x, false), imm16, hw * 16);
+        else snprintf(text, text_size, "%s %s, #0x%x", mnemonic, ffi_disasm_arm64_reg(rd, x, false), imm16);
+        return true;
+    }
+    if ((insn & 0x1F800000) == 0x11000000) { // add/sub immediate
+        const bool x = insn >> 31, sub = (insn >> 30) & 1, flags = (insn >> 29) & 1, shifted = (insn >> 22) & 1;
+        const unsigned imm12 = (insn >> 10) & 0xFFF;
+        const char* dst = ffi_disasm_arm64_reg(rd, x, !flags);
+        const char* src = ffi_disasm_arm64_reg(rn, x, true);
+        if (!sub && !flags && imm12 == 0 && !shifted && (rd == 31 || rn == 31)) {
+            snprintf(text, text_size, "mov %s, %s", dst, src);
+        } else {
+            snprintf(text, text_size, "%s%s %s, %s, #%u%s", sub ? "sub" : "add", flags ? "s" : "", dst, src, imm12,
+                     shifted ? ", lsl #12" : "");
+        }
+        return true;
+    }
+    if ((insn & 0x7FE0FFE0) == 0x2A0003E0) { // orr rd, zr, rm: mov (register)
+        const bool x = insn >> 31;
+        snprintf(text, text_size, "mov %s, %s", ffi_disasm_arm64_reg(rd, x, false), ffi_disasm_arm64_reg((insn >> 16) & 31, x, false));
+        return true;
+    }
+    if ((insn & 0xFFFFFC1F) == 0xD63F0000) { snprintf(text, text_size, "blr %s", ffi_disasm_arm64_reg(rn, true, false)); return true; }
+    if ((insn & 0xFFFFFC1F) == 0xD61F0000) { snprintf(text, text_size, "br %s", ffi_disasm_arm64_reg(rn, true, false)); return true; }
+    if ((insn & 0xFFFFFC1F) == 0xD65F0000) {
+        if (rn == 30) snprintf(text, text_size, "ret");
+        else snprintf(text, text_size, "ret %s", ffi_disasm_arm64_reg(rn, true, false));
+        return true;
+    }
+    if ((insn & 0xFFE0001F) == 0xD4000001) { snprintf(text, text_size, "svc #0x%x", (insn >> 5) & 0xFFFF); return true; }
+    if (insn == 0xD503201F) { snprintf(text, text_size, "nop"); return true; }
+unknown:
+    snprintf(text, text_size, ".inst 0x%08x", insn);
+    return false;
 }
-#endif // FFI_ARCH_X64
 
+/**
+ * @brief Disassembles a code range for the host architecture, one line per instruction.
+ * @param out Stream for the listing, or NULL to send it to the trace log.
+ * @return Instruction, byte and unknown counts.
+ */
+FFI_DisasmSummary ffi_disassemble(const void* code, size_t size, FILE* out) {
+    FFI_DisasmSummary summary = { 0, 0, 0 };
+    const unsigned char* bytes = (const unsigned char*)code;
+    char text[96], hex[40];
+    size_t pos = 0;
+    while (pos < size) {
+        size_t length;
 #ifdef FFI_ARCH_ARM64
+        uint32_t word = 0;
+        length = size - pos >= 4 ? 4 : size - pos;
+        memcpy(&word, bytes + pos, length);
+        if (length < 4 || !ffi_disasm_arm64(word, text, sizeof(text))) summary.unknown++;
+        snprintf(hex, sizeof(hex), "%08x", word);
+#else
+        length = ffi_disasm_x86_64(bytes + pos, size - pos, text, sizeof(text));
+        if (length == 0) {
+            length = 1;
+            summary.unknown++;
+            snprintf(text, sizeof(text), "(bad)");
+        }
+        int hex_len = 0;
+        for (size_t i = 0; i < length && i < 12; ++i) {
+            hex_len += snprintf(hex + hex_len, sizeof(hex) - (size_t)hex_len, "%02x ", bytes[pos + i]);
+        }
+        if (length > 12) snprintf(hex + hex_len - 1, sizeof(hex) - (size_t)hex_len + 1, "..");
+#endif
+        if (out) fprintf(out, "  %4zx:  %-37s %s\n", pos, hex, text);
+        else ffi_log_trace("  %4zx:  %-37s %s", pos, hex, text);
+        summary.instructions++;
+        pos += length;
+    }
+    summary.bytes = pos;
+    return summary;
+}
+
 /**
- * @brief Generates ARM64 AAPCS trampoline bytes.
- * This is a highly simplified and conceptual implementation.
- * A complete ARM64 trampoline would require precise instruction encoding.
- * @param code_buffer Pointer to the memory where the assembly bytes will be written.
- * @param sig A pointer to the FFI_FunctionSignature.
- * @return The size of the generated assembly code in bytes.
+ * @brief Prints a handle's trampoline as assembly, followed by its instruction and byte counts.
+ * Handles that have no generated code yet (lazy or tier 0) print a one-line note instead.
+ * @return The counts (all zero when there is no code).
  */
-size_t generate_arm64_aapcs_trampoline(unsigned char* code_buffer, FFI_FunctionSignature* sig) {
-    uint32_t *current_code_ptr = (uint32_t*)code_buffer;
-    uint64_t target_addr_val = (uint64_t)sig->func_ptr;
+FFI_DisasmSummary ffi_dump_trampoline(const FFI_FunctionSignature* sig, FILE* out) {
+    FFI_DisasmSummary summary = { 0, 0, 0 };
+    int64_t code_size = FFI_ATOMIC_LOAD_I64((int64_t*)&sig->code_size);
+    if (code_size == 0) {
+        fprintf(out, "%s: no generated trampoline\n", sig->debug_name);
+        return summary;
+    }
+    fprintf(out, "%s at %p:\n", sig->debug_name, (void*)sig->trampoline_code);
+    summary = ffi_disassemble((const void*)sig->trampoline_code, (size_t)code_size, out);
+    fprintf(out, "%s: %d instructions, %zu bytes%s\n", sig->debug_name, summary.instructions, summary.bytes,
+            summary.unknown ? " (some not decoded)" : "");
+    return summary;
+}
 
-    // The trampoline itself will be called by C with this signature:
-    // void (*GenericTrampoline)(FFI_Argument* args, int num_args, void* return_buffer_ptr)
-    // Register mapping for this trampoline call (AAPCS64):
-    // X0: FFI_Argument* args (base address of the FFI_Argument array)
-    // X1: int num_args (number of arguments in the array)
-    // X2: void* return_buffer_ptr (pointer to where the return value should be stored)
+// --- USDT Probes ---
+// Static tracepoints for SystemTap, bpftrace and perf (`usdt:./cross:ffi:invoke_entry`).
+// Each probe site compiles to a single nop plus an entry in the `.note.stapsdt` ELF note that
+// tells the tracer where the nop is and where the arguments live (register, immediate or memory
+// operand). A tracer attaching replaces the nop with a breakpoint; with none attached the cost
+// is the nop and nothing else, since the operands are described in place rather than loaded.
+//
+// <sys/sdt.h> is used when the toolchain has it. Otherwise GCC and Clang on x86-64/AArch64 ELF
+// targets get the same note layout from the inline assembly below, and other targets compile
+// the probes away. The probes are:
+//   ffi:trampoline_create  (id, name, address, size)  after a trampoline is generated
+//   ffi:invoke_entry       (id, num_args)             before invoke_foreign/prepared_call
+//   ffi:invoke_exit        (id, invoked)              after the call (invoked is 0 on errors)
+//   ffi:trampoline_destroy (id, name, address)        when destroy_ffi_function() retires it
+// `id` is the handle's process-unique number (FFI_FunctionSignature::id), starting at 1.
+
+#if defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define FFI_HAVE_USDT 1
+    #endif
+#endif
 
-    // --- Prologue ---
-    // Save X29 (FP) and X30 (LR) to stack, adjust SP.
-    // STP X29, X30, [SP, #-16]!
-    *current_code_ptr++ = 0xA9BF7BFD; // STP X29, X30, [SP, #-16]!
+#if defined(FFI_HAVE_USDT)
+    #define FFI_PROBE2(name, a1, a2) DTRACE_PROBE2(ffi, name, (uint64_t)(a1), (uint64_t)(a2))
+    #define FFI_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(ffi, name, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3))
+    #define FFI_PROBE4(name, a1, a2, a3, a4) \
+        DTRACE_PROBE4(ffi, name, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3), (uint64_t)(a4))
+#elif defined(__GNUC__) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+    #define FFI_HAVE_USDT 1
+    // SystemTap v3 note: location, base (for prelink adjustment), semaphore (none), provider,
+    // name and an argument string of `8@operand` entries. `.stapsdt.base` is emitted once per
+    // object as a comdat so every probe references the same symbol.
+    #define FFI_SDT_ASM(name, args, ...)                                                        \
+        __asm__ __volatile__("990: nop\n"                                                       \
+                             ".pushsection .note.stapsdt,\"?\",\"note\"\n"                      \
+                             ".balign 4\n"                                                      \
+                             ".4byte 992f-991f, 994f-993f, 3\n"                                 \
+                             "991: .asciz \"stapsdt\"\n"                                        \
+                             "992: .balign 4\n"                                                 \
+                             "993: .8byte 990b\n"                                               \
+                             ".8byte _.stapsdt.base\n"                                          \
+                             ".8byte 0\n"                                                       \
+                             ".asciz \"ffi\"\n"                                                 \
+                             ".asciz \"" #name "\"\n"                                           \
+                             ".asciz \"" args "\"\n"                                            \
+                             "994: .balign 4\n"                                                 \
+                             ".popsection\n"                                                    \
+                             ".ifndef _.stapsdt.base\n"                                         \
+                             ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+                             ".weak _.stapsdt.base\n"                                           \
+                             ".hidden _.stapsdt.base\n"                                         \
+                             "_.stapsdt.base: .space 1\n"                                       \
+                             ".size _.stapsdt.base, 1\n"                                        \
+                             ".popsection\n"                                                    \
+                             ".endif\n"                                                         \
+                             : : __VA_ARGS__)
+    #define FFI_SDT_ARG(n, value) [a##n] "nor"((uint64_t)(value))
+    #define FFI_PROBE2(name, a1, a2) \
+        FFI_SDT_ASM(name, "8@%[a1] 8@%[a2]", FFI_SDT_ARG(1, a1), FFI_SDT_ARG(2, a2))
+    #define FFI_PROBE3(name, a1, a2, a3) \
+        FFI_SDT_ASM(name, "8@%[a1] 8@%[a2] 8@%[a3]", FFI_SDT_ARG(1, a1), FFI_SDT_ARG(2, a2), FFI_SDT_ARG(3, a3))
+    #define FFI_PROBE4(name, a1, a2, a3, a4)                                                    \
+        FFI_SDT_ASM(name, "8@%[a1] 8@%[a2] 8@%[a3] 8@%[a4]", FFI_SDT_ARG(1, a1), FFI_SDT_ARG(2, a2), \
+                    FFI_SDT_ARG(3, a3), FFI_SDT_ARG(4, a4))
+#else
+    #define FFI_PROBE2(name, a1, a2) ((void)0)
+    #define FFI_PROBE3(name, a1, a2, a3) ((void)0)
+    #define FFI_PROBE4(name, a1, a2, a3, a4) ((void)0)
+#endif
 
-    // MOV X29, SP (Frame Pointer = Stack Pointer)
-    *current_code_ptr++ = 0xF90003BD; // MOV X29, SP (actually ADD X29, SP, #0)
+static int64_t g_ffi_next_handle_id = 0; // Last id handed out by create_ffi_function_with_abi()
+
+// --- Call Tracing ---
+// A record of individual foreign calls for latency investigations: which handle, on which
+// thread, and when it started and ended. invoke_foreign_function() and invoke_prepared_call()
+// feed it while ffi_set_call_tracing(true) is in effect. When it is off, each call pays one
+// load and a branch.
+//
+// Each thread owns a fixed ring of FFI_TRACE_RING_EVENTS events. It writes them with plain
+// (release) stores and no locks, and overwrites the oldest events once the ring is full.
+// Every slot carries a sequence number, cleared before the slot is rewritten and set to the
+// event's index + 1 afterwards. Readers copy a slot between two loads of that number, and
+// drop the event if they differ. The owner never waits, and readers never return a torn
+// event. Rings outlive their threads, so a dump still covers threads that have exited.
+//
+// A handle's name is copied into a shared table the first time that handle is traced. Events
+// carry only the id, so they stay 32 bytes. ffi_call_trace_write() saves everything in a
+// compact binary file. ffi_call_trace_to_chrome_json() turns such a file into Chrome
+// `trace_event` JSON for chrome://tracing or Perfetto. `./cross --call-trace <file>` traces the
+// test run or the benchmarks and writes both <file> and <file>.json.
+//
+// Binary layout (native byte order):
+//   FFI_TraceFileHeader
+//   name_count x { int64_t id; uint32_t length; char name[length]; }
+//   event_count x FFI_TraceRecord
+
+#define FFI_TRACE_RING_EVENTS 4096 // Per thread; a power of two
+#define FFI_TRACE_FILE_VERSION 1
+
+// One traced call, as stored in a ring and in the binary file.
+typedef struct {
+    int64_t sig_id;     // FFI_FunctionSignature::id
+    uint32_t thread_id; // 1-based, in order of each thread's first traced call
+    uint32_t reserved;
+    int64_t start_ns;   // Monotonic clock at entry and exit
+    int64_t end_ns;
+} FFI_TraceRecord;
 
-    // Save callee-saved registers: X19-X30, V8-V15
-    // We'll use X19 (args_ptr) and X20 (return_buffer_ptr) as callee-saved.
-    // X0, X1, X2 are caller-saved and will be overwritten.
+typedef struct {
+    char magic[8];      // "FFITRACE"
+    uint32_t version;   // FFI_TRACE_FILE_VERSION
+    uint32_t name_count;
+    uint64_t event_count;
+} FFI_TraceFileHeader;
 
-    // STP X19, X20, [SP, #-16]!
-    *current_code_ptr++ = 0xA9BF4FF3; // STP X19, X20, [SP, #-16]!
+typedef struct {
+    int64_t seq;        // Index + 1 of the event in the slot, 0 while it is being rewritten
+    int64_t sig_id;
+    int64_t start_ns;
+    int64_t end_ns;
+} FFI_TraceSlot;
+
+typedef struct FFI_TraceRing {
+    int64_t head;                   // Events ever written; only the owning thread stores it
+    uint32_t thread_id;
+    struct FFI_TraceRing* next;     // Guarded by g_ffi_trace_lock
+    FFI_TraceSlot slots[FFI_TRACE_RING_EVENTS];
+} FFI_TraceRing;
+
+typedef struct FFI_TraceName {
+    int64_t id;
+    char* name;
+    struct FFI_TraceName* next;
+} FFI_TraceName;
+
+static ffi_mutex_t g_ffi_trace_lock = FFI_MUTEX_INITIALIZER;
+static FFI_TraceRing* g_ffi_trace_rings = NULL;  // Guarded by g_ffi_trace_lock
+static FFI_TraceName* g_ffi_trace_names = NULL;  // Guarded by g_ffi_trace_lock
+static uint32_t g_ffi_trace_name_count = 0;      // Guarded by g_ffi_trace_lock
+static uint32_t g_ffi_trace_thread_count = 0;    // Guarded by g_ffi_trace_lock
+static uint32_t g_ffi_trace_enabled = 0;
+static FFI_THREAD_LOCAL FFI_TraceRing* t_ffi_trace_ring = NULL;
 
-    // MOV X19, X0 (Save args pointer from X0 to X19)
-    *current_code_ptr++ = 0xAA0003F3; // MOV X19, X0
+/**
+ * @brief Starts or stops recording foreign calls into the per-thread rings.
+ * Stopping keeps what was recorded; it can still be read or written out.
+ */
+void ffi_set_call_tracing(bool enabled) {
+    FFI_ATOMIC_XCHG_U32(&g_ffi_trace_enabled, enabled ? 1u : 0u);
+}
 
-    // MOV X20, X2 (Save return_buffer_ptr from X2 to X20)
-    *current_code_ptr++ = 0xAA0203F4; // MOV X20, X2
+bool ffi_call_tracing_enabled(void) {
+    return FFI_ATOMIC_LOAD_U32(&g_ffi_trace_enabled) != 0;
+}
 
-    // --- Determine Stack Arguments and Calculate Total Stack Space ---
-    int num_gp_regs_used = 0;
-    int num_xmm_regs_used = 0;
-    int num_stack_args = 0; // Number of 8-byte slots needed on stack
+/**
+ * @brief Returns the entry timestamp of a traced call, or 0 when tracing is off.
+ */
+static inline int64_t ffi_call_trace_begin(void) {
+    return FFI_ATOMIC_LOAD_U32(&g_ffi_trace_enabled) ? (int64_t)ffi_stats_now_ns() : 0;
+}
 
-    // AAPCS64 GPRs: X0-X7 (8 registers)
-    // AAPCS64 FP/SIMD: V0-V7 (8 registers)
+/**
+ * @brief Creates the calling thread's ring (first traced call on this thread).
+ */
+static FFI_TraceRing* ffi_call_trace_ring_slow(void) {
+    FFI_TraceRing* ring = (FFI_TraceRing*)calloc(1, sizeof(FFI_TraceRing));
+    if (ring == NULL) {
+        ffi_log_error("ERROR: Out of memory for this thread's call trace ring.");
+        return NULL;
+    }
+    ffi_mutex_lock(&g_ffi_trace_lock);
+    ring->thread_id = ++g_ffi_trace_thread_count;
+    ring->next = g_ffi_trace_rings;
+    g_ffi_trace_rings = ring;
+    ffi_mutex_unlock(&g_ffi_trace_lock);
+    t_ffi_trace_ring = ring;
+    return ring;
+}
 
-    // If returning a struct > 16 bytes, the return buffer pointer is the first argument (X0).
-    bool return_struct_by_pointer = false;
-    if (sig->return_type == FFI_TYPE_INT128 || sig->return_type == FFI_TYPE_UINT128) {
-        // AAPCS64 returns 128-bit integers in X0/X1. No pointer needed.
-        // If it were a struct > 16 bytes, X0 would be used for the return buffer pointer.
-        // For now, assume 128-bit fits in X0/X1.
-    } else if (sig->return_type == FFI_TYPE_UNKNOWN) {
-        // Placeholder for larger structs
+/**
+ * @brief Copies a handle's name into the trace name table (first traced call of the handle).
+ */
+static void ffi_call_trace_name(FFI_FunctionSignature* sig) {
+    uint32_t unnamed = 0;
+    if (!FFI_ATOMIC_CAS_U32(&sig->trace_named, unnamed, 1u)) {
+        return;
+    }
+    const char* name = sig->debug_name ? sig->debug_name : "(unnamed)";
+    size_t length = strlen(name);
+    FFI_TraceName* entry = (FFI_TraceName*)malloc(sizeof(FFI_TraceName) + length + 1);
+    if (entry == NULL) {
+        return; // The events still carry the id
     }
+    entry->id = sig->id;
+    entry->name = (char*)(entry + 1);
+    memcpy(entry->name, name, length + 1);
+    ffi_mutex_lock(&g_ffi_trace_lock);
+    entry->next = g_ffi_trace_names;
+    g_ffi_trace_names = entry;
+    g_ffi_trace_name_count++;
+    ffi_mutex_unlock(&g_ffi_trace_lock);
+}
 
-    for (int i = 0; i < sig->num_params; ++i) {
-        FFI_Type param_type = sig->param_types[i];
-        if (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE) {
-            if (num_xmm_regs_used < 8) { // AAPCS64 has 8 V registers
-                num_xmm_regs_used++;
-            } else {
-                num_stack_args++;
+/**
+ * @brief Appends a finished call to the calling thread's ring.
+ * @param start_ns The value ffi_call_trace_begin() returned (nonzero).
+ */
+static void ffi_call_trace_end(FFI_FunctionSignature* sig, int64_t start_ns) {
+    int64_t end_ns = (int64_t)ffi_stats_now_ns();
+    FFI_TraceRing* ring = t_ffi_trace_ring ? t_ffi_trace_ring : ffi_call_trace_ring_slow();
+    if (ring == NULL) {
+        return;
+    }
+    if (!FFI_ATOMIC_LOAD_U32(&sig->trace_named)) {
+        ffi_call_trace_name(sig);
+    }
+    int64_t head = ring->head; // Only this thread writes it
+    FFI_TraceSlot* slot = &ring->slots[head & (FFI_TRACE_RING_EVENTS - 1)];
+    FFI_ATOMIC_STORE_I64(&slot->seq, 0);
+    FFI_ATOMIC_STORE_I64(&slot->sig_id, sig->id);
+    FFI_ATOMIC_STORE_I64(&slot->start_ns, start_ns);
+    FFI_ATOMIC_STORE_I64(&slot->end_ns, end_ns);
+    FFI_ATOMIC_STORE_I64(&slot->seq, head + 1);
+    FFI_ATOMIC_STORE_I64(&ring->head, head + 1);
+}
+
+/**
+ * @brief Copies the events currently held by all rings, oldest first within each thread.
+ * @param out Destination, may be NULL when `capacity` is 0.
+ * @return The number of events available, which may exceed `capacity` (then only the first
+ * `capacity` were copied). Events overwritten while they are read are skipped.
+ */
+size_t ffi_call_trace_snapshot(FFI_TraceRecord* out, size_t capacity) {
+    size_t total = 0;
+    ffi_mutex_lock(&g_ffi_trace_lock);
+    for (FFI_TraceRing* ring = g_ffi_trace_rings; ring; ring = ring->next) {
+        int64_t head = FFI_ATOMIC_LOAD_I64(&ring->head);
+        int64_t first = head > FFI_TRACE_RING_EVENTS ? head - FFI_TRACE_RING_EVENTS : 0;
+        for (int64_t i = first; i < head; ++i) {
+            const FFI_TraceSlot* slot = &ring->slots[i & (FFI_TRACE_RING_EVENTS - 1)];
+            FFI_TraceRecord copy = { 0, ring->thread_id, 0, 0, 0 };
+            if (FFI_ATOMIC_LOAD_I64(&slot->seq) != i + 1) {
+                continue; // Already overwritten by a newer event
             }
-        } else if (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128) {
-            // 128-bit integers consume two GPRs or 16 bytes on stack
-            if (num_gp_regs_used <= 6) { // If num_gp_regs_used is 7, we only have X7 left, so it spills.
-                num_gp_regs_used += 2; // Consumes two GPRs
-            } else {
-                num_stack_args += 2; // Consumes 16 bytes on stack
+            copy.sig_id = FFI_ATOMIC_LOAD_I64(&slot->sig_id);
+            copy.start_ns = FFI_ATOMIC_LOAD_I64(&slot->start_ns);
+            copy.end_ns = FFI_ATOMIC_LOAD_I64(&slot->end_ns);
+            if (FFI_ATOMIC_LOAD_I64(&slot->seq) != i + 1) {
+                continue; // Rewritten while we copied it
             }
-        } else { // All other types go to GPRs
-            if (num_gp_regs_used < 8) { // AAPCS64 has 8 GPRs
-                num_gp_regs_used++;
-            } else {
-                num_stack_args++;
+            if (total < capacity) {
+                out[total] = copy;
             }
+            total++;
         }
     }
+    ffi_mutex_unlock(&g_ffi_trace_lock);
+    return total;
+}
+
+/**
+ * @brief Writes the recorded calls and the names of the traced handles to a binary file.
+ * @return The number of events written, or -1 on error.
+ */
+int64_t ffi_call_trace_write(const char* path) {
+    size_t capacity = ffi_call_trace_snapshot(NULL, 0);
+    FFI_TraceRecord* events = (FFI_TraceRecord*)malloc((capacity ? capacity : 1) * sizeof(FFI_TraceRecord));
+    if (events == NULL) {
+        ffi_log_error("ERROR: Out of memory for a call trace of %zu events.", capacity);
+        return -1;
+    }
+    size_t count = ffi_call_trace_snapshot(events, capacity);
+    count = count < capacity ? count : capacity; // Rings may have gained events in between
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        ffi_log_error("ERROR: Cannot write the call trace to '%s'.", path);
+        free(events);
+        return -1;
+    }
+    FFI_TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "FFITRACE", 8);
+    header.version = FFI_TRACE_FILE_VERSION;
+    header.event_count = count;
+    ffi_mutex_lock(&g_ffi_trace_lock);
+    header.name_count = g_ffi_trace_name_count;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (FFI_TraceName* entry = g_ffi_trace_names; entry && written; entry = entry->next) {
+        uint32_t length = (uint32_t)strlen(entry->name);
+        written = fwrite(&entry->id, sizeof(entry->id), 1, file) == 1 && fwrite(&length, sizeof(length), 1, file) == 1 &&
+                  fwrite(entry->name, 1, length, file) == length;
+    }
+    ffi_mutex_unlock(&g_ffi_trace_lock);
+    written = written && fwrite(events, sizeof(FFI_TraceRecord), count, file) == count;
+    written = (fclose(file) == 0) && written;
+    free(events);
+    if (!written) {
+        ffi_log_error("ERROR: Failed writing the call trace to '%s'.", path);
+        return -1;
+    }
+    return (int64_t)count;
+}
 
-    size_t stack_args_total_size = (size_t)num_stack_args * 8;
-    size_t final_stack_subtraction = stack_args_total_size;
+static int ffi_trace_name_compare(const void* a, const void* b) {
+    int64_t x = ((const FFI_TraceName*)a)->id, y = ((const FFI_TraceName*)b)->id;
+    return (x > y) - (x < y);
+}
 
-    // SP must be 16-byte aligned.
-    // After STP X29, X30, [SP, #-16]! and STP X19, X20, [SP, #-16]!, SP is 32 bytes lower.
-    // So SP is already 16-byte aligned.
-    // We just need to ensure the total stack allocation for arguments is 16-byte aligned.
-    if ((final_stack_subtraction % 16) != 0) {
-        final_stack_subtraction += 8; // Pad to 16-byte alignment
+static void ffi_json_write_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* c = (const unsigned char*)text; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
     }
+    fputc('"', out);
+}
 
-    if (final_stack_subtraction > 0) {
-        // SUB SP, SP, #final_stack_subtraction
-        *current_code_ptr++ = 0xD1000000 | ((final_stack_subtraction & 0xFFF) << 10) | (ARM64_REG_SP << 5) | ARM64_REG_SP;
+/**
+ * @brief Converts a file written by ffi_call_trace_write() to Chrome `trace_event` JSON.
+ * Every call becomes a complete ("X") event named after its handle, with timestamps in
+ * microseconds from the earliest call in the file.
+ * @return The number of events converted, or -1 if the input is unreadable or malformed.
+ */
+int64_t ffi_call_trace_to_chrome_json(const char* trace_path, const char* json_path) {
+    FILE* in = fopen(trace_path, "rb");
+    if (in == NULL) {
+        ffi_log_error("ERROR: Cannot open call trace '%s'.", trace_path);
+        return -1;
+    }
+    int64_t converted = -1;
+    FFI_TraceName* names = NULL;
+    FFI_TraceRecord* events = NULL;
+    uint32_t num_names = 0;
+    FILE* out = NULL;
+    FFI_TraceFileHeader header;
+    long file_size = -1;
+    if (fseek(in, 0, SEEK_END) == 0) {
+        file_size = ftell(in);
+    }
+    if (file_size < (long)sizeof(header) || fseek(in, 0, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, "FFITRACE", 8) != 0 || header.version != FFI_TRACE_FILE_VERSION) {
+        ffi_log_error("ERROR: '%s' is not a call trace file.", trace_path);
+        goto out;
+    }
+    // The counts come from the file: check them against its size before allocating anything.
+    uint64_t payload = (uint64_t)file_size - sizeof(header);
+    const uint64_t min_name_size = sizeof(int64_t) + sizeof(uint32_t);
+    if (header.name_count > payload / min_name_size ||
+        header.event_count > (payload - header.name_count * min_name_size) / sizeof(FFI_TraceRecord)) {
+        ffi_log_error("ERROR: Call trace '%s' claims more names or events than it holds.", trace_path);
+        goto out;
+    }
+    names = (FFI_TraceName*)calloc(header.name_count ? header.name_count : 1, sizeof(FFI_TraceName));
+    if (names == NULL) {
+        goto out;
+    }
+    for (; num_names < header.name_count; ++num_names) {
+        uint32_t length;
+        FFI_TraceName* entry = &names[num_names];
+        if (fread(&entry->id, sizeof(entry->id), 1, in) != 1 || fread(&length, sizeof(length), 1, in) != 1 ||
+            length > payload || (entry->name = (char*)malloc((size_t)length + 1)) == NULL ||
+            fread(entry->name, 1, length, in) != length) {
+            ffi_log_error("ERROR: Truncated name table in call trace '%s'.", trace_path);
+            goto out;
+        }
+        entry->name[length] = '\0';
+    }
+    qsort(names, num_names, sizeof(FFI_TraceName), ffi_trace_name_compare);
+    events = (FFI_TraceRecord*)malloc((header.event_count ? header.event_count : 1) * sizeof(FFI_TraceRecord));
+    if (events == NULL || fread(events, sizeof(FFI_TraceRecord), header.event_count, in) != header.event_count) {
+        ffi_log_error("ERROR: Truncated events in call trace '%s'.", trace_path);
+        goto out;
     }
+    out = fopen(json_path, "w");
+    if (out == NULL) {
+        ffi_log_error("ERROR: Cannot write Chrome trace '%s'.", json_path);
+        goto out;
+    }
+    int64_t origin = INT64_MAX;
+    for (uint64_t i = 0; i < header.event_count; ++i) {
+        origin = events[i].start_ns < origin ? events[i].start_ns : origin;
+    }
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    for (uint64_t i = 0; i < header.event_count; ++i) {
+        FFI_TraceName key = { events[i].sig_id, NULL, NULL };
+        const FFI_TraceName* entry =
+            (const FFI_TraceName*)bsearch(&key, names, num_names, sizeof(FFI_TraceName), ffi_trace_name_compare);
+        fprintf(out, "%s\n  {\"name\": ", i ? "," : "");
+        if (entry != NULL) {
+            ffi_json_write_string(out, entry->name);
+        } else {
+            fprintf(out, "\"ffi#%lld\"", (long long)events[i].sig_id);
+        }
+        fprintf(out, ", \"cat\": \"ffi\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u, "
+                     "\"args\": {\"id\": %lld}}",
+                (double)(events[i].start_ns - origin) / 1000.0, (double)(events[i].end_ns - events[i].start_ns) / 1000.0,
+                events[i].thread_id, (long long)events[i].sig_id);
+    }
+    fprintf(out, "\n]}\n");
+    converted = (int64_t)header.event_count;
+out:
+    if (out != NULL && fclose(out) != 0) {
+        converted = -1;
+    }
+    for (uint32_t i = 0; names && i < header.name_count; ++i) {
+        free(names[i].name);
+    }
+    free(names);
+    free(events);
+    fclose(in);
+    return converted;
+}
 
-    // --- Argument Marshalling ---
-    int gp_reg_idx = 0;
-    int xmm_reg_idx = 0;
-    int stack_arg_current_idx = 0; // 0-indexed counter for arguments going to stack
+// --- Runtime Assembly Generation and Execution Functions (Platform Agnostic) ---
 
-    // Array of GPR argument registers in order for AAPCS64: X0-X7
-    unsigned char gp_arg_regs[] = { ARM64_REG_X0, ARM64_REG_X1, ARM64_REG_X2, ARM64_REG_X3, ARM64_REG_X4, ARM64_REG_X5, ARM64_REG_X6, ARM64_REG_X7 };
-    // Array of FP argument registers in order for AAPCS64: V0-V7
-    unsigned char fp_arg_regs[] = { ARM64_REG_V0, ARM64_REG_V1, ARM64_REG_V2, ARM64_REG_V3, ARM64_REG_V4, ARM64_REG_V5, ARM64_REG_V6, ARM64_REG_V7 };
+/**
+ * @brief Abstracts platform-specific memory allocation for executable memory.
+ * Safe to call from any thread: every trampoline gets its own mapping and no library state is
+ * touched, so concurrent creators only contend inside the kernel's address-space lock.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the allocated memory, or NULL on failure.
+ */
+void* ffi_create_executable_memory(size_t size) {
+#ifdef FFI_OS_LINUX
+    long page_size_long = sysconf(_SC_PAGESIZE);
+    size_t page_size = (size_t)page_size_long;
+    size_t aligned_size = (size + page_size - 1) & ~(page_size - 1);
+    void* mem = mmap(NULL, aligned_size,
+                     PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    if (mem == MAP_FAILED) {
+        ffi_log_error("Failed to allocate executable memory with mmap: %s", strerror(errno));
+        return NULL;
+    }
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.bytes_reserved, (int64_t)aligned_size);
+    ffi_log_info("Allocated executable memory at %p (size: %zu bytes) using mmap.", mem, aligned_size);
+    return mem;
+#elif defined(FFI_OS_WIN64)
+    // VirtualAlloc allocates memory on page boundaries already
+    void* mem = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+    if (mem == NULL) {
+        ffi_log_error("Failed to allocate executable memory with VirtualAlloc: error %lu", GetLastError());
+        return NULL;
+    }
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.bytes_reserved, (int64_t)((size + 4095) & ~(size_t)4095));
+    ffi_log_info("Allocated executable memory at %p (size: %zu bytes) using VirtualAlloc.", mem, size);
+    return mem;
+#elif defined(FFI_OS_MACOS)
+    long page_size_long = sysconf(_SC_PAGESIZE);
+    size_t page_size = (size_t)page_size_long;
+    size_t aligned_size = (size + page_size - 1) & ~(page_size - 1);
+    void* mem = mmap(NULL, aligned_size,
+                     PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    if (mem == MAP_FAILED) {
+        ffi_log_error("Failed to allocate executable memory with mmap: %s", strerror(errno));
+        return NULL;
+    }
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.bytes_reserved, (int64_t)aligned_size);
+    ffi_log_info("Allocated executable memory at %p (size: %zu bytes) using mmap (macOS).", mem, aligned_size);
+    return mem;
+#else
+    BAIL_OUT("ffi_create_executable_memory: Unsupported OS.");
+    return NULL;
+#endif
+}
 
-    // If returning a struct by pointer, the return buffer pointer is the first argument (X0)
-    // and subsequent arguments shift.
-    if (return_struct_by_pointer) {
-        // MOV X0, X20 (Move saved return_buffer_ptr from X20 to X0)
-        *current_code_ptr++ = 0xAA1403E0; // MOV X0, X20
-        gp_reg_idx++; // X0 is now used for the return buffer pointer
+#ifdef FFI_OS_LINUX
+/**
+ * @brief Unmaps the oldest quarantined range. Must hold g_ffi_perf_map_lock.
+ */
+static void ffi_perf_map_release_oldest_locked(void) {
+    FFI_QuarantinedRange* oldest = &g_ffi_perf_map_held[g_ffi_perf_map_held_first];
+    if (munmap(oldest->mem, oldest->size) == -1) {
+        ffi_log_error("WARNING: Failed to release quarantined memory at %p: %s", oldest->mem, strerror(errno));
     }
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.bytes_quarantined, -(int64_t)oldest->size);
+    g_ffi_perf_map_held_first = (g_ffi_perf_map_held_first + 1) % FFI_PERF_MAP_QUARANTINE_MAX;
+    g_ffi_perf_map_held_count--;
+}
 
-    if (sig->num_params > 0 && sig->param_types != NULL) {
-        for (int i = 0; i < sig->num_params; ++i) {
-            FFI_Type param_type = sig->param_types[i];
+static void ffi_perf_map_release_quarantine_locked(void) {
+    while (g_ffi_perf_map_held_count > 0) {
+        ffi_perf_map_release_oldest_locked();
+    }
+}
 
-            // Load args[i].value_ptr into X8 (temporary register for base address)
-            size_t current_arg_value_ptr_offset = (size_t)i * sizeof(FFI_Argument);
-            // LDR X8, [X19, #offset] (X19 holds the base address of FFI_Argument array)
-            *current_code_ptr++ = ARM64_LDR_X_X_IMM(ARM64_REG_X8, ARM64_REG_X19, current_arg_value_ptr_offset);
+/**
+ * @brief Keeps a freed range reserved as PROT_NONE while the perf map is in use, releasing the
+ * oldest held range once FFI_PERF_MAP_QUARANTINE_MAX are held.
+ * @return False if the mode is off or the range cannot be protected; the caller unmaps it.
+ */
+static bool ffi_perf_map_quarantine(void* mem, size_t size) {
+    ffi_mutex_lock(&g_ffi_perf_map_lock);
+    bool held = FFI_ATOMIC_LOAD_U32(&g_ffi_perf_map_quarantine) != 0;
+    if (held) {
+        madvise(mem, size, MADV_DONTNEED);
+        if (mprotect(mem, size, PROT_NONE) == -1) {
+            ffi_log_error("WARNING: Failed to quarantine executable memory at %p: %s", mem, strerror(errno));
+            held = false;
+        }
+    }
+    if (held) {
+        if (g_ffi_perf_map_held_count == FFI_PERF_MAP_QUARANTINE_MAX) {
+            ffi_perf_map_release_oldest_locked();
+        }
+        size_t slot = (g_ffi_perf_map_held_first + g_ffi_perf_map_held_count) % FFI_PERF_MAP_QUARANTINE_MAX;
+        g_ffi_perf_map_held[slot] = (FFI_QuarantinedRange){ mem, size };
+        g_ffi_perf_map_held_count++;
+        FFI_ATOMIC_ADD_I64(&g_ffi_counters.bytes_quarantined, (int64_t)size);
+        ffi_log_info("Quarantined executable memory at %p (Linux, perf map active).", mem);
+    }
+    ffi_mutex_unlock(&g_ffi_perf_map_lock);
+    return held;
+}
+#endif
 
-            bool is_current_param_xmm_type = (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE);
-            bool is_current_param_int128_type = (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128);
-            bool goes_to_reg = false;
-            bool to_stack = false;
+/**
+ * @brief Abstracts platform-specific memory deallocation for executable memory.
+ * @param mem Pointer to the memory to free.
+ * @param size The size of the allocated memory.
+ */
+void ffi_free_executable_memory(void* mem, size_t size) {
+    if (mem) {
+        ffi_gdb_jit_forget(mem);
+        ffi_unwind_forget(mem);
+#ifdef FFI_OS_LINUX
+        long page_size_long = sysconf(_SC_PAGESIZE);
+        size_t page_size = (size_t)page_size_long;
+        size_t aligned_size = (size + page_size - 1) & ~(page_size - 1);
+        FFI_ATOMIC_ADD_I64(&g_ffi_counters.bytes_reserved, -(int64_t)aligned_size);
+        if (FFI_ATOMIC_LOAD_U32(&g_ffi_perf_map_quarantine) && ffi_perf_map_quarantine(mem, aligned_size)) {
+            return; // The perf map may name this range; it stays reserved so it is not reused.
+        }
+        if (munmap(mem, aligned_size) == -1) {
+            perror("munmap failed");
+            ffi_log_error("WARNING: Failed to free executable memory at %p (Linux).", mem);
+        } else {
+            ffi_log_info("Freed executable memory at %p (Linux).", mem);
+        }
+#elif defined(FFI_OS_WIN64)
+        FFI_ATOMIC_ADD_I64(&g_ffi_counters.bytes_reserved, -(int64_t)((size + 4095) & ~(size_t)4095));
+        if (VirtualFree(mem, 0, MEM_RELEASE) == 0) {
+            ffi_log_error("VirtualFree failed with error: %lu", GetLastError());
+            ffi_log_error("WARNING: Failed to free executable memory at %p (Win64).", mem);
+        } else {
+            ffi_log_info("Freed executable memory at %p (Win64).", mem);
+        }
+#elif defined(FFI_OS_MACOS)
+        long page_size_long = sysconf(_SC_PAGESIZE);
+        size_t page_size = (size_t)page_size_long;
+        size_t aligned_size = (size + page_size - 1) & ~(page_size - 1);
+        FFI_ATOMIC_ADD_I64(&g_ffi_counters.bytes_reserved, -(int64_t)aligned_size);
+        if (munmap(mem, aligned_size) == -1) {
+            perror("munmap failed");
+            ffi_log_error("WARNING: Failed to free executable memory at %p (macOS).", mem);
+        } else {
+            ffi_log_info("Freed executable memory at %p (macOS).", mem);
+        }
+#else
+        ffi_log_error("WARNING: ffi_free_executable_memory: Unsupported OS. Memory at %p not freed.", mem);
+#endif
+    }
+}
 
-            if (is_current_param_xmm_type) {
-                if (xmm_reg_idx < 8) { // 8 V registers for AAPCS64
-                    goes_to_reg = true;
-                    // LDR Sn, [X8] (for float) or LDR Dn, [X8] (for double)
-                    if (param_type == FFI_TYPE_FLOAT) {
-                        *current_code_ptr++ = 0xBC400100 | (fp_arg_regs[xmm_reg_idx] << 0) | (ARM64_REG_X8 << 5); // LDR Sn, [X8]
-                    } else { // FFI_TYPE_DOUBLE
-                        *current_code_ptr++ = 0xBC800100 | (fp_arg_regs[xmm_reg_idx] << 0) | (ARM64_REG_X8 << 5); // LDR Dn, [X8]
-                    }
-                    xmm_reg_idx++;
-                } else {
-                    to_stack = true;
-                }
-            } else if (is_current_param_int128_type) {
-                // 128-bit integers consume two GPRs
-                if (gp_reg_idx <= 6) { // Check if at least two GPRs are available (X0-X7)
-                    goes_to_reg = true;
-                    // LDR Xn, [X8] (lower 64 bits)
-                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(gp_arg_regs[gp_reg_idx], ARM64_REG_X8, 0);
-                    // LDR Xn+1, [X8, #8] (upper 64 bits)
-                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(gp_arg_regs[gp_reg_idx+1], ARM64_REG_X8, 8);
-                    gp_reg_idx += 2; // Consume two GPRs
-                } else {
-                    to_stack = true;
-                }
-            } else { // All other types (integers, bool, char, pointer, wchar_t, size_t)
-                if (gp_reg_idx < 8) { // 8 GPRs for AAPCS64
-                    goes_to_reg = true;
-                    unsigned char dest_reg = gp_arg_regs[gp_reg_idx];
-                    // Load value from [X8] into dest_reg, with appropriate zero/sign extension
-                    switch (param_type) {
-                        case FFI_TYPE_BOOL:
-                        case FFI_TYPE_CHAR:
-                        case FFI_TYPE_UCHAR:
-                            // LDRB Wd, [Xn] (zero-extends to 32-bit, then to 64-bit)
-                            *current_code_ptr++ = 0x38400100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
-                            break;
-                        case FFI_TYPE_SCHAR:
-                            // LDRSB Wd, [Xn] (sign-extends to 32-bit, then to 64-bit)
-                            *current_code_ptr++ = 0x38C00100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
-                            break;
-                        case FFI_TYPE_SHORT:
-                        case FFI_TYPE_USHORT:
-                        case FFI_TYPE_WCHAR: // wchar_t is 4 bytes on Linux/macOS, 2 bytes on Win64. Assume 4 for ARM64.
-                            // LDRH Wd, [Xn] (zero-extends for unsigned, sign-extends for signed)
-                            if (param_type == FFI_TYPE_USHORT || param_type == FFI_TYPE_WCHAR) {
-                                *current_code_ptr++ = 0x78400100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
-                            } else { // FFI_TYPE_SHORT, FFI_TYPE_SSHORT
-                                *current_code_ptr++ = 0x78C00100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
-                            }
-                            break;
-                        case FFI_TYPE_SSHORT:
-                            // LDRSH Wd, [Xn] (sign-extends to 32-bit, then to 64-bit)
-                            *current_code_ptr++ = 0x78C00100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
-                            break;
-                        case FFI_TYPE_INT:
-                        case FFI_TYPE_UINT:
-                        case FFI_TYPE_SINT:
-                        case FFI_TYPE_LONG: // 64-bit on AAPCS64
-                        case FFI_TYPE_ULONG:
-                        case FFI_TYPE_LLONG:
-                        case FFI_TYPE_ULLONG:
-                        case FFI_TYPE_POINTER:
-                        case FFI_TYPE_SIZE_T:
-                        case FFI_TYPE_SLONG:
-                        case FFI_TYPE_SLLONG:
-                            // LDR Xd, [Xn] (64-bit load)
-                            *current_code_ptr++ = ARM64_LDR_X_X_IMM(dest_reg, ARM64_REG_X8, 0);
-                            break;
-                        default: return 0; // Error
-                    }
-                    gp_reg_idx++;
-                } else {
-                    to_stack = true;
-                }
-            }
-
-            if (to_stack) {
-                // Stack arguments are placed relative to SP.
-                // Current SP is already adjusted by prologue and for alignment.
-                // The stack arguments start at SP + 0, then SP + 8, etc.
-                size_t stack_offset_from_sp = (size_t)stack_arg_current_idx * 8;
+/**
+ * @brief Flushes the instruction cache for a given memory range.
+ * This is crucial after writing executable code.
+ * @param addr The start address of the memory range.
+ * @param len The length of the memory range.
+ */
+void ffi_flush_instruction_cache(void* addr, size_t len) {
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.icache_flushes, 1);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.icache_bytes_flushed, (int64_t)len);
+#if defined(__GNUC__) || defined(__clang__)
+    // For GCC/Clang on Linux/macOS/ARM, __builtin___clear_cache is available.
+    // It's a no-op on x86-64 as instruction cache coherency is handled by hardware.
+    // But it's essential for ARM.
+    __builtin___clear_cache((char*)addr, (char*)addr + len);
+    ffi_log_info("Instruction cache flushed for %p - %p (GCC/Clang builtin).", addr, (char*)addr + len);
+#elif defined(FFI_OS_WIN64)
+    // For Windows, use FlushInstructionCache
+    if (!FlushInstructionCache(GetCurrentProcess(), addr, len)) {
+        ffi_log_error("WARNING: FlushInstructionCache failed with error: %lu", GetLastError());
+    } else {
+        ffi_log_info("Instruction cache flushed for %p - %p (Win64).", addr, (char*)addr + len);
+    }
+#else
+    ffi_log_error("WARNING: Instruction cache flush not implemented for this platform.");
+#endif
+}
 
-                if (is_current_param_int128_type) {
-                    // LDR X9, [X8] (lower 64 bits into scratch X9)
-                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(ARM64_REG_X9, ARM64_REG_X8, 0);
-                    // LDR X10, [X8, #8] (upper 64 bits into scratch X10)
-                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(ARM64_REG_X10, ARM64_REG_X8, 8);
 
-                    // STR X9, [SP, #offset_low]
-                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X9, ARM64_REG_SP, stack_offset_from_sp);
-                    // STR X10, [SP, #offset_high]
-                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X10, ARM64_REG_SP, stack_offset_from_sp + 8);
-                    stack_arg_current_idx += 2;
-                } else if (is_current_param_xmm_type) {
-                    // LDR Dn, [X8] (load into scratch V8)
-                    if (param_type == FFI_TYPE_FLOAT) {
-                        *current_code_ptr++ = 0xBC400100 | (ARM64_REG_V8 << 0) | (ARM64_REG_X8 << 5); // LDR S8, [X8]
-                    } else { // FFI_TYPE_DOUBLE
-                        *current_code_ptr++ = 0xBC800100 | (ARM64_REG_V8 << 0) | (ARM64_REG_X8 << 5); // LDR D8, [X8]
-                    }
-                    // STR Dn, [SP, #offset]
-                    if (param_type == FFI_TYPE_FLOAT) {
-                        *current_code_ptr++ = 0xBC000100 | (ARM64_REG_V8 << 0) | (ARM64_REG_SP << 5) | ((stack_offset_from_sp/4) << 10); // STR S8, [SP, #offset]
-                    } else { // FFI_TYPE_DOUBLE
-                        *current_code_ptr++ = 0xBC200100 | (ARM64_REG_V8 << 0) | (ARM64_REG_SP << 5) | ((stack_offset_from_sp/8) << 10); // STR D8, [SP, #offset]
-                    }
-                    stack_arg_current_idx++;
-                } else { // GPR types to stack
-                    // LDR X9, [X8] (load into scratch X9)
-                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(ARM64_REG_X9, ARM64_REG_X8, 0);
-                    // STR X9, [SP, #offset]
-                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X9, ARM64_REG_SP, stack_offset_from_sp);
-                    stack_arg_current_idx++;
-                }
-            }
-        }
+#ifdef FFI_ARCH_X64
+/**
+ * @brief Emits the ModR/M, SIB and displacement bytes for an `[rsp + disp]` memory operand.
+ * Picks the short disp8 form when the offset fits, disp32 otherwise.
+ * @param p Current write position in the code buffer (opcode bytes already emitted).
+ * @param reg_code The 3-bit ModR/M.Reg field (register operand or opcode extension).
+ * @param disp The non-negative byte offset from RSP.
+ * @return The advanced write position.
+ */
+static unsigned char* emit_x86_64_rsp_operand(unsigned char* p, unsigned char reg_code, size_t disp) {
+    if (disp <= 127) {
+        *p++ = (unsigned char)((MOD_DISP8 << 6) | ((reg_code & 0x07) << 3) | RM_SIB_BYTE_FOLLOWS);
+        *p++ = SIB_BYTE_RSP;
+        *p++ = (unsigned char)disp;
+    } else {
+        uint32_t disp32 = (uint32_t)disp;
+        *p++ = (unsigned char)((MOD_DISP32 << 6) | ((reg_code & 0x07) << 3) | RM_SIB_BYTE_FOLLOWS);
+        *p++ = SIB_BYTE_RSP;
+        memcpy(p, &disp32, 4);
+        p += 4;
     }
+    return p;
+}
 
-    // --- Call Target Function ---
-    // LDR X16, #target_addr_val_offset (load target address into X16 - temporary)
-    // This requires a PC-relative load or a literal pool. For simplicity, we'll use MOV.
-    // MOV X16, #high_part
-    // MOVK X16, #low_part
-    // This is a simplified direct load. A real implementation would use ADRP/ADD or LDR literal.
-    // For now, assuming direct 64-bit immediate load (which is not directly possible in one instruction)
-    // This needs to be done in multiple instructions: MOVZ, MOVK.
-    // Example: MOVZ X16, #lower16
-    // MOVK X16, #mid16, LSL #16
-    // MOVK X16, #mid_high16, LSL #32
-    // MOVK X16, #upper16, LSL #48
-
-    // This is a placeholder for a 64-bit address load.
-    // A proper implementation would use ADRP/ADD or LDR literal.
-    // For now, we'll just put the address in X16 (assuming it's a small offset or direct load is possible for testing)
-    // This is the most complex part of ARM64 assembly generation.
-    // For simplicity, we'll assume the target address is loaded into X16.
-    // A more robust solution would involve a literal pool or ADRP/ADD.
-    // For now, we'll just use a placeholder for the target address.
-    // The `BLR X16` instruction will branch to the address in X16.
+/**
+ * @brief Error path called by raw syscall trampolines.
+ * Translates the kernel's negative errno return into the libc convention.
+ * @param raw_result The raw value returned in RAX by the `syscall` instruction (-errno).
+ * @return Always -1, with errno set to the positive error code.
+ */
+static long ffi_syscall_error(long raw_result) {
+    errno = (int)-raw_result;
+    return -1;
+}
 
-    // Load target_addr_val into X16 (scratch register)
-    // This is a simplified sequence for loading a 64-bit constant.
-    // It assumes the address fits in a sequence of MOVZ/MOVK instructions.
-    // For a full 64-bit arbitrary address, it takes 4 instructions.
-    // MOVZ X16, #lower_16_bits
-    *current_code_ptr++ = 0xD2800000 | ((target_addr_val & 0xFFFF) << 5) | (ARM64_REG_X16);
-    // MOVK X16, #next_16_bits, LSL #16
-    *current_code_ptr++ = 0xF2800000 | (((target_addr_val >> 16) & 0xFFFF) << 5) | (1 << 21) | (ARM64_REG_X16);
-    // MOVK X16, #next_16_bits, LSL #32
-    *current_code_ptr++ = 0xF2800000 | (((target_addr_val >> 32) & 0xFFFF) << 5) | (2 << 21) | (ARM64_REG_X16);
-    // MOVK X16, #upper_16_bits, LSL #48
-    *current_code_ptr++ = 0xF2800000 | (((target_addr_val >> 48) & 0xFFFF) << 5) | (3 << 21) | (ARM64_REG_X16);
+/**
+ * @brief Generates x86-64 System V ABI trampoline bytes.
+ * @param code_buffer Pointer to the memory where the assembly bytes will be written.
+ * @param sig A pointer to the FFI_FunctionSignature.
+ * @return The size of the generated assembly code in bytes.
+ */
+size_t generate_x86_64_sysv_trampoline(unsigned char* code_buffer, FFI_FunctionSignature* sig) {
+    unsigned char *current_code_ptr = code_buffer;
+    long target_addr_val;
 
+    // The trampoline itself will be called by C with this signature:
+    // void (*GenericTrampoline)(FFI_Argument* args, int num_args, void* return_buffer_ptr)
+    // Register mapping for this trampoline call (System V):
+    // %rdi: FFI_Argument* args (base address of the FFI_Argument array)
+    // %rsi: int num_args (number of arguments in the array)
+    // %rdx: void* return_buffer_ptr (pointer to where the return value should be stored)
 
-    // BLR X16 (Branch with Link to Register X16)
-    *current_code_ptr++ = ARM64_BLR(ARM64_REG_X16);
+    // --- CET Compliance: endbr64 ---
+    *current_code_ptr++ = 0xF3;
+    *current_code_ptr++ = 0x0F;
+    *current_code_ptr++ = 0x1E;
+    *current_code_ptr++ = OPCODE_END_BRANCH_64; // 0xFA
 
-    // --- Return Value Handling ---
-    // Store return value (from X0/V0) into (X20)
-    if (sig->return_type != FFI_TYPE_VOID) {
-        if (return_struct_by_pointer) {
-            // If returning by pointer, the target function wrote to X0 (our X20).
-            // No explicit store needed here.
-        } else {
-            switch (sig->return_type) {
-                case FFI_TYPE_BOOL:
-                case FFI_TYPE_CHAR:
-                case FFI_TYPE_UCHAR:
-                case FFI_TYPE_SCHAR:
-                    // STRB W0, [X20]
-                    *current_code_ptr++ = 0x38000000 | (ARM64_REG_X0 << 0) | (ARM64_REG_X20 << 5);
-                    break;
-                case FFI_TYPE_SHORT:
-                case FFI_TYPE_USHORT:
-                case FFI_TYPE_SSHORT:
-                case FFI_TYPE_WCHAR:
-                    // STRH W0, [X20]
-                    *current_code_ptr++ = 0x78000000 | (ARM64_REG_X0 << 0) | (ARM64_REG_X20 << 5);
-                    break;
-                case FFI_TYPE_INT:
-                case FFI_TYPE_UINT:
-                case FFI_TYPE_SINT:
-                case FFI_TYPE_LONG:
-                case FFI_TYPE_ULONG:
-                case FFI_TYPE_SLONG:
-                    // STR W0, [X20] (store 32-bit value)
-                    *current_code_ptr++ = 0xB8000000 | (ARM64_REG_X0 << 0) | (ARM64_REG_X20 << 5);
-                    break;
-                case FFI_TYPE_LLONG:
-                case FFI_TYPE_ULLONG:
-                case FFI_TYPE_POINTER:
-                case FFI_TYPE_SIZE_T:
-                case FFI_TYPE_SLLONG:
-                    // STR X0, [X20] (store 64-bit value)
-                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X0, ARM64_REG_X20, 0);
-                    break;
-                case FFI_TYPE_FLOAT:
-                    // STR S0, [X20]
-                    *current_code_ptr++ = 0xBC000000 | (ARM64_REG_V0 << 0) | (ARM64_REG_X20 << 5);
-                    break;
-                case FFI_TYPE_DOUBLE:
-                    // STR D0, [X20]
-                    *current_code_ptr++ = 0xBC200000 | (ARM64_REG_V0 << 0) | (ARM64_REG_X20 << 5);
-                    break;
-                case FFI_TYPE_INT128:
-                case FFI_TYPE_UINT128:
-                    // Return value in X0:X1 (X0 is lower 64, X1 is upper 64)
-                    // STR X0, [X20] (store lower 64)
-                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X0, ARM64_REG_X20, 0);
-                    // STR X1, [X20, #8] (store upper 64)
-                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X1, ARM64_REG_X20, 8);
-                    break;
-                default: return 0; // Indicate error
-            }
-        }
-    }
+    // --- Prologue ---
+    // push %rbp
+    *current_code_ptr++ = OPCODE_PUSH_RBP;
 
-    // --- Epilogue ---
-    // Reverse stack alignment
-    if (final_stack_subtraction > 0) {
-        // ADD SP, SP, #final_stack_subtraction
-        *current_code_ptr++ = 0x91000000 | ((final_stack_subtraction & 0xFFF) << 10) | (ARM64_REG_SP << 5) | ARM64_REG_SP;
-    }
+    // mov %rsp, %rbp
+    *current_code_ptr++ = REX_W_PREFIX;
+    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64
+    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RSP << 3) | MODRM_REG_RBP;
 
-    // Restore callee-saved registers
-    // LDP X19, X20, [SP], #16
-    *current_code_ptr++ = 0xA8C14FF3; // LDP X19, X20, [SP], #16
+    // Save callee-saved registers that we'll use: R12, R14
+    // System V callee-saved: RBX, RBP, R12, R13, R14, R15
+    // We are using R14 (for args_ptr) and R12 (for return_buffer_ptr) as callee-saved.
+    // R10 and R11 are caller-saved, so we don't need to save/restore them unless we need their values across calls.
+    // In this trampoline, R10 and R11 are scratch, so no explicit save/restore for them.
+    // R14 (args pointer from rdi)
+    *current_code_ptr++ = REX_PUSH_POP_R14_PREFIX; // 0x41
+    *current_code_ptr++ = OPCODE_PUSH_R14_BYTE;    // 0x56
 
-    // LDP X29, X30, [SP], #16
-    *current_code_ptr++ = 0xA8C17BFD; // LDP X29, X30, [SP], #16
+    // mov %rdi, %r14 (Save args pointer from rdi to r14 for later use in argument marshalling)
+    *current_code_ptr++ = REX_WB_PREFIX; // 0x49 (W=1, B=1 for R14)
+    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64 (store rdi to r14)
+    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RDI << 3) | MODRM_REG_R14_CODE; // 0xCE
 
-    // RET (return from function)
-    *current_code_ptr++ = ARM64_RET();
+    // R12 (return_buffer_ptr from rdx)
+    *current_code_ptr++ = REX_PUSH_POP_R12_PREFIX; // 0x41
+    *current_code_ptr++ = OPCODE_PUSH_R12_BYTE;    // 0x54
 
-    return (size_t)((unsigned char*)current_code_ptr - code_buffer);
-}
+    // mov %rdx, %r12 (Save return_buffer_ptr from rdx to r12)
+    *current_code_ptr++ = REX_WB_PREFIX; // 0x49 (W=1, B=1 for R12)
+    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64 (store rdx to r12)
+    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RDX << 3) | MODRM_REG_R12_CODE; // 0xEA
+
+    // --- Determine Stack Arguments and Calculate Total Stack Space ---
+    // Classification follows the System V psABI: INTEGER values use RDI..R9, SSE values use
+    // XMM0..XMM7, and a value that needs two registers of a class goes entirely to memory
+    // when fewer than two remain (later arguments may still use the leftover register).
+    // Memory-class values are laid out in 8-byte slots; __int128 and long double slots are
+    // 16-byte aligned.
+    int num_gp_regs_used = 0;
+    int num_xmm_regs_used = 0;
+    size_t stack_args_total_size = 0; // Bytes of outgoing stack arguments, including alignment padding
+
+    for (int i = 0; i < sig->num_params; ++i) {
+        FFI_Type param_type = sig->param_types[i];
+        if (param_type == FFI_TYPE_LONG_DOUBLE) {
+            // Class X87: always passed in memory
+            stack_args_total_size = ((stack_args_total_size + 15) & ~(size_t)15) + 16;
+        } else if (param_type == FFI_TYPE_DOUBLE_COMPLEX) {
+            // Two SSE eightbytes: real part and imaginary part in consecutive XMM registers
+            if (num_xmm_regs_used <= 6) {
+                num_xmm_regs_used += 2;
+            } else {
+                stack_args_total_size += 16;
+            }
+        } else if (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE ||
+                   param_type == FFI_TYPE_FLOAT16 || param_type == FFI_TYPE_BFLOAT16 ||
+                   param_type == FFI_TYPE_FLOAT_COMPLEX) { // float complex is a single SSE eightbyte
+            if (num_xmm_regs_used < 8) { // System V has 8 XMM registers (XMM0-XMM7)
+                num_xmm_regs_used++;
+            } else {
+                stack_args_total_size += 8;
+            }
+        } else if (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128) {
+            // 128-bit integers consume two GPRs or a 16-byte aligned stack slot
+            // System V GPRs: RDI, RSI, RDX, RCX, R8, R9 (6 registers)
+            if (num_gp_regs_used <= 4) { // If num_gp_regs_used is 5, we only have R9 left, so it spills.
+                num_gp_regs_used += 2; // Consumes two GPRs
+            } else {
+                stack_args_total_size = ((stack_args_total_size + 15) & ~(size_t)15) + 16;
+            }
+        } else { // All other types (integers, bool, char, pointer, wchar_t, size_t) go to GPRs
+            if (num_gp_regs_used < 6) { // System V has 6 GPRs
+                num_gp_regs_used++;
+            } else {
+                stack_args_total_size += 8;
+            }
+        }
+    }
+
+    // After push RBP, push R14, push R12 (plus the return address), RSP is 16-byte aligned.
+    // Keeping the subtraction a multiple of 16 keeps it aligned at the CALL, as the ABI requires.
+    size_t final_stack_subtraction = (stack_args_total_size + 15) & ~(size_t)15;
+    FFI_CallStats* stats = sig->call_stats;
+    if (stats != NULL && stats->mode == FFI_INSTRUMENT_TIME) {
+        final_stack_subtraction += 16; // [RBP-24] holds the start timestamp, above any outgoing arguments
+    }
+
+    if (final_stack_subtraction > 0) {
+        *current_code_ptr++ = REX_W_PREFIX; // REX.W prefix for 64-bit operation
+        if (final_stack_subtraction <= 127) {
+            *current_code_ptr++ = OPCODE_SUB_IMM8_RSP; // 0x83 (SUB r/m64, imm8)
+            *current_code_ptr++ = (MOD_REGISTER << 6) | (0x05 << 3) | MODRM_REG_RSP; // Mod=11, Reg=Group 5 (SUB), R/M=RSP (0x04) -> 0xEC
+            *current_code_ptr++ = (unsigned char)final_stack_subtraction; // imm8
+        } else {
+            uint32_t imm32 = (uint32_t)final_stack_subtraction;
+            *current_code_ptr++ = OPCODE_ALU_IMM32_RM64; // 0x81 (SUB r/m64, imm32)
+            *current_code_ptr++ = (MOD_REGISTER << 6) | (0x05 << 3) | MODRM_REG_RSP;
+            memcpy(current_code_ptr, &imm32, 4);
+            current_code_ptr += 4;
+        }
+    }
+
+    if (stats != NULL) {
+        // movabs r11, &stats->calls ; lock inc qword [r11]
+        uint64_t counter = (uint64_t)(uintptr_t)&stats->calls;
+        *current_code_ptr++ = REX_WB_PREFIX;
+        *current_code_ptr++ = OPCODE_MOV_IMM64_RAX + MODRM_REG_R11_CODE; // 0xBB
+        memcpy(current_code_ptr, &counter, 8);
+        current_code_ptr += 8;
+        static const unsigned char lock_inc_r11[] = { 0xF0, 0x49, 0xFF, 0x03 };
+        memcpy(current_code_ptr, lock_inc_r11, sizeof(lock_inc_r11));
+        current_code_ptr += sizeof(lock_inc_r11);
+        if (stats->mode == FFI_INSTRUMENT_TIME) {
+            // rdtsc ; shl rdx, 32 ; or rax, rdx ; mov [rbp-24], rax
+            static const unsigned char start_timer[] = { 0x0F, 0x31, 0x48, 0xC1, 0xE2, 0x20, 0x48, 0x09, 0xD0, 0x48, 0x89, 0x45, 0xE8 };
+            memcpy(current_code_ptr, start_timer, sizeof(start_timer));
+            current_code_ptr += sizeof(start_timer);
+        }
+    }
+
+    // --- Argument Marshalling ---
+    int gp_reg_idx = 0;
+    int xmm_reg_idx = 0;
+    size_t stack_offset_cursor = 0; // Offset from RSP of the next outgoing stack slot
+
+    // Array of GPR argument registers in order: RDI, RSI, RDX, RCX, R8, R9
+    unsigned char gp_arg_regs[] = { MODRM_REG_RDI, MODRM_REG_RSI, MODRM_REG_RDX, MODRM_REG_RCX, MODRM_REG_R8_CODE, MODRM_REG_R9_CODE };
+    bool gp_arg_regs_needs_rex_r[] = { false, false, false, false, true, true }; // R8, R9 need REX.R
+
+    if (sig->num_params > 0 && sig->param_types != NULL) {
+        for (int i = 0; i < sig->num_params; ++i) {
+            FFI_Type param_type = sig->param_types[i];
+
+            // Load args[i].value_ptr into R10 (temporary register for base address)
+            size_t current_arg_value_ptr_offset = (size_t)i * sizeof(FFI_Argument);
+            *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT; // 0x4D (W=1, R=1, B=1)
+            *current_code_ptr++ = OPCODE_MOV_R64_RM64; // mov r64, r/m64 (LOAD from memory)
+            *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R10_CODE << 3) | MODRM_REG_R14_CODE); // Mod=01, Reg=R10, R/M=R14_CODE
+            *current_code_ptr++ = (unsigned char)current_arg_value_ptr_offset; // disp8
+
+            // _Float16 and __bf16 are SSE-class: they travel in the low 16 bits of an XMM register.
+            bool is_current_param_half_type = (param_type == FFI_TYPE_FLOAT16 || param_type == FFI_TYPE_BFLOAT16);
+            // Types that occupy exactly one XMM register (float complex packs both parts into one eightbyte).
+            bool is_current_param_xmm_type = (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE ||
+                                              param_type == FFI_TYPE_FLOAT_COMPLEX || is_current_param_half_type);
+            bool is_current_param_int128_type = (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128);
+            bool to_stack = false;
+
+            if (is_current_param_half_type) {
+                // movzx r11d, word [r10] (both register and stack paths start here)
+                *current_code_ptr++ = REX_BASE_0x40_BIT | REX_R_BIT | REX_B_BIT;
+                *current_code_ptr++ = 0x0F;
+                *current_code_ptr++ = OPCODE_MOVZX_R_RM16;
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+            }
+
+            if (param_type == FFI_TYPE_LONG_DOUBLE) {
+                to_stack = true; // Class X87 is never passed in registers
+            } else if (param_type == FFI_TYPE_DOUBLE_COMPLEX) {
+                if (xmm_reg_idx <= 6) {
+                    // movsd xmmN, [r10] (real) ; movsd xmmN+1, [r10 + 8] (imaginary)
+                    for (int part = 0; part < 2; ++part) {
+                        *current_code_ptr++ = PREFIX_MOVSD;
+                        *current_code_ptr++ = REX_BASE_0x40_BIT | REX_B_BIT; // REX.B for R10 as base
+                        *current_code_ptr++ = 0x0F;
+                        *current_code_ptr++ = OPCODE_XMM_MOV_XMM_RM;
+                        *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | ((MODRM_REG_XMM0_CODE + xmm_reg_idx) << 3) | MODRM_REG_R10_CODE);
+                        *current_code_ptr++ = (unsigned char)(part * 8);
+                        xmm_reg_idx++;
+                    }
+                } else {
+                    to_stack = true;
+                }
+            } else if (is_current_param_half_type) {
+                if (xmm_reg_idx < 8) {
+                    // movd xmmN, r11d
+                    *current_code_ptr++ = 0x66;
+                    *current_code_ptr++ = REX_BASE_0x40_BIT | REX_B_BIT; // REX.B for R11
+                    *current_code_ptr++ = 0x0F;
+                    *current_code_ptr++ = OPCODE_MOVD_GPR_XMM;
+                    *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | ((MODRM_REG_XMM0_CODE + xmm_reg_idx) << 3) | MODRM_REG_R11_CODE);
+                    xmm_reg_idx++;
+                } else {
+                    to_stack = true;
+                }
+            } else if (is_current_param_xmm_type) {
+                if (xmm_reg_idx < 8) { // 8 XMM registers for System V
+                    // MOVSS XMMn, [R10] for float; MOVSD XMMn, [R10] for double and float complex (8 bytes)
+                    unsigned char xmm_prefix = (param_type == FFI_TYPE_FLOAT) ? PREFIX_MOVSS : PREFIX_MOVSD;
+                    unsigned char xmm_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT; // REX.B for R10 as base
+                    // XMM0-XMM7 do not need REX.R bit.
+                    *current_code_ptr++ = xmm_prefix;
+                    *current_code_ptr++ = xmm_rex_prefix;
+                    *current_code_ptr++ = 0x0F;
+                    *current_code_ptr++ = OPCODE_XMM_MOV_XMM_RM; // 0x10
+                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | ((MODRM_REG_XMM0_CODE + xmm_reg_idx) << 3) | MODRM_REG_R10_CODE);
+                    xmm_reg_idx++;
+                } else {
+                    to_stack = true;
+                }
+            } else if (is_current_param_int128_type) {
+                // 128-bit integers need two GPRs
+                if (gp_reg_idx <= 4) { // Check if there are at least two registers remaining (R9 is gp_reg_idx 5)
+                    // Load lower 64 bits from [R10] into first GPR
+                    unsigned char dest_reg_low = gp_arg_regs[gp_reg_idx];
+                    bool needs_rex_r_low = gp_arg_regs_needs_rex_r[gp_reg_idx];
+                    unsigned char rex_prefix_low = REX_W_PREFIX | REX_B_BIT;
+                    if (needs_rex_r_low) rex_prefix_low |= REX_R_BIT;
+                    *current_code_ptr++ = rex_prefix_low;
+                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV reg, [mem]
+                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (dest_reg_low << 3) | MODRM_REG_R10_CODE);
+
+                    // Load upper 64 bits from [R10 + 8] into second GPR
+                    unsigned char dest_reg_high = gp_arg_regs[gp_reg_idx + 1];
+                    bool needs_rex_r_high = gp_arg_regs_needs_rex_r[gp_reg_idx + 1];
+                    unsigned char rex_prefix_high = REX_W_PREFIX | REX_B_BIT;
+                    if (needs_rex_r_high) rex_prefix_high |= REX_R_BIT;
+                    *current_code_ptr++ = rex_prefix_high;
+                    *current_code_ptr++ = OPCODE_MOV_R64_RM64; // MOV reg, [mem]
+                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (dest_reg_high << 3) | MODRM_REG_R10_CODE);
+                    *current_code_ptr++ = 0x08; // disp8 = 8 (for upper 64 bits)
+
+                    gp_reg_idx += 2; // Consume two GPRs
+                } else {
+                    to_stack = true;
+                }
+            } else { // All other types (integers, bool, char, pointer, wchar_t, size_t)
+                if (gp_reg_idx < 6) { // 6 GPRs for System V
+                    unsigned char dest_reg_code = gp_arg_regs[gp_reg_idx];
+                    bool use_rex_r_for_dest_reg = gp_arg_regs_needs_rex_r[gp_reg_idx];
+                    unsigned char current_opcode;
+                    unsigned char modrm = (unsigned char)((MOD_INDIRECT << 6) | (dest_reg_code << 3) | MODRM_REG_R10_CODE);
+                    unsigned char final_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT;
+                    if (use_rex_r_for_dest_reg) final_rex_prefix |= REX_R_BIT;
+
+                    switch (param_type) {
+                        case FFI_TYPE_BOOL:
+                        case FFI_TYPE_CHAR:
+                        case FFI_TYPE_UCHAR:
+                            current_opcode = 0xB6; // MOVZX r64, r/m8
+                            final_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
+                            break;
+                        case FFI_TYPE_SCHAR:
+                            current_opcode = 0xBE; // MOVSX r64, r/m8
+                            final_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
+                            break;
+                        case FFI_TYPE_SHORT:
+                        case FFI_TYPE_SSHORT:
+                            current_opcode = 0xBF; // MOVSX r64, r/m16
+                            final_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = 0x66; *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
+                            break;
+                        case FFI_TYPE_USHORT:
+                            current_opcode = 0xB7; // MOVZX r64, r/m16
+                            final_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = 0x66; *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
+                            break;
+                        case FFI_TYPE_INT:
+                        case FFI_TYPE_SINT:
+                        case FFI_TYPE_WCHAR:
+                            current_opcode = 0x63; // MOVSXD r64, r/m32
+                            final_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
+                            break;
+                        case FFI_TYPE_UINT:
+                            current_opcode = OPCODE_MOV_R64_RM64; // MOV r32, r/m32 (zero-extends)
+                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
+                            break;
+                        case FFI_TYPE_LONG:
+                        case FFI_TYPE_ULONG:
+                        case FFI_TYPE_LLONG:
+                        case FFI_TYPE_ULLONG:
+                        case FFI_TYPE_POINTER:
+                        case FFI_TYPE_SIZE_T:    // size_t is typically 64-bit on x86-64
+                        case FFI_TYPE_SLONG:
+                        case FFI_TYPE_SLLONG:
+                            current_opcode = OPCODE_MOV_R64_RM64; // MOV r64, r/m64
+                            final_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = final_rex_prefix; *current_code_ptr++ = current_opcode; *current_code_ptr++ = modrm;
+                            break;
+                        default: return 0; // Error
+                    }
+                    gp_reg_idx++;
+                } else {
+                    to_stack = true;
+                }
+            }
+
+            if (to_stack) {
+                // Everything headed for memory goes through R11 (caller-saved and not an argument
+                // register), so registers that already hold earlier arguments are never clobbered.
+                size_t slot_size = 8;
+                if (is_current_param_int128_type || param_type == FFI_TYPE_LONG_DOUBLE) {
+                    stack_offset_cursor = (stack_offset_cursor + 15) & ~(size_t)15;
+                    slot_size = 16;
+                } else if (param_type == FFI_TYPE_DOUBLE_COMPLEX) {
+                    slot_size = 16;
+                }
+
+                if (is_current_param_half_type) {
+                    // Already zero-extended into R11 above; a single store follows.
+                } else if (param_type == FFI_TYPE_FLOAT) {
+                    // mov r11d, [r10] (4 bytes; never read past the float)
+                    *current_code_ptr++ = REX_BASE_0x40_BIT | REX_R_BIT | REX_B_BIT;
+                    *current_code_ptr++ = OPCODE_MOV_R64_RM64;
+                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+                } else if (is_current_param_xmm_type || is_current_param_int128_type ||
+                           param_type == FFI_TYPE_DOUBLE_COMPLEX || param_type == FFI_TYPE_LONG_DOUBLE) {
+                    // Raw copy, one eightbyte at a time: mov r11, [r10 + k] ; mov [rsp + slot + k], r11
+                    for (size_t k = 0; k < slot_size; k += 8) {
+                        *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT;
+                        *current_code_ptr++ = OPCODE_MOV_R64_RM64;
+                        *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+                        *current_code_ptr++ = (unsigned char)k;
+                        if (k + 8 < slot_size) {
+                            *current_code_ptr++ = REX_WR_PREFIX;
+                            *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+                            current_code_ptr = emit_x86_64_rsp_operand(current_code_ptr, MODRM_REG_R11_CODE, stack_offset_cursor + k);
+                        }
+                    }
+                    // The final eightbyte is stored below, shared with the scalar paths.
+                    stack_offset_cursor += slot_size - 8;
+                } else { // GPR types to stack: load the value from (R10) into R11 with the right extension
+                    unsigned char load_rex_prefix = REX_BASE_0x40_BIT | REX_B_BIT | REX_R_BIT; // R10 is base, R11 is dest (R11's code is 0x03, needs REX.R)
+                    unsigned char load_opcode;
+                    unsigned char load_modrm = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+
+                    switch (param_type) {
+                        case FFI_TYPE_BOOL: case FFI_TYPE_CHAR: case FFI_TYPE_UCHAR:
+                            load_opcode = 0xB6; load_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
+                            break;
+                        case FFI_TYPE_SCHAR:
+                            load_opcode = 0xBE; load_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
+                            break;
+                        case FFI_TYPE_SHORT: case FFI_TYPE_SSHORT:
+                            load_opcode = 0xBF; load_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = 0x66; *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
+                            break;
+                        case FFI_TYPE_USHORT:
+                            load_opcode = 0xB7; load_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = 0x66; *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = 0x0F; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
+                            break;
+                        case FFI_TYPE_INT: case FFI_TYPE_SINT: case FFI_TYPE_WCHAR:
+                            load_opcode = 0x63; load_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
+                            break;
+                        case FFI_TYPE_UINT:
+                            load_opcode = OPCODE_MOV_R64_RM64;
+                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
+                            break;
+                        case FFI_TYPE_LONG: case FFI_TYPE_ULONG: case FFI_TYPE_LLONG: case FFI_TYPE_ULLONG:
+                        case FFI_TYPE_POINTER: case FFI_TYPE_SIZE_T: case FFI_TYPE_SLONG: case FFI_TYPE_SLLONG:
+                            load_opcode = OPCODE_MOV_R64_RM64; load_rex_prefix |= REX_W_PREFIX;
+                            *current_code_ptr++ = load_rex_prefix; *current_code_ptr++ = load_opcode; *current_code_ptr++ = load_modrm;
+                            break;
+                        default: return 0; // Error
+                    }
+                }
+
+                // Store R11 to (RSP + stack_offset_cursor)
+                *current_code_ptr++ = REX_W_PREFIX | REX_R_BIT;
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+                current_code_ptr = emit_x86_64_rsp_operand(current_code_ptr, MODRM_REG_R11_CODE, stack_offset_cursor);
+                stack_offset_cursor += 8;
+            }
+        }
+    }
+
+    if (sig->abi == FFI_ABI_SYSCALL) {
+        // --- Raw Syscall ---
+        // The kernel takes its 4th argument in R10 instead of RCX (RCX is clobbered by `syscall`).
+        // Marshalling above used the regular System V order, so just move RCX over.
+        // mov %rcx, %r10
+        *current_code_ptr++ = REX_WB_PREFIX; // 0x49 (W=1, B=1 for R10)
+        *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+        *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (MODRM_REG_RCX << 3) | MODRM_REG_R10_CODE); // 0xCA
+
+        // mov eax, imm32 (syscall number, zero-extends into RAX)
+        *current_code_ptr++ = OPCODE_MOV_IMM32_EAX;
+        int32_t syscall_number_imm = (int32_t)sig->syscall_number;
+        memcpy(current_code_ptr, &syscall_number_imm, 4);
+        current_code_ptr += 4;
+
+        // syscall
+        *current_code_ptr++ = 0x0F;
+        *current_code_ptr++ = OPCODE_SYSCALL_BYTE;
+
+        // Errno convention: the kernel returns -errno in [-4095, -1].
+        // cmp rax, -4095 ; jb .done (unsigned: anything below 0xFFFF...F001 is a success value)
+        *current_code_ptr++ = REX_W_PREFIX;
+        *current_code_ptr++ = OPCODE_CMP_RAX_IMM32;
+        int32_t errno_threshold = -4095;
+        memcpy(current_code_ptr, &errno_threshold, 4);
+        current_code_ptr += 4;
+        *current_code_ptr++ = OPCODE_JB_REL8;
+        unsigned char* jb_displacement_ptr = current_code_ptr++;
+        unsigned char* error_path_start = current_code_ptr;
+
+        // mov %rax, %rdi ; movabs rax, ffi_syscall_error ; call rax  (sets errno, returns -1)
+        *current_code_ptr++ = REX_W_PREFIX;
+        *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+        *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (MODRM_REG_RAX << 3) | MODRM_REG_RDI); // 0xC7
+        *current_code_ptr++ = REX_W_PREFIX;
+        *current_code_ptr++ = OPCODE_MOV_IMM64_RAX;
+        target_addr_val = (long)(uintptr_t)&ffi_syscall_error;
+        memcpy(current_code_ptr, &target_addr_val, 8);
+        current_code_ptr += 8;
+        *current_code_ptr++ = OPCODE_CALL_RM64;
+        *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (0x02 << 3) | MODRM_REG_RAX);
+
+        *jb_displacement_ptr = (unsigned char)(current_code_ptr - error_path_start);
+    } else {
+        // --- Call Target Function ---
+        // movabs R11, <target_func_address>. R11 rather than RAX, because AL is set below.
+        *current_code_ptr++ = REX_W_PREFIX | REX_B_BIT; // 0x49
+        *current_code_ptr++ = OPCODE_MOV_IMM64_RAX + MODRM_REG_R11_CODE; // 0xBB
+
+        target_addr_val = (long)(uintptr_t)sig->func_ptr; // Get the 64-bit address as a long (cast through uintptr_t)
+        // Write the 8-byte target function address
+        memcpy(current_code_ptr, &target_addr_val, 8);
+        current_code_ptr += 8;
+
+        // AL carries an upper bound on the vector registers used, which a variadic callee's
+        // va_start() relies on; non-variadic callees ignore it. Set last, so no marshalling
+        // code can clobber RAX after it.
+        *current_code_ptr++ = 0xB0; // MOV AL, imm8
+        *current_code_ptr++ = (unsigned char)num_xmm_regs_used; // 0..8
+
+        // call R11
+        *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41
+        *current_code_ptr++ = OPCODE_CALL_RM64; // CALL r/m64
+        *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (0x02 << 3) | MODRM_REG_R11_CODE);
+    }
+
+    // --- Return Value Handling ---
+    // Store return value (from EAX/RAX or XMM0) into (R12)
+    if (sig->return_type != FFI_TYPE_VOID) {
+        switch (sig->return_type) {
+            case FFI_TYPE_BOOL:
+            case FFI_TYPE_CHAR:
+            case FFI_TYPE_UCHAR:
+            case FFI_TYPE_SCHAR:
+                // movb AL, [R12]
+                *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41 (for R12 as base)
+                *current_code_ptr++ = 0x88; // MOV r/m8, r8 (AL is 8-bit part of RAX)
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            case FFI_TYPE_SHORT:
+            case FFI_TYPE_USHORT:
+            case FFI_TYPE_SSHORT:
+                // movw AX, [R12]
+                *current_code_ptr++ = 0x66; // Operand-size override prefix for 16-bit
+                *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41 (for R12 as base)
+                *current_code_ptr++ = 0x89; // MOV r/m16, r16 (AX is 16-bit part of RAX)
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            case FFI_TYPE_INT:
+            case FFI_TYPE_UINT:
+            case FFI_TYPE_SINT:
+            case FFI_TYPE_WCHAR: // wchar_t is typically 32-bit on Linux
+                // movl EAX, [R12]
+                *current_code_ptr++ = REX_B_PREFIX_32BIT_OP; // 0x41
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64;   // 0x89
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            case FFI_TYPE_LONG:
+            case FFI_TYPE_ULONG:
+            case FFI_TYPE_LLONG:
+            case FFI_TYPE_ULLONG:
+            case FFI_TYPE_POINTER:
+            case FFI_TYPE_SIZE_T: // size_t is typically 64-bit on x86-64
+            case FFI_TYPE_SLONG:
+            case FFI_TYPE_SLLONG:
+                // movq RAX, [R12]
+                *current_code_ptr++ = REX_WB_PREFIX;         // 0x49
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64;   // 0x89
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            case FFI_TYPE_FLOAT:
+                // movss XMM0, [R12]
+                *current_code_ptr++ = PREFIX_MOVSS;          // 0xF3
+                *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_B_BIT); // 0x41
+                *current_code_ptr++ = 0x0F;
+                *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM; // 0x11
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            case FFI_TYPE_DOUBLE:
+                // movsd XMM0, [R12]
+                *current_code_ptr++ = PREFIX_MOVSD;          // 0xF2
+                *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_B_BIT); // 0x41
+                *current_code_ptr++ = 0x0F;
+                *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM; // 0x11
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            case FFI_TYPE_INT128:
+            case FFI_TYPE_UINT128:
+                // Return value in RDX:RAX (RAX is lower 64, RDX is upper 64)
+                // Store RAX (lower) to [R12]
+                *current_code_ptr++ = REX_WB_PREFIX; // 0x49
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64; // 0x89
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+
+                // Store RDX (upper) to [R12 + 8]
+                *current_code_ptr++ = REX_WB_PREFIX; // 0x49
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64; // 0x89
+                *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_RDX << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                *current_code_ptr++ = 0x08; // disp8 = 8
+                break;
+            case FFI_TYPE_FLOAT16:
+            case FFI_TYPE_BFLOAT16:
+                // Returned in the low 16 bits of XMM0: movd eax, xmm0 ; movw [R12], ax
+                *current_code_ptr++ = 0x66;
+                *current_code_ptr++ = 0x0F;
+                *current_code_ptr++ = OPCODE_MOVD_XMM_GPR; // 0x7E
+                *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (MODRM_REG_XMM0_CODE << 3) | MODRM_REG_RAX);
+                *current_code_ptr++ = 0x66;
+                *current_code_ptr++ = REX_B_PREFIX_32BIT_OP;
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            case FFI_TYPE_FLOAT_COMPLEX:
+                // Both parts come back packed in the low 8 bytes of XMM0: movsd [R12], XMM0
+                *current_code_ptr++ = PREFIX_MOVSD;
+                *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_B_BIT);
+                *current_code_ptr++ = 0x0F;
+                *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM;
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            case FFI_TYPE_DOUBLE_COMPLEX:
+                // Real part in XMM0, imaginary part in XMM1: movsd [R12], XMM0 ; movsd [R12 + 8], XMM1
+                for (int part = 0; part < 2; ++part) {
+                    *current_code_ptr++ = PREFIX_MOVSD;
+                    *current_code_ptr++ = (REX_BASE_0x40_BIT | REX_B_BIT);
+                    *current_code_ptr++ = 0x0F;
+                    *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM;
+                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | ((MODRM_REG_XMM0_CODE + part) << 3) | RM_SIB_BYTE_FOLLOWS);
+                    *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                    *current_code_ptr++ = (unsigned char)(part * 8);
+                }
+                break;
+            case FFI_TYPE_LONG_DOUBLE:
+                // Returned in ST(0): fstp tbyte [R12] (pops the x87 stack, leaving it empty as the ABI requires)
+                *current_code_ptr++ = REX_B_PREFIX_32BIT_OP;
+                *current_code_ptr++ = OPCODE_FSTP_M80;
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (0x07 << 3) | RM_SIB_BYTE_FOLLOWS); // /7
+                *current_code_ptr++ = SIB_BYTE_R12_BASE;
+                break;
+            default: // This default case catches FFI_TYPE_UNKNOWN or any other unsupported type for return
+                return 0; // Indicate error
+        }
+    }
+
+    if (stats != NULL && stats->mode == FFI_INSTRUMENT_TIME) {
+        // rdtscp, or lfence ; rdtsc where the CPU lacks it (both wait for the call to retire)
+        static const unsigned char rdtscp[] = { 0x0F, 0x01, 0xF9 };
+        static const unsigned char lfence_rdtsc[] = { 0x0F, 0xAE, 0xE8, 0x0F, 0x31 };
+        if (FFI_ATOMIC_LOAD_U32(&g_ffi_instr_rdtscp)) {
+            memcpy(current_code_ptr, rdtscp, sizeof(rdtscp));
+            current_code_ptr += sizeof(rdtscp);
+        } else {
+            memcpy(current_code_ptr, lfence_rdtsc, sizeof(lfence_rdtsc));
+            current_code_ptr += sizeof(lfence_rdtsc);
+        }
+        // shl rdx, 32 ; or rax, rdx ; sub rax, [rbp-24] ; mov rsi, rax
+        static const unsigned char stop_timer[] = { 0x48, 0xC1, 0xE2, 0x20, 0x48, 0x09, 0xD0,
+                                                    0x48, 0x2B, 0x45, 0xE8, 0x48, 0x89, 0xC6 };
+        memcpy(current_code_ptr, stop_timer, sizeof(stop_timer));
+        current_code_ptr += sizeof(stop_timer);
+        // movabs rdi, stats ; movabs r11, ffi_call_stats_record ; call r11
+        uint64_t stats_addr = (uint64_t)(uintptr_t)stats;
+        uint64_t record_addr = (uint64_t)(uintptr_t)&ffi_call_stats_record;
+        *current_code_ptr++ = REX_W_PREFIX;
+        *current_code_ptr++ = OPCODE_MOV_IMM64_RAX + MODRM_REG_RDI; // 0xBF
+        memcpy(current_code_ptr, &stats_addr, 8);
+        current_code_ptr += 8;
+        *current_code_ptr++ = REX_WB_PREFIX;
+        *current_code_ptr++ = OPCODE_MOV_IMM64_RAX + MODRM_REG_R11_CODE; // 0xBB
+        memcpy(current_code_ptr, &record_addr, 8);
+        current_code_ptr += 8;
+        *current_code_ptr++ = REX_B_PREFIX_32BIT_OP;
+        *current_code_ptr++ = OPCODE_CALL_RM64;
+        *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (0x02 << 3) | MODRM_REG_R11_CODE);
+    }
+
+    // --- Epilogue ---
+    // Reverse stack alignment only if space was allocated
+    if (final_stack_subtraction > 0) {
+        *current_code_ptr++ = REX_W_PREFIX; // REX.W prefix for 64-bit operation
+        if (final_stack_subtraction <= 127) {
+            *current_code_ptr++ = OPCODE_ADD_IMM8_RSP; // 0x83 (ADD r/m64, imm8)
+            *current_code_ptr++ = (MOD_REGISTER << 6) | (0x00 << 3) | MODRM_REG_RSP; // Mod=11, Reg=Group 0 (ADD), R/M=RSP (0x04) -> 0xC4
+            *current_code_ptr++ = (unsigned char)final_stack_subtraction; // imm8
+        } else {
+            uint32_t imm32 = (uint32_t)final_stack_subtraction;
+            *current_code_ptr++ = OPCODE_ALU_IMM32_RM64; // 0x81 (ADD r/m64, imm32)
+            *current_code_ptr++ = (MOD_REGISTER << 6) | (0x00 << 3) | MODRM_REG_RSP;
+            memcpy(current_code_ptr, &imm32, 4);
+            current_code_ptr += 4;
+        }
+    }
+
+    // Pop R12 to restore its original value
+    *current_code_ptr++ = REX_PUSH_POP_R12_PREFIX; // 0x41
+    *current_code_ptr++ = OPCODE_POP_R12_BYTE;     // 0x5C
+
+    // Pop R14 to restore original RDI (args pointer)
+    *current_code_ptr++ = REX_PUSH_POP_R14_PREFIX;
+    *current_code_ptr++ = OPCODE_POP_R14_BYTE;
+
+    // pop RBP
+    *current_code_ptr++ = OPCODE_POP_RBP;
+
+    // ret
+    *current_code_ptr++ = OPCODE_RET;
+
+    return (size_t)(current_code_ptr - code_buffer);
+}
+
+/**
+ * @brief Emits a load of an integer-class value from [R10] into a 64-bit GPR, widened
+ * (sign- or zero-extended) to the full register as the Microsoft x64 ABI callee expects.
+ * `long` and `wchar_t` widths follow the host compiler, so an ms_abi target built by GCC on
+ * Linux (64-bit long, 32-bit wchar_t) and a native Windows target (32-bit long, 16-bit
+ * wchar_t) both receive correctly sized values.
+ * @param p Current write position in the code buffer.
+ * @param type The FFI_Type of the value at [R10].
+ * @param dest_code Low 3 bits of the destination register.
+ * @param dest_is_extended True if the destination is one of R8-R15 (needs REX.R).
+ * @return The advanced write position, or NULL if `type` is not an integer-class type.
+ */
+static unsigned char* emit_x86_64_win64_integer_load(unsigned char* p, FFI_Type type, unsigned char dest_code, bool dest_is_extended) {
+    unsigned char rex = REX_BASE_0x40_BIT | REX_B_BIT; // REX.B for R10 as base
+    if (dest_is_extended) rex |= REX_R_BIT;
+
+    switch (type) {
+        case FFI_TYPE_BOOL:
+        case FFI_TYPE_CHAR:
+        case FFI_TYPE_UCHAR:
+            *p++ = rex | REX_W_PREFIX; *p++ = 0x0F; *p++ = 0xB6; // MOVZX r64, r/m8
+            break;
+        case FFI_TYPE_SCHAR:
+            *p++ = rex | REX_W_PREFIX; *p++ = 0x0F; *p++ = 0xBE; // MOVSX r64, r/m8
+            break;
+        case FFI_TYPE_SHORT:
+        case FFI_TYPE_SSHORT:
+            *p++ = rex | REX_W_PREFIX; *p++ = 0x0F; *p++ = 0xBF; // MOVSX r64, r/m16
+            break;
+        case FFI_TYPE_USHORT:
+        case FFI_TYPE_FLOAT16:  // GCC/Clang ms_abi pass 16-bit floats as integer-class values
+        case FFI_TYPE_BFLOAT16:
+            *p++ = rex | REX_W_PREFIX; *p++ = 0x0F; *p++ = 0xB7; // MOVZX r64, r/m16
+            break;
+        case FFI_TYPE_INT:
+        case FFI_TYPE_SINT:
+            *p++ = rex | REX_W_PREFIX; *p++ = 0x63; // MOVSXD r64, r/m32
+            break;
+        case FFI_TYPE_UINT:
+            *p++ = rex; *p++ = OPCODE_MOV_R64_RM64; // MOV r32, r/m32 (zero-extends)
+            break;
+        case FFI_TYPE_LONG:
+        case FFI_TYPE_SLONG:
+            *p++ = rex | REX_W_PREFIX;
+            *p++ = (sizeof(long) == 8) ? OPCODE_MOV_R64_RM64 : 0x63; // MOV r64 / MOVSXD r64
+            break;
+        case FFI_TYPE_ULONG:
+            if (sizeof(long) == 8) rex |= REX_W_PREFIX;
+            *p++ = rex; *p++ = OPCODE_MOV_R64_RM64; // MOV r64, r/m64 or MOV r32, r/m32
+            break;
+        case FFI_TYPE_WCHAR:
+            if (sizeof(wchar_t) == 2) {
+                *p++ = rex | REX_W_PREFIX; *p++ = 0x0F; *p++ = 0xB7; // MOVZX r64, r/m16
+            } else {
+                *p++ = rex | REX_W_PREFIX; *p++ = 0x63; // MOVSXD r64, r/m32
+            }
+            break;
+        case FFI_TYPE_LLONG:
+        case FFI_TYPE_ULLONG:
+        case FFI_TYPE_SLLONG:
+        case FFI_TYPE_POINTER:
+        case FFI_TYPE_SIZE_T:
+            *p++ = rex | REX_W_PREFIX; *p++ = OPCODE_MOV_R64_RM64; // MOV r64, r/m64
+            break;
+        default:
+            return NULL;
+    }
+    *p++ = (unsigned char)((MOD_INDIRECT << 6) | ((dest_code & 0x07) << 3) | MODRM_REG_R10_CODE);
+    return p;
+}
+
+/**
+ * @brief Generates x86-64 Microsoft x64 ABI trampoline bytes (Win64).
+ * Arguments are assigned positionally: argument N uses RCX/RDX/R8/R9[N] or XMM0-3[N],
+ * never both, and the fifth and later arguments go to the stack above the 32-byte shadow
+ * space. 128-bit integers are larger than 8 bytes and so are passed by reference to a
+ * 16-byte aligned copy in the trampoline's frame. This generator works on any x86-64 host,
+ * which lets Linux builds call `__attribute__((ms_abi))` functions through FFI_ABI_WIN64.
+ * @param code_buffer Pointer to the memory where the assembly bytes will be written.
+ * @param sig A pointer to the FFI_FunctionSignature.
+ * @return The size of the generated assembly code in bytes, or 0 on an unsupported signature.
+ */
+size_t generate_x86_64_win64_trampoline(unsigned char* code_buffer, FFI_FunctionSignature* sig) {
+    unsigned char *current_code_ptr = code_buffer;
+    long target_addr_val;
+
+    // The trampoline itself will be called by C with this signature:
+    // void (*GenericTrampoline)(FFI_Argument* args, int num_args, void* return_buffer_ptr)
+    // Those three values arrive in the *host* convention's registers, independent of the
+    // target's: RCX/RDX/R8 on Windows, RDI/RSI/RDX on a System V host. The args pointer is
+    // parked in R13 and the return buffer in R14; both are callee-saved in either ABI.
+    // Only volatile scratch (R10, R11) is used below, so XMM6-XMM15, RSI and RDI, which
+    // are callee-saved under Win64, are never touched.
+
+    // --- Validate the signature up front ---
+    int num_indirect_args = 0;
+    for (int i = 0; i < sig->num_params; ++i) {
+        FFI_Type param_type = sig->param_types[i];
+        if (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128) {
+            num_indirect_args++;
+        } else if (param_type == FFI_TYPE_VOID || param_type == FFI_TYPE_UNKNOWN ||
+                   param_type == FFI_TYPE_FLOAT_COMPLEX || param_type == FFI_TYPE_DOUBLE_COMPLEX ||
+                   param_type == FFI_TYPE_LONG_DOUBLE) {
+            ffi_log_error("ERROR: Unsupported parameter type %d at index %d for Win64 trampoline '%s'.", param_type, i, sig->debug_name);
+            return 0;
+        }
+    }
+
+    // --- Prologue ---
+    // endbr64 (CET landing pad, a NOP on CPUs without IBT)
+    *current_code_ptr++ = 0xF3;
+    *current_code_ptr++ = 0x0F;
+    *current_code_ptr++ = 0x1E;
+    *current_code_ptr++ = OPCODE_END_BRANCH_64;
+
+    // push %rbp
+    *current_code_ptr++ = OPCODE_PUSH_RBP;
+
+    // mov %rsp, %rbp
+    *current_code_ptr++ = REX_W_PREFIX;
+    *current_code_ptr++ = OPCODE_MOV_RM64_R64; // mov r/m64, r64
+    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RSP << 3) | MODRM_REG_RBP;
+
+    // push %r13
+    *current_code_ptr++ = REX_PUSH_POP_R13_PREFIX;
+    *current_code_ptr++ = OPCODE_PUSH_R13_BYTE;
+
+#ifdef FFI_OS_WIN64
+    // mov %rcx, %r13 (args pointer)
+    *current_code_ptr++ = REX_WB_PREFIX;
+    *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RCX << 3) | MODRM_REG_R13_CODE;
+#else
+    // mov %rdi, %r13 (args pointer)
+    *current_code_ptr++ = REX_WB_PREFIX;
+    *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RDI << 3) | MODRM_REG_R13_CODE;
+#endif
+
+    // push %r14
+    *current_code_ptr++ = REX_PUSH_POP_R14_PREFIX;
+    *current_code_ptr++ = OPCODE_PUSH_R14_BYTE;
+
+#ifdef FFI_OS_WIN64
+    // mov %r8, %r14 (return buffer pointer)
+    *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT;
+    *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_R8_CODE << 3) | MODRM_REG_R14_CODE;
+#else
+    // mov %rdx, %r14 (return buffer pointer)
+    *current_code_ptr++ = REX_WB_PREFIX;
+    *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+    *current_code_ptr++ = (MOD_REGISTER << 6) | (MODRM_REG_RDX << 3) | MODRM_REG_R14_CODE;
+#endif
+
+    // --- Frame Layout ---
+    // Entry RSP is 8 mod 16 (return address); after pushing RBP, R13 and R14 it is 16-byte
+    // aligned, so every allocation below must be a multiple of 16 to keep the CALL aligned.
+    //   [rsp + 0]                  32-byte shadow space owned by the callee
+    //   [rsp + 32 + 8*k]           stack argument k (the fifth and later parameters)
+    //   [rsp + indirect_base + 16*j] 16-byte aligned copy of by-reference argument j
+    int num_stack_args = sig->num_params > 4 ? sig->num_params - 4 : 0;
+    size_t outgoing_area_size = 32 + (size_t)num_stack_args * 8;
+    size_t indirect_base = (outgoing_area_size + 15) & ~(size_t)15;
+    size_t total_stack_alloc = indirect_base + (size_t)num_indirect_args * 16;
+
+    // sub $total_stack_alloc, %rsp
+    *current_code_ptr++ = REX_W_PREFIX;
+    if (total_stack_alloc <= 127) {
+        *current_code_ptr++ = OPCODE_SUB_IMM8_RSP; // 0x83 /5 ib
+        *current_code_ptr++ = (MOD_REGISTER << 6) | (0x05 << 3) | MODRM_REG_RSP;
+        *current_code_ptr++ = (unsigned char)total_stack_alloc;
+    } else {
+        uint32_t imm32 = (uint32_t)total_stack_alloc;
+        *current_code_ptr++ = OPCODE_ALU_IMM32_RM64; // 0x81 /5 id
+        *current_code_ptr++ = (MOD_REGISTER << 6) | (0x05 << 3) | MODRM_REG_RSP;
+        memcpy(current_code_ptr, &imm32, 4);
+        current_code_ptr += 4;
+    }
+
+    // --- Argument Marshalling ---
+    // Win64 GPRs: RCX, RDX, R8, R9; XMMs: XMM0-XMM3. Slot N is used by argument N only.
+    unsigned char gp_arg_regs[] = { MODRM_REG_RCX, MODRM_REG_RDX, MODRM_REG_R8_CODE, MODRM_REG_R9_CODE };
+    bool gp_arg_regs_needs_rex_r[] = { false, false, true, true };
+    int indirect_idx = 0;
+
+    for (int i = 0; i < sig->num_params; ++i) {
+        FFI_Type param_type = sig->param_types[i];
+        bool in_register = i < 4;
+        size_t stack_offset = 32 + (size_t)(i - 4) * 8; // Only meaningful when !in_register
+
+        // mov r10, [r13 + i*8] (args[i].value_ptr)
+        size_t arg_offset = (size_t)i * sizeof(FFI_Argument);
+        *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT;
+        *current_code_ptr++ = OPCODE_MOV_R64_RM64;
+        if (arg_offset <= 127) {
+            *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R10_CODE << 3) | MODRM_REG_R13_CODE);
+            *current_code_ptr++ = (unsigned char)arg_offset;
+        } else {
+            uint32_t disp32 = (uint32_t)arg_offset;
+            *current_code_ptr++ = (unsigned char)((MOD_DISP32 << 6) | (MODRM_REG_R10_CODE << 3) | MODRM_REG_R13_CODE);
+            memcpy(current_code_ptr, &disp32, 4);
+            current_code_ptr += 4;
+        }
+
+        if (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE) {
+            if (in_register) {
+                // movss/movsd xmm<i>, [r10]
+                *current_code_ptr++ = (param_type == FFI_TYPE_FLOAT) ? PREFIX_MOVSS : PREFIX_MOVSD;
+                *current_code_ptr++ = REX_BASE_0x40_BIT | REX_B_BIT;
+                *current_code_ptr++ = 0x0F;
+                *current_code_ptr++ = OPCODE_XMM_MOV_XMM_RM;
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | ((MODRM_REG_XMM0_CODE + i) << 3) | MODRM_REG_R10_CODE);
+            } else {
+                // mov r11d, [r10] (float) / mov r11, [r10] (double): raw bits, no XMM scratch needed
+                unsigned char rex = REX_BASE_0x40_BIT | REX_R_BIT | REX_B_BIT;
+                if (param_type == FFI_TYPE_DOUBLE) rex |= REX_W_PREFIX;
+                *current_code_ptr++ = rex;
+                *current_code_ptr++ = OPCODE_MOV_R64_RM64;
+                *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+                // mov [rsp + stack_offset], r11
+                *current_code_ptr++ = REX_WR_PREFIX;
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+                current_code_ptr = emit_x86_64_rsp_operand(current_code_ptr, MODRM_REG_R11_CODE, stack_offset);
+            }
+        } else if (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128) {
+            // Copy the 16 bytes into the frame, then pass the copy's address. The callee may
+            // read it with aligned SSE loads, so the copy (not the caller's value) must be used.
+            size_t copy_offset = indirect_base + (size_t)indirect_idx * 16;
+            for (int half = 0; half < 2; ++half) {
+                // mov r11, [r10 + 8*half]
+                *current_code_ptr++ = REX_WR_PREFIX | REX_B_BIT;
+                *current_code_ptr++ = OPCODE_MOV_R64_RM64;
+                if (half == 0) {
+                    *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+                } else {
+                    *current_code_ptr++ = (unsigned char)((MOD_DISP8 << 6) | (MODRM_REG_R11_CODE << 3) | MODRM_REG_R10_CODE);
+                    *current_code_ptr++ = 0x08;
+                }
+                // mov [rsp + copy_offset + 8*half], r11
+                *current_code_ptr++ = REX_WR_PREFIX;
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+                current_code_ptr = emit_x86_64_rsp_operand(current_code_ptr, MODRM_REG_R11_CODE, copy_offset + (size_t)half * 8);
+            }
+            indirect_idx++;
+
+            // lea <reg>, [rsp + copy_offset]
+            unsigned char dest_reg = in_register ? gp_arg_regs[i] : MODRM_REG_R11_CODE;
+            bool dest_is_extended = in_register ? gp_arg_regs_needs_rex_r[i] : true;
+            *current_code_ptr++ = dest_is_extended ? REX_WR_PREFIX : REX_W_PREFIX;
+            *current_code_ptr++ = OPCODE_LEA_R64_M;
+            current_code_ptr = emit_x86_64_rsp_operand(current_code_ptr, dest_reg, copy_offset);
+
+            if (!in_register) {
+                // mov [rsp + stack_offset], r11
+                *current_code_ptr++ = REX_WR_PREFIX;
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+                current_code_ptr = emit_x86_64_rsp_operand(current_code_ptr, MODRM_REG_R11_CODE, stack_offset);
+            }
+        } else {
+            unsigned char dest_reg = in_register ? gp_arg_regs[i] : MODRM_REG_R11_CODE;
+            bool dest_is_extended = in_register ? gp_arg_regs_needs_rex_r[i] : true;
+            current_code_ptr = emit_x86_64_win64_integer_load(current_code_ptr, param_type, dest_reg, dest_is_extended);
+            if (current_code_ptr == NULL) {
+                ffi_log_error("ERROR: Unsupported parameter type %d at index %d for Win64 trampoline '%s'.", param_type, i, sig->debug_name);
+                return 0;
+            }
+            if (!in_register) {
+                // mov [rsp + stack_offset], r11
+                *current_code_ptr++ = REX_WR_PREFIX;
+                *current_code_ptr++ = OPCODE_MOV_RM64_R64;
+                current_code_ptr = emit_x86_64_rsp_operand(current_code_ptr, MODRM_REG_R11_CODE, stack_offset);
+            }
+        }
+    }
+
+    // --- Call Target Function ---
+    // movabs RAX, <target_func_address>
+    *current_code_ptr++ = REX_W_PREFIX;
+    *current_code_ptr++ = OPCODE_MOV_IMM64_RAX;
+
+    target_addr_val = (long)(uintptr_t)sig->func_ptr;
+    memcpy(current_code_ptr, &target_addr_val, 8);
+    current_code_ptr += 8;
+
+    // call RAX
+    *current_code_ptr++ = OPCODE_CALL_RM64;
+    *current_code_ptr++ = (unsigned char)((MOD_REGISTER << 6) | (0x02 << 3) | MODRM_REG_RAX);
+
+    // --- Return Value Handling ---
+    // Store the return value (from RAX or XMM0) into (R14), sized to the host's C type.
+    size_t return_size = 0;
+    switch (sig->return_type) {
+        case FFI_TYPE_VOID:
+            break;
+        case FFI_TYPE_BOOL:
+        case FFI_TYPE_CHAR:
+        case FFI_TYPE_UCHAR:
+        case FFI_TYPE_SCHAR:
+            return_size = 1;
+            break;
+        case FFI_TYPE_SHORT:
+        case FFI_TYPE_USHORT:
+        case FFI_TYPE_SSHORT:
+        case FFI_TYPE_FLOAT16:  // Returned in AX under ms_abi
+        case FFI_TYPE_BFLOAT16:
+            return_size = 2;
+            break;
+        case FFI_TYPE_INT:
+        case FFI_TYPE_UINT:
+        case FFI_TYPE_SINT:
+            return_size = 4;
+            break;
+        case FFI_TYPE_LONG:
+        case FFI_TYPE_ULONG:
+        case FFI_TYPE_SLONG:
+            return_size = sizeof(long);
+            break;
+        case FFI_TYPE_WCHAR:
+            return_size = sizeof(wchar_t);
+            break;
+        case FFI_TYPE_LLONG:
+        case FFI_TYPE_ULLONG:
+        case FFI_TYPE_SLLONG:
+        case FFI_TYPE_POINTER:
+        case FFI_TYPE_SIZE_T:
+            return_size = 8;
+            break;
+        case FFI_TYPE_FLOAT:
+        case FFI_TYPE_DOUBLE:
+            // movss/movsd [R14], XMM0
+            *current_code_ptr++ = (sig->return_type == FFI_TYPE_FLOAT) ? PREFIX_MOVSS : PREFIX_MOVSD;
+            *current_code_ptr++ = REX_BASE_0x40_BIT | REX_B_BIT;
+            *current_code_ptr++ = 0x0F;
+            *current_code_ptr++ = OPCODE_XMM_MOV_RM_XMM;
+            *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
+            *current_code_ptr++ = SIB_BYTE_R14_BASE;
+            break;
+        case FFI_TYPE_INT128:
+        case FFI_TYPE_UINT128:
+            // GCC and Clang return __int128 in XMM0 for x86_64-w64 targets (MSVC has no
+            // 128-bit integer type): movdqu [R14], XMM0
+            *current_code_ptr++ = PREFIX_MOVSS; // 0xF3 selects MOVDQU
+            *current_code_ptr++ = REX_BASE_0x40_BIT | REX_B_BIT;
+            *current_code_ptr++ = 0x0F;
+            *current_code_ptr++ = OPCODE_MOVDQU_RM_XMM;
+            *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_XMM0_CODE << 3) | RM_SIB_BYTE_FOLLOWS);
+            *current_code_ptr++ = SIB_BYTE_R14_BASE;
+            break;
+        default:
+            ffi_log_error("ERROR: Unsupported return type %d for Win64 trampoline '%s'.", sig->return_type, sig->debug_name);
+            return 0;
+    }
+
+    if (return_size == 2) *current_code_ptr++ = 0x66; // Operand-size override for 16-bit
+    if (return_size != 0) {
+        // mov [R14], AL/AX/EAX/RAX
+        *current_code_ptr++ = (return_size == 8) ? REX_WB_PREFIX : REX_B_PREFIX_32BIT_OP;
+        *current_code_ptr++ = (return_size == 1) ? 0x88 : OPCODE_MOV_RM64_R64;
+        *current_code_ptr++ = (unsigned char)((MOD_INDIRECT << 6) | (MODRM_REG_RAX << 3) | RM_SIB_BYTE_FOLLOWS);
+        *current_code_ptr++ = SIB_BYTE_R14_BASE;
+    }
+
+    // --- Epilogue ---
+    // add $total_stack_alloc, %rsp
+    *current_code_ptr++ = REX_W_PREFIX;
+    if (total_stack_alloc <= 127) {
+        *current_code_ptr++ = OPCODE_ADD_IMM8_RSP; // 0x83 /0 ib
+        *current_code_ptr++ = (MOD_REGISTER << 6) | (0x00 << 3) | MODRM_REG_RSP;
+        *current_code_ptr++ = (unsigned char)total_stack_alloc;
+    } else {
+        uint32_t imm32 = (uint32_t)total_stack_alloc;
+        *current_code_ptr++ = OPCODE_ALU_IMM32_RM64; // 0x81 /0 id
+        *current_code_ptr++ = (MOD_REGISTER << 6) | (0x00 << 3) | MODRM_REG_RSP;
+        memcpy(current_code_ptr, &imm32, 4);
+        current_code_ptr += 4;
+    }
+
+    // Pop R14 to restore its original value
+    *current_code_ptr++ = REX_PUSH_POP_R14_PREFIX;
+    *current_code_ptr++ = OPCODE_POP_R14_BYTE;
+
+    // Pop R13 to restore its original value
+    *current_code_ptr++ = REX_PUSH_POP_R13_PREFIX;
+    *current_code_ptr++ = OPCODE_POP_R13_BYTE;
+
+    // pop RBP
+    *current_code_ptr++ = OPCODE_POP_RBP;
+
+    // ret
+    *current_code_ptr++ = OPCODE_RET;
+
+    return (size_t)(current_code_ptr - code_buffer);
+}
+#endif // FFI_ARCH_X64
+
+#ifdef FFI_ARCH_ARM64
+/**
+ * @brief Generates ARM64 AAPCS trampoline bytes.
+ * This is a highly simplified and conceptual implementation.
+ * A complete ARM64 trampoline would require precise instruction encoding.
+ * @param code_buffer Pointer to the memory where the assembly bytes will be written.
+ * @param sig A pointer to the FFI_FunctionSignature.
+ * @return The size of the generated assembly code in bytes.
+ */
+size_t generate_arm64_aapcs_trampoline(unsigned char* code_buffer, FFI_FunctionSignature* sig) {
+    uint32_t *current_code_ptr = (uint32_t*)code_buffer;
+    uint64_t target_addr_val = (uint64_t)sig->func_ptr;
+
+    // The trampoline itself will be called by C with this signature:
+    // void (*GenericTrampoline)(FFI_Argument* args, int num_args, void* return_buffer_ptr)
+    // Register mapping for this trampoline call (AAPCS64):
+    // X0: FFI_Argument* args (base address of the FFI_Argument array)
+    // X1: int num_args (number of arguments in the array)
+    // X2: void* return_buffer_ptr (pointer to where the return value should be stored)
+
+    // --- Prologue ---
+    // Save X29 (FP) and X30 (LR) to stack, adjust SP.
+    // STP X29, X30, [SP, #-16]!
+    *current_code_ptr++ = 0xA9BF7BFD; // STP X29, X30, [SP, #-16]!
+
+    // MOV X29, SP (Frame Pointer = Stack Pointer)
+    *current_code_ptr++ = 0xF90003BD; // MOV X29, SP (actually ADD X29, SP, #0)
+
+    // Save callee-saved registers: X19-X30, V8-V15
+    // We'll use X19 (args_ptr) and X20 (return_buffer_ptr) as callee-saved.
+    // X0, X1, X2 are caller-saved and will be overwritten.
+
+    // STP X19, X20, [SP, #-16]!
+    *current_code_ptr++ = 0xA9BF4FF3; // STP X19, X20, [SP, #-16]!
+
+    // MOV X19, X0 (Save args pointer from X0 to X19)
+    *current_code_ptr++ = 0xAA0003F3; // MOV X19, X0
+
+    // MOV X20, X2 (Save return_buffer_ptr from X2 to X20)
+    *current_code_ptr++ = 0xAA0203F4; // MOV X20, X2
+
+    // --- Determine Stack Arguments and Calculate Total Stack Space ---
+    int num_gp_regs_used = 0;
+    int num_xmm_regs_used = 0;
+    int num_stack_args = 0; // Number of 8-byte slots needed on stack
+
+    // AAPCS64 GPRs: X0-X7 (8 registers)
+    // AAPCS64 FP/SIMD: V0-V7 (8 registers)
+
+    // If returning a struct > 16 bytes, the return buffer pointer is the first argument (X0).
+    bool return_struct_by_pointer = false;
+    if (sig->return_type == FFI_TYPE_INT128 || sig->return_type == FFI_TYPE_UINT128) {
+        // AAPCS64 returns 128-bit integers in X0/X1. No pointer needed.
+        // If it were a struct > 16 bytes, X0 would be used for the return buffer pointer.
+        // For now, assume 128-bit fits in X0/X1.
+    } else if (sig->return_type == FFI_TYPE_UNKNOWN) {
+        // Placeholder for larger structs
+    }
+
+    for (int i = 0; i < sig->num_params; ++i) {
+        FFI_Type param_type = sig->param_types[i];
+        if (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE) {
+            if (num_xmm_regs_used < 8) { // AAPCS64 has 8 V registers
+                num_xmm_regs_used++;
+            } else {
+                num_stack_args++;
+            }
+        } else if (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128) {
+            // 128-bit integers consume two GPRs or 16 bytes on stack
+            if (num_gp_regs_used <= 6) { // If num_gp_regs_used is 7, we only have X7 left, so it spills.
+                num_gp_regs_used += 2; // Consumes two GPRs
+            } else {
+                num_stack_args += 2; // Consumes 16 bytes on stack
+            }
+        } else { // All other types go to GPRs
+            if (num_gp_regs_used < 8) { // AAPCS64 has 8 GPRs
+                num_gp_regs_used++;
+            } else {
+                num_stack_args++;
+            }
+        }
+    }
+
+    size_t stack_args_total_size = (size_t)num_stack_args * 8;
+    size_t final_stack_subtraction = stack_args_total_size;
+
+    // SP must be 16-byte aligned.
+    // After STP X29, X30, [SP, #-16]! and STP X19, X20, [SP, #-16]!, SP is 32 bytes lower.
+    // So SP is already 16-byte aligned.
+    // We just need to ensure the total stack allocation for arguments is 16-byte aligned.
+    if ((final_stack_subtraction % 16) != 0) {
+        final_stack_subtraction += 8; // Pad to 16-byte alignment
+    }
+
+    if (final_stack_subtraction > 0) {
+        // SUB SP, SP, #final_stack_subtraction
+        *current_code_ptr++ = 0xD1000000 | ((final_stack_subtraction & 0xFFF) << 10) | (ARM64_REG_SP << 5) | ARM64_REG_SP;
+    }
+
+    // --- Argument Marshalling ---
+    int gp_reg_idx = 0;
+    int xmm_reg_idx = 0;
+    int stack_arg_current_idx = 0; // 0-indexed counter for arguments going to stack
+
+    // Array of GPR argument registers in order for AAPCS64: X0-X7
+    unsigned char gp_arg_regs[] = { ARM64_REG_X0, ARM64_REG_X1, ARM64_REG_X2, ARM64_REG_X3, ARM64_REG_X4, ARM64_REG_X5, ARM64_REG_X6, ARM64_REG_X7 };
+    // Array of FP argument registers in order for AAPCS64: V0-V7
+    unsigned char fp_arg_regs[] = { ARM64_REG_V0, ARM64_REG_V1, ARM64_REG_V2, ARM64_REG_V3, ARM64_REG_V4, ARM64_REG_V5, ARM64_REG_V6, ARM64_REG_V7 };
+
+    // If returning a struct by pointer, the return buffer pointer is the first argument (X0)
+    // and subsequent arguments shift.
+    if (return_struct_by_pointer) {
+        // MOV X0, X20 (Move saved return_buffer_ptr from X20 to X0)
+        *current_code_ptr++ = 0xAA1403E0; // MOV X0, X20
+        gp_reg_idx++; // X0 is now used for the return buffer pointer
+    }
+
+    if (sig->num_params > 0 && sig->param_types != NULL) {
+        for (int i = 0; i < sig->num_params; ++i) {
+            FFI_Type param_type = sig->param_types[i];
+
+            // Load args[i].value_ptr into X8 (temporary register for base address)
+            size_t current_arg_value_ptr_offset = (size_t)i * sizeof(FFI_Argument);
+            // LDR X8, [X19, #offset] (X19 holds the base address of FFI_Argument array)
+            *current_code_ptr++ = ARM64_LDR_X_X_IMM(ARM64_REG_X8, ARM64_REG_X19, current_arg_value_ptr_offset);
+
+            bool is_current_param_xmm_type = (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE);
+            bool is_current_param_int128_type = (param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128);
+            bool goes_to_reg = false;
+            bool to_stack = false;
+
+            if (is_current_param_xmm_type) {
+                if (xmm_reg_idx < 8) { // 8 V registers for AAPCS64
+                    goes_to_reg = true;
+                    // LDR Sn, [X8] (for float) or LDR Dn, [X8] (for double)
+                    if (param_type == FFI_TYPE_FLOAT) {
+                        *current_code_ptr++ = 0xBC400100 | (fp_arg_regs[xmm_reg_idx] << 0) | (ARM64_REG_X8 << 5); // LDR Sn, [X8]
+                    } else { // FFI_TYPE_DOUBLE
+                        *current_code_ptr++ = 0xBC800100 | (fp_arg_regs[xmm_reg_idx] << 0) | (ARM64_REG_X8 << 5); // LDR Dn, [X8]
+                    }
+                    xmm_reg_idx++;
+                } else {
+                    to_stack = true;
+                }
+            } else if (is_current_param_int128_type) {
+                // 128-bit integers consume two GPRs
+                if (gp_reg_idx <= 6) { // Check if at least two GPRs are available (X0-X7)
+                    goes_to_reg = true;
+                    // LDR Xn, [X8] (lower 64 bits)
+                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(gp_arg_regs[gp_reg_idx], ARM64_REG_X8, 0);
+                    // LDR Xn+1, [X8, #8] (upper 64 bits)
+                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(gp_arg_regs[gp_reg_idx+1], ARM64_REG_X8, 8);
+                    gp_reg_idx += 2; // Consume two GPRs
+                } else {
+                    to_stack = true;
+                }
+            } else { // All other types (integers, bool, char, pointer, wchar_t, size_t)
+                if (gp_reg_idx < 8) { // 8 GPRs for AAPCS64
+                    goes_to_reg = true;
+                    unsigned char dest_reg = gp_arg_regs[gp_reg_idx];
+                    // Load value from [X8] into dest_reg, with appropriate zero/sign extension
+                    switch (param_type) {
+                        case FFI_TYPE_BOOL:
+                        case FFI_TYPE_CHAR:
+                        case FFI_TYPE_UCHAR:
+                            // LDRB Wd, [Xn] (zero-extends to 32-bit, then to 64-bit)
+                            *current_code_ptr++ = 0x38400100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
+                            break;
+                        case FFI_TYPE_SCHAR:
+                            // LDRSB Wd, [Xn] (sign-extends to 32-bit, then to 64-bit)
+                            *current_code_ptr++ = 0x38C00100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
+                            break;
+                        case FFI_TYPE_SHORT:
+                        case FFI_TYPE_USHORT:
+                        case FFI_TYPE_WCHAR: // wchar_t is 4 bytes on Linux/macOS, 2 bytes on Win64. Assume 4 for ARM64.
+                            // LDRH Wd, [Xn] (zero-extends for unsigned, sign-extends for signed)
+                            if (param_type == FFI_TYPE_USHORT || param_type == FFI_TYPE_WCHAR) {
+                                *current_code_ptr++ = 0x78400100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
+                            } else { // FFI_TYPE_SHORT, FFI_TYPE_SSHORT
+                                *current_code_ptr++ = 0x78C00100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
+                            }
+                            break;
+                        case FFI_TYPE_SSHORT:
+                            // LDRSH Wd, [Xn] (sign-extends to 32-bit, then to 64-bit)
+                            *current_code_ptr++ = 0x78C00100 | (dest_reg << 0) | (ARM64_REG_X8 << 5);
+                            break;
+                        case FFI_TYPE_INT:
+                        case FFI_TYPE_UINT:
+                        case FFI_TYPE_SINT:
+                        case FFI_TYPE_LONG: // 64-bit on AAPCS64
+                        case FFI_TYPE_ULONG:
+                        case FFI_TYPE_LLONG:
+                        case FFI_TYPE_ULLONG:
+                        case FFI_TYPE_POINTER:
+                        case FFI_TYPE_SIZE_T:
+                        case FFI_TYPE_SLONG:
+                        case FFI_TYPE_SLLONG:
+                            // LDR Xd, [Xn] (64-bit load)
+                            *current_code_ptr++ = ARM64_LDR_X_X_IMM(dest_reg, ARM64_REG_X8, 0);
+                            break;
+                        default: return 0; // Error
+                    }
+                    gp_reg_idx++;
+                } else {
+                    to_stack = true;
+                }
+            }
+
+            if (to_stack) {
+                // Stack arguments are placed relative to SP.
+                // Current SP is already adjusted by prologue and for alignment.
+                // The stack arguments start at SP + 0, then SP + 8, etc.
+                size_t stack_offset_from_sp = (size_t)stack_arg_current_idx * 8;
+
+                if (is_current_param_int128_type) {
+                    // LDR X9, [X8] (lower 64 bits into scratch X9)
+                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(ARM64_REG_X9, ARM64_REG_X8, 0);
+                    // LDR X10, [X8, #8] (upper 64 bits into scratch X10)
+                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(ARM64_REG_X10, ARM64_REG_X8, 8);
+
+                    // STR X9, [SP, #offset_low]
+                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X9, ARM64_REG_SP, stack_offset_from_sp);
+                    // STR X10, [SP, #offset_high]
+                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X10, ARM64_REG_SP, stack_offset_from_sp + 8);
+                    stack_arg_current_idx += 2;
+                } else if (is_current_param_xmm_type) {
+                    // LDR Dn, [X8] (load into scratch V8)
+                    if (param_type == FFI_TYPE_FLOAT) {
+                        *current_code_ptr++ = 0xBC400100 | (ARM64_REG_V8 << 0) | (ARM64_REG_X8 << 5); // LDR S8, [X8]
+                    } else { // FFI_TYPE_DOUBLE
+                        *current_code_ptr++ = 0xBC800100 | (ARM64_REG_V8 << 0) | (ARM64_REG_X8 << 5); // LDR D8, [X8]
+                    }
+                    // STR Dn, [SP, #offset]
+                    if (param_type == FFI_TYPE_FLOAT) {
+                        *current_code_ptr++ = 0xBC000100 | (ARM64_REG_V8 << 0) | (ARM64_REG_SP << 5) | ((stack_offset_from_sp/4) << 10); // STR S8, [SP, #offset]
+                    } else { // FFI_TYPE_DOUBLE
+                        *current_code_ptr++ = 0xBC200100 | (ARM64_REG_V8 << 0) | (ARM64_REG_SP << 5) | ((stack_offset_from_sp/8) << 10); // STR D8, [SP, #offset]
+                    }
+                    stack_arg_current_idx++;
+                } else { // GPR types to stack
+                    // LDR X9, [X8] (load into scratch X9)
+                    *current_code_ptr++ = ARM64_LDR_X_X_IMM(ARM64_REG_X9, ARM64_REG_X8, 0);
+                    // STR X9, [SP, #offset]
+                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X9, ARM64_REG_SP, stack_offset_from_sp);
+                    stack_arg_current_idx++;
+                }
+            }
+        }
+    }
+
+    // --- Call Target Function ---
+    // LDR X16, #target_addr_val_offset (load target address into X16 - temporary)
+    // This requires a PC-relative load or a literal pool. For simplicity, we'll use MOV.
+    // MOV X16, #high_part
+    // MOVK X16, #low_part
+    // This is a simplified direct load. A real implementation would use ADRP/ADD or LDR literal.
+    // For now, assuming direct 64-bit immediate load (which is not directly possible in one instruction)
+    // This needs to be done in multiple instructions: MOVZ, MOVK.
+    // Example: MOVZ X16, #lower16
+    // MOVK X16, #mid16, LSL #16
+    // MOVK X16, #mid_high16, LSL #32
+    // MOVK X16, #upper16, LSL #48
+
+    // This is a placeholder for a 64-bit address load.
+    // A proper implementation would use ADRP/ADD or LDR literal.
+    // For now, we'll just put the address in X16 (assuming it's a small offset or direct load is possible for testing)
+    // This is the most complex part of ARM64 assembly generation.
+    // For simplicity, we'll assume the target address is loaded into X16.
+    // A more robust solution would involve a literal pool or ADRP/ADD.
+    // For now, we'll just use a placeholder for the target address.
+    // The `BLR X16` instruction will branch to the address in X16.
+
+    // Load target_addr_val into X16 (scratch register)
+    // This is a simplified sequence for loading a 64-bit constant.
+    // It assumes the address fits in a sequence of MOVZ/MOVK instructions.
+    // For a full 64-bit arbitrary address, it takes 4 instructions.
+    // MOVZ X16, #lower_16_bits
+    *current_code_ptr++ = 0xD2800000 | ((target_addr_val & 0xFFFF) << 5) | (ARM64_REG_X16);
+    // MOVK X16, #next_16_bits, LSL #16
+    *current_code_ptr++ = 0xF2800000 | (((target_addr_val >> 16) & 0xFFFF) << 5) | (1 << 21) | (ARM64_REG_X16);
+    // MOVK X16, #next_16_bits, LSL #32
+    *current_code_ptr++ = 0xF2800000 | (((target_addr_val >> 32) & 0xFFFF) << 5) | (2 << 21) | (ARM64_REG_X16);
+    // MOVK X16, #upper_16_bits, LSL #48
+    *current_code_ptr++ = 0xF2800000 | (((target_addr_val >> 48) & 0xFFFF) << 5) | (3 << 21) | (ARM64_REG_X16);
+
+
+    // BLR X16 (Branch with Link to Register X16)
+    *current_code_ptr++ = ARM64_BLR(ARM64_REG_X16);
+
+    // --- Return Value Handling ---
+    // Store return value (from X0/V0) into (X20)
+    if (sig->return_type != FFI_TYPE_VOID) {
+        if (return_struct_by_pointer) {
+            // If returning by pointer, the target function wrote to X0 (our X20).
+            // No explicit store needed here.
+        } else {
+            switch (sig->return_type) {
+                case FFI_TYPE_BOOL:
+                case FFI_TYPE_CHAR:
+                case FFI_TYPE_UCHAR:
+                case FFI_TYPE_SCHAR:
+                    // STRB W0, [X20]
+                    *current_code_ptr++ = 0x38000000 | (ARM64_REG_X0 << 0) | (ARM64_REG_X20 << 5);
+                    break;
+                case FFI_TYPE_SHORT:
+                case FFI_TYPE_USHORT:
+                case FFI_TYPE_SSHORT:
+                case FFI_TYPE_WCHAR:
+                    // STRH W0, [X20]
+                    *current_code_ptr++ = 0x78000000 | (ARM64_REG_X0 << 0) | (ARM64_REG_X20 << 5);
+                    break;
+                case FFI_TYPE_INT:
+                case FFI_TYPE_UINT:
+                case FFI_TYPE_SINT:
+                case FFI_TYPE_LONG:
+                case FFI_TYPE_ULONG:
+                case FFI_TYPE_SLONG:
+                    // STR W0, [X20] (store 32-bit value)
+                    *current_code_ptr++ = 0xB8000000 | (ARM64_REG_X0 << 0) | (ARM64_REG_X20 << 5);
+                    break;
+                case FFI_TYPE_LLONG:
+                case FFI_TYPE_ULLONG:
+                case FFI_TYPE_POINTER:
+                case FFI_TYPE_SIZE_T:
+                case FFI_TYPE_SLLONG:
+                    // STR X0, [X20] (store 64-bit value)
+                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X0, ARM64_REG_X20, 0);
+                    break;
+                case FFI_TYPE_FLOAT:
+                    // STR S0, [X20]
+                    *current_code_ptr++ = 0xBC000000 | (ARM64_REG_V0 << 0) | (ARM64_REG_X20 << 5);
+                    break;
+                case FFI_TYPE_DOUBLE:
+                    // STR D0, [X20]
+                    *current_code_ptr++ = 0xBC200000 | (ARM64_REG_V0 << 0) | (ARM64_REG_X20 << 5);
+                    break;
+                case FFI_TYPE_INT128:
+                case FFI_TYPE_UINT128:
+                    // Return value in X0:X1 (X0 is lower 64, X1 is upper 64)
+                    // STR X0, [X20] (store lower 64)
+                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X0, ARM64_REG_X20, 0);
+                    // STR X1, [X20, #8] (store upper 64)
+                    *current_code_ptr++ = ARM64_STR_X_X_IMM(ARM64_REG_X1, ARM64_REG_X20, 8);
+                    break;
+                default: return 0; // Indicate error
+            }
+        }
+    }
+
+    // --- Epilogue ---
+    // Reverse stack alignment
+    if (final_stack_subtraction > 0) {
+        // ADD SP, SP, #final_stack_subtraction
+        *current_code_ptr++ = 0x91000000 | ((final_stack_subtraction & 0xFFF) << 10) | (ARM64_REG_SP << 5) | ARM64_REG_SP;
+    }
+
+    // Restore callee-saved registers
+    // LDP X19, X20, [SP], #16
+    *current_code_ptr++ = 0xA8C14FF3; // LDP X19, X20, [SP], #16
+
+    // LDP X29, X30, [SP], #16
+    *current_code_ptr++ = 0xA8C17BFD; // LDP X29, X30, [SP], #16
+
+    // RET (return from function)
+    *current_code_ptr++ = ARM64_RET();
+
+    return (size_t)((unsigned char*)current_code_ptr - code_buffer);
+}
 #endif // FFI_ARCH_ARM64
 
 
-/**
- * @brief Generates assembly bytes for a generic trampoline based on a function signature.
- * It dynamically marshals arguments into registers and handles return values.
- *
- * @param code_buffer Pointer to the memory where the assembly bytes will be written.
- * @param sig A pointer to the FFI_FunctionSignature containing all metadata for the target function.
- * @return The size of the generated assembly code in bytes.
- */
-size_t generate_generic_trampoline(unsigned char* code_buffer, FFI_FunctionSignature* sig) {
-#ifdef FFI_ARCH_X64
-    #ifdef FFI_OS_LINUX
-        diag("Generating x86-64 System V trampoline for '%s'.", sig->debug_name);
-        return generate_x86_64_sysv_trampoline(code_buffer, sig);
-    #elif defined(FFI_OS_WIN64)
-        diag("Generating x86-64 Win64 trampoline for '%s'.", sig->debug_name);
-        return generate_x86_64_win64_trampoline(code_buffer, sig);
-    #elif defined(FFI_OS_MACOS)
-        diag("Generating x86-64 System V (macOS) trampoline for '%s'.", sig->debug_name);
-        return generate_x86_64_sysv_trampoline(code_buffer, sig); // macOS uses System V
-    #else
-        BAIL_OUT("Unsupported x86-64 OS for trampoline generation.");
-        return 0;
-    #endif
-#elif defined(FFI_ARCH_ARM64)
-    diag("Generating ARM64 AAPCS trampoline for '%s'.", sig->debug_name);
-    return generate_arm64_aapcs_trampoline(code_buffer, sig);
+/**
+ * @brief Generates assembly bytes for a generic trampoline based on a function signature.
+ * It dynamically marshals arguments into registers and handles return values.
+ *
+ * @param code_buffer Pointer to the memory where the assembly bytes will be written.
+ * @param sig A pointer to the FFI_FunctionSignature containing all metadata for the target function.
+ * @return The size of the generated assembly code in bytes.
+ */
+size_t generate_generic_trampoline(unsigned char* code_buffer, FFI_FunctionSignature* sig) {
+    if (sig->abi == FFI_ABI_SYSCALL) {
+#if defined(FFI_ARCH_X64) && defined(__linux__)
+        ffi_log_info("Generating x86-64 Linux raw syscall trampoline for '%s' (syscall %ld).", sig->debug_name, sig->syscall_number);
+        return generate_x86_64_sysv_trampoline(code_buffer, sig);
+#else
+        ffi_log_error("ERROR: Raw syscall trampolines are only supported on x86-64 Linux ('%s').", sig->debug_name);
+        return 0;
+#endif
+    }
+    if (sig->abi == FFI_ABI_WIN64) {
+#ifdef FFI_ARCH_X64
+        ffi_log_info("Generating x86-64 Win64 trampoline for '%s'.", sig->debug_name);
+        return generate_x86_64_win64_trampoline(code_buffer, sig);
+#else
+        ffi_log_error("ERROR: The Win64 calling convention is only available on x86-64 ('%s').", sig->debug_name);
+        return 0;
+#endif
+    }
+    if (sig->abi == FFI_ABI_SYSV) {
+#if defined(FFI_ARCH_X64) && !defined(FFI_OS_WIN64)
+        ffi_log_info("Generating x86-64 System V trampoline for '%s'.", sig->debug_name);
+        return generate_x86_64_sysv_trampoline(code_buffer, sig);
+#else
+        // The System V generator expects its own arguments in RDI/RSI/RDX.
+        ffi_log_error("ERROR: The System V calling convention is only available on x86-64 System V hosts ('%s').", sig->debug_name);
+        return 0;
+#endif
+    }
+#ifdef FFI_ARCH_X64
+    #ifdef FFI_OS_LINUX
+        ffi_log_info("Generating x86-64 System V trampoline for '%s'.", sig->debug_name);
+        return generate_x86_64_sysv_trampoline(code_buffer, sig);
+    #elif defined(FFI_OS_WIN64)
+        ffi_log_info("Generating x86-64 Win64 trampoline for '%s'.", sig->debug_name);
+        return generate_x86_64_win64_trampoline(code_buffer, sig);
+    #elif defined(FFI_OS_MACOS)
+        ffi_log_info("Generating x86-64 System V (macOS) trampoline for '%s'.", sig->debug_name);
+        return generate_x86_64_sysv_trampoline(code_buffer, sig); // macOS uses System V
+    #else
+        BAIL_OUT("Unsupported x86-64 OS for trampoline generation.");
+        return 0;
+    #endif
+#elif defined(FFI_ARCH_ARM64)
+    ffi_log_info("Generating ARM64 AAPCS trampoline for '%s'.", sig->debug_name);
+    return generate_arm64_aapcs_trampoline(code_buffer, sig);
+#else
+    BAIL_OUT("Unsupported architecture for trampoline generation.");
+    return 0;
+#endif
+}
+
+/**
+ * @brief Allocates executable memory for `sig` and fills it with its trampoline.
+ * Uses the manual bytes when given, otherwise generates code for `sig->abi`, then flushes
+ * the instruction cache and dumps the bytes for debugging. Does not touch `sig->trampoline_code`.
+ * @return The ready-to-call trampoline, or NULL on failure (nothing left allocated).
+ */
+static GenericTrampolinePtr ffi_build_trampoline(FFI_FunctionSignature* sig,
+                                                 unsigned char* manual_trampoline_bytes,
+                                                 size_t manual_trampoline_size) {
+    const char* debug_name = sig->debug_name;
+    // Cast to void* before assigning to function pointer type to avoid ISO C warning
+    GenericTrampolinePtr trampoline_code = (GenericTrampolinePtr)(void*)ffi_create_executable_memory(sig->trampoline_size);
+    if (trampoline_code == NULL) {
+        return NULL;
+    }
+
+    size_t actual_code_size;
+    if (manual_trampoline_bytes && manual_trampoline_size > 0) {
+        ffi_log_info("Using manual trampoline bytes for '%s'. Size: %zu", debug_name, manual_trampoline_size);
+        if (manual_trampoline_size > sig->trampoline_size) {
+            ffi_log_error("ERROR: Manual trampoline size (%zu) exceeds allocated memory (%zu).",
+                    manual_trampoline_size, sig->trampoline_size);
+            // Cast to void* for ffi_free_executable_memory
+            ffi_free_executable_memory((void*)trampoline_code, sig->trampoline_size);
+            return NULL;
+        }
+        // Cast to void* for memcpy destination
+        memcpy((void*)trampoline_code, manual_trampoline_bytes, manual_trampoline_size);
+        actual_code_size = manual_trampoline_size;
+    } else {
+        // Cast to unsigned char* for generate_generic_trampoline
+        actual_code_size = generate_generic_trampoline((unsigned char*)trampoline_code, sig);
+        if (actual_code_size == 0 || actual_code_size > sig->trampoline_size) {
+            ffi_log_error("ERROR: Trampoline generation issue for '%s': size %zu, allocated %zu. Cleaning up.",
+                    debug_name, actual_code_size, sig->trampoline_size);
+            // Cast to void* for ffi_free_executable_memory
+            ffi_free_executable_memory((void*)trampoline_code, sig->trampoline_size);
+            return NULL;
+        }
+    }
+
+    // Flush instruction cache after writing executable code
+    ffi_flush_instruction_cache((void*)trampoline_code, actual_code_size);
+    FFI_ATOMIC_STORE_I64(&sig->code_size, (int64_t)actual_code_size); // Racing resolvers emit the same size
+    ffi_stats_trampoline_built(sig->abi, actual_code_size);
+    // Cast to void* for printf %p
+    ffi_log_info("Generated trampoline for '%s' at %p (size: %zu bytes). Target func: %p",
+           debug_name, (void*)trampoline_code, actual_code_size, (void*)sig->func_ptr);
+    ffi_perf_map_record(sig, (const void*)trampoline_code, actual_code_size);
+    ffi_jitdump_record_load(sig, (const void*)trampoline_code, actual_code_size);
+    ffi_gdb_jit_record(sig, (const void*)trampoline_code, actual_code_size);
+    FFI_PROBE4(trampoline_create, sig->id, (uintptr_t)debug_name, (uintptr_t)trampoline_code, actual_code_size);
+    if (!(manual_trampoline_bytes && manual_trampoline_size > 0)) {
+        ffi_unwind_register(sig, (const void*)trampoline_code, actual_code_size);
+    }
+    if (ffi_log_enabled(FFI_LOG_LEVEL_TRACE)) {
+        ffi_log_trace("Disassembly of the trampoline for '%s':", debug_name);
+        FFI_DisasmSummary summary = ffi_disassemble((const void*)trampoline_code, actual_code_size, NULL);
+        ffi_log_trace("'%s': %d instructions, %zu bytes%s", debug_name, summary.instructions, summary.bytes,
+                      summary.unknown ? " (some not decoded)" : "");
+    }
+
+    return trampoline_code;
+}
+
+// Lazy binding: when enabled, handles start out pointing at the shared resolver stub and get
+// their real trampoline on first invoke, like PLT entries resolved by the dynamic linker.
+static uint32_t g_ffi_lazy_binding = 0;
+
+/**
+ * @brief Enables or disables lazy trampoline generation for handles created afterwards.
+ * With lazy binding, create_ffi_function() and friends only record the signature; code is
+ * generated (and any generation error reported) by the first invoke_foreign_function() or
+ * ffi_resolve_function() call. Handles with manual trampoline bytes are always bound eagerly.
+ * @param enabled True to defer generation, false (the default) to generate at creation.
+ */
+void ffi_set_lazy_binding(bool enabled) {
+    FFI_ATOMIC_XCHG_U32(&g_ffi_lazy_binding, enabled ? 1u : 0u);
+}
+
+/**
+ * @brief Placeholder trampoline shared by every unbound lazy handle.
+ * invoke_foreign_function() recognises it and binds the handle before calling through it;
+ * it only runs when someone calls `trampoline_code` directly on an unbound handle.
+ */
+static void ffi_lazy_resolver_stub(FFI_Argument* args, int num_args, void* return_buffer_ptr) {
+    (void)args;
+    (void)num_args;
+    (void)return_buffer_ptr;
+    BAIL_OUT("Lazy FFI handle called through its trampoline before binding; use invoke_foreign_function() or ffi_resolve_function().");
+}
+
+/**
+ * @brief Placeholder trampoline of a handle still served by a tier-0 shim (see Tiered Execution).
+ * Like the lazy stub, invoke_foreign_function() recognises it and never calls it.
+ */
+static void ffi_tier0_stub(FFI_Argument* args, int num_args, void* return_buffer_ptr) {
+    (void)args;
+    (void)num_args;
+    (void)return_buffer_ptr;
+    BAIL_OUT("Tier-0 FFI handle called through its trampoline before promotion; use invoke_foreign_function() or ffi_resolve_function().");
+}
+
+/**
+ * @brief Reports whether a handle's real trampoline has been generated.
+ * @param sig The handle to inspect.
+ * @return True if `sig` is bound, false if it still points at the lazy resolver stub.
+ */
+bool ffi_function_is_bound(FFI_FunctionSignature* sig) {
+    void* current = FFI_ATOMIC_LOAD_PTR((void**)&sig->trampoline_code);
+    return current != NULL && current != (void*)ffi_lazy_resolver_stub && current != (void*)ffi_tier0_stub;
+}
+
+/**
+ * @brief Generates the trampoline of a lazily bound or tier-0 handle, if it has not been generated yet.
+ * Safe to call from several threads: each racer builds its own copy, one compare-and-swap
+ * publishes the winner and the losers free theirs.
+ * @param sig The handle to bind.
+ * @return True if the handle is bound on return, false if generation failed.
+ */
+bool ffi_resolve_function(FFI_FunctionSignature* sig) {
+    void* expected = FFI_ATOMIC_LOAD_PTR((void**)&sig->trampoline_code);
+    if (expected != (void*)ffi_lazy_resolver_stub && expected != (void*)ffi_tier0_stub) {
+        return expected != NULL;
+    }
+    if (expected == (void*)ffi_tier0_stub) {
+        ffi_log_info("Tiered execution: compiling '%s' after %lld tier-0 calls.", sig->debug_name,
+                     (long long)FFI_ATOMIC_LOAD_I64(&sig->tier0_calls));
+    } else {
+        ffi_log_info("Lazy binding: resolving '%s' on first use.", sig->debug_name);
+    }
+    GenericTrampolinePtr built = ffi_build_trampoline(sig, NULL, 0);
+    if (built == NULL) {
+        ffi_log_error("ERROR: Deferred trampoline generation failed for '%s'; the handle stays unbound.", sig->debug_name);
+        return false;
+    }
+    if (!FFI_ATOMIC_CAS_PTR((void**)&sig->trampoline_code, expected, (void*)built)) {
+        ffi_log_info("Lazy binding: '%s' was bound concurrently, discarding duplicate trampoline.", sig->debug_name);
+        ffi_free_executable_memory((void*)built, sig->trampoline_size);
+        ffi_stats_trampoline_freed((size_t)FFI_ATOMIC_LOAD_I64(&sig->code_size));
+    }
+    return true;
+}
+
+// --- Tiered Execution ---
+// With tiering enabled, a handle whose arguments all travel in registers starts at tier 0: its
+// calls go through a precompiled C shim chosen by the number of integer and floating-point
+// arguments, so creating it maps no executable memory and generates no code. Once the handle
+// has served `threshold` calls it is promoted: a background compiler thread generates the JIT
+// trampoline while tier 0 keeps serving calls, and one compare-and-swap on `trampoline_code`
+// switches callers over.
+//
+// The shims call the target through a function pointer type that lists the integer arguments
+// first and the floating-point ones second. That only matches the real prototype on ABIs that
+// assign the two register files independently (System V x86-64, AAPCS64), and relies on the
+// little-endian layout of a float inside a double register; everything else is JIT-only.
+#if (defined(FFI_ARCH_X64) && !defined(FFI_OS_WIN64)) || (defined(FFI_ARCH_ARM64) && !defined(_WIN32))
+#define FFI_HAVE_TIER0 1
+#endif
+
+#define FFI_TIER0_MAX_INTS 6 // System V x86-64 integer argument registers (AAPCS64 has 8)
+#define FFI_TIER0_MAX_FPS 4  // Covers the common shapes; 8 registers are available on both ABIs
+
+enum { FFI_TIER0_RET_VOID, FFI_TIER0_RET_INT, FFI_TIER0_RET_FLOAT, FFI_TIER0_RET_DOUBLE };
+enum { FFI_TIER0_ARG_NONE, FFI_TIER0_ARG_INT, FFI_TIER0_ARG_FLOAT, FFI_TIER0_ARG_DOUBLE };
+// Promotion progress of a tier-0 handle.
+enum { FFI_TIER_IDLE, FFI_TIER_QUEUED, FFI_TIER_COMPILING, FFI_TIER_DONE };
+
+// Parameter and argument lists of the shims: IP/IA for `n` integers, FP/FA for `n` doubles
+// standing alone, FPC/FAC for `n` doubles following the integers.
+#define FFI_TIER0_IP1 uint64_t
+#define FFI_TIER0_IP2 FFI_TIER0_IP1, uint64_t
+#define FFI_TIER0_IP3 FFI_TIER0_IP2, uint64_t
+#define FFI_TIER0_IP4 FFI_TIER0_IP3, uint64_t
+#define FFI_TIER0_IP5 FFI_TIER0_IP4, uint64_t
+#define FFI_TIER0_IP6 FFI_TIER0_IP5, uint64_t
+#define FFI_TIER0_IA1 ints[0]
+#define FFI_TIER0_IA2 FFI_TIER0_IA1, ints[1]
+#define FFI_TIER0_IA3 FFI_TIER0_IA2, ints[2]
+#define FFI_TIER0_IA4 FFI_TIER0_IA3, ints[3]
+#define FFI_TIER0_IA5 FFI_TIER0_IA4, ints[4]
+#define FFI_TIER0_IA6 FFI_TIER0_IA5, ints[5]
+#define FFI_TIER0_FP0 void
+#define FFI_TIER0_FP1 double
+#define FFI_TIER0_FP2 FFI_TIER0_FP1, double
+#define FFI_TIER0_FP3 FFI_TIER0_FP2, double
+#define FFI_TIER0_FP4 FFI_TIER0_FP3, double
+#define FFI_TIER0_FA0
+#define FFI_TIER0_FA1 fps[0]
+#define FFI_TIER0_FA2 FFI_TIER0_FA1, fps[1]
+#define FFI_TIER0_FA3 FFI_TIER0_FA2, fps[2]
+#define FFI_TIER0_FA4 FFI_TIER0_FA3, fps[3]
+#define FFI_TIER0_FPC0
+#define FFI_TIER0_FPC1 , FFI_TIER0_FP1
+#define FFI_TIER0_FPC2 , FFI_TIER0_FP2
+#define FFI_TIER0_FPC3 , FFI_TIER0_FP3
+#define FFI_TIER0_FPC4 , FFI_TIER0_FP4
+#define FFI_TIER0_FAC0
+#define FFI_TIER0_FAC1 , FFI_TIER0_FA1
+#define FFI_TIER0_FAC2 , FFI_TIER0_FA2
+#define FFI_TIER0_FAC3 , FFI_TIER0_FA3
+#define FFI_TIER0_FAC4 , FFI_TIER0_FA4
+
+// Defines ffi_tier0_shim_<ni>_<nf> from the full parameter and argument lists.
+#define FFI_TIER0_DEFINE_SHIM(name, params, call_args) \
+    static void name(GenericFuncPtr fn, const uint64_t* ints, const double* fps, int ret_class, void* ret) { \
+        (void)ints; \
+        (void)fps; \
+        switch (ret_class) { \
+            case FFI_TIER0_RET_INT: *(uint64_t*)ret = ((uint64_t (*)(params))fn)(call_args); break; \
+            case FFI_TIER0_RET_FLOAT: \
+            case FFI_TIER0_RET_DOUBLE: *(double*)ret = ((double (*)(params))fn)(call_args); break; \
+            default: ((void (*)(params))fn)(call_args); break; \
+        } \
+    }
+#define FFI_TIER0_LIST(...) __VA_ARGS__
+#define FFI_TIER0_SHIM_F(nf) \
+    FFI_TIER0_DEFINE_SHIM(ffi_tier0_shim_0_##nf, FFI_TIER0_LIST(FFI_TIER0_FP##nf), FFI_TIER0_LIST(FFI_TIER0_FA##nf))
+#define FFI_TIER0_SHIM_IF(ni, nf) \
+    FFI_TIER0_DEFINE_SHIM(ffi_tier0_shim_##ni##_##nf, FFI_TIER0_LIST(FFI_TIER0_IP##ni FFI_TIER0_FPC##nf), \
+                          FFI_TIER0_LIST(FFI_TIER0_IA##ni FFI_TIER0_FAC##nf))
+#define FFI_TIER0_SHIM_ROW(ni) \
+    FFI_TIER0_SHIM_IF(ni, 0) FFI_TIER0_SHIM_IF(ni, 1) FFI_TIER0_SHIM_IF(ni, 2) FFI_TIER0_SHIM_IF(ni, 3) FFI_TIER0_SHIM_IF(ni, 4)
+#define FFI_TIER0_TABLE_ROW(ni) \
+    { ffi_tier0_shim_##ni##_0, ffi_tier0_shim_##ni##_1, ffi_tier0_shim_##ni##_2, ffi_tier0_shim_##ni##_3, ffi_tier0_shim_##ni##_4 }
+
+#ifdef FFI_HAVE_TIER0
+FFI_TIER0_SHIM_F(0) FFI_TIER0_SHIM_F(1) FFI_TIER0_SHIM_F(2) FFI_TIER0_SHIM_F(3) FFI_TIER0_SHIM_F(4)
+FFI_TIER0_SHIM_ROW(1)
+FFI_TIER0_SHIM_ROW(2)
+FFI_TIER0_SHIM_ROW(3)
+FFI_TIER0_SHIM_ROW(4)
+FFI_TIER0_SHIM_ROW(5)
+FFI_TIER0_SHIM_ROW(6)
+
+// Indexed by [integer argument count][floating-point argument count].
+static const FFI_Tier0Shim g_ffi_tier0_shims[FFI_TIER0_MAX_INTS + 1][FFI_TIER0_MAX_FPS + 1] = {
+    FFI_TIER0_TABLE_ROW(0), FFI_TIER0_TABLE_ROW(1), FFI_TIER0_TABLE_ROW(2), FFI_TIER0_TABLE_ROW(3),
+    FFI_TIER0_TABLE_ROW(4), FFI_TIER0_TABLE_ROW(5), FFI_TIER0_TABLE_ROW(6),
+};
+#endif
+
+// Calls a handle may serve at tier 0 before promotion (0 disables tiering, the default), and
+// whether promotion happens on the compiler thread or inline in the call that reaches it.
+static int64_t g_ffi_tier_threshold = 0;
+static uint32_t g_ffi_tier_background = 1;
+
+// Background compiler: a FIFO of handles awaiting promotion, linked through `tier_next`.
+static ffi_mutex_t g_ffi_tier_lock = FFI_MUTEX_INITIALIZER;
+static ffi_cond_t g_ffi_tier_work;      // Signalled when a handle is queued or on shutdown
+static ffi_cond_t g_ffi_tier_progress;  // Broadcast whenever a compilation finishes
+static bool g_ffi_tier_conds_ready = false;
+static FFI_FunctionSignature* g_ffi_tier_head = NULL;
+static FFI_FunctionSignature* g_ffi_tier_tail = NULL;
+static int g_ffi_tier_compiling = 0;
+static bool g_ffi_tier_thread_running = false;
+static bool g_ffi_tier_stopping = false;
+static ffi_thread_t g_ffi_tier_thread;
+
+/**
+ * @brief Enables or disables tiered execution for handles created afterwards.
+ * @param threshold Tier-0 calls before a handle is compiled; 0 or less disables tiering.
+ * @param background True to compile on the background compiler thread while tier 0 keeps
+ * serving calls, false to compile inside the call that reaches the threshold.
+ */
+void ffi_set_tiered_execution(int64_t threshold, bool background) {
+    FFI_ATOMIC_XCHG_U32(&g_ffi_tier_background, background ? 1u : 0u);
+    FFI_ATOMIC_STORE_I64(&g_ffi_tier_threshold, threshold > 0 ? threshold : 0);
+}
+
+/**
+ * @brief Reports which tier currently serves a handle's calls.
+ * @return 0 while a precompiled tier-0 shim serves them, 1 once they go through JIT code.
+ */
+int ffi_function_tier(FFI_FunctionSignature* sig) {
+    return FFI_ATOMIC_LOAD_PTR((void**)&sig->trampoline_code) == (void*)ffi_tier0_stub ? 0 : 1;
+}
+
+/**
+ * @brief Register class of a type in a tier-0 call, or FFI_TIER0_ARG_NONE if it needs the JIT.
+ */
+static int ffi_tier0_arg_class(FFI_Type type) {
+    switch (type) {
+        case FFI_TYPE_BOOL: case FFI_TYPE_CHAR: case FFI_TYPE_UCHAR: case FFI_TYPE_SCHAR:
+        case FFI_TYPE_SHORT: case FFI_TYPE_USHORT: case FFI_TYPE_SSHORT:
+        case FFI_TYPE_INT: case FFI_TYPE_UINT: case FFI_TYPE_SINT:
+        case FFI_TYPE_LONG: case FFI_TYPE_ULONG: case FFI_TYPE_SLONG:
+        case FFI_TYPE_LLONG: case FFI_TYPE_ULLONG: case FFI_TYPE_SLLONG:
+        case FFI_TYPE_POINTER: case FFI_TYPE_WCHAR: case FFI_TYPE_SIZE_T:
+            return FFI_TIER0_ARG_INT;
+        case FFI_TYPE_FLOAT:
+            return FFI_TIER0_ARG_FLOAT;
+        case FFI_TYPE_DOUBLE:
+            return FFI_TIER0_ARG_DOUBLE;
+        default:
+            return FFI_TIER0_ARG_NONE;
+    }
+}
+
+/**
+ * @brief Picks the tier-0 shim for a signature, if it has one.
+ * @param ret_class Receives the FFI_TIER0_RET_* of the return type.
+ * @return The shim, or NULL if the signature needs JIT code from the start.
+ */
+static FFI_Tier0Shim ffi_tier0_select_shim(const FFI_FunctionSignature* sig, int* ret_class) {
+#ifdef FFI_HAVE_TIER0
+    if ((sig->abi != FFI_ABI_DEFAULT && sig->abi != FFI_ABI_SYSV) || sig->num_fixed_params != sig->num_params) {
+        return NULL; // A variadic callee expects the caller's vector-register count, which a C call cannot supply
+    }
+    int num_ints = 0, num_fps = 0;
+    for (int i = 0; i < sig->num_params; ++i) {
+        int arg_class = ffi_tier0_arg_class(sig->param_types[i]);
+        if (arg_class == FFI_TIER0_ARG_NONE) return NULL;
+        if (arg_class == FFI_TIER0_ARG_INT) num_ints++; else num_fps++;
+    }
+    if (num_ints > FFI_TIER0_MAX_INTS || num_fps > FFI_TIER0_MAX_FPS) {
+        return NULL;
+    }
+    switch (sig->return_type == FFI_TYPE_VOID ? -1 : ffi_tier0_arg_class(sig->return_type)) {
+        case -1: *ret_class = FFI_TIER0_RET_VOID; break;
+        case FFI_TIER0_ARG_INT: *ret_class = FFI_TIER0_RET_INT; break;
+        case FFI_TIER0_ARG_FLOAT: *ret_class = FFI_TIER0_RET_FLOAT; break;
+        case FFI_TIER0_ARG_DOUBLE: *ret_class = FFI_TIER0_RET_DOUBLE; break;
+        default: return NULL;
+    }
+    return g_ffi_tier0_shims[num_ints][num_fps];
+#else
+    (void)sig;
+    (void)ret_class;
+    return NULL;
+#endif
+}
+
+/**
+ * @brief Widens an integer-class argument to the 64-bit register value the ABI expects.
+ */
+static uint64_t ffi_tier0_load_int(FFI_Type type, const void* value) {
+    switch (type) {
+        case FFI_TYPE_BOOL:   return *(const bool*)value;
+        case FFI_TYPE_CHAR:   return (uint64_t)(int64_t)*(const char*)value;
+        case FFI_TYPE_SCHAR:  return (uint64_t)(int64_t)*(const signed char*)value;
+        case FFI_TYPE_UCHAR:  return *(const unsigned char*)value;
+        case FFI_TYPE_SHORT:
+        case FFI_TYPE_SSHORT: return (uint64_t)(int64_t)*(const short*)value;
+        case FFI_TYPE_USHORT: return *(const unsigned short*)value;
+        case FFI_TYPE_INT:
+        case FFI_TYPE_SINT:   return (uint64_t)(int64_t)*(const int*)value;
+        case FFI_TYPE_UINT:   return *(const unsigned int*)value;
+        case FFI_TYPE_LONG:
+        case FFI_TYPE_SLONG:  return (uint64_t)(int64_t)*(const long*)value;
+        case FFI_TYPE_ULONG:  return *(const unsigned long*)value;
+        case FFI_TYPE_LLONG:
+        case FFI_TYPE_SLLONG: return (uint64_t)*(const long long*)value;
+        case FFI_TYPE_ULLONG: return *(const unsigned long long*)value;
+        case FFI_TYPE_WCHAR:  return (uint64_t)(int64_t)*(const wchar_t*)value;
+        case FFI_TYPE_SIZE_T: return *(const size_t*)value;
+        default:              return (uint64_t)(uintptr_t)*(void* const*)value; // FFI_TYPE_POINTER
+    }
+}
+
+/**
+ * @brief Stores the low bits of an integer-class return register as the C return type.
+ */
+static void ffi_tier0_store_int(FFI_Type type, uint64_t raw, void* out) {
+    switch (type) {
+        case FFI_TYPE_BOOL:   *(bool*)out = (uint8_t)raw != 0; break;
+        case FFI_TYPE_CHAR:   *(char*)out = (char)raw; break;
+        case FFI_TYPE_SCHAR:  *(signed char*)out = (signed char)raw; break;
+        case FFI_TYPE_UCHAR:  *(unsigned char*)out = (unsigned char)raw; break;
+        case FFI_TYPE_SHORT:
+        case FFI_TYPE_SSHORT: *(short*)out = (short)raw; break;
+        case FFI_TYPE_USHORT: *(unsigned short*)out = (unsigned short)raw; break;
+        case FFI_TYPE_INT:
+        case FFI_TYPE_SINT:   *(int*)out = (int)raw; break;
+        case FFI_TYPE_UINT:   *(unsigned int*)out = (unsigned int)raw; break;
+        case FFI_TYPE_LONG:
+        case FFI_TYPE_SLONG:  *(long*)out = (long)raw; break;
+        case FFI_TYPE_ULONG:  *(unsigned long*)out = (unsigned long)raw; break;
+        case FFI_TYPE_LLONG:
+        case FFI_TYPE_SLLONG: *(long long*)out = (long long)raw; break;
+        case FFI_TYPE_ULLONG: *(unsigned long long*)out = (unsigned long long)raw; break;
+        case FFI_TYPE_WCHAR:  *(wchar_t*)out = (wchar_t)raw; break;
+        case FFI_TYPE_SIZE_T: *(size_t*)out = (size_t)raw; break;
+        default:              *(void**)out = (void*)(uintptr_t)raw; break; // FFI_TYPE_POINTER
+    }
+}
+
+/**
+ * @brief Puts `sig` on the background compiler's queue, starting the compiler thread if needed.
+ * Falls back to compiling inline if the thread cannot be started.
+ */
+static void ffi_tier_up_request(FFI_FunctionSignature* sig);
+
+/**
+ * @brief Serves one call at tier 0 and counts it towards promotion.
+ * The caller has validated the arguments and return buffer like for a JIT call.
+ */
+static void ffi_tier0_invoke(FFI_FunctionSignature* sig, FFI_Argument* args, void* return_buffer_ptr) {
+    // Only calls below the threshold write the shared counter, so promoted-but-not-yet-switched
+    // handles do not keep bouncing its cache line between callers.
+    if (FFI_ATOMIC_LOAD_I64(&sig->tier0_calls) < sig->tier_up_at &&
+        FFI_ATOMIC_ADD_I64(&sig->tier0_calls, 1) + 1 == sig->tier_up_at) {
+        ffi_tier_up_request(sig);
+    }
+    uint64_t ints[FFI_TIER0_MAX_INTS];
+    double fps[FFI_TIER0_MAX_FPS];
+    int num_ints = 0, num_fps = 0;
+    for (int i = 0; i < sig->num_params; ++i) {
+        FFI_Type type = sig->param_types[i];
+        if (type == FFI_TYPE_DOUBLE) {
+            fps[num_fps++] = *(const double*)args[i].value_ptr;
+        } else if (type == FFI_TYPE_FLOAT) {
+            uint64_t bits = 0; // The callee reads the low 32 bits of the register
+            memcpy(&bits, args[i].value_ptr, sizeof(float));
+            memcpy(&fps[num_fps++], &bits, sizeof(double));
+        } else {
+            ints[num_ints++] = ffi_tier0_load_int(type, args[i].value_ptr);
+        }
+    }
+    union { uint64_t i; double d; } ret;
+    sig->tier0_shim(sig->func_ptr, ints, fps, sig->tier0_ret_class, &ret);
+    switch (sig->tier0_ret_class) {
+        case FFI_TIER0_RET_INT:    ffi_tier0_store_int(sig->return_type, ret.i, return_buffer_ptr); break;
+        case FFI_TIER0_RET_FLOAT:  memcpy(return_buffer_ptr, &ret.d, sizeof(float)); break;
+        case FFI_TIER0_RET_DOUBLE: *(double*)return_buffer_ptr = ret.d; break;
+        default: break;
+    }
+}
+
+FFI_THREAD_FUNC(ffi_tier_compiler_main, arg) {
+    (void)arg;
+    ffi_mutex_lock(&g_ffi_tier_lock);
+    for (;;) {
+        while (g_ffi_tier_head == NULL && !g_ffi_tier_stopping) {
+            ffi_cond_wait(&g_ffi_tier_work, &g_ffi_tier_lock);
+        }
+        if (g_ffi_tier_head == NULL) {
+            break; // Stopping, and the queue is drained
+        }
+        FFI_FunctionSignature* sig = g_ffi_tier_head;
+        g_ffi_tier_head = sig->tier_next;
+        if (g_ffi_tier_head == NULL) g_ffi_tier_tail = NULL;
+        sig->tier_next = NULL;
+        sig->tier_state = FFI_TIER_COMPILING; // destroy_ffi_function() now waits for us
+        g_ffi_tier_compiling++;
+        ffi_mutex_unlock(&g_ffi_tier_lock);
+
+        ffi_resolve_function(sig);
+
+        ffi_mutex_lock(&g_ffi_tier_lock);
+        sig->tier_state = FFI_TIER_DONE;
+        g_ffi_tier_compiling--;
+        ffi_cond_broadcast(&g_ffi_tier_progress);
+    }
+    ffi_mutex_unlock(&g_ffi_tier_lock);
+    return FFI_THREAD_RETURN;
+}
+
+static void ffi_tier_up_request(FFI_FunctionSignature* sig) {
+    if (!FFI_ATOMIC_LOAD_U32(&g_ffi_tier_background)) {
+        ffi_resolve_function(sig);
+        return;
+    }
+    bool inline_compile = false;
+    ffi_mutex_lock(&g_ffi_tier_lock);
+    if (sig->tier_state == FFI_TIER_IDLE) {
+        if (!g_ffi_tier_conds_ready) {
+            ffi_cond_init(&g_ffi_tier_work);
+            ffi_cond_init(&g_ffi_tier_progress);
+            g_ffi_tier_conds_ready = true;
+        }
+        if (!g_ffi_tier_thread_running) {
+            g_ffi_tier_stopping = false;
+            g_ffi_tier_thread_running = ffi_thread_start(&g_ffi_tier_thread, ffi_tier_compiler_main, NULL);
+        }
+        if (g_ffi_tier_thread_running) {
+            sig->tier_state = FFI_TIER_QUEUED;
+            sig->tier_next = NULL;
+            if (g_ffi_tier_tail) g_ffi_tier_tail->tier_next = sig; else g_ffi_tier_head = sig;
+            g_ffi_tier_tail = sig;
+            ffi_cond_signal(&g_ffi_tier_work);
+        } else {
+            ffi_log_error("ERROR: Tiered execution: cannot start the compiler thread; compiling '%s' inline.", sig->debug_name);
+            sig->tier_state = FFI_TIER_DONE;
+            inline_compile = true;
+        }
+    }
+    ffi_mutex_unlock(&g_ffi_tier_lock);
+    if (inline_compile) {
+        ffi_resolve_function(sig);
+    }
+}
+
+/**
+ * @brief Takes a tier-0 handle out of the promotion pipeline before it is destroyed.
+ * Unlinks it if queued, waits if the compiler thread is working on it, and marks it so that
+ * calls still in flight cannot queue it again.
+ */
+static void ffi_tier_cancel(FFI_FunctionSignature* sig) {
+    if (sig->tier0_shim == NULL) {
+        return;
+    }
+    ffi_mutex_lock(&g_ffi_tier_lock);
+    if (sig->tier_state == FFI_TIER_QUEUED) {
+        FFI_FunctionSignature** link = &g_ffi_tier_head;
+        FFI_FunctionSignature* prev = NULL;
+        while (*link != sig) {
+            prev = *link;
+            link = &(*link)->tier_next;
+        }
+        *link = sig->tier_next;
+        if (g_ffi_tier_tail == sig) g_ffi_tier_tail = prev;
+    }
+    while (sig->tier_state == FFI_TIER_COMPILING) {
+        ffi_cond_wait(&g_ffi_tier_progress, &g_ffi_tier_lock);
+    }
+    sig->tier_state = FFI_TIER_DONE;
+    ffi_mutex_unlock(&g_ffi_tier_lock);
+}
+
+/**
+ * @brief Blocks until the background compiler has no queued or running compilations.
+ */
+void ffi_tier_up_wait(void) {
+    ffi_mutex_lock(&g_ffi_tier_lock);
+    while (g_ffi_tier_head != NULL || g_ffi_tier_compiling > 0) {
+        ffi_cond_wait(&g_ffi_tier_progress, &g_ffi_tier_lock);
+    }
+    ffi_mutex_unlock(&g_ffi_tier_lock);
+}
+
+/**
+ * @brief Drains the compiler queue and joins the background compiler thread.
+ * The thread is started again by the next promotion.
+ */
+void ffi_tier_up_shutdown(void) {
+    ffi_mutex_lock(&g_ffi_tier_lock);
+    bool running = g_ffi_tier_thread_running;
+    if (running) {
+        g_ffi_tier_stopping = true;
+        ffi_cond_signal(&g_ffi_tier_work);
+    }
+    ffi_mutex_unlock(&g_ffi_tier_lock);
+    if (running) {
+        ffi_thread_join(g_ffi_tier_thread);
+        ffi_mutex_lock(&g_ffi_tier_lock);
+        g_ffi_tier_thread_running = false;
+        ffi_mutex_unlock(&g_ffi_tier_lock);
+    }
+}
+
+/**
+ * @brief Shared constructor behind create_ffi_function() and create_ffi_syscall().
+ * Allocates memory for the struct and its trampoline code, and generates the assembly
+ * for the requested calling convention (deferred to first use under lazy binding).
+ */
+static FFI_FunctionSignature* create_ffi_function_with_abi(const char* debug_name, FFI_Type return_type,
+                                                           int num_params, int num_fixed_params, FFI_Type* param_types,
+                                                           GenericFuncPtr func_ptr, FFI_ABI abi, long syscall_number,
+                                                           unsigned char* manual_trampoline_bytes,
+                                                           size_t manual_trampoline_size) {
+    ffi_log_info("create_ffi_function: Entering for '%s'. func_ptr received: %p", debug_name, (void*)func_ptr);
+    // The parameter types are copied into the same allocation, right after the struct, so
+    // callers may pass short-lived arrays (e.g. compound literals from FFI_BIND()).
+    size_t param_types_size = (param_types != NULL && num_params > 0) ? (size_t)num_params * sizeof(FFI_Type) : 0;
+    FFI_FunctionSignature* new_ffi_func = (FFI_FunctionSignature*)malloc(sizeof(FFI_FunctionSignature) + param_types_size);
+    if (new_ffi_func == NULL) {
+        ffi_log_error("Failed to allocate FFI_FunctionSignature for '%s'", debug_name);
+        return NULL;
+    }
+    new_ffi_func->debug_name = debug_name;
+    new_ffi_func->return_type = return_type;
+    new_ffi_func->num_params = num_params;
+    new_ffi_func->num_fixed_params = num_fixed_params;
+    new_ffi_func->param_types = param_types_size ? (FFI_Type*)(void*)(new_ffi_func + 1) : NULL;
+    if (param_types_size) {
+        memcpy(new_ffi_func->param_types, param_types, param_types_size);
+    }
+    new_ffi_func->func_ptr = func_ptr;
+    new_ffi_func->abi = abi;
+    new_ffi_func->syscall_number = syscall_number;
+    new_ffi_func->trampoline_size = 512; // Increased size to 512 bytes for more complex trampolines
+    new_ffi_func->tier0_shim = NULL;
+    new_ffi_func->tier0_ret_class = FFI_TIER0_RET_VOID;
+    new_ffi_func->tier0_calls = 0;
+    new_ffi_func->tier_up_at = FFI_ATOMIC_LOAD_I64(&g_ffi_tier_threshold);
+    new_ffi_func->tier_state = FFI_TIER_IDLE;
+    new_ffi_func->tier_next = NULL;
+    new_ffi_func->code_size = 0;
+    new_ffi_func->id = FFI_ATOMIC_ADD_I64(&g_ffi_next_handle_id, 1) + 1;
+    new_ffi_func->trace_named = 0;
+    new_ffi_func->record_generation = 0;
+    if (!ffi_call_stats_attach(new_ffi_func, !(manual_trampoline_bytes && manual_trampoline_size > 0))) {
+        free(new_ffi_func);
+        return NULL;
+    }
+    if (new_ffi_func->call_stats != NULL) {
+        new_ffi_func->trampoline_size += 128; // Counter and timer sequences
+    }
+
+    if (new_ffi_func->tier_up_at > 0 && !(manual_trampoline_bytes && manual_trampoline_size > 0)) {
+        new_ffi_func->tier0_shim = ffi_tier0_select_shim(new_ffi_func, &new_ffi_func->tier0_ret_class);
+        if (new_ffi_func->tier0_shim != NULL) {
+            new_ffi_func->trampoline_code = ffi_tier0_stub;
+            ffi_log_info("Tiered execution: '%s' starts at tier 0, JIT after %lld calls.", debug_name,
+                         (long long)new_ffi_func->tier_up_at);
+            ffi_stats_handle_created();
+            return new_ffi_func;
+        }
+    }
+
+    if (FFI_ATOMIC_LOAD_U32(&g_ffi_lazy_binding) && !(manual_trampoline_bytes && manual_trampoline_size > 0)) {
+        new_ffi_func->trampoline_code = ffi_lazy_resolver_stub;
+        ffi_log_info("Lazy binding: '%s' recorded, trampoline deferred to first invoke.", debug_name);
+        ffi_stats_handle_created();
+        return new_ffi_func;
+    }
+
+    new_ffi_func->trampoline_code = ffi_build_trampoline(new_ffi_func, manual_trampoline_bytes, manual_trampoline_size);
+    if (new_ffi_func->trampoline_code == NULL) {
+        ffi_call_stats_release(new_ffi_func->call_stats);
+        free(new_ffi_func);
+        return NULL;
+    }
+    ffi_stats_handle_created();
+    return new_ffi_func;
+}
+
+/**
+ * @brief Creates and initializes an FFI_FunctionSignature object.
+ * Allocates memory for the struct and its trampoline code, and generates the assembly.
+ *
+ * @param debug_name A string name for debugging purposes.
+ * @param return_type The return type of the C function.
+ * @param num_params The number of parameters the C function expects.
+ * @param param_types An array of FFI_Type representing the parameter types, or NULL if num_params is 0.
+ * @param func_ptr A pointer to the actual C function implementation.
+ * @param manual_trampoline_bytes Optional. Pointer to a byte array for a pre-defined trampoline.
+ * @param manual_trampoline_size Optional. Size of the pre-defined trampoline byte array.
+ * @return A pointer to the newly created FFI_FunctionSignature object, or NULL on failure.
+ */
+FFI_FunctionSignature* create_ffi_function(const char* debug_name, FFI_Type return_type,
+                                            int num_params, FFI_Type* param_types,
+                                            GenericFuncPtr func_ptr,
+                                            unsigned char* manual_trampoline_bytes,
+                                            size_t manual_trampoline_size) {
+    return create_ffi_function_with_abi(debug_name, return_type, num_params, num_params, param_types, func_ptr,
+                                        FFI_ABI_DEFAULT, 0, manual_trampoline_bytes, manual_trampoline_size);
+}
+
+/**
+ * @brief Creates an FFI_FunctionSignature whose trampoline issues a raw `syscall` instruction.
+ * Arguments are marshalled like a System V call and then placed in RDI, RSI, RDX, R10, R8, R9.
+ * A kernel error return (-errno) is translated to the libc convention: the return buffer
+ * receives -1 and errno is set.
+ *
+ * @param debug_name A string name for debugging purposes.
+ * @param return_type The return type (an integer/pointer type, or FFI_TYPE_VOID).
+ * @param syscall_number The kernel syscall number (e.g. SYS_write).
+ * @param num_params The number of parameters (at most 6).
+ * @param param_types An array of FFI_Type for the parameters (integer/pointer types only).
+ * @return A pointer to the newly created FFI_FunctionSignature object, or NULL on failure.
+ */
+FFI_FunctionSignature* create_ffi_syscall(const char* debug_name, FFI_Type return_type, long syscall_number,
+                                           int num_params, FFI_Type* param_types) {
+    if (num_params < 0 || num_params > 6) {
+        ffi_log_error("ERROR: Syscall '%s' takes %d parameters; the kernel ABI allows at most 6.", debug_name, num_params);
+        return NULL;
+    }
+    for (int i = 0; i < num_params; ++i) {
+        FFI_Type param_type = param_types[i];
+        if (param_type == FFI_TYPE_FLOAT || param_type == FFI_TYPE_DOUBLE ||
+            param_type == FFI_TYPE_FLOAT16 || param_type == FFI_TYPE_BFLOAT16 ||
+            param_type == FFI_TYPE_FLOAT_COMPLEX || param_type == FFI_TYPE_DOUBLE_COMPLEX ||
+            param_type == FFI_TYPE_LONG_DOUBLE ||
+            param_type == FFI_TYPE_INT128 || param_type == FFI_TYPE_UINT128 ||
+            param_type == FFI_TYPE_VOID || param_type == FFI_TYPE_UNKNOWN) {
+            ffi_log_error("ERROR: Syscall '%s' parameter %d has type %d; only integer and pointer types fit a syscall register.",
+                 debug_name, i, param_type);
+            return NULL;
+        }
+    }
+    if (return_type == FFI_TYPE_FLOAT || return_type == FFI_TYPE_DOUBLE ||
+        return_type == FFI_TYPE_FLOAT16 || return_type == FFI_TYPE_BFLOAT16 ||
+        return_type == FFI_TYPE_FLOAT_COMPLEX || return_type == FFI_TYPE_DOUBLE_COMPLEX ||
+        return_type == FFI_TYPE_LONG_DOUBLE ||
+        return_type == FFI_TYPE_INT128 || return_type == FFI_TYPE_UINT128) {
+        ffi_log_error("ERROR: Syscall '%s' return type %d is not an integer or pointer type.", debug_name, return_type);
+        return NULL;
+    }
+    return create_ffi_function_with_abi(debug_name, return_type, num_params, num_params, param_types, NULL,
+                                        FFI_ABI_SYSCALL, syscall_number, NULL, 0);
+}
+
+/**
+ * @brief Creates an FFI_FunctionSignature for a target using an explicitly chosen calling convention.
+ * This makes the convention a runtime choice: for example, FFI_ABI_WIN64 on a Linux host calls
+ * functions declared `__attribute__((ms_abi))`.
+ *
+ * @param debug_name A string name for debugging purposes.
+ * @param return_type The return type of the target function.
+ * @param num_params The number of parameters the target function expects.
+ * @param param_types An array of FFI_Type for the parameters.
+ * @param func_ptr A pointer to the actual C function implementation.
+ * @param abi The calling convention of the target (FFI_ABI_DEFAULT, FFI_ABI_SYSV or FFI_ABI_WIN64).
+ * @return A pointer to the newly created FFI_FunctionSignature object, or NULL on failure.
+ */
+FFI_FunctionSignature* create_ffi_function_abi(const char* debug_name, FFI_Type return_type,
+                                                int num_params, FFI_Type* param_types,
+                                                GenericFuncPtr func_ptr, FFI_ABI abi) {
+    if (abi == FFI_ABI_SYSCALL) {
+        ffi_log_error("ERROR: Use create_ffi_syscall() for raw syscall trampolines ('%s').", debug_name);
+        return NULL;
+    }
+    return create_ffi_function_with_abi(debug_name, return_type, num_params, num_params, param_types, func_ptr,
+                                        abi, 0, NULL, 0);
+}
+
+// --- Signature Strings ---
+// A compact text form for signatures loaded from metadata: the return type code, then the
+// parameter codes in parentheses, e.g. "i(ifp)" for int f(int, float, void*). Commas and
+// whitespace between codes are ignored, so "i(i, f, p)" is the same signature. A variadic
+// prototype ends its fixed parameters with "...", optionally followed by the types passed
+// at one particular call site: "i(p...id)" is printf(const char*, ...) called with an int
+// and a double.
+//
+//   v void (return only)   B bool        c char        C unsigned char   a signed char
+//   s short                S ushort      i int         I unsigned int    j long
+//   J unsigned long        l long long   L ull         z size_t          w wchar_t
+//   p pointer              f float       d double      g long double     e _Float16
+//   E bfloat16             k float _Complex            K double _Complex
+//   x __int128             X unsigned __int128
+//
+// Parsed signatures are interned: every spelling of the same signature maps to one canonical,
+// immutable FFI_SignatureDesc, so after the first occurrence a signature costs a parse into a
+// stack buffer plus one hash lookup. Descriptors are carved out of an append-only arena and
+// stay valid until ffi_signature_table_reset().
+
+#define FFI_SIGNATURE_MAX_PARAMS 127
+
+typedef struct FFI_SignatureDesc {
+    const char* text;            // Canonical spelling: no separators, e.g. "i(ifp)"
+    uint64_t hash;               // FNV-1a of `text`
+    FFI_Type return_type;
+    int num_params;              // Including the call-site types after "..."
+    int num_fixed_params;        // Parameters before "..."; equals num_params if not variadic
+    bool variadic;
+    FFI_Type param_types[];
+} FFI_SignatureDesc;
+
+// Type code -> FFI_Type; FFI_TYPE_UNKNOWN marks characters that are not type codes.
+static const FFI_Type g_ffi_signature_codes[128] = {
+    ['v'] = FFI_TYPE_VOID,    ['B'] = FFI_TYPE_BOOL,   ['c'] = FFI_TYPE_CHAR,   ['C'] = FFI_TYPE_UCHAR,
+    ['a'] = FFI_TYPE_SCHAR,   ['s'] = FFI_TYPE_SHORT,  ['S'] = FFI_TYPE_USHORT, ['i'] = FFI_TYPE_INT,
+    ['I'] = FFI_TYPE_UINT,    ['j'] = FFI_TYPE_LONG,   ['J'] = FFI_TYPE_ULONG,  ['l'] = FFI_TYPE_LLONG,
+    ['L'] = FFI_TYPE_ULLONG,  ['z'] = FFI_TYPE_SIZE_T, ['w'] = FFI_TYPE_WCHAR,  ['p'] = FFI_TYPE_POINTER,
+    ['f'] = FFI_TYPE_FLOAT,   ['d'] = FFI_TYPE_DOUBLE, ['g'] = FFI_TYPE_LONG_DOUBLE,
+    ['e'] = FFI_TYPE_FLOAT16, ['E'] = FFI_TYPE_BFLOAT16,
+    ['k'] = FFI_TYPE_FLOAT_COMPLEX, ['K'] = FFI_TYPE_DOUBLE_COMPLEX,
+    ['x'] = FFI_TYPE_INT128,  ['X'] = FFI_TYPE_UINT128,
+};
+
+#define FFI_SIGNATURE_ARENA_CHUNK 65536
+
+typedef struct FFI_SignatureChunk {
+    struct FFI_SignatureChunk* next;
+    size_t used;
+    size_t size;
+    // Descriptors follow, each aligned for FFI_SignatureDesc
+} FFI_SignatureChunk;
+
+// Open-addressed table of interned descriptors (linear probing, kept at most half full).
+static ffi_mutex_t g_ffi_signature_lock = FFI_MUTEX_INITIALIZER;
+static const FFI_SignatureDesc** g_ffi_signature_slots = NULL;
+static size_t g_ffi_signature_capacity = 0; // Power of two
+static size_t g_ffi_signature_count = 0;
+static FFI_SignatureChunk* g_ffi_signature_arena = NULL;
+
+/**
+ * @brief Carves `size` bytes out of the descriptor arena. Called with g_ffi_signature_lock held.
+ */
+static void* ffi_signature_arena_alloc(size_t size) {
+    const size_t align = sizeof(void*) > sizeof(uint64_t) ? sizeof(void*) : sizeof(uint64_t);
+    size_t header = (sizeof(FFI_SignatureChunk) + align - 1) & ~(align - 1);
+    size = (size + align - 1) & ~(align - 1);
+    FFI_SignatureChunk* chunk = g_ffi_signature_arena;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > FFI_SIGNATURE_ARENA_CHUNK - header ? size + header : FFI_SIGNATURE_ARENA_CHUNK;
+        chunk = (FFI_SignatureChunk*)malloc(chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = g_ffi_signature_arena;
+        chunk->used = header;
+        chunk->size = chunk_size;
+        g_ffi_signature_arena = chunk;
+    }
+    void* mem = (unsigned char*)chunk + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+/**
+ * @brief Doubles the intern table (or creates it). Called with g_ffi_signature_lock held.
+ */
+static bool ffi_signature_table_grow(void) {
+    size_t capacity = g_ffi_signature_capacity ? g_ffi_signature_capacity * 2 : 1024;
+    const FFI_SignatureDesc** slots = (const FFI_SignatureDesc**)calloc(capacity, sizeof(*slots));
+    if (slots == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < g_ffi_signature_capacity; ++i) {
+        const FFI_SignatureDesc* desc = g_ffi_signature_slots[i];
+        if (desc == NULL) continue;
+        size_t index = (size_t)desc->hash & (capacity - 1);
+        while (slots[index] != NULL) {
+            index = (index + 1) & (capacity - 1);
+        }
+        slots[index] = desc;
+    }
+    free((void*)g_ffi_signature_slots);
+    g_ffi_signature_slots = slots;
+    g_ffi_signature_capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Parses a signature string and returns its interned descriptor.
+ * Parsing writes into stack buffers only; memory is allocated just the first time a
+ * signature is seen. Thread-safe.
+ *
+ * @param text The signature, e.g. "i(ifp)", "v(d, d, ...)" or "i(p...id)".
+ * @return The canonical descriptor shared by every spelling of the signature, or NULL if the
+ * string is malformed (the error and its offset are logged).
+ */
+const FFI_SignatureDesc* ffi_intern_signature(const char* text) {
+    if (text == NULL) {
+        ffi_log_error("ERROR: ffi_intern_signature: NULL signature string.");
+        return NULL;
+    }
+    FFI_Type types[FFI_SIGNATURE_MAX_PARAMS + 1]; // Return type first
+    char canonical[FFI_SIGNATURE_MAX_PARAMS + 8]; // Codes plus "()" and "..."
+    int num_types = 0, num_fixed = -1;
+    size_t length = 0;
+    const char* cursor = text;
+    const char* error = NULL;
+    bool closed = false;
+
+    for (; *cursor != '\0'; ++cursor) {
+        unsigned char ch = (unsigned char)*cursor;
+        if (ch == ' ' || ch == '\t' || (ch == ',' && length >= 2)) {
+            continue;
+        }
+        if (closed) {
+            error = "trailing characters after ')'";
+        } else if (length == 1) {
+            if (ch == '(') canonical[length++] = '('; else error = "expected '(' after the return type";
+        } else if (ch == ')' && length >= 2) {
+            canonical[length++] = ')';
+            closed = true;
+        } else if (ch == '.' && length >= 2) {
+            if (num_fixed >= 0 || strncmp(cursor, "...", 3) != 0) {
+                error = "malformed or repeated '...'";
+            } else {
+                num_fixed = num_types - 1;
+                memcpy(canonical + length, "...", 3);
+                length += 3;
+                cursor += 2; // The loop steps over the last '.'
+            }
+        } else if (ch < 128 && g_ffi_signature_codes[ch] != FFI_TYPE_UNKNOWN) {
+            FFI_Type type = g_ffi_signature_codes[ch];
+            if (length > 0 && type == FFI_TYPE_VOID) {
+                error = "'v' is only valid as the return type";
+            } else if (num_types > FFI_SIGNATURE_MAX_PARAMS) {
+                error = "too many parameters";
+            } else if (num_fixed >= 0 && (type == FFI_TYPE_FLOAT || type == FFI_TYPE_BOOL || type == FFI_TYPE_CHAR ||
+                                          type == FFI_TYPE_UCHAR || type == FFI_TYPE_SCHAR || type == FFI_TYPE_SHORT ||
+                                          type == FFI_TYPE_USHORT || type == FFI_TYPE_FLOAT16 || type == FFI_TYPE_BFLOAT16)) {
+                error = "variadic arguments undergo default promotion; pass them as 'd' or 'i'";
+            } else {
+                types[num_types++] = type;
+                canonical[length++] = (char)ch;
+            }
+        } else {
+            error = "unknown type code";
+        }
+        if (error != NULL) {
+            break; // `cursor` stays on the offending character
+        }
+    }
+    if (error == NULL && !closed) {
+        error = "missing ')'";
+    }
+    if (error != NULL) {
+        ffi_log_error("ERROR: Signature \"%s\": %s at offset %d.", text, error, (int)(cursor - text));
+        return NULL;
+    }
+    canonical[length] = '\0';
+
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char)canonical[i]) * 0x100000001b3ull;
+    }
+
+    ffi_mutex_lock(&g_ffi_signature_lock);
+    const FFI_SignatureDesc* found = NULL;
+    if (g_ffi_signature_capacity != 0 || ffi_signature_table_grow()) {
+        size_t index = (size_t)hash & (g_ffi_signature_capacity - 1);
+        for (const FFI_SignatureDesc* desc; (desc = g_ffi_signature_slots[index]) != NULL;
+             index = (index + 1) & (g_ffi_signature_capacity - 1)) {
+            if (desc->hash == hash && strcmp(desc->text, canonical) == 0) {
+                found = desc;
+                break;
+            }
+        }
+        if (found == NULL && ((g_ffi_signature_count + 1) * 2 <= g_ffi_signature_capacity || ffi_signature_table_grow())) {
+            // One arena block per descriptor: struct, parameter types, canonical text.
+            int num_params = num_types - 1;
+            size_t params_size = (size_t)num_params * sizeof(FFI_Type);
+            FFI_SignatureDesc* desc = (FFI_SignatureDesc*)ffi_signature_arena_alloc(sizeof(FFI_SignatureDesc) + params_size + length + 1);
+            if (desc != NULL) {
+                char* desc_text = (char*)desc->param_types + params_size;
+                memcpy(desc_text, canonical, length + 1);
+                memcpy(desc->param_types, types + 1, params_size);
+                desc->text = desc_text;
+                desc->hash = hash;
+                desc->return_type = types[0];
+                desc->num_params = num_params;
+                desc->variadic = num_fixed >= 0;
+                desc->num_fixed_params = desc->variadic ? num_fixed : num_params;
+                index = (size_t)hash & (g_ffi_signature_capacity - 1);
+                while (g_ffi_signature_slots[index] != NULL) {
+                    index = (index + 1) & (g_ffi_signature_capacity - 1);
+                }
+                g_ffi_signature_slots[index] = desc;
+                g_ffi_signature_count++;
+                found = desc;
+            }
+        }
+    }
+    ffi_mutex_unlock(&g_ffi_signature_lock);
+    if (found == NULL) {
+        ffi_log_error("ERROR: ffi_intern_signature: out of memory interning \"%s\".", canonical);
+    }
+    return found;
+}
+
+/**
+ * @brief Number of distinct signatures interned so far.
+ */
+size_t ffi_signature_count(void) {
+    ffi_mutex_lock(&g_ffi_signature_lock);
+    size_t count = g_ffi_signature_count;
+    ffi_mutex_unlock(&g_ffi_signature_lock);
+    return count;
+}
+
+/**
+ * @brief Frees every interned descriptor. Descriptors returned earlier become invalid;
+ * handles created from them are unaffected (they copy the parameter types).
+ */
+void ffi_signature_table_reset(void) {
+    ffi_mutex_lock(&g_ffi_signature_lock);
+    while (g_ffi_signature_arena != NULL) {
+        FFI_SignatureChunk* next = g_ffi_signature_arena->next;
+        free(g_ffi_signature_arena);
+        g_ffi_signature_arena = next;
+    }
+    free((void*)g_ffi_signature_slots);
+    g_ffi_signature_slots = NULL;
+    g_ffi_signature_capacity = 0;
+    g_ffi_signature_count = 0;
+    ffi_mutex_unlock(&g_ffi_signature_lock);
+}
+
+/**
+ * @brief Creates an FFI_FunctionSignature from a signature string (see Signature Strings).
+ * A variadic signature must list the types of the call site after "...": the trampoline is
+ * generated for that one argument list. Variadic calls are only supported with the System V
+ * x86-64 convention, where the trampoline passes the vector-register count in AL.
+ *
+ * @param debug_name A string name for debugging purposes.
+ * @param signature The signature string, e.g. "i(ii)".
+ * @param func_ptr A pointer to the actual C function implementation.
+ * @return A pointer to the newly created FFI_FunctionSignature object, or NULL on failure.
+ */
+FFI_FunctionSignature* create_ffi_function_from_signature(const char* debug_name, const char* signature,
+                                                          GenericFuncPtr func_ptr) {
+    const FFI_SignatureDesc* desc = ffi_intern_signature(signature);
+    if (desc == NULL) {
+        return NULL;
+    }
+    if (desc->variadic) {
+#if !defined(FFI_ARCH_X64) || defined(FFI_OS_WIN64)
+        ffi_log_error("ERROR: '%s': variadic signature \"%s\" needs the System V x86-64 convention.", debug_name, desc->text);
+        return NULL;
+#endif
+        if (desc->num_params == desc->num_fixed_params) {
+            ffi_log_error("ERROR: '%s': variadic signature \"%s\" lists no call-site types; append the codes of the arguments passed.",
+                          debug_name, desc->text);
+            return NULL;
+        }
+    }
+    return create_ffi_function_with_abi(debug_name, desc->return_type, desc->num_params, desc->num_fixed_params,
+                                        (FFI_Type*)desc->param_types, func_ptr, FFI_ABI_DEFAULT, 0, NULL, 0);
+}
+
+/**
+ * @brief Allocates `size` bytes aligned to `alignment` (a power of two). Free with ffi_aligned_free().
+ */
+static void* ffi_aligned_malloc(size_t alignment, size_t size) {
+#ifdef _MSC_VER
+    return _aligned_malloc(size, alignment);
+#else
+    // aligned_alloc requires the size to be a multiple of the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+}
+
+static void ffi_aligned_free(void* mem) {
+#ifdef _MSC_VER
+    _aligned_free(mem);
+#else
+    free(mem);
+#endif
+}
+
+// --- Call Recording and Replay ---
+// Microbenchmarks call one signature with one set of arguments. Production traffic mixes
+// many of both. The recorder samples real calls into a log so the same stream can be replayed
+// offline, e.g. to compare code generator changes on realistic traffic.
+//
+// ffi_call_recorder_start() maps a fixed-size log file and records every Nth call that each
+// thread makes through invoke_foreign_function() or invoke_prepared_call(). A signature
+// record (canonical signature string, ABI and name) is written the first time a handle is
+// sampled. Each call record then holds the handle id, the argument bytes and the result
+// bytes. Writers reserve space with one atomic add on the header. A record becomes valid when
+// its size field is stored last. Calls that no longer fit are counted as dropped. Handles
+// using FFI_ABI_SYSCALL are never recorded, since replaying them would repeat the syscalls.
+//
+// ffi_replay_call_log() re-creates every recorded signature and invokes the stream. A resolver
+// supplies the target for each handle by name and signature. Without one, or when it returns
+// NULL, the handle calls a stub that returns immediately. A first pass compares each result
+// with the recorded one; stubbed handles and void results are not compared. Then `passes`
+// timed passes replay the stream at full speed for throughput. Arguments are replayed as the
+// recorded bytes, so pointer arguments carry recording-time addresses: use stubs or targets
+// that do not dereference them.
+//
+// Log layout (native byte order, every record 16-byte aligned):
+//   FFI_RecordLogHeader
+//   FFI_RECORD_SIGNATURE: FFI_RecordSignature, signature text, NUL, name, NUL
+//   FFI_RECORD_CALL:      FFI_RecordPrefix, then each argument and the result at offsets
+//                         computed from the signature (ffi_record_layout())
+
+#define FFI_RECORD_LOG_VERSION 1
+#define FFI_RECORD_SIGNATURE 1u
+#define FFI_RECORD_CALL 2u
+
+typedef struct {
+    char magic[8];          // "FFIRECLG"
+    uint32_t version;       // FFI_RECORD_LOG_VERSION
+    uint32_t sample_every;
+    int64_t capacity;       // Size of the file and mapping
+    int64_t used;           // Bytes reserved so far, header included; may exceed capacity once full
+    int64_t calls;          // Call records completed
+    int64_t signatures;     // Signature records completed
+    int64_t dropped;        // Sampled calls that did not fit
+    int64_t reserved;
+} FFI_RecordLogHeader;
+
+typedef struct {
+    uint32_t size;          // Whole record, a multiple of 16; stored last, 0 until complete
+    uint32_t kind;          // FFI_RECORD_SIGNATURE or FFI_RECORD_CALL
+    int64_t sig_id;         // FFI_FunctionSignature::id at recording time
+} FFI_RecordPrefix;
+
+typedef struct {
+    FFI_RecordPrefix prefix;
+    uint32_t abi;
+    uint32_t text_length;   // Excluding the NULs
+    uint32_t name_length;
+    uint32_t pad;
+} FFI_RecordSignature;
+
+// Outcome of ffi_replay_call_log().
+typedef struct {
+    int64_t signatures;     // Signature records re-created
+    int64_t stubbed;        // Of those, bound to the stub target
+    int64_t calls;          // Call records replayed per pass
+    int64_t skipped;        // Call records whose signature was missing or could not be re-created
+    int64_t compared;       // Results checked against the recording
+    int64_t mismatches;     // Results that differed
+    int passes;             // Timed passes
+    double seconds;         // Time spent in the timed passes
+    double calls_per_second;
+} FFI_ReplayReport;
+
+// Returns the target for a recorded handle, or NULL to replay it against the stub.
+typedef GenericFuncPtr (*FFI_ReplayResolver)(const char* name, const char* signature, void* user_data);
+
+void destroy_ffi_function(FFI_FunctionSignature* ffi_func);
+void ffi_epoch_synchronize(void);
+
+static ffi_mutex_t g_ffi_record_lock = FFI_MUTEX_INITIALIZER;  // Serializes start and stop
+static FFI_RecordLogHeader* g_ffi_record_log = NULL;          // The mapping while recording
+static uint32_t g_ffi_record_generation = 0;                  // Bumped by every start
+static int64_t g_ffi_record_writers = 0;                      // Threads inside ffi_call_record()
+static FFI_THREAD_LOCAL uint32_t t_ffi_record_countdown = 0;
+
+/**
+ * @brief Bytes that carry a value of `type`: x87 long double is 10, not its padded sizeof.
+ * @return 0 for FFI_TYPE_VOID and types that have no value.
+ */
+static size_t ffi_type_value_size(FFI_Type type) {
+    switch (type) {
+        case FFI_TYPE_BOOL: return sizeof(bool);
+        case FFI_TYPE_CHAR: case FFI_TYPE_UCHAR: case FFI_TYPE_SCHAR: return 1;
+        case FFI_TYPE_SHORT: case FFI_TYPE_USHORT: case FFI_TYPE_SSHORT: return sizeof(short);
+        case FFI_TYPE_INT: case FFI_TYPE_UINT: case FFI_TYPE_SINT: return sizeof(int);
+        case FFI_TYPE_LONG: case FFI_TYPE_ULONG: case FFI_TYPE_SLONG: return sizeof(long);
+        case FFI_TYPE_LLONG: case FFI_TYPE_ULLONG: case FFI_TYPE_SLLONG: return sizeof(long long);
+        case FFI_TYPE_FLOAT: return sizeof(float);
+        case FFI_TYPE_DOUBLE: return sizeof(double);
+        case FFI_TYPE_POINTER: return sizeof(void*);
+        case FFI_TYPE_WCHAR: return sizeof(wchar_t);
+        case FFI_TYPE_SIZE_T: return sizeof(size_t);
+        case FFI_TYPE_INT128: case FFI_TYPE_UINT128: return 16;
+        case FFI_TYPE_FLOAT16: case FFI_TYPE_BFLOAT16: return 2;
+        case FFI_TYPE_FLOAT_COMPLEX: return 2 * sizeof(float);
+        case FFI_TYPE_DOUBLE_COMPLEX: return 2 * sizeof(double);
+        case FFI_TYPE_LONG_DOUBLE: return LDBL_MANT_DIG == 64 ? 10 : sizeof(long double);
+        default: return 0;
+    }
+}
+
+/**
+ * @brief Places a call record's arguments and result: 8-byte slots, 16-byte aligned for values
+ * wider than 8 bytes, starting after the prefix.
+ * @param offsets Receives `num_params + 1` offsets from the record start, the result's last.
+ * @return The record size, a multiple of 16.
+ */
+static size_t ffi_record_layout(const FFI_Type* param_types, int num_params, FFI_Type return_type, size_t* offsets) {
+    size_t pos = sizeof(FFI_RecordPrefix);
+    for (int i = 0; i <= num_params; ++i) {
+        size_t size = ffi_type_value_size(i < num_params ? param_types[i] : return_type);
+        size_t align = size > 8 ? 16 : 8;
+        pos = (pos + align - 1) & ~(align - 1);
+        offsets[i] = pos;
+        pos += (size + 7) & ~(size_t)7;
+    }
+    return (pos + 15) & ~(size_t)15;
+}
+
+/**
+ * @brief Reserves `size` bytes in the log. @return The record, or NULL if the log is full.
+ */
+static unsigned char* ffi_record_reserve(FFI_RecordLogHeader* log, size_t size) {
+    int64_t offset = FFI_ATOMIC_ADD_I64(&log->used, (int64_t)size);
+    if (offset + (int64_t)size > log->capacity) {
+        return NULL;
+    }
+    return (unsigned char*)log + offset;
+}
+
+/**
+ * @brief Writes the signature record of `sig` unless this recording already has it.
+ * @return False if the record did not fit.
+ */
+static bool ffi_record_signature(FFI_RecordLogHeader* log, FFI_FunctionSignature* sig, uint32_t generation) {
+    uint32_t seen = FFI_ATOMIC_LOAD_U32(&sig->record_generation);
+    if (seen == generation || !FFI_ATOMIC_CAS_U32(&sig->record_generation, seen, generation)) {
+        return true; // Written, or being written by the thread that won the claim
+    }
+    char text[FFI_SIGNATURE_MAX_PARAMS + 8];
+    size_t text_length = ffi_format_signature(sig, text, sizeof(text));
+    const char* name = sig->debug_name ? sig->debug_name : "";
+    size_t name_length = strlen(name);
+    size_t size = (sizeof(FFI_RecordSignature) + text_length + name_length + 2 + 15) & ~(size_t)15;
+    unsigned char* record = text_length < sizeof(text) ? ffi_record_reserve(log, size) : NULL;
+    if (record == NULL) {
+        return false;
+    }
+    FFI_RecordSignature* header = (FFI_RecordSignature*)record;
+    header->prefix.kind = FFI_RECORD_SIGNATURE;
+    header->prefix.sig_id = sig->id;
+    header->abi = (uint32_t)sig->abi;
+    header->text_length = (uint32_t)text_length;
+    header->name_length = (uint32_t)name_length;
+    memcpy(record + sizeof(FFI_RecordSignature), text, text_length + 1);
+    memcpy(record + sizeof(FFI_RecordSignature) + text_length + 1, name, name_length + 1);
+    FFI_ATOMIC_ADD_I64(&log->signatures, 1);
+    FFI_ATOMIC_XCHG_U32(&header->prefix.size, (uint32_t)size);
+    return true;
+}
+
+/**
+ * @brief Samples a completed call into the log (see ffi_call_recorder_start()).
+ * @param result The return value storage, NULL for void.
+ */
+static void ffi_call_record(FFI_FunctionSignature* sig, const FFI_Argument* args, const void* result) {
+    if (t_ffi_record_countdown > 1) {
+        t_ffi_record_countdown--;
+        return;
+    }
+    if (sig->abi == FFI_ABI_SYSCALL || sig->num_params > FFI_SIGNATURE_MAX_PARAMS) {
+        return;
+    }
+    FFI_ATOMIC_ADD_I64(&g_ffi_record_writers, 1);
+    FFI_ATOMIC_FENCE(); // Pairs with the fence in ffi_call_recorder_stop()
+    FFI_RecordLogHeader* log = (FFI_RecordLogHeader*)FFI_ATOMIC_LOAD_PTR((void**)&g_ffi_record_log);
+    if (log != NULL) {
+        t_ffi_record_countdown = log->sample_every;
+        size_t offsets[FFI_SIGNATURE_MAX_PARAMS + 1];
+        size_t size = ffi_record_layout(sig->param_types, sig->num_params, sig->return_type, offsets);
+        unsigned char* record = NULL;
+        if (ffi_record_signature(log, sig, FFI_ATOMIC_LOAD_U32(&g_ffi_record_generation))) {
+            record = ffi_record_reserve(log, size);
+        }
+        if (record == NULL) {
+            FFI_ATOMIC_ADD_I64(&log->dropped, 1);
+        } else {
+            FFI_RecordPrefix* prefix = (FFI_RecordPrefix*)record;
+            prefix->kind = FFI_RECORD_CALL;
+            prefix->sig_id = sig->id;
+            for (int i = 0; i < sig->num_params; ++i) {
+                memcpy(record + offsets[i], args[i].value_ptr, ffi_type_value_size(sig->param_types[i]));
+            }
+            size_t result_size = ffi_type_value_size(sig->return_type);
+            if (result != NULL && result_size > 0) {
+                memcpy(record + offsets[sig->num_params], result, result_size);
+            }
+            FFI_ATOMIC_ADD_I64(&log->calls, 1);
+            FFI_ATOMIC_XCHG_U32(&prefix->size, (uint32_t)size);
+        }
+    }
+    FFI_ATOMIC_ADD_I64(&g_ffi_record_writers, -1);
+}
+
+/**
+ * @brief Starts sampling calls into a new log file of exactly `capacity` bytes.
+ * @param sample_every Record one call in this many per thread (1 records every call).
+ * @return False if a recording is already running or the file cannot be mapped.
+ */
+bool ffi_call_recorder_start(const char* path, size_t capacity, uint32_t sample_every) {
+#if defined(FFI_OS_LINUX) || defined(FFI_OS_MACOS)
+    if (capacity < sizeof(FFI_RecordLogHeader) || sample_every == 0) {
+        ffi_log_error("ERROR: A call log needs room for its header and a nonzero sampling interval.");
+        return false;
+    }
+    bool started = false;
+    ffi_mutex_lock(&g_ffi_record_lock);
+    if (g_ffi_record_log != NULL) {
+        ffi_log_error("ERROR: A call recording is already running.");
+        ffi_mutex_unlock(&g_ffi_record_lock);
+        return false;
+    }
+    FILE* file = fopen(path, "w+b");
+    void* mem = MAP_FAILED;
+    if (file != NULL && ftruncate(fileno(file), (off_t)capacity) == 0) {
+        mem = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+    }
+    if (mem == MAP_FAILED) {
+        ffi_log_error("ERROR: Cannot map call log '%s': %s", path, strerror(errno));
+    } else {
+        FFI_RecordLogHeader* log = (FFI_RecordLogHeader*)mem;
+        memcpy(log->magic, "FFIRECLG", 8);
+        log->version = FFI_RECORD_LOG_VERSION;
+        log->sample_every = sample_every;
+        log->capacity = (int64_t)capacity;
+        log->used = (int64_t)sizeof(FFI_RecordLogHeader);
+        FFI_ATOMIC_XCHG_U32(&g_ffi_record_generation, g_ffi_record_generation + 1);
+        void* idle = NULL;
+        FFI_ATOMIC_CAS_PTR((void**)&g_ffi_record_log, idle, (void*)log);
+        ffi_log_info("Recording one call in %u per thread into '%s' (%zu bytes).", sample_every, path, capacity);
+        started = true;
+    }
+    if (file != NULL) {
+        fclose(file); // The mapping keeps the file contents
+    }
+    ffi_mutex_unlock(&g_ffi_record_lock);
+    return started;
+#else
+    (void)path; (void)capacity; (void)sample_every;
+    ffi_log_error("ERROR: Call recording needs mmap (Linux or macOS).");
+    return false;
+#endif
+}
+
+/**
+ * @brief Stops the recording, waits for calls still writing into the log, and unmaps it.
+ * The file keeps its full capacity; the header says how much of it holds records.
+ * @param stats Optional; receives the final header counters.
+ * @return False if no recording was running.
+ */
+bool ffi_call_recorder_stop(FFI_RecordLogHeader* stats) {
+#if defined(FFI_OS_LINUX) || defined(FFI_OS_MACOS)
+    ffi_mutex_lock(&g_ffi_record_lock);
+    FFI_RecordLogHeader* log = g_ffi_record_log;
+    if (log == NULL) {
+        ffi_mutex_unlock(&g_ffi_record_lock);
+        return false;
+    }
+    void* current = log;
+    FFI_ATOMIC_CAS_PTR((void**)&g_ffi_record_log, current, NULL);
+    FFI_ATOMIC_FENCE(); // Pairs with the fence in ffi_call_record()
+    while (FFI_ATOMIC_LOAD_I64(&g_ffi_record_writers) != 0) {
+        ffi_thread_yield();
+    }
+    if (log->used > log->capacity) {
+        log->used = log->capacity;
+    }
+    if (stats != NULL) {
+        *stats = *log;
+    }
+    munmap(log, (size_t)log->capacity);
+    ffi_mutex_unlock(&g_ffi_record_lock);
+    return true;
+#else
+    (void)stats;
+    return false;
+#endif
+}
+
+// Target of handles replayed without a real one; returns whatever the registers hold.
+static void ffi_replay_stub(void) {
+}
+
+typedef struct {
+    int64_t id;
+    FFI_FunctionSignature* sig;
+    bool stubbed;
+} FFI_ReplaySignature;
+
+typedef struct {
+    FFI_FunctionSignature* sig;
+    FFI_Argument* args;
+    const unsigned char* expected; // Recorded result, NULL if it is not compared
+    size_t result_size;
+} FFI_ReplayCall;
+
+static int ffi_replay_signature_compare(const void* a, const void* b) {
+    int64_t x = ((const FFI_ReplaySignature*)a)->id, y = ((const FFI_ReplaySignature*)b)->id;
+    return (x > y) - (x < y);
+}
+
+/** @brief Checks a complete record against the `room` bytes left in the stream before anything reads it. */
+static bool ffi_replay_record_valid(const unsigned char* record, int64_t room) {
+    const FFI_RecordPrefix* prefix = (const FFI_RecordPrefix*)record;
+    if (prefix->size % 16 != 0 || prefix->size > room) {
+        return false;
+    }
+    if (prefix->kind == FFI_RECORD_CALL) {
+        return prefix->size >= sizeof(FFI_RecordPrefix);
+    }
+    if (prefix->kind != FFI_RECORD_SIGNATURE || prefix->size < sizeof(FFI_RecordSignature)) {
+        return false;
+    }
+    const FFI_RecordSignature* sig = (const FFI_RecordSignature*)record;
+    if ((uint64_t)sizeof(FFI_RecordSignature) + sig->text_length + sig->name_length + 2 > prefix->size) {
+        return false;
+    }
+    const char* text = (const char*)(sig + 1);
+    return text[sig->text_length] == '\0' && text[sig->text_length + 1 + sig->name_length] == '\0';
+}
+
+/**
+ * @brief Replays a log written by the recorder and reports throughput and result mismatches.
+ * @param resolver Supplies real targets; may be NULL to replay everything against the stub.
+ * @param passes Timed passes over the stream after the comparing pass (0 only compares).
+ * @return False if the log cannot be read, is not a call log or holds a malformed record.
+ */
+bool ffi_replay_call_log(const char* path, FFI_ReplayResolver resolver, void* user_data, int passes,
+                         FFI_ReplayReport* report) {
+    memset(report, 0, sizeof(*report));
+#if defined(FFI_OS_LINUX) || defined(FFI_OS_MACOS)
+    FILE* file = fopen(path, "rb");
+    long file_size = -1;
+    if (file != NULL && fseek(file, 0, SEEK_END) == 0) {
+        file_size = ftell(file);
+    }
+    const unsigned char* log = MAP_FAILED;
+    if (file_size >= (long)sizeof(FFI_RecordLogHeader)) {
+        log = (const unsigned char*)mmap(NULL, (size_t)file_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    const FFI_RecordLogHeader* header = (const FFI_RecordLogHeader*)log;
+    if (log == MAP_FAILED || memcmp(header->magic, "FFIRECLG", 8) != 0 || header->version != FFI_RECORD_LOG_VERSION) {
+        ffi_log_error("ERROR: '%s' is not a call log.", path);
+        if (log != MAP_FAILED) {
+            munmap((void*)log, (size_t)file_size);
+        }
+        return false;
+    }
+    int64_t end = header->used < (int64_t)file_size ? header->used : (int64_t)file_size;
+
+    // Pass 1: validate and count the records, then re-create the signatures. Later walks stay
+    // within stream_end, so they only ever see records checked here.
+    int64_t num_sigs = 0, num_calls = 0;
+    int64_t stream_end = sizeof(FFI_RecordLogHeader);
+    while (stream_end + (int64_t)sizeof(FFI_RecordPrefix) <= end) {
+        const FFI_RecordPrefix* prefix = (const FFI_RecordPrefix*)(log + stream_end);
+        if (prefix->size == 0) {
+            break; // Unfinished tail of a full log
+        }
+        if (!ffi_replay_record_valid(log + stream_end, end - stream_end)) {
+            ffi_log_error("ERROR: Call log '%s' has a malformed record at offset %lld.", path, (long long)stream_end);
+            munmap((void*)log, (size_t)file_size);
+            return false;
+        }
+        num_sigs += prefix->kind == FFI_RECORD_SIGNATURE;
+        num_calls += prefix->kind == FFI_RECORD_CALL;
+        stream_end += prefix->size;
+    }
+    FFI_ReplaySignature* sigs = (FFI_ReplaySignature*)calloc((size_t)num_sigs + 1, sizeof(FFI_ReplaySignature));
+    FFI_ReplayCall* calls = (FFI_ReplayCall*)calloc((size_t)num_calls + 1, sizeof(FFI_ReplayCall));
+    bool ok = sigs != NULL && calls != NULL;
+    int64_t created = 0;
+    for (int64_t pos = sizeof(FFI_RecordLogHeader); ok && pos < stream_end && created < num_sigs;) {
+        const FFI_RecordSignature* record = (const FFI_RecordSignature*)(log + pos);
+        pos += record->prefix.size;
+        if (record->prefix.kind != FFI_RECORD_SIGNATURE) {
+            continue;
+        }
+        const char* text = (const char*)(record + 1);
+        const char* name = text + record->text_length + 1;
+        const FFI_SignatureDesc* desc = ffi_intern_signature(text);
+        GenericFuncPtr target = (desc && resolver) ? resolver(name, text, user_data) : NULL;
+        FFI_ReplaySignature* entry = &sigs[created++];
+        entry->id = record->prefix.sig_id;
+        entry->stubbed = target == NULL;
+        if (desc != NULL && record->abi < FFI_ABI_COUNT && record->abi != FFI_ABI_SYSCALL) {
+            entry->sig = create_ffi_function_with_abi(name, desc->return_type, desc->num_params,
+                                                      desc->num_fixed_params, (FFI_Type*)desc->param_types,
+                                                      target ? target : (GenericFuncPtr)ffi_replay_stub,
+                                                      (FFI_ABI)record->abi, 0, NULL, 0);
+        }
+        // The passes below call trampoline_code directly, so lazy and tier-0 handles are bound first
+        if (entry->sig != NULL && !ffi_resolve_function(entry->sig)) {
+            destroy_ffi_function(entry->sig);
+            entry->sig = NULL;
+        }
+        if (entry->sig == NULL) {
+            ffi_log_error("ERROR: Cannot re-create recorded signature \"%s\" ('%s').", text, name);
+        } else {
+            report->signatures++;
+            report->stubbed += entry->stubbed;
+        }
+    }
+    qsort(sigs, (size_t)created, sizeof(FFI_ReplaySignature), ffi_replay_signature_compare);
+
+    // Pass 2: point each call's arguments into the log
+    size_t pool_size = 0;
+    for (int64_t pos = sizeof(FFI_RecordLogHeader), c = 0; ok && pos < stream_end && c < num_calls; pos += ((const FFI_RecordPrefix*)(log + pos))->size) {
+        const FFI_RecordPrefix* prefix = (const FFI_RecordPrefix*)(log + pos);
+        if (prefix->kind != FFI_RECORD_CALL) {
+            continue;
+        }
+        c++;
+        FFI_ReplaySignature key = { prefix->sig_id, NULL, false };
+        const FFI_ReplaySignature* entry = (const FFI_ReplaySignature*)bsearch(&key, sigs, (size_t)created,
+                                                                               sizeof(FFI_ReplaySignature),
+                                                                               ffi_replay_signature_compare);
+        pool_size += (entry && entry->sig) ? (size_t)entry->sig->num_params : 0;
+    }
+    FFI_Argument* arg_pool = ok ? (FFI_Argument*)malloc((pool_size + 1) * sizeof(FFI_Argument)) : NULL;
+    ok = ok && arg_pool != NULL;
+    size_t pool_used = 0;
+    int64_t replayed = 0;
+    for (int64_t pos = sizeof(FFI_RecordLogHeader), c = 0; ok && pos < stream_end && c < num_calls; pos += ((const FFI_RecordPrefix*)(log + pos))->size) {
+        const FFI_RecordPrefix* prefix = (const FFI_RecordPrefix*)(log + pos);
+        if (prefix->kind != FFI_RECORD_CALL) {
+            continue;
+        }
+        c++;
+        FFI_ReplaySignature key = { prefix->sig_id, NULL, false };
+        const FFI_ReplaySignature* entry = (const FFI_ReplaySignature*)bsearch(&key, sigs, (size_t)created,
+                                                                               sizeof(FFI_ReplaySignature),
+                                                                               ffi_replay_signature_compare);
+        FFI_FunctionSignature* sig = entry ? entry->sig : NULL;
+        size_t offsets[FFI_SIGNATURE_MAX_PARAMS + 1];
+        if (sig == NULL || ffi_record_layout(sig->param_types, sig->num_params, sig->return_type, offsets) != prefix->size) {
+            report->skipped++;
+            continue;
+        }
+        FFI_ReplayCall* call = &calls[replayed++];
+        call->sig = sig;
+        call->args = &arg_pool[pool_used];
+        for (int i = 0; i < sig->num_params; ++i) {
+            call->args[i].value_ptr = (void*)(log + pos + offsets[i]);
+        }
+        pool_used += (size_t)sig->num_params;
+        call->result_size = ffi_type_value_size(sig->return_type);
+        call->expected = (!entry->stubbed && call->result_size > 0) ? log + pos + offsets[sig->num_params] : NULL;
+    }
+    report->calls = replayed;
+
+    // Comparing pass, then the timed passes
+    union { long double ld; unsigned char bytes[16]; } result; // Large and aligned enough for any FFI_Type
+    for (int64_t i = 0; ok && i < replayed; ++i) {
+        const FFI_ReplayCall* call = &calls[i];
+        GenericTrampolinePtr trampoline = (GenericTrampolinePtr)FFI_ATOMIC_LOAD_PTR((void**)&call->sig->trampoline_code);
+        memset(&result, 0, sizeof(result));
+        trampoline(call->args, call->sig->num_params, &result);
+        if (call->expected != NULL) {
+            report->compared++;
+            report->mismatches += memcmp(result.bytes, call->expected, call->result_size) != 0;
+        }
+    }
+    uint64_t start = ffi_stats_now_ns();
+    for (int pass = 0; ok && pass < passes; ++pass) {
+        for (int64_t i = 0; i < replayed; ++i) {
+            const FFI_ReplayCall* call = &calls[i];
+            GenericTrampolinePtr trampoline = (GenericTrampolinePtr)FFI_ATOMIC_LOAD_PTR((void**)&call->sig->trampoline_code);
+            trampoline(call->args, call->sig->num_params, &result);
+        }
+    }
+    report->passes = ok ? passes : 0;
+    report->seconds = (double)(ffi_stats_now_ns() - start) / 1e9;
+    report->calls_per_second = report->seconds > 0.0 ? (double)(replayed * report->passes) / report->seconds : 0.0;
+
+    for (int64_t i = 0; sigs && i < created; ++i) {
+        destroy_ffi_function(sigs[i].sig);
+    }
+    ffi_epoch_synchronize(); // Retired handles are gone before the log they were built from
+    free(arg_pool);
+    free(calls);
+    free(sigs);
+    munmap((void*)log, (size_t)file_size);
+    if (!ok) {
+        ffi_log_error("ERROR: Out of memory replaying '%s'.", path);
+    }
+    return ok;
+#else
+    (void)path; (void)resolver; (void)user_data; (void)passes;
+    ffi_log_error("ERROR: Call replay needs mmap (Linux or macOS).");
+    return false;
+#endif
+}
+
+// --- Epoch-Based Reclamation ---
+// destroy_ffi_function() may race with invocations of the same signature on other threads, so it
+// only retires the signature; its code pages and struct are freed once every thread has passed
+// a grace period. Invokers pay no shared refcount: ffi_epoch_enter() publishes the global epoch
+// in the calling thread's own cache line and ffi_epoch_leave() clears it. The epoch advances
+// only when every thread inside a critical section has seen the current one; anything retired
+// two epochs ago can no longer be referenced and is freed. With no concurrent invokers, the
+// epoch advances immediately and destroy frees synchronously, as before.
+
+// One per thread that has ever entered an epoch, reused after ffi_epoch_thread_detach().
+// Allocated on its own cache line so invokers never share a line with each other.
+typedef struct FFI_EpochThread {
+    int64_t state;                // epoch * 2 + 1 while inside a critical section, 0 outside
+    int depth;                    // ffi_epoch_enter() nesting; owner thread only
+    bool in_use;                  // Guarded by g_ffi_epoch_lock
+    struct FFI_EpochThread* next; // Registry link, never unlinked
+} FFI_EpochThread;
+
+static int64_t g_ffi_epoch = 1;
+static ffi_mutex_t g_ffi_epoch_lock = FFI_MUTEX_INITIALIZER; // Guards the registry and the retired list
+static FFI_EpochThread* g_ffi_epoch_threads = NULL;
+static FFI_FunctionSignature* g_ffi_retired = NULL;
+static int64_t g_ffi_retired_count = 0;
+static FFI_THREAD_LOCAL FFI_EpochThread* t_ffi_epoch_thread = NULL;
+
+/**
+ * @brief Gives the calling thread an epoch record, reusing one a detached thread left behind.
+ */
+static FFI_EpochThread* ffi_epoch_register(void) {
+    ffi_mutex_lock(&g_ffi_epoch_lock);
+    FFI_EpochThread* self = g_ffi_epoch_threads;
+    while (self != NULL && self->in_use) {
+        self = self->next;
+    }
+    if (self == NULL) {
+        self = (FFI_EpochThread*)ffi_aligned_malloc(FFI_CACHE_LINE_SIZE, sizeof(FFI_EpochThread));
+        if (self != NULL) {
+            memset(self, 0, sizeof(*self));
+            self->next = g_ffi_epoch_threads;
+            g_ffi_epoch_threads = self;
+        }
+    }
+    if (self != NULL) {
+        self->in_use = true;
+    }
+    ffi_mutex_unlock(&g_ffi_epoch_lock);
+    if (self == NULL) {
+        ffi_log_error("ERROR: ffi_epoch_enter: out of memory for a thread record; this thread is unprotected.");
+    }
+    t_ffi_epoch_thread = self;
+    return self;
+}
+
+/**
+ * @brief Enters an epoch critical section. Signatures loaded after this call stay valid, even if
+ * another thread destroys them, until the matching ffi_epoch_leave(). Sections nest.
+ * invoke_foreign_function() enters one itself; bracket the load of a shared handle too when
+ * another thread may destroy it.
+ */
+void ffi_epoch_enter(void) {
+    FFI_EpochThread* self = t_ffi_epoch_thread;
+    if (self == NULL && (self = ffi_epoch_register()) == NULL) {
+        return;
+    }
+    if (self->depth++ == 0) {
+        FFI_ATOMIC_STORE_I64(&self->state, FFI_ATOMIC_LOAD_I64(&g_ffi_epoch) * 2 + 1);
+        FFI_ATOMIC_FENCE(); // The epoch must be visible before any handle is read
+    }
+}
+
+/**
+ * @brief Leaves the critical section opened by the matching ffi_epoch_enter().
+ */
+void ffi_epoch_leave(void) {
+    FFI_EpochThread* self = t_ffi_epoch_thread;
+    if (self != NULL && --self->depth == 0) {
+        FFI_ATOMIC_STORE_I64(&self->state, 0);
+    }
+}
+
+/**
+ * @brief Releases the calling thread's epoch record for reuse. Call before a thread that
+ * invoked foreign functions exits; the worker pool and executor threads do so themselves.
+ */
+void ffi_epoch_thread_detach(void) {
+    FFI_EpochThread* self = t_ffi_epoch_thread;
+    if (self == NULL) {
+        return;
+    }
+    if (self->depth != 0) {
+        ffi_log_error("ERROR: ffi_epoch_thread_detach: called inside an epoch critical section.");
+        return;
+    }
+    ffi_mutex_lock(&g_ffi_epoch_lock);
+    self->in_use = false;
+    ffi_mutex_unlock(&g_ffi_epoch_lock);
+    t_ffi_epoch_thread = NULL;
+}
+
+/**
+ * @brief Frees a signature's trampoline and struct immediately. Only safe once it is unreachable.
+ */
+static void ffi_free_function_now(FFI_FunctionSignature* ffi_func) {
+    if (ffi_func->trampoline_code && ffi_func->trampoline_code != ffi_lazy_resolver_stub &&
+        ffi_func->trampoline_code != ffi_tier0_stub) {
+        // Cast to void* for ffi_free_executable_memory
+        ffi_free_executable_memory((void*)ffi_func->trampoline_code, ffi_func->trampoline_size);
+        ffi_stats_trampoline_freed((size_t)ffi_func->code_size);
+        ffi_func->trampoline_code = NULL;
+    }
+    ffi_call_stats_release(ffi_func->call_stats);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.handles_freed, 1);
+    free(ffi_func);
+}
+
+/**
+ * @brief Advances the global epoch (at most twice) and frees every retired signature no thread
+ * can still hold. Called with g_ffi_epoch_lock held.
+ */
+static void ffi_epoch_reclaim_locked(void) {
+    for (int step = 0; step < 2; ++step) {
+        int64_t epoch = FFI_ATOMIC_LOAD_I64(&g_ffi_epoch);
+        FFI_ATOMIC_FENCE(); // Pairs with the fence in ffi_epoch_enter()
+        bool quiescent = true;
+        for (FFI_EpochThread* thread = g_ffi_epoch_threads; thread != NULL && quiescent; thread = thread->next) {
+            int64_t state = FFI_ATOMIC_LOAD_I64(&thread->state);
+            quiescent = !(state & 1) || (state >> 1) == epoch;
+        }
+        if (!quiescent) {
+            break;
+        }
+        FFI_ATOMIC_STORE_I64(&g_ffi_epoch, epoch + 1);
+    }
+
+    int64_t epoch = FFI_ATOMIC_LOAD_I64(&g_ffi_epoch);
+    FFI_FunctionSignature** link = &g_ffi_retired;
+    while (*link != NULL) {
+        FFI_FunctionSignature* retired = *link;
+        if (retired->retired_epoch + 2 <= epoch) {
+            *link = retired->retired_next;
+            ffi_free_function_now(retired);
+            g_ffi_retired_count--;
+        } else {
+            link = &retired->retired_next;
+        }
+    }
+}
+
+/**
+ * @brief Blocks until every signature destroyed so far has been freed.
+ * Must not be called inside an epoch critical section (it would wait for itself).
+ */
+void ffi_epoch_synchronize(void) {
+    if (t_ffi_epoch_thread != NULL && t_ffi_epoch_thread->depth > 0) {
+        ffi_log_error("ERROR: ffi_epoch_synchronize: called inside an epoch critical section.");
+        return;
+    }
+    for (;;) {
+        ffi_mutex_lock(&g_ffi_epoch_lock);
+        ffi_epoch_reclaim_locked();
+        int64_t remaining = g_ffi_retired_count;
+        ffi_mutex_unlock(&g_ffi_epoch_lock);
+        if (remaining == 0) {
+            break;
+        }
+        ffi_thread_yield();
+    }
+}
+
+/**
+ * @brief Number of destroyed signatures still waiting for their grace period.
+ */
+int64_t ffi_epoch_retired_count(void) {
+    ffi_mutex_lock(&g_ffi_epoch_lock);
+    int64_t count = g_ffi_retired_count;
+    ffi_mutex_unlock(&g_ffi_epoch_lock);
+    return count;
+}
+
+/**
+ * @brief Destroys an FFI_FunctionSignature object, freeing its associated memory.
+ * The handle is retired rather than freed on the spot: threads still invoking it (or inside an
+ * epoch section that loaded it) keep a valid trampoline until they leave their section.
+ * The caller must already have made the handle unreachable for new invocations.
+ *
+ * @param ffi_func A pointer to the FFI_FunctionSignature object to destroy.
+ */
+void destroy_ffi_function(FFI_FunctionSignature* ffi_func) {
+    if (ffi_func) {
+        ffi_log_info("Destroying FFI function: '%s'", ffi_func->debug_name);
+        FFI_ATOMIC_ADD_I64(&g_ffi_counters.handles_destroyed, 1);
+        FFI_PROBE3(trampoline_destroy, ffi_func->id, (uintptr_t)ffi_func->debug_name,
+                   (uintptr_t)FFI_ATOMIC_LOAD_PTR((void**)&ffi_func->trampoline_code));
+        ffi_tier_cancel(ffi_func);
+        ffi_mutex_lock(&g_ffi_epoch_lock);
+        ffi_func->retired_epoch = FFI_ATOMIC_LOAD_I64(&g_ffi_epoch);
+        ffi_func->retired_next = g_ffi_retired;
+        g_ffi_retired = ffi_func;
+        g_ffi_retired_count++;
+        ffi_epoch_reclaim_locked();
+        ffi_mutex_unlock(&g_ffi_epoch_lock);
+    }
+}
+
+static bool invoke_foreign_function_in_epoch(FFI_FunctionSignature* sig, FFI_Argument* args, int num_args, FFI_Argument* return_value_out);
+
+/**
+ * @brief Invokes a foreign C function using its dynamically generated trampoline.
+ * This function acts as the "core VM dispatcher".
+ *
+ * @param sig A pointer to the FFI_FunctionSignature object representing the target function.
+ * @param args An array of FFI_Argument structs holding the input arguments. Can be NULL if num_args is 0.
+ * @param num_args The number of arguments in the `args` array.
+ * @param return_value_out A pointer to an FFI_Argument struct where the return value should be stored.
+ * Its `value_ptr` should point to a buffer of appropriate size. Can be NULL for void returns.
+ * @return True if the function was invoked successfully, false otherwise.
+ */
+bool invoke_foreign_function(FFI_FunctionSignature* sig, FFI_Argument* args, int num_args, FFI_Argument* return_value_out) {
+    ffi_epoch_enter(); // Keeps `sig` and its trampoline alive even if another thread destroys it
+    FFI_PROBE2(invoke_entry, sig->id, num_args);
+    int64_t trace_start = ffi_call_trace_begin();
+    bool invoked = invoke_foreign_function_in_epoch(sig, args, num_args, return_value_out);
+    if (trace_start) {
+        ffi_call_trace_end(sig, trace_start);
+    }
+    if (invoked && FFI_ATOMIC_LOAD_PTR((void**)&g_ffi_record_log) != NULL) {
+        ffi_call_record(sig, args, return_value_out ? return_value_out->value_ptr : NULL);
+    }
+    FFI_PROBE2(invoke_exit, sig->id, invoked);
+    ffi_epoch_leave();
+    return invoked;
+}
+
+static bool invoke_foreign_function_in_epoch(FFI_FunctionSignature* sig, FFI_Argument* args, int num_args, FFI_Argument* return_value_out) {
+    void* actual_return_buffer_ptr = NULL;
+    ffi_log_trace("\n--- Inside invoke_foreign_function (FFI Gateway / Core VM) ---");
+    ffi_log_trace("FFI Gateway: Calling function '%s'. Args array: %p, Num args: %d, Return FFI_Argument: %p.",
+           sig->debug_name, (void*)args, num_args, (void*)return_value_out);
+
+    // --- Argument count validation moved to the top ---
+    if (num_args != sig->num_params) {
+        ffi_log_error("Error: Incorrect number of arguments for function '%s'. Expected %d, got %d.",
+                sig->debug_name, sig->num_params, num_args);
+        return false;
+    }
+    // --- END Argument count validation ---
+
+    if (return_value_out) {
+        actual_return_buffer_ptr = return_value_out->value_ptr;
+        ffi_log_trace("FFI Gateway: Return value buffer pointer: %p", actual_return_buffer_ptr);
+        if (!actual_return_buffer_ptr && sig->return_type != FFI_TYPE_VOID) {
+            ffi_log_error("Error: return_value_out->value_ptr is NULL for non-void return type. Cannot store result.");
+            return false;
+        }
+    } else if (sig->return_type != FFI_TYPE_VOID) {
+         ffi_log_error("Warning: No return_value_out provided for non-void function '%s'. Return value will be lost.", sig->debug_name);
+    }
+
+
+    // Tier-0 handles are served by their shim until promoted; everything else needs its trampoline now.
+    bool tier0 = FFI_ATOMIC_LOAD_PTR((void**)&sig->trampoline_code) == (void*)ffi_tier0_stub;
+    if (!tier0 && !ffi_resolve_function(sig)) {
+        ffi_log_error("Error: Trampoline code not generated/set for function '%s'.", sig->debug_name);
+        return false;
+    }
+
+    // --- VERBOSE POINTER DEBUGGING ---
+    // Skipped entirely below trace level: no argument loads, no formatting.
+    if (ffi_log_enabled(FFI_LOG_LEVEL_TRACE)) {
+        ffi_log_trace("FFI Gateway: Input FFI_Argument array address: %p", (void*)args);
+        if (num_args > 0 && args != NULL) {
+            for (int i = 0; i < num_args; ++i) {
+                ffi_log_trace("FFI Gateway:   args[%d].value_ptr = %p", i, args[i].value_ptr);
+                // Attempt to peek at the value if it's an integer type (using sig->param_types[i])
+                if (sig->param_types && i < sig->num_params) {
+                    FFI_Type arg_type = sig->param_types[i];
+                    ffi_log_trace("FFI Gateway:   args[%d] (param_type %d) value: ", i, arg_type);
+                    if (args[i].value_ptr != NULL) {
+                        switch (arg_type) {
+                            case FFI_TYPE_BOOL:    ffi_log_trace("%d (bool)", *(bool*)args[i].value_ptr); break;
+                            case FFI_TYPE_CHAR:    ffi_log_trace("%d (char)", *(char*)args[i].value_ptr); break;
+                            case FFI_TYPE_UCHAR:   ffi_log_trace("%u (uchar)", *(unsigned char*)args[i].value_ptr); break;
+                            case FFI_TYPE_SCHAR:   ffi_log_trace("%d (schar)", *(signed char*)args[i].value_ptr); break;
+                            case FFI_TYPE_SHORT:   ffi_log_trace("%hd (short)", *(short*)args[i].value_ptr); break;
+                            case FFI_TYPE_USHORT:  ffi_log_trace("%hu (ushort)", *(unsigned short*)args[i].value_ptr); break;
+                            case FFI_TYPE_SSHORT:  ffi_log_trace("%hd (sshort)", *(signed short*)args[i].value_ptr); break;
+                            case FFI_TYPE_INT:     ffi_log_trace("%d (int)", *(int*)args[i].value_ptr); break;
+                            case FFI_TYPE_UINT:    ffi_log_trace("%u (uint)", *(unsigned int*)args[i].value_ptr); break;
+                            case FFI_TYPE_SINT:    ffi_log_trace("%d (sint)", *(signed int*)args[i].value_ptr); break;
+                            case FFI_TYPE_LONG:    ffi_log_trace("%ld (long)", *(long*)args[i].value_ptr); break;
+                            case FFI_TYPE_ULONG:   ffi_log_trace("%lu (ulong)", *(unsigned long*)args[i].value_ptr); break;
+                            case FFI_TYPE_SLONG:   ffi_log_trace("%ld (slong)", *(signed long*)args[i].value_ptr); break;
+                            case FFI_TYPE_LLONG:   ffi_log_trace("%lld (llong)", *(long long*)args[i].value_ptr); break;
+                            case FFI_TYPE_ULLONG:  ffi_log_trace("%llu (ullong)", *(unsigned long long*)args[i].value_ptr); break;
+                            case FFI_TYPE_SLLONG:  ffi_log_trace("%lld (sllong)", *(signed long long*)args[i].value_ptr); break;
+                            case FFI_TYPE_FLOAT:   ffi_log_trace("%f (float)", *(float*)args[i].value_ptr); break;
+                            case FFI_TYPE_DOUBLE:  ffi_log_trace("%lf (double)", *(double*)args[i].value_ptr); break;
+                            case FFI_TYPE_POINTER: ffi_log_trace("%p (pointer)", *(void**)args[i].value_ptr); break;
+                            case FFI_TYPE_WCHAR:   ffi_log_trace("%lc (wchar_t)", *(wchar_t*)args[i].value_ptr); break;
+                            case FFI_TYPE_SIZE_T:  ffi_log_trace("%zu (size_t)", *(size_t*)args[i].value_ptr); break;
+                            case FFI_TYPE_FLOAT16: ffi_log_trace("%f (float16)", ffi_f16_bits_to_float(*(uint16_t*)args[i].value_ptr)); break;
+                            case FFI_TYPE_BFLOAT16: ffi_log_trace("%f (bfloat16)", ffi_bf16_bits_to_float(*(uint16_t*)args[i].value_ptr)); break;
+                            case FFI_TYPE_LONG_DOUBLE: ffi_log_trace("%Lf (long double)", *(long double*)args[i].value_ptr); break;
+#ifdef FFI_HAVE_COMPLEX
+                            case FFI_TYPE_FLOAT_COMPLEX:
+                                {
+                                    float _Complex val = *(float _Complex*)args[i].value_ptr;
+                                    ffi_log_trace("%f%+fi (float complex)", crealf(val), cimagf(val));
+                                }
+                                break;
+                            case FFI_TYPE_DOUBLE_COMPLEX:
+                                {
+                                    double _Complex val = *(double _Complex*)args[i].value_ptr;
+                                    ffi_log_trace("%lf%+lfi (double complex)", creal(val), cimag(val));
+                                }
+                                break;
+#endif
+#if defined(__SIZEOF_INT128__) || defined(__GNUC__)
+                            case FFI_TYPE_INT128:
+                                {
+                                    __int128 val = *(__int128*)args[i].value_ptr;
+                                    ffi_log_trace("0x%llx%016llx (__int128)", (unsigned long long)(val >> 64), (unsigned long long)val);
+                                }
+                                break;
+                            case FFI_TYPE_UINT128:
+                                {
+                                    unsigned __int128 val = *(unsigned __int128*)args[i].value_ptr;
+                                    ffi_log_trace("0x%llx%016llx (unsigned __int128)", (unsigned long long)(val >> 64), (unsigned long long)val);
+                                }
+                                break;
+#else
+                            case FFI_TYPE_INT128:
+                                {
+                                    int128_struct val = *(int128_struct*)args[i].value_ptr;
+                                    ffi_log_trace("0x%llx%016llx (int128_struct)", (unsigned long long)val.high, (unsigned long long)val.low);
+                                }
+                                break;
+                            case FFI_TYPE_UINT128:
+                                {
+                                    uint128_struct val = *(uint128_struct*)args[i].value_ptr;
+                                    ffi_log_trace("0x%llx%016llx (uint128_struct)", (unsigned long long)val.high, (unsigned long long)val.low);
+                                }
+                                break;
+#endif
+                            default: ffi_log_trace("Unknown Type (at %p)", args[i].value_ptr); break;
+                        }
+                    } else {
+                        ffi_log_trace("NULL pointer");
+                    }
+                } else {
+                    ffi_log_trace("FFI Gateway:   args[%d] value (raw ptr): %p", i, args[i].value_ptr);
+                }
+            }
+        } else {
+            ffi_log_trace("FFI Gateway:   No arguments to display.");
+        }
+    }
+    // --- END VERBOSE POINTER DEBUGGING ---
+
+    ffi_log_trace("FFI Gateway: Final return buffer ptr passed to trampoline: %p", actual_return_buffer_ptr);
+
+    // CRITICAL VALIDATION POINT: Ensure the return buffer pointer is valid before calling the trampoline
+    if (sig->return_type != FFI_TYPE_VOID && actual_return_buffer_ptr == NULL) {
+        ffi_log_error("CRITICAL ERROR: Return buffer pointer is NULL for non-void function '%s'. This should have been caught earlier.", sig->debug_name);
+        return false;
+    }
+
+    // (Additional sophisticated checks would involve ensuring it's writable memory, etc., but that's platform-dependent and usually handled by mmap PROT_WRITE)
+    if (tier0) {
+        ffi_log_trace("FFI Gateway: Calling tier-0 shim for '%s'.", sig->debug_name);
+        ffi_tier0_invoke(sig, args, actual_return_buffer_ptr);
+        return true;
+    }
+    GenericTrampolinePtr trampoline = (GenericTrampolinePtr)FFI_ATOMIC_LOAD_PTR((void**)&sig->trampoline_code);
+    ffi_log_trace("FFI Gateway: Calling dynamically generated generic trampoline for '%s' at %p...", sig->debug_name, (void*)trampoline);
+    trampoline(args, num_args, actual_return_buffer_ptr);
+
+    ffi_log_trace("FFI Gateway: Trampoline finished. Function '%s' invoked successfully.", sig->debug_name);
+
+    return true;
+}
+
+// --- Library Bindings ---
+// Binds a whole shared library from a table of (symbol, signature string) pairs. Opening the
+// library only records the table: like PLT entries, each slot starts out unresolved and the
+// first call through it runs the resolver, which looks the symbol up, creates its handle and
+// publishes it with a compare-and-swap. Later calls go straight to the handle, and symbols
+// that are never called cost nothing beyond their table entry.
+
+#ifdef FFI_OS_WIN64
+    typedef HMODULE ffi_library_handle_t;
+    #define ffi_library_dlopen(path) LoadLibraryA(path)
+    #define ffi_library_dlsym(handle, name) ((void*)GetProcAddress((handle), (name)))
+    #define ffi_library_dlclose(handle) ((void)FreeLibrary(handle))
+#else
+    typedef void* ffi_library_handle_t;
+    #define ffi_library_dlopen(path) dlopen((path), RTLD_LAZY | RTLD_LOCAL)
+    #define ffi_library_dlsym(handle, name) dlsym((handle), (name))
+    #define ffi_library_dlclose(handle) ((void)dlclose(handle))
+#endif
+
+// One entry of a binding table. The strings must outlive the library binding.
+typedef struct {
+    const char* symbol;    // Exported name, e.g. "cos"
+    const char* signature; // Signature string, e.g. "d(d)"
+} FFI_LibraryBinding;
+
+typedef struct {
+    ffi_library_handle_t handle;
+    const char* path;
+    const FFI_LibraryBinding* table;
+    int count;
+    FFI_FunctionSignature** slots; // NULL until the symbol's first call
+    int64_t resolved;
+} FFI_Library;
+
+/**
+ * @brief Runs the resolver for entry `index` if it has not run yet.
+ * Safe to race: every racer builds a handle, one compare-and-swap publishes the winner and
+ * the losers destroy theirs.
+ * @return The entry's handle, or NULL if the symbol is missing or its signature is invalid.
+ */
+FFI_FunctionSignature* ffi_library_function(FFI_Library* lib, int index) {
+    if (index < 0 || index >= lib->count) {
+        ffi_log_error("ERROR: ffi_library_function: index %d out of range for '%s' (%d entries).", index, lib->path, lib->count);
+        return NULL;
+    }
+    FFI_FunctionSignature* sig = (FFI_FunctionSignature*)FFI_ATOMIC_LOAD_PTR((void**)&lib->slots[index]);
+    if (sig != NULL) {
+        return sig;
+    }
+    const FFI_LibraryBinding* entry = &lib->table[index];
+    void* address = ffi_library_dlsym(lib->handle, entry->symbol);
+    if (address == NULL) {
+        ffi_log_error("ERROR: Library '%s' has no symbol '%s'.", lib->path, entry->symbol);
+        return NULL;
+    }
+    ffi_log_info("Library binding: resolved '%s' in '%s' at %p.", entry->symbol, lib->path, address);
+    FFI_FunctionSignature* built = create_ffi_function_from_signature(entry->symbol, entry->signature, (GenericFuncPtr)address);
+    if (built == NULL) {
+        return NULL;
+    }
+    void* expected = NULL;
+    if (!FFI_ATOMIC_CAS_PTR((void**)&lib->slots[index], expected, (void*)built)) {
+        destroy_ffi_function(built); // Lost the race; nobody else has seen `built`
+        return (FFI_FunctionSignature*)FFI_ATOMIC_LOAD_PTR((void**)&lib->slots[index]);
+    }
+    FFI_ATOMIC_ADD_I64(&lib->resolved, 1);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.library_resolved, 1);
+    return built;
+}
+
+/**
+ * @brief Destroys every resolved handle and closes the library.
+ * Waits for invocations still running on other threads to finish before the library's code
+ * is unmapped; must not be called inside an epoch section.
+ */
+void ffi_library_close(FFI_Library* lib) {
+    if (lib == NULL) {
+        return;
+    }
+    for (int i = 0; i < lib->count; ++i) {
+        destroy_ffi_function(lib->slots[i]);
+    }
+    ffi_epoch_synchronize();
+    ffi_library_dlclose(lib->handle);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.libraries_open, -1);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.library_bindings, -(int64_t)lib->count);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.library_resolved, -FFI_ATOMIC_LOAD_I64(&lib->resolved));
+    ffi_log_info("Closed library '%s' (%d of %d bindings were resolved).", lib->path, (int)lib->resolved, lib->count);
+    free(lib->slots);
+    free(lib);
+}
+
+/**
+ * @brief Opens a shared library and attaches a binding table to it.
+ * No symbol is looked up and no handle is created here unless `bind_now` asks for it (the
+ * equivalent of LD_BIND_NOW), so lookup and signature errors surface at first call.
+ *
+ * @param path The library to open, as passed to dlopen()/LoadLibrary().
+ * @param table The (symbol, signature) pairs; entry `i` is called through index `i`.
+ * @param count Number of entries in `table`.
+ * @param bind_now True to resolve every entry up front, failing if any cannot be bound.
+ * @return The library binding, or NULL if the library cannot be opened.
+ */
+FFI_Library* ffi_library_open(const char* path, const FFI_LibraryBinding* table, int count, bool bind_now) {
+    ffi_library_handle_t handle = ffi_library_dlopen(path);
+    if (handle == NULL) {
+#ifdef FFI_OS_WIN64
+        ffi_log_error("ERROR: Cannot open library '%s' (error %lu).", path, (unsigned long)GetLastError());
+#else
+        ffi_log_error("ERROR: Cannot open library '%s': %s", path, dlerror());
+#endif
+        return NULL;
+    }
+    FFI_Library* lib = (FFI_Library*)calloc(1, sizeof(FFI_Library));
+    FFI_FunctionSignature** slots = (FFI_FunctionSignature**)calloc(count > 0 ? (size_t)count : 1, sizeof(*slots));
+    if (lib == NULL || slots == NULL) {
+        ffi_log_error("ERROR: ffi_library_open: out of memory for %d entries of '%s'.", count, path);
+        free(slots);
+        free(lib);
+        ffi_library_dlclose(handle);
+        return NULL;
+    }
+    lib->handle = handle;
+    lib->path = path;
+    lib->table = table;
+    lib->count = count;
+    lib->slots = slots;
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.libraries_open, 1);
+    FFI_ATOMIC_ADD_I64(&g_ffi_counters.library_bindings, count);
+    ffi_log_info("Opened library '%s' with %d lazy bindings.", path, count);
+    for (int i = 0; bind_now && i < count; ++i) {
+        if (ffi_library_function(lib, i) == NULL) {
+            ffi_log_error("ERROR: ffi_library_open: cannot bind '%s' from '%s' now.", table[i].symbol, path);
+            ffi_library_close(lib);
+            return NULL;
+        }
+    }
+    if (bind_now) {
+        ffi_gdb_jit_flush(); // A bulk binding pass is a natural end of batch
+    }
+    return lib;
+}
+
+/**
+ * @brief Looks up the table index of a symbol by name (a linear scan; cache the result).
+ * @return The index, or -1 if the table has no such entry.
+ */
+int ffi_library_index(const FFI_Library* lib, const char* symbol) {
+    for (int i = 0; i < lib->count; ++i) {
+        if (strcmp(lib->table[i].symbol, symbol) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Calls entry `index` of a library binding, resolving it on first use.
+ * @return True if the function was invoked, false if it could not be resolved or the call was rejected.
+ */
+bool ffi_library_invoke(FFI_Library* lib, int index, FFI_Argument* args, int num_args, FFI_Argument* return_value_out) {
+    FFI_FunctionSignature* sig = ffi_library_function(lib, index);
+    return sig != NULL && invoke_foreign_function(sig, args, num_args, return_value_out);
+}
+
+/**
+ * @brief Number of entries whose resolver has run successfully.
+ */
+int ffi_library_resolved_count(FFI_Library* lib) {
+    return (int)FFI_ATOMIC_LOAD_I64(&lib->resolved);
+}
+
+// Every argument and the return value get a slot this large and this aligned, enough for the
+// widest FFI_Type (__int128, long double, double complex).
+#define FFI_PREPARED_SLOT_SIZE 16
+// Prepared calls start on their own cache line so per-thread objects never share one.
+#define FFI_PREPARED_CALL_ALIGN FFI_CACHE_LINE_SIZE
+
+/**
+ * @brief Validates a signature once and builds a reusable call object for it.
+ * The argument count, parameter types and return type are checked here, and a lazily bound
+ * signature is resolved, so invoke_prepared_call() needs no checks of its own. The object
+ * holds one aligned slot per argument plus one for the return value, all in a single
+ * allocation; write arguments through prepared_call_arg() and read the result through
+ * prepared_call_return().
+ *
+ * @param sig The signature to call. It must not be destroyed while the prepared call exists.
+ * @return The prepared call, or NULL if the signature cannot be called.
+ */
+FFI_PreparedCall* prepare_ffi_call(FFI_FunctionSignature* sig) {
+    if (sig == NULL) {
+        ffi_log_error("ERROR: prepare_ffi_call: NULL signature.");
+        return NULL;
+    }
+    if (sig->num_params < 0 || (sig->num_params > 0 && sig->param_types == NULL)) {
+        ffi_log_error("ERROR: prepare_ffi_call: '%s' has %d parameters but no parameter types.", sig->debug_name, sig->num_params);
+        return NULL;
+    }
+    for (int i = 0; i < sig->num_params; ++i) {
+        if (sig->param_types[i] == FFI_TYPE_VOID || sig->param_types[i] == FFI_TYPE_UNKNOWN) {
+            ffi_log_error("ERROR: prepare_ffi_call: '%s' parameter %d has invalid type %d.", sig->debug_name, i, sig->param_types[i]);
+            return NULL;
+        }
+    }
+    if (sig->return_type == FFI_TYPE_UNKNOWN) {
+        ffi_log_error("ERROR: prepare_ffi_call: '%s' has an unknown return type.", sig->debug_name);
+        return NULL;
+    }
+    if (!ffi_resolve_function(sig)) {
+        ffi_log_error("ERROR: prepare_ffi_call: no trampoline for '%s'.", sig->debug_name);
+        return NULL;
+    }
+
+    // Layout: [header][FFI_Argument x n][argument slots x n][return slot], slots 16-byte aligned.
+    size_t num_args = (size_t)sig->num_params;
+    size_t header_size = (sizeof(FFI_PreparedCall) + FFI_PREPARED_SLOT_SIZE - 1) & ~(size_t)(FFI_PREPARED_SLOT_SIZE - 1);
+    size_t args_size = (num_args * sizeof(FFI_Argument) + FFI_PREPARED_SLOT_SIZE - 1) & ~(size_t)(FFI_PREPARED_SLOT_SIZE - 1);
+    size_t slots_size = (num_args + 1) * FFI_PREPARED_SLOT_SIZE;
+    unsigned char* block = (unsigned char*)ffi_aligned_malloc(FFI_PREPARED_CALL_ALIGN, header_size + args_size + slots_size);
+    if (block == NULL) {
+        ffi_log_error("ERROR: prepare_ffi_call: out of memory for '%s'.", sig->debug_name);
+        return NULL;
+    }
+    memset(block, 0, header_size + args_size + slots_size);
+
+    FFI_PreparedCall* call = (FFI_PreparedCall*)block;
+    unsigned char* slots = block + header_size + args_size;
+    call->trampoline = (GenericTrampolinePtr)FFI_ATOMIC_LOAD_PTR((void**)&sig->trampoline_code);
+    call->args = (FFI_Argument*)(block + header_size);
+    call->num_args = sig->num_params;
+    call->return_value = slots + num_args * FFI_PREPARED_SLOT_SIZE;
+    call->sig = sig;
+    for (size_t i = 0; i < num_args; ++i) {
+        call->args[i].value_ptr = slots + i * FFI_PREPARED_SLOT_SIZE;
+    }
+    ffi_log_info("Prepared call for '%s' at %p (%d argument slots).", sig->debug_name, (void*)call, call->num_args);
+    return call;
+}
+
+/**
+ * @brief Returns the storage of argument `index`; write the argument's C value there.
+ * The pointer is stable for the life of the prepared call, so it can be cached.
+ */
+void* prepared_call_arg(FFI_PreparedCall* call, int index) {
+    return call->args[index].value_ptr;
+}
+
+/**
+ * @brief Returns the storage the last invoke_prepared_call() wrote its result to.
+ */
+void* prepared_call_return(FFI_PreparedCall* call) {
+    return call->return_value;
+}
+
+/**
+ * @brief Calls the target with the arguments currently in the prepared call's slots.
+ * Everything was validated by prepare_ffi_call(), so the only per-call work besides the indirect
+ * call is the invoke_entry/invoke_exit USDT probes (a NOP each unless attached), the call-trace
+ * timing check and the check for an active call recording.
+ */
+void invoke_prepared_call(FFI_PreparedCall* call) {
+    FFI_PROBE2(invoke_entry, call->sig->id, call->num_args);
+    int64_t trace_start = ffi_call_trace_begin();
+    call->trampoline(call->args, call->num_args, call->return_value);
+    if (trace_start) {
+        ffi_call_trace_end(call->sig, trace_start);
+    }
+    if (FFI_ATOMIC_LOAD_PTR((void**)&g_ffi_record_log) != NULL) {
+        ffi_call_record(call->sig, call->args, call->return_value);
+    }
+    FFI_PROBE2(invoke_exit, call->sig->id, 1);
+}
+
+/**
+ * @brief Frees a prepared call. The signature it was prepared from is left untouched.
+ */
+void destroy_prepared_call(FFI_PreparedCall* call) {
+    ffi_aligned_free(call);
+}
+
+// --- Typed Bindings (C11 _Generic) ---
+// FFI_BIND() derives a signature from C type names and FFI_CALL() derives the argument types
+// from the argument expressions themselves, so binding sites need no FFI_Type tables and no
+// hand-boxed FFI_Argument arrays. Each argument is copied into a compound literal in the
+// caller's frame; the result comes back as a value of the requested C type.
+//
+// Types are matched exactly, without promotions: pass `(char)'a'`, `1.0f` or `(short)x` when
+// the parameter is narrower than the literal. Any type not in the list below (in practice,
+// any pointer) is treated as FFI_TYPE_POINTER. typedefs such as size_t and wchar_t map to the
+// FFI_Type of their underlying type, which has the same calling convention.
+
+// X(c_type, ffi_type, box_name) for every scalar with a fixed FFI_Type.
+#ifdef FFI_HAVE_COMPLEX
+    #define FFI_GENERIC_COMPLEX_SCALARS(X) \
+        X(float _Complex, FFI_TYPE_FLOAT_COMPLEX, fc) \
+        X(double _Complex, FFI_TYPE_DOUBLE_COMPLEX, dc)
+#else
+    #define FFI_GENERIC_COMPLEX_SCALARS(X)
+#endif
+#ifdef __SIZEOF_INT128__
+    #define FFI_GENERIC_INT128_SCALARS(X) \
+        X(__int128, FFI_TYPE_INT128, i128) \
+        X(unsigned __int128, FFI_TYPE_UINT128, ui128)
+#else
+    #define FFI_GENERIC_INT128_SCALARS(X)
+#endif
+#ifdef __FLT16_MAX__
+    #define FFI_GENERIC_FLOAT16_SCALARS(X) X(_Float16, FFI_TYPE_FLOAT16, f16)
+#else
+    #define FFI_GENERIC_FLOAT16_SCALARS(X)
+#endif
+
+#define FFI_GENERIC_SCALARS(X) \
+    X(bool, FFI_TYPE_BOOL, b) \
+    X(char, FFI_TYPE_CHAR, c) \
+    X(signed char, FFI_TYPE_SCHAR, sc) \
+    X(unsigned char, FFI_TYPE_UCHAR, uc) \
+    X(short, FFI_TYPE_SHORT, s) \
+    X(unsigned short, FFI_TYPE_USHORT, us) \
+    X(int, FFI_TYPE_INT, i) \
+    X(unsigned int, FFI_TYPE_UINT, ui) \
+    X(long, FFI_TYPE_LONG, l) \
+    X(unsigned long, FFI_TYPE_ULONG, ul) \
+    X(long long, FFI_TYPE_LLONG, ll) \
+    X(unsigned long long, FFI_TYPE_ULLONG, ull) \
+    X(float, FFI_TYPE_FLOAT, f) \
+    X(double, FFI_TYPE_DOUBLE, d) \
+    X(long double, FFI_TYPE_LONG_DOUBLE, ld) \
+    FFI_GENERIC_COMPLEX_SCALARS(X) \
+    FFI_GENERIC_INT128_SCALARS(X) \
+    FFI_GENERIC_FLOAT16_SCALARS(X)
+
+// One argument slot of a typed call: every member starts at offset 0, so a pointer to the
+// union is a pointer to the value, which is what FFI_Argument::value_ptr expects.
+typedef union {
+#define FFI_VALUE_MEMBER(c_type, ffi_type, name) c_type name;
+    FFI_GENERIC_SCALARS(FFI_VALUE_MEMBER)
+#undef FFI_VALUE_MEMBER
+    const volatile void* ptr;
+} FFI_Value;
+
+// ffi_box_<name>(): stores one C value into an FFI_Value. Only the function _Generic selects
+// is called, so an argument is only ever converted to its own type.
+#define FFI_DEFINE_BOX(c_type, ffi_type, name) \
+    static inline FFI_Value ffi_box_##name(c_type value) { FFI_Value boxed; boxed.name = value; return boxed; }
+FFI_GENERIC_SCALARS(FFI_DEFINE_BOX)
+#undef FFI_DEFINE_BOX
+static inline FFI_Value ffi_box_ptr(const volatile void* value) { FFI_Value boxed; boxed.ptr = value; return boxed; }
+
+#define FFI_GENERIC_TYPE_OF_VALUE(c_type, ffi_type, name) c_type: ffi_type,
+#define FFI_GENERIC_TYPE_OF_NAME(c_type, ffi_type, name) c_type*: ffi_type,
+#define FFI_GENERIC_BOX(c_type, ffi_type, name) c_type: ffi_box_##name,
+
+/** @brief The FFI_Type of an expression's type. The expression is not evaluated. */
+#define FFI_TYPE_OF(expr) _Generic((expr), FFI_GENERIC_SCALARS(FFI_GENERIC_TYPE_OF_VALUE) default: FFI_TYPE_POINTER)
+/** @brief The FFI_Type of a type name; `void` gives FFI_TYPE_VOID, any pointer type FFI_TYPE_POINTER. */
+#define FFI_TYPE_ID(c_type) _Generic((c_type*)0, void*: FFI_TYPE_VOID, FFI_GENERIC_SCALARS(FFI_GENERIC_TYPE_OF_NAME) default: FFI_TYPE_POINTER)
+/** @brief An FFI_Value holding `expr` as its own C type. */
+#define FFI_BOX(expr) _Generic((expr), FFI_GENERIC_SCALARS(FFI_GENERIC_BOX) default: ffi_box_ptr)(expr)
+
+// Argument-list helpers, for up to 16 arguments.
+#define FFI_PP_EXPAND(x) x
+#define FFI_PP_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, n, ...) n
+#define FFI_PP_NARGS(...) FFI_PP_EXPAND(FFI_PP_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0))
+#define FFI_PP_CAT_(a, b) a##b
+#define FFI_PP_CAT(a, b) FFI_PP_CAT_(a, b)
+#define FFI_PP_MAP_1(f, x) f(x)
+#define FFI_PP_MAP_2(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_1(f, __VA_ARGS__))
+#define FFI_PP_MAP_3(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_2(f, __VA_ARGS__))
+#define FFI_PP_MAP_4(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_3(f, __VA_ARGS__))
+#define FFI_PP_MAP_5(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_4(f, __VA_ARGS__))
+#define FFI_PP_MAP_6(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_5(f, __VA_ARGS__))
+#define FFI_PP_MAP_7(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_6(f, __VA_ARGS__))
+#define FFI_PP_MAP_8(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_7(f, __VA_ARGS__))
+#define FFI_PP_MAP_9(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_8(f, __VA_ARGS__))
+#define FFI_PP_MAP_10(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_9(f, __VA_ARGS__))
+#define FFI_PP_MAP_11(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_10(f, __VA_ARGS__))
+#define FFI_PP_MAP_12(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_11(f, __VA_ARGS__))
+#define FFI_PP_MAP_13(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_12(f, __VA_ARGS__))
+#define FFI_PP_MAP_14(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_13(f, __VA_ARGS__))
+#define FFI_PP_MAP_15(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_14(f, __VA_ARGS__))
+#define FFI_PP_MAP_16(f, x, ...) f(x), FFI_PP_EXPAND(FFI_PP_MAP_15(f, __VA_ARGS__))
+#define FFI_PP_MAP(f, ...) FFI_PP_EXPAND(FFI_PP_CAT(FFI_PP_MAP_, FFI_PP_NARGS(__VA_ARGS__))(f, __VA_ARGS__))
+
+#define FFI_ARG_SLOT(expr) { (FFI_Value[1]){ FFI_BOX(expr) } }
+#define FFI_ARG_FRAME(...) ((FFI_Argument[]){ FFI_PP_MAP(FFI_ARG_SLOT, __VA_ARGS__) })
+
+/**
+ * @brief Backend of FFI_CALL(): invokes `sig` and returns `return_slot`, which holds the result.
+ * On failure the error has already been logged and the slot is returned untouched (zeroed).
+ */
+static inline void* ffi_invoke_typed(FFI_FunctionSignature* sig, FFI_Argument* args, int num_args, FFI_Value* return_slot) {
+    FFI_Argument return_value = { return_slot };
+    invoke_foreign_function(sig, args, num_args, &return_value);
+    return return_slot;
+}
+
+/**
+ * @brief Creates a signature for `func` from C type names, e.g. FFI_BIND(add_two_ints, int, int, int).
+ * The parameter list follows the C prototype convention: write `void` for a function without
+ * parameters. The type list is copied, so the binding may outlive the enclosing block.
+ */
+#define FFI_BIND(func, return_c_type, ...) \
+    create_ffi_function(#func, FFI_TYPE_ID(return_c_type), FFI_BIND_NUM_PARAMS(__VA_ARGS__), \
+                        (FFI_Type[]){ FFI_PP_MAP(FFI_TYPE_ID, __VA_ARGS__) }, (GenericFuncPtr)(func), NULL, 0)
+#define FFI_BIND_NUM_PARAMS(...) \
+    ((FFI_PP_NARGS(__VA_ARGS__) == 1 && (FFI_Type[]){ FFI_PP_MAP(FFI_TYPE_ID, __VA_ARGS__) }[0] == FFI_TYPE_VOID) \
+         ? 0 : FFI_PP_NARGS(__VA_ARGS__))
+
+/**
+ * @brief Calls `sig` with typed arguments and yields its result as `return_c_type`,
+ * e.g. `int sum = FFI_CALL(sig, int, 3, 4);`.
+ */
+#define FFI_CALL(sig, return_c_type, ...) \
+    (*(return_c_type*)ffi_invoke_typed((sig), FFI_ARG_FRAME(__VA_ARGS__), FFI_PP_NARGS(__VA_ARGS__), &(FFI_Value){ 0 }))
+/** @brief FFI_CALL() for a function without parameters. */
+#define FFI_CALL0(sig, return_c_type) \
+    (*(return_c_type*)ffi_invoke_typed((sig), NULL, 0, &(FFI_Value){ 0 }))
+/** @brief FFI_CALL() for a function returning void. */
+#define FFI_CALL_VOID(sig, ...) \
+    ((void)ffi_invoke_typed((sig), FFI_ARG_FRAME(__VA_ARGS__), FFI_PP_NARGS(__VA_ARGS__), &(FFI_Value){ 0 }))
+
+// --- Asynchronous Invocation (Worker Pool) ---
+// Foreign calls that block (on I/O, locks, sleeps) can be handed to a pool of worker threads
+// instead of running on the caller's thread. A submission is a prepared call: its signature,
+// argument slots and return slot travel together, and the pool owns it until the future
+// completes. Each worker has its own bounded queue; submissions are spread round-robin and an
+// idle worker steals from the other queues, so one slow call never strands the work behind it.
+
+typedef struct FFI_Future FFI_Future;
+typedef struct FFI_ThreadPool FFI_ThreadPool;
+
+/**
+ * @brief Called on the worker thread right after the call returns, before the future is marked
+ * complete. It may read the result through ffi_future_result() but must not destroy the future.
+ */
+typedef void (*FFI_FutureCallback)(FFI_Future* future, void* user_data);
+
+typedef struct {
+    int num_workers; // Worker threads (0 picks 4)
+    int queue_depth; // Capacity of each worker's queue (0 picks 256)
+} FFI_ThreadPoolConfig;
+
+// Snapshot of a pool's configuration and counters; counters are read without a global lock.
+typedef struct {
+    int num_workers;
+    int queue_depth;   // Per-worker capacity; the pool holds at most num_workers * queue_depth queued calls
+    int64_t queued;    // Submitted, not yet picked up by a worker
+    int64_t running;   // Currently executing on a worker
+    int64_t completed; // Finished since the pool was created
+    int64_t stolen;    // Completed by a worker other than the one they were queued on
+    int64_t rejected;  // Refused by ffi_invoke_async() because every queue was full
+} FFI_ThreadPoolStats;
+
+struct FFI_Future {
+    FFI_PreparedCall* call;
+    FFI_FutureCallback callback;
+    void* user_data;
+    int64_t done;    // Set (under `lock`) once the call and its callback have returned
+    ffi_mutex_t lock;
+    ffi_cond_t completed;
+};
+
+// Each queue (and its ring) sits on its own cache lines so workers never share one.
+typedef struct {
+    ffi_mutex_t lock;
+    FFI_Future** ring; // `queue_depth` slots; oldest entry at `head`
+    int head;
+    int count;
+} FFI_WorkerQueue;
+
+typedef struct {
+    FFI_WorkerQueue queue;
+    unsigned char pad[FFI_CACHE_LINE_SIZE - sizeof(FFI_WorkerQueue) % FFI_CACHE_LINE_SIZE];
+} FFI_PaddedWorkerQueue;
+
+typedef struct {
+    FFI_ThreadPool* pool;
+    int index;
+    ffi_thread_t thread;
+} FFI_Worker;
+
+struct FFI_ThreadPool {
+    // Read-mostly configuration, shared by every thread.
+    int num_workers;
+    int queue_depth;
+    FFI_PaddedWorkerQueue* queues; // One per worker
+    FFI_Worker* workers;
+    FFI_Future** rings;            // Backing store of every queue's ring
+    ffi_mutex_t idle_lock;         // Guards sleeping and `shutting_down`
+    ffi_cond_t work_available;
+    bool shutting_down;
+    // Written on every submission and every completion; kept off the configuration's line.
+    unsigned char pad0[FFI_CACHE_LINE_SIZE];
+    int64_t next_queue;            // Round-robin submission cursor
+    int64_t rejected;
+    unsigned char pad1[FFI_CACHE_LINE_SIZE];
+    int64_t queued;
+    int64_t running;
+    int64_t completed;
+    int64_t stolen;
+};
+
+/**
+ * @brief Appends `task` to `queue`; false if the queue is full.
+ */
+static bool ffi_worker_queue_push(FFI_ThreadPool* pool, FFI_WorkerQueue* queue, FFI_Future* task) {
+    bool pushed = false;
+    ffi_mutex_lock(&queue->lock);
+    if (queue->count < pool->queue_depth) {
+        queue->ring[(queue->head + queue->count) % pool->queue_depth] = task;
+        queue->count++;
+        FFI_ATOMIC_ADD_I64(&pool->queued, 1);
+        pushed = true;
+    }
+    ffi_mutex_unlock(&queue->lock);
+    return pushed;
+}
+
+/**
+ * @brief Removes the oldest entry of `queue`, or returns NULL if it is empty.
+ */
+static FFI_Future* ffi_worker_queue_pop(FFI_ThreadPool* pool, FFI_WorkerQueue* queue) {
+    FFI_Future* task = NULL;
+    ffi_mutex_lock(&queue->lock);
+    if (queue->count > 0) {
+        task = queue->ring[queue->head];
+        queue->head = (queue->head + 1) % pool->queue_depth;
+        queue->count--;
+        FFI_ATOMIC_ADD_I64(&pool->queued, -1);
+    }
+    ffi_mutex_unlock(&queue->lock);
+    return task;
+}
+
+/**
+ * @brief Runs one task: the call, its callback, then completion of the future.
+ * The future is not touched after it is marked complete, since a waiter may free it.
+ */
+static void ffi_worker_run(FFI_ThreadPool* pool, FFI_Future* task, bool stolen) {
+    FFI_ATOMIC_ADD_I64(&pool->running, 1);
+    invoke_prepared_call(task->call);
+    if (task->callback) {
+        task->callback(task, task->user_data);
+    }
+    FFI_ATOMIC_ADD_I64(&pool->running, -1);
+    FFI_ATOMIC_ADD_I64(&pool->completed, 1);
+    if (stolen) {
+        FFI_ATOMIC_ADD_I64(&pool->stolen, 1);
+    }
+    ffi_mutex_lock(&task->lock);
+    FFI_ATOMIC_STORE_I64(&task->done, 1);
+    ffi_cond_broadcast(&task->completed);
+    ffi_mutex_unlock(&task->lock);
+}
+
+FFI_THREAD_FUNC(ffi_worker_main, arg) {
+    FFI_Worker* self = (FFI_Worker*)arg;
+    FFI_ThreadPool* pool = self->pool;
+    for (;;) {
+        // Own queue first, then steal from the others, starting with the next worker.
+        FFI_Future* task = NULL;
+        int victim;
+        for (victim = 0; victim < pool->num_workers; ++victim) {
+            task = ffi_worker_queue_pop(pool, &pool->queues[(self->index + victim) % pool->num_workers].queue);
+            if (task) {
+                break;
+            }
+        }
+        if (task) {
+            ffi_worker_run(pool, task, victim != 0);
+            continue;
+        }
+
+        // Submitters bump `queued` before signalling under `idle_lock`, so no wakeup is lost.
+        ffi_mutex_lock(&pool->idle_lock);
+        while (FFI_ATOMIC_LOAD_I64(&pool->queued) == 0 && !pool->shutting_down) {
+            ffi_cond_wait(&pool->work_available, &pool->idle_lock);
+        }
+        bool exit_worker = pool->shutting_down && FFI_ATOMIC_LOAD_I64(&pool->queued) == 0;
+        ffi_mutex_unlock(&pool->idle_lock);
+        if (exit_worker) {
+            break;
+        }
+    }
+    ffi_epoch_thread_detach();
+    return FFI_THREAD_RETURN;
+}
+
+/**
+ * @brief Stops the first `num_threads` workers (after they drain the queues) and frees the pool.
+ */
+static void ffi_thread_pool_stop(FFI_ThreadPool* pool, int num_threads) {
+    ffi_mutex_lock(&pool->idle_lock);
+    pool->shutting_down = true;
+    ffi_cond_broadcast(&pool->work_available);
+    ffi_mutex_unlock(&pool->idle_lock);
+    for (int i = 0; i < num_threads; ++i) {
+        ffi_thread_join(pool->workers[i].thread);
+    }
+    for (int i = 0; i < pool->num_workers; ++i) {
+        ffi_mutex_destroy(&pool->queues[i].queue.lock);
+    }
+    ffi_cond_destroy(&pool->work_available);
+    ffi_mutex_destroy(&pool->idle_lock);
+    ffi_aligned_free(pool->rings);
+    free(pool->workers);
+    ffi_aligned_free(pool->queues);
+    ffi_aligned_free(pool);
+}
+
+/**
+ * @brief Starts a pool of worker threads for asynchronous foreign calls.
+ *
+ * @param config Worker count and per-worker queue depth, or NULL for the defaults.
+ * @return The pool, or NULL if memory or threads could not be obtained.
+ */
+FFI_ThreadPool* ffi_thread_pool_create(const FFI_ThreadPoolConfig* config) {
+    int num_workers = (config && config->num_workers > 0) ? config->num_workers : 4;
+    int queue_depth = (config && config->queue_depth > 0) ? config->queue_depth : 256;
+    // Round each ring up to whole cache lines so neighbouring queues never share one.
+    size_t ring_stride = ((size_t)queue_depth * sizeof(FFI_Future*) + FFI_CACHE_LINE_SIZE - 1)
+        / FFI_CACHE_LINE_SIZE * FFI_CACHE_LINE_SIZE / sizeof(FFI_Future*);
+    FFI_ThreadPool* pool = (FFI_ThreadPool*)ffi_aligned_malloc(FFI_CACHE_LINE_SIZE, sizeof(FFI_ThreadPool));
+    if (pool == NULL) {
+        ffi_log_error("ERROR: ffi_thread_pool_create: out of memory.");
+        return NULL;
+    }
+    memset(pool, 0, sizeof(FFI_ThreadPool));
+    pool->num_workers = num_workers;
+    pool->queue_depth = queue_depth;
+    size_t queues_size = (size_t)num_workers * sizeof(FFI_PaddedWorkerQueue);
+    size_t rings_size = (size_t)num_workers * ring_stride * sizeof(FFI_Future*);
+    pool->queues = (FFI_PaddedWorkerQueue*)ffi_aligned_malloc(FFI_CACHE_LINE_SIZE, queues_size);
+    pool->workers = (FFI_Worker*)calloc((size_t)num_workers, sizeof(FFI_Worker));
+    pool->rings = (FFI_Future**)ffi_aligned_malloc(FFI_CACHE_LINE_SIZE, rings_size);
+    if (pool->queues == NULL || pool->workers == NULL || pool->rings == NULL) {
+        ffi_log_error("ERROR: ffi_thread_pool_create: out of memory for %d workers.", num_workers);
+        ffi_aligned_free(pool->rings);
+        free(pool->workers);
+        ffi_aligned_free(pool->queues);
+        ffi_aligned_free(pool);
+        return NULL;
+    }
+    memset(pool->queues, 0, queues_size);
+    memset(pool->rings, 0, rings_size);
+    ffi_mutex_init(&pool->idle_lock);
+    ffi_cond_init(&pool->work_available);
+    for (int i = 0; i < num_workers; ++i) {
+        ffi_mutex_init(&pool->queues[i].queue.lock);
+        pool->queues[i].queue.ring = pool->rings + (size_t)i * ring_stride;
+    }
+
+    int started = 0;
+    for (; started < num_workers; ++started) {
+        pool->workers[started].pool = pool;
+        pool->workers[started].index = started;
+        if (!ffi_thread_start(&pool->workers[started].thread, ffi_worker_main, &pool->workers[started])) {
+            break;
+        }
+    }
+    if (started < num_workers) {
+        ffi_log_error("ERROR: ffi_thread_pool_create: could only start %d of %d workers.", started, num_workers);
+        ffi_thread_pool_stop(pool, started);
+        return NULL;
+    }
+    ffi_log_info("Thread pool %p started: %d workers, queue depth %d.", (void*)pool, num_workers, queue_depth);
+    return pool;
+}
+
+/**
+ * @brief Runs every call still queued, stops the workers and frees the pool.
+ * Futures handed out by the pool stay valid and must still be destroyed by their owners.
+ */
+void ffi_thread_pool_destroy(FFI_ThreadPool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    ffi_log_info("Stopping thread pool %p.", (void*)pool);
+    ffi_thread_pool_stop(pool, pool->num_workers);
+}
+
+/**
+ * @brief Queues a prepared call for a worker thread and returns its future.
+ * The prepared call belongs to the pool until the future completes: do not touch its slots
+ * or submit it again before then.
+ *
+ * @param pool The pool to run the call on.
+ * @param call A prepared call with its arguments already written.
+ * @param callback Optional. Run on the worker once the call returns.
+ * @param user_data Passed to `callback`.
+ * @return The future, or NULL if every worker queue is full (back-pressure) or on error.
+ */
+FFI_Future* ffi_invoke_async(FFI_ThreadPool* pool, FFI_PreparedCall* call, FFI_FutureCallback callback, void* user_data) {
+    if (pool == NULL || call == NULL) {
+        ffi_log_error("ERROR: ffi_invoke_async: NULL pool or prepared call.");
+        return NULL;
+    }
+    FFI_Future* future = (FFI_Future*)malloc(sizeof(FFI_Future));
+    if (future == NULL) {
+        ffi_log_error("ERROR: ffi_invoke_async: out of memory for '%s'.", call->sig->debug_name);
+        return NULL;
+    }
+    future->call = call;
+    future->callback = callback;
+    future->user_data = user_data;
+    future->done = 0;
+    ffi_mutex_init(&future->lock);
+    ffi_cond_init(&future->completed);
+
+    int start = (int)(FFI_ATOMIC_ADD_I64(&pool->next_queue, 1) % pool->num_workers);
+    bool pushed = false;
+    for (int i = 0; i < pool->num_workers && !pushed; ++i) {
+        pushed = ffi_worker_queue_push(pool, &pool->queues[(start + i) % pool->num_workers].queue, future);
+    }
+    if (!pushed) {
+        FFI_ATOMIC_ADD_I64(&pool->rejected, 1);
+        ffi_cond_destroy(&future->completed);
+        ffi_mutex_destroy(&future->lock);
+        free(future);
+        return NULL;
+    }
+
+    ffi_mutex_lock(&pool->idle_lock);
+    ffi_cond_signal(&pool->work_available);
+    ffi_mutex_unlock(&pool->idle_lock);
+    return future;
+}
+
+/**
+ * @brief True once the call and its callback have returned. Never blocks.
+ */
+bool ffi_future_poll(FFI_Future* future) {
+    return FFI_ATOMIC_LOAD_I64(&future->done) != 0;
+}
+
+/**
+ * @brief Blocks until the future completes and returns its result storage.
+ */
+void* ffi_future_wait(FFI_Future* future) {
+    ffi_mutex_lock(&future->lock);
+    while (FFI_ATOMIC_LOAD_I64(&future->done) == 0) {
+        ffi_cond_wait(&future->completed, &future->lock);
+    }
+    ffi_mutex_unlock(&future->lock);
+    return prepared_call_return(future->call);
+}
+
+/**
+ * @brief The result storage of a completed future (the prepared call's return slot).
+ */
+void* ffi_future_result(FFI_Future* future) {
+    return prepared_call_return(future->call);
+}
+
+/**
+ * @brief Waits for the future if it is still pending, then frees it.
+ * The prepared call is returned to the caller and is left untouched.
+ */
+void ffi_future_destroy(FFI_Future* future) {
+    if (future == NULL) {
+        return;
+    }
+    ffi_future_wait(future);
+    ffi_cond_destroy(&future->completed);
+    ffi_mutex_destroy(&future->lock);
+    free(future);
+}
+
+/**
+ * @brief Fills `stats` with the pool's configuration and current counters.
+ */
+void ffi_thread_pool_get_stats(FFI_ThreadPool* pool, FFI_ThreadPoolStats* stats) {
+    stats->num_workers = pool->num_workers;
+    stats->queue_depth = pool->queue_depth;
+    stats->queued = FFI_ATOMIC_LOAD_I64(&pool->queued);
+    stats->running = FFI_ATOMIC_LOAD_I64(&pool->running);
+    stats->completed = FFI_ATOMIC_LOAD_I64(&pool->completed);
+    stats->stolen = FFI_ATOMIC_LOAD_I64(&pool->stolen);
+    stats->rejected = FFI_ATOMIC_LOAD_I64(&pool->rejected);
+}
+
+// --- Dedicated Executor (Thread-Affine Libraries) ---
+// Some libraries may only be called from one thread (GUI toolkits, some database clients).
+// An executor owns that thread. Any number of producer threads push invocation records into a
+// bounded lock-free ring (Vyukov's array queue, with a single consumer); the executor thread
+// drains it in batches through the trampolines and completes each record. Producers and the
+// executor only sleep on a futex word when there is nothing to do, and completing a record
+// skips the wake syscall when its producer is still spinning.
+
+#define FFI_EXEC_SPIN_LIMIT 256 // Polls before a thread goes to sleep on its futex word
+
+enum { FFI_EXEC_PENDING = 0, FFI_EXEC_WAITING = 1, FFI_EXEC_DONE = 2 };
+
+typedef struct FFI_Executor FFI_Executor;
+
+// One queued call. It lives in the producer's storage (often its stack) until it completes.
+typedef struct {
+    FFI_PreparedCall* call;
+    FFI_Executor* executor;
+    uint32_t state; // FFI_EXEC_PENDING, FFI_EXEC_WAITING (producer asleep) or FFI_EXEC_DONE
+} FFI_ExecRecord;
+
+typedef struct {
+    int ring_capacity; // Records the ring holds, rounded up to a power of two (0 picks 1024)
+    int batch_size;    // Records run per drain before the executor re-checks its state (0 picks 64)
+} FFI_ExecutorConfig;
+
+typedef struct {
+    int ring_capacity;
+    int batch_size;
+    int64_t executed; // Records run
+    int64_t batches;  // Non-empty drains; executed / batches is the mean batch size
+    int64_t sleeps;   // Times the executor thread slept on an empty ring
+    int64_t full;     // Submissions refused because the ring was full
+} FFI_ExecutorStats;
+
+typedef struct {
+    int64_t sequence; // Position + 1 once published, position + capacity once consumed
+    FFI_ExecRecord* record;
+} FFI_RingSlot;
+
+struct FFI_Executor {
+    FFI_RingSlot* ring;
+    int64_t mask;
+    int batch_size;
+    ffi_thread_t thread;
+    FFI_ParkingLot lot;           // Wait queue where futex(2) is unavailable
+    uint32_t shutting_down;
+    // Producers contend on `enqueue_pos`; keep it off the executor thread's cache lines.
+    unsigned char pad0[FFI_CACHE_LINE_SIZE];
+    int64_t enqueue_pos;
+    int64_t full;                 // Producer-side counter, lives on the producers' line
+    unsigned char pad1[FFI_CACHE_LINE_SIZE];
+    int64_t dequeue_pos;          // Executor thread only
+    int64_t executed, batches, sleeps;
+    uint32_t consumer_sleeping;   // 1 while the executor thread sleeps (or is about to)
+};
+
+static bool ffi_executor_ring_empty(FFI_Executor* exec) {
+    FFI_RingSlot* slot = &exec->ring[exec->dequeue_pos & exec->mask];
+    return FFI_ATOMIC_LOAD_I64(&slot->sequence) != exec->dequeue_pos + 1;
+}
+
+FFI_THREAD_FUNC(ffi_executor_main, arg) {
+    FFI_Executor* exec = (FFI_Executor*)arg;
+    for (;;) {
+        int drained = 0;
+        while (drained < exec->batch_size && !ffi_executor_ring_empty(exec)) {
+            FFI_RingSlot* slot = &exec->ring[exec->dequeue_pos & exec->mask];
+            FFI_ExecRecord* record = slot->record;
+            // Hand the slot back before running the call so producers can refill it meanwhile.
+            FFI_ATOMIC_STORE_I64(&slot->sequence, exec->dequeue_pos + exec->mask + 1);
+            exec->dequeue_pos++;
+            invoke_prepared_call(record->call);
+            // Counted before the record reads DONE, so a caller that has its result also sees it in
+            // the stats. This thread is the only writer, so storing the next value needs no read-modify-write.
+            if (drained++ == 0) {
+                FFI_ATOMIC_STORE_I64(&exec->batches, exec->batches + 1);
+            }
+            FFI_ATOMIC_STORE_I64(&exec->executed, exec->executed + 1);
+            // The record may be gone as soon as it reads DONE; only its address is used after this.
+            if (FFI_ATOMIC_XCHG_U32(&record->state, FFI_EXEC_DONE) == FFI_EXEC_WAITING) {
+                ffi_futex_wake(&record->state, &exec->lot);
+            }
+        }
+        if (drained > 0) {
+            continue;
+        }
+        if (FFI_ATOMIC_LOAD_U32(&exec->shutting_down)) {
+            break;
+        }
+        for (int spin = 0; spin < FFI_EXEC_SPIN_LIMIT && ffi_executor_ring_empty(exec); ++spin) {
+        }
+        // Announce the sleep, then re-check: a producer that published before seeing the flag
+        // is caught by the re-check, one that published after it will wake us.
+        FFI_ATOMIC_XCHG_U32(&exec->consumer_sleeping, 1);
+        if (ffi_executor_ring_empty(exec) && !FFI_ATOMIC_LOAD_U32(&exec->shutting_down)) {
+            FFI_ATOMIC_ADD_I64(&exec->sleeps, 1);
+            ffi_futex_wait(&exec->consumer_sleeping, 1, &exec->lot);
+        }
+        FFI_ATOMIC_XCHG_U32(&exec->consumer_sleeping, 0);
+    }
+    ffi_epoch_thread_detach();
+    return FFI_THREAD_RETURN;
+}
+
+/**
+ * @brief Starts a dedicated executor thread with a bounded submission ring.
+ * Every call submitted to the executor runs on that one thread, in submission order per producer.
+ *
+ * @param config Ring capacity and batch size, or NULL for the defaults.
+ * @return The executor, or NULL if memory or the thread could not be obtained.
+ */
+FFI_Executor* ffi_executor_create(const FFI_ExecutorConfig* config) {
+    int64_t capacity = 2;
+    int64_t requested = (config && config->ring_capacity > 0) ? config->ring_capacity : 1024;
+    while (capacity < requested) {
+        capacity <<= 1;
+    }
+    FFI_Executor* exec = (FFI_Executor*)ffi_aligned_malloc(FFI_CACHE_LINE_SIZE, sizeof(FFI_Executor));
+    FFI_RingSlot* ring = (FFI_RingSlot*)calloc((size_t)capacity, sizeof(FFI_RingSlot));
+    if (exec == NULL || ring == NULL) {
+        ffi_log_error("ERROR: ffi_executor_create: out of memory for a %lld-record ring.", (long long)capacity);
+        free(ring);
+        ffi_aligned_free(exec);
+        return NULL;
+    }
+    memset(exec, 0, sizeof(*exec));
+    for (int64_t i = 0; i < capacity; ++i) {
+        ring[i].sequence = i;
+    }
+    exec->ring = ring;
+    exec->mask = capacity - 1;
+    exec->batch_size = (config && config->batch_size > 0) ? config->batch_size : 64;
+    ffi_mutex_init(&exec->lot.lock);
+    ffi_cond_init(&exec->lot.cond);
+    if (!ffi_thread_start(&exec->thread, ffi_executor_main, exec)) {
+        ffi_log_error("ERROR: ffi_executor_create: could not start the executor thread.");
+        ffi_cond_destroy(&exec->lot.cond);
+        ffi_mutex_destroy(&exec->lot.lock);
+        free(ring);
+        ffi_aligned_free(exec);
+        return NULL;
+    }
+    ffi_log_info("Executor %p started: ring of %lld records, batches of %d.", (void*)exec, (long long)capacity, exec->batch_size);
+    return exec;
+}
+
+/**
+ * @brief Runs every record already in the ring, stops the executor thread and frees the executor.
+ * No thread may submit to the executor once this has been called.
+ */
+void ffi_executor_destroy(FFI_Executor* exec) {
+    if (exec == NULL) {
+        return;
+    }
+    ffi_log_info("Stopping executor %p.", (void*)exec);
+    FFI_ATOMIC_XCHG_U32(&exec->shutting_down, 1);
+    FFI_ATOMIC_XCHG_U32(&exec->consumer_sleeping, 0);
+    ffi_futex_wake(&exec->consumer_sleeping, &exec->lot);
+    ffi_thread_join(exec->thread);
+    ffi_cond_destroy(&exec->lot.cond);
+    ffi_mutex_destroy(&exec->lot.lock);
+    free(exec->ring);
+    ffi_aligned_free(exec);
+}
+
+/**
+ * @brief Pushes a call onto the executor's ring without waiting for it to run.
+ * The record and the prepared call belong to the executor until ffi_exec_record_done() is true.
+ * Never call this from the executor thread itself and then wait: the wait would deadlock.
+ *
+ * @param exec The executor.
+ * @param record Storage for the invocation record; it must stay valid until the call completes.
+ * @param call A prepared call with its arguments already written.
+ * @return False if the ring is full (the record is left unqueued).
+ */
+bool ffi_executor_submit(FFI_Executor* exec, FFI_ExecRecord* record, FFI_PreparedCall* call) {
+    record->call = call;
+    record->executor = exec;
+    record->state = FFI_EXEC_PENDING;
+
+    FFI_RingSlot* slot;
+    int64_t pos = FFI_ATOMIC_LOAD_I64(&exec->enqueue_pos);
+    for (;;) {
+        slot = &exec->ring[pos & exec->mask];
+        int64_t diff = FFI_ATOMIC_LOAD_I64(&slot->sequence) - pos;
+        if (diff == 0) {
+            if (FFI_ATOMIC_CAS_I64(&exec->enqueue_pos, pos, pos + 1)) {
+                break;
+            }
+            pos = FFI_ATOMIC_LOAD_I64(&exec->enqueue_pos);
+        } else if (diff < 0) {
+            FFI_ATOMIC_ADD_I64(&exec->full, 1);
+            return false;
+        } else {
+            pos = FFI_ATOMIC_LOAD_I64(&exec->enqueue_pos);
+        }
+    }
+    slot->record = record;
+    FFI_ATOMIC_STORE_I64(&slot->sequence, pos + 1);
+
+    // Pairs with the executor's announce-then-recheck: only pay for a wake when it may be asleep.
+    FFI_ATOMIC_FENCE();
+    if (FFI_ATOMIC_LOAD_U32(&exec->consumer_sleeping) && FFI_ATOMIC_XCHG_U32(&exec->consumer_sleeping, 0)) {
+        ffi_futex_wake(&exec->consumer_sleeping, &exec->lot);
+    }
+    return true;
+}
+
+/**
+ * @brief True once the executor has run the record's call. Never blocks.
+ */
+bool ffi_exec_record_done(FFI_ExecRecord* record) {
+    return FFI_ATOMIC_LOAD_U32(&record->state) == FFI_EXEC_DONE;
+}
+
+/**
+ * @brief Spins briefly, then sleeps until the record's call has run. Returns its result storage.
+ */
+void* ffi_executor_wait(FFI_ExecRecord* record) {
+    for (int spin = 0; spin < FFI_EXEC_SPIN_LIMIT; ++spin) {
+        if (FFI_ATOMIC_LOAD_U32(&record->state) == FFI_EXEC_DONE) {
+            return prepared_call_return(record->call);
+        }
+    }
+    uint32_t expected = FFI_EXEC_PENDING;
+    FFI_ATOMIC_CAS_U32(&record->state, expected, FFI_EXEC_WAITING);
+    while (FFI_ATOMIC_LOAD_U32(&record->state) != FFI_EXEC_DONE) {
+        ffi_futex_wait(&record->state, FFI_EXEC_WAITING, &record->executor->lot);
+    }
+    return prepared_call_return(record->call);
+}
+
+/**
+ * @brief Runs a prepared call on the executor thread and waits for it; retries while the ring is full.
+ * @return The prepared call's result storage.
+ */
+void* ffi_executor_invoke(FFI_Executor* exec, FFI_PreparedCall* call) {
+    FFI_ExecRecord record;
+    while (!ffi_executor_submit(exec, &record, call)) {
+        ffi_thread_yield();
+    }
+    return ffi_executor_wait(&record);
+}
+
+/**
+ * @brief Fills `stats` with the executor's configuration and current counters.
+ */
+void ffi_executor_get_stats(FFI_Executor* exec, FFI_ExecutorStats* stats) {
+    stats->ring_capacity = (int)(exec->mask + 1);
+    stats->batch_size = exec->batch_size;
+    stats->executed = FFI_ATOMIC_LOAD_I64(&exec->executed);
+    stats->batches = FFI_ATOMIC_LOAD_I64(&exec->batches);
+    stats->sleeps = FFI_ATOMIC_LOAD_I64(&exec->sleeps);
+    stats->full = FFI_ATOMIC_LOAD_I64(&exec->full);
+}
+
+// --- Main Application ---
+typedef union {
+    bool b_val;
+    char c_val;
+    unsigned char uc_val;
+    signed char sc_val; // For explicit signed char
+    short s_val;
+    unsigned short us_val;
+    signed short ss_val; // For explicit signed short
+    int i_val;
+    unsigned int ui_val;
+    signed int si_val;   // For explicit signed int
+    long l_val;
+    unsigned long ul_val;
+    signed long sl_val;  // For explicit signed long
+    long long ll_val;
+    unsigned long long ull_val;
+    signed long long sll_val; // For explicit signed long long
+    float f_val;
+    double d_val;
+    void* ptr_val;
+    wchar_t wc_val; // For wchar_t
+    size_t sz_val;  // For size_t
+    uint16_t f16_bits; // For FFI_TYPE_FLOAT16 / FFI_TYPE_BFLOAT16 (raw 16-bit pattern)
+    long double ld_val; // For FFI_TYPE_LONG_DOUBLE
+#ifdef FFI_HAVE_COMPLEX
+    float _Complex fc_val;  // For FFI_TYPE_FLOAT_COMPLEX
+    double _Complex dc_val; // For FFI_TYPE_DOUBLE_COMPLEX
+#endif
+#if defined(__SIZEOF_INT128__) || defined(__GNUC__)
+    __int128 i128_val; // New: 128-bit signed
+    unsigned __int128 ui128_val; // New: 128-bit unsigned
+#else
+    int128_struct i128_val; // Placeholder for 128-bit signed
+    uint128_struct ui128_val; // Placeholder for 128-bit unsigned
+#endif
+    // Ensure this union is large enough for the largest possible return type (e.g., double or long long or 128-bit)
+} GenericReturnValue;
+
+// Return value storage and FFI_Argument for tests, one pair per thread so concurrent tests never
+// share a result buffer. main() points the main thread's pair at each other; any other thread
+// must do the same before using them.
+static FFI_THREAD_LOCAL FFI_Argument g_ffi_return_value;
+static FFI_THREAD_LOCAL GenericReturnValue g_ret_storage;
+
+
+// --- Test Functions (for subtest macro) ---
+
+void test_get_fixed_int_minimal() {
+    FFI_FunctionSignature* ffi_get_fixed_int_test = create_ffi_function(
+        "get_fixed_int_minimal", FFI_TYPE_INT, 0, NULL, (GenericFuncPtr)get_fixed_int_minimal, NULL, 0);
+    if (ffi_get_fixed_int_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        bool invocation_success = invoke_foreign_function(ffi_get_fixed_int_test, NULL, 0, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for get_fixed_int_minimal");
+        is_int(g_ret_storage.i_val, 42, "Result (int): %d (Expected 42)", g_ret_storage.i_val);
+        destroy_ffi_function(ffi_get_fixed_int_test);
+    } else {
+        fail("Failed to create FFI object for get_fixed_int_minimal.");
+    }
+}
+
+void test_int_identity_minimal() {
+    FFI_FunctionSignature* ffi_int_identity_test = create_ffi_function(
+        "int_identity_minimal", FFI_TYPE_INT, 1, identity_int_params, (GenericFuncPtr)int_identity_minimal, NULL, 0);
+    if (ffi_int_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        int identity_in_val = 123;
+        FFI_Argument identity_args[] = { { .value_ptr = &identity_in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_int_identity_test, identity_args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for int_identity_minimal");
+        is_int(g_ret_storage.i_val, identity_in_val, "Result (int): %d (Expected %d)", g_ret_storage.i_val, identity_in_val);
+        destroy_ffi_function(ffi_int_identity_test);
+    } else {
+        fail("Failed to create FFI object for int_identity_minimal.");
+    }
+}
+
+void test_bool_identity_minimal() {
+    FFI_FunctionSignature* ffi_bool_identity_test = create_ffi_function(
+        "bool_identity_minimal", FFI_TYPE_BOOL, 1, identity_bool_params, (GenericFuncPtr)bool_identity_minimal, NULL, 0);
+    if (ffi_bool_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        bool in_val = true;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_bool_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for bool_identity_minimal");
+        is_int(g_ret_storage.b_val, in_val, "Result (bool): %d (Expected %d)", g_ret_storage.b_val, in_val);
+        destroy_ffi_function(ffi_bool_identity_test);
+    } else {
+        fail("Failed to create FFI object for bool_identity_minimal.");
+    }
+}
+
+void test_char_identity_minimal() {
+    FFI_FunctionSignature* ffi_char_identity_test = create_ffi_function(
+        "char_identity_minimal", FFI_TYPE_CHAR, 1, identity_char_params, (GenericFuncPtr)char_identity_minimal, NULL, 0);
+    if (ffi_char_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        char in_val = 'X';
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_char_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for char_identity_minimal");
+        is_char(g_ret_storage.c_val, in_val, "Result (char): '%c' (Expected '%c')", g_ret_storage.c_val, in_val);
+        destroy_ffi_function(ffi_char_identity_test);
+    } else {
+        fail("Failed to create FFI object for char_identity_minimal.");
+    }
+}
+
+void test_uchar_identity_minimal() {
+    FFI_FunctionSignature* ffi_uchar_identity_test = create_ffi_function(
+        "uchar_identity_minimal", FFI_TYPE_UCHAR, 1, identity_uchar_params, (GenericFuncPtr)uchar_identity_minimal, NULL, 0);
+    if (ffi_uchar_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        unsigned char in_val = 250;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_uchar_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for uchar_identity_minimal");
+        is_int(g_ret_storage.uc_val, in_val, "Result (uchar): %u (Expected %u)", g_ret_storage.uc_val, in_val);
+        destroy_ffi_function(ffi_uchar_identity_test);
+    } else {
+        fail("Failed to create FFI object for uchar_identity_minimal.");
+    }
+}
+
+void test_short_identity_minimal() {
+    FFI_FunctionSignature* ffi_short_identity_test = create_ffi_function(
+        "short_identity_minimal", FFI_TYPE_SHORT, 1, identity_short_params, (GenericFuncPtr)short_identity_minimal, NULL, 0);
+    if (ffi_short_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        short in_val = -32000;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_short_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for short_identity_minimal");
+        is_int(g_ret_storage.s_val, in_val, "Result (short): %hd (Expected %hd)", g_ret_storage.s_val, in_val);
+        destroy_ffi_function(ffi_short_identity_test);
+    } else {
+        fail("Failed to create FFI object for short_identity_minimal.");
+    }
+}
+
+void test_ushort_identity_minimal() {
+    FFI_FunctionSignature* ffi_ushort_identity_test = create_ffi_function(
+        "ushort_identity_minimal", FFI_TYPE_USHORT, 1, identity_ushort_params, (GenericFuncPtr)ushort_identity_minimal, NULL, 0);
+    if (ffi_ushort_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        unsigned short in_val = 65000;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_ushort_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for ushort_identity_minimal");
+        is_int(g_ret_storage.us_val, in_val, "Result (ushort): %hu (Expected %hu)", g_ret_storage.us_val, in_val);
+        destroy_ffi_function(ffi_ushort_identity_test);
+    } else {
+        fail("Failed to create FFI object for ushort_identity_minimal.");
+    }
+}
+
+void test_long_identity_minimal() {
+    FFI_FunctionSignature* ffi_long_identity_test = create_ffi_function(
+        "long_identity_minimal", FFI_TYPE_LONG, 1, identity_long_params, (GenericFuncPtr)long_identity_minimal, NULL, 0);
+    if (ffi_long_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        long in_val = 9876543210L; // Example long value (32-bit on Win64, 64-bit on Linux/macOS x64/ARM64)
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_long_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for long_identity_minimal");
+        is_int(g_ret_storage.l_val, in_val, "Result (long): %ld (Expected %ld)", g_ret_storage.l_val, in_val);
+        destroy_ffi_function(ffi_long_identity_test);
+    } else {
+        fail("Failed to create FFI object for long_identity_minimal.");
+    }
+}
+
+void test_llong_identity_minimal() {
+    FFI_FunctionSignature* ffi_llong_identity_test = create_ffi_function(
+        "llong_identity_minimal", FFI_TYPE_LLONG, 1, identity_llong_params, (GenericFuncPtr)llong_identity_minimal, NULL, 0);
+    if (ffi_llong_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        long long in_val = -9876543210987654321LL; // Example long long value
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_llong_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for llong_identity_minimal");
+        is_int(g_ret_storage.ll_val, in_val, "Result (long long): %lld (Expected %lld)", g_ret_storage.ll_val, in_val);
+        destroy_ffi_function(ffi_llong_identity_test);
+    } else {
+        fail("Failed to create FFI object for llong_identity_minimal.");
+    }
+}
+
+void test_ullong_identity_minimal() {
+    FFI_FunctionSignature* ffi_ullong_identity_test = create_ffi_function(
+        "ullong_identity_minimal", FFI_TYPE_ULLONG, 1, identity_ullong_params, (GenericFuncPtr)ullong_identity_minimal, NULL, 0);
+    if (ffi_ullong_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        unsigned long long in_val = 0xFEDCBA9876543210ULL; // Example ullong value
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_ullong_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for ullong_identity_minimal");
+        is_int(g_ret_storage.ull_val, in_val, "Result (ullong): %llu (Expected %llu)", g_ret_storage.ull_val, in_val);
+        destroy_ffi_function(ffi_ullong_identity_test);
+    } else {
+        fail("Failed to create FFI object for ullong_identity_minimal.");
+    }
+}
+
+void test_float_identity_minimal() {
+    FFI_FunctionSignature* ffi_float_identity_test = create_ffi_function(
+        "float_identity_minimal", FFI_TYPE_FLOAT, 1, identity_float_params, (GenericFuncPtr)float_identity_minimal, NULL, 0);
+    if (ffi_float_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        float in_val = 3.14159f;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_float_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for float_identity_minimal");
+        is_float(g_ret_storage.f_val, in_val, "Result (float): %f (Expected %f)", g_ret_storage.f_val, in_val);
+        destroy_ffi_function(ffi_float_identity_test);
+    } else {
+        fail("Failed to create FFI object for float_identity_minimal.");
+    }
+}
+
+void test_double_identity_minimal() {
+    FFI_FunctionSignature* ffi_double_identity_test = create_ffi_function(
+        "double_identity_minimal", FFI_TYPE_DOUBLE, 1, identity_double_params, (GenericFuncPtr)double_identity_minimal, NULL, 0);
+    if (ffi_double_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        double in_val = 2.718281828;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_double_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for double_identity_minimal");
+        is_double(g_ret_storage.d_val, in_val, "Result (double): %lf (Expected %lf)", g_ret_storage.d_val, in_val);
+        destroy_ffi_function(ffi_double_identity_test);
+    } else {
+        fail("Failed to create FFI object for double_identity_minimal.");
+    }
+}
+
+
+void test_pointer_identity_minimal() {
+    FFI_FunctionSignature* ffi_pointer_identity_test = create_ffi_function(
+        "pointer_identity_minimal", FFI_TYPE_POINTER, 1, identity_pointer_params, (GenericFuncPtr)pointer_identity_minimal, NULL, 0);
+    if (ffi_pointer_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        void* in_val = (void*)0xDEADBEEF; // Example pointer value
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_pointer_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for pointer_identity_minimal");
+        is_ptr(g_ret_storage.ptr_val, in_val, "Result (pointer): %p (Expected %p)", g_ret_storage.ptr_val, in_val);
+        destroy_ffi_function(ffi_pointer_identity_test);
+    } else {
+        fail("Failed to create FFI object for pointer_identity_minimal.");
+    }
+}
+
+void test_print_two_ints() {
+    FFI_FunctionSignature* ffi_print_two_ints_test = create_ffi_function(
+        "print_two_ints", FFI_TYPE_VOID, 2, print_two_ints_params, (GenericFuncPtr)print_two_ints, NULL, 0);
+    if (ffi_print_two_ints_test) {
+        // No return value to clear for void function
+        int int1_void = 50;
+        int int2_void = 75;
+        FFI_Argument two_ints_void_args[] = {
+            { .value_ptr = &int1_void },
+            { .value_ptr = &int2_void }
+        };
+        bool invocation_success = invoke_foreign_function(ffi_print_two_ints_test, two_ints_void_args, 2, NULL);
+        ok(invocation_success, "FFI call successful for print_two_ints");
+        destroy_ffi_function(ffi_print_two_ints_test);
+    } else {
+        fail("Failed to create FFI object for print_two_ints.");
+    }
+}
+
+void test_print_float_and_double() {
+    FFI_FunctionSignature* ffi_print_float_and_double_test = create_ffi_function(
+        "print_float_and_double", FFI_TYPE_VOID, 2, print_float_double_params, (GenericFuncPtr)print_float_and_double, NULL, 0);
+    if (ffi_print_float_and_double_test) {
+        // No return value to clear for void function
+        float f_test = 3.14f;
+        double d_test = 2.718;
+        FFI_Argument float_double_args[] = {
+            { .value_ptr = &f_test },
+            { .value_ptr = &d_test }
+        };
+        bool invocation_success = invoke_foreign_function(ffi_print_float_and_double_test, float_double_args, 2, NULL);
+        ok(invocation_success, "FFI call successful for print_float_and_double");
+        destroy_ffi_function(ffi_print_float_and_double_test);
+    } else {
+        fail("Failed to create FFI object for print_float_and_double.");
+    }
+}
+
+void test_get_float_value() {
+    FFI_FunctionSignature* ffi_get_float_value_test = create_ffi_function(
+        "get_float_value", FFI_TYPE_FLOAT, 0, NULL, (GenericFuncPtr)get_float_value, NULL, 0);
+    if (ffi_get_float_value_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        bool invocation_success = invoke_foreign_function(ffi_get_float_value_test, NULL, 0, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for get_float_value");
+        is_float(g_ret_storage.f_val, 123.45f, "Result (float): %f (Expected 123.45)", g_ret_storage.f_val);
+        destroy_ffi_function(ffi_get_float_value_test);
+    } else {
+        fail("Failed to create FFI object for get_float_value.");
+    }
+}
+
+void test_get_double_value() {
+    FFI_FunctionSignature* ffi_get_double_value_test = create_ffi_function(
+        "get_double_value", FFI_TYPE_DOUBLE, 0, NULL, (GenericFuncPtr)get_double_value, NULL, 0);
+    if (ffi_get_double_value_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        bool invocation_success = invoke_foreign_function(ffi_get_double_value_test, NULL, 0, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for get_double_value");
+        is_double(g_ret_storage.d_val, 987.654, "Result (double): %lf (Expected 987.654)", g_ret_storage.d_val);
+        destroy_ffi_function(ffi_get_double_value_test);
+    } else {
+        fail("Failed to create FFI object for get_double_value.");
+    }
+}
+
+void test_sum_seven_ints() {
+    FFI_FunctionSignature* ffi_sum_seven_ints_test = create_ffi_function(
+        "sum_seven_ints", FFI_TYPE_INT, 7, sum_seven_ints_params, (GenericFuncPtr)sum_seven_ints, NULL, 0);
+    if (ffi_sum_seven_ints_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        int v1=1, v2=2, v3=3, v4=4, v5=5, v6=6, v7=7;
+        FFI_Argument args[] = {
+            { .value_ptr = &v1 }, { .value_ptr = &v2 }, { .value_ptr = &v3 },
+            { .value_ptr = &v4 }, { .value_ptr = &v5 }, { .value_ptr = &v6 },
+            { .value_ptr = &v7 }
+        };
+        bool invocation_success = invoke_foreign_function(ffi_sum_seven_ints_test, args, 7, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for sum_seven_ints");
+        is_int(g_ret_storage.i_val, 28, "Result (sum_seven_ints): %d (Expected 28)", g_ret_storage.i_val);
+        destroy_ffi_function(ffi_sum_seven_ints_test);
+    } else {
+        fail("Failed to create FFI object for sum_seven_ints.");
+    }
+}
+
+// NEW: Test for reentrancy of trampoline
+void test_reentrancy_add_two_ints() {
+    FFI_FunctionSignature* ffi_add_two_ints_reentrant = create_ffi_function(
+        "add_two_ints_reentrant", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)add_two_ints, NULL, 0);
+    if (ffi_add_two_ints_reentrant) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        // Call 1
+        int a1 = 10, b1 = 20;
+        FFI_Argument args1[] = { { .value_ptr = &a1 }, { .value_ptr = &b1 } };
+        bool success1 = invoke_foreign_function(ffi_add_two_ints_reentrant, args1, 2, &g_ffi_return_value);
+        ok(success1, "Reentrancy Call 1 successful");
+        is_int(g_ret_storage.i_val, 30, "Reentrancy Result 1: %d (Expected 30)", g_ret_storage.i_val);
+
+        // Call 2
+        int a2 = -5, b2 = 15;
+        FFI_Argument args2[] = { { .value_ptr = &a2 }, { .value_ptr = &b2 } };
+        bool success2 = invoke_foreign_function(ffi_add_two_ints_reentrant, args2, 2, &g_ffi_return_value);
+        ok(success2, "Reentrancy Call 2 successful");
+        is_int(g_ret_storage.i_val, 10, "Reentrancy Result 2: %d (Expected 10)", g_ret_storage.i_val);
+
+        // Call 3
+        int a3 = 100, b3 = -200;
+        FFI_Argument args3[] = { { .value_ptr = &a3 }, { .value_ptr = &b3 } };
+        bool success3 = invoke_foreign_function(ffi_add_two_ints_reentrant, args3, 2, &g_ffi_return_value);
+        ok(success3, "Reentrancy Call 3 successful");
+        is_int(g_ret_storage.i_val, -100, "Reentrancy Result 3: %d (Expected -100)", g_ret_storage.i_val);
+
+        destroy_ffi_function(ffi_add_two_ints_reentrant);
+    } else {
+        fail("Failed to create FFI object for reentrancy test.");
+    }
+}
+
+// NEW: Test for mixed arguments: int, float, pointer
+void test_mixed_args_int_float_ptr() {
+    FFI_FunctionSignature* ffi_mixed_test1 = create_ffi_function(
+        "mixed_int_float_ptr_func", FFI_TYPE_INT, 3, mixed_int_float_ptr_params, (GenericFuncPtr)mixed_int_float_ptr_func, NULL, 0);
+    if (ffi_mixed_test1) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        int i_val = 10;
+        float f_val = 5.5f;
+        void* ptr_val = (void*)0x12345678; // Non-NULL pointer
+        FFI_Argument args[] = {
+            { .value_ptr = &i_val },
+            { .value_ptr = &f_val },
+            { .value_ptr = &ptr_val }
+        };
+        bool success = invoke_foreign_function(ffi_mixed_test1, args, 3, &g_ffi_return_value);
+        ok(success, "Mixed args (int,float,ptr) call successful");
+        // Expected: 10 + (int)5.5f + (1 if ptr_val != NULL) = 10 + 5 + 1 = 16
+        is_int(g_ret_storage.i_val, 16, "Mixed args (int,float,ptr) result: %d (Expected 16)", g_ret_storage.i_val);
+
+        destroy_ffi_function(ffi_mixed_test1);
+    } else {
+        fail("Failed to create FFI object for mixed_int_float_ptr_func.");
+    }
+}
+
+// NEW: Test for mixed arguments: double, char, int
+void test_mixed_args_double_char_int() {
+    FFI_FunctionSignature* ffi_mixed_test2 = create_ffi_function(
+        "mixed_double_char_int_func", FFI_TYPE_DOUBLE, 3, mixed_double_char_int_params, (GenericFuncPtr)mixed_double_char_int_func, NULL, 0);
+    if (ffi_mixed_test2) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        double d_val = 10.5;
+        char c_val = 'A'; // ASCII 65
+        int i_val = 20;
+        FFI_Argument args[] = {
+            { .value_ptr = &d_val },
+            { .value_ptr = &c_val },
+            { .value_ptr = &i_val }
+        };
+        bool success = invoke_foreign_function(ffi_mixed_test2, args, 3, &g_ffi_return_value);
+        ok(success, "Mixed args (double,char,int) call successful");
+        // Expected: 10.5 + 65.0 + 20.0 = 95.5
+        is_double(g_ret_storage.d_val, 95.5, "Mixed args (double,char,int) result: %lf (Expected 95.5)", g_ret_storage.d_val);
+
+        destroy_ffi_function(ffi_mixed_test2);
+    } else {
+        fail("Failed to create FFI object for mixed_double_char_int_func.");
+    }
+}
+
+// NEW: Reentrancy test with stack spilling for GPR arguments
+void test_reentrancy_sum_eight_ints() {
+    FFI_FunctionSignature* ffi_sum_eight_ints_reentrant = create_ffi_function(
+        "sum_eight_ints_reentrant", FFI_TYPE_INT, 8, sum_eight_ints_params, (GenericFuncPtr)sum_eight_ints, NULL, 0);
+    if (ffi_sum_eight_ints_reentrant) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        // Call 1: All args sum to 36
+        int v1_1=1, v1_2=2, v1_3=3, v1_4=4, v1_5=5, v1_6=6, v1_7=7, v1_8=8;
+        FFI_Argument args1[] = {
+            { .value_ptr = &v1_1 }, { .value_ptr = &v1_2 }, { .value_ptr = &v1_3 },
+            { .value_ptr = &v1_4 }, { .value_ptr = &v1_5 }, { .value_ptr = &v1_6 },
+            { .value_ptr = &v1_7 }, { .value_ptr = &v1_8 }
+        };
+        bool success1 = invoke_foreign_function(ffi_sum_eight_ints_reentrant, args1, 8, &g_ffi_return_value);
+        ok(success1, "Reentrancy sum_eight_ints Call 1 successful");
+        is_int(g_ret_storage.i_val, 36, "Reentrancy sum_eight_ints Result 1: %d (Expected 36)", g_ret_storage.i_val);
+
+        // Call 2: All args sum to 0
+        int v2_1=0, v2_2=0, v2_3=0, v2_4=0, v2_5=0, v2_6=0, v2_7=0, v2_8=0;
+        FFI_Argument args2[] = {
+            { .value_ptr = &v2_1 }, { .value_ptr = &v2_2 }, { .value_ptr = &v2_3 },
+            { .value_ptr = &v2_4 }, { .value_ptr = &v2_5 }, { .value_ptr = &v2_6 },
+            { .value_ptr = &v2_7 }, { .value_ptr = &v2_8 }
+        };
+        bool success2 = invoke_foreign_function(ffi_sum_eight_ints_reentrant, args2, 8, &g_ffi_return_value);
+        ok(success2, "Reentrancy sum_eight_ints Call 2 successful");
+        is_int(g_ret_storage.i_val, 0, "Reentrancy sum_eight_ints Result 2: %d (Expected 0)", g_ret_storage.i_val);
+
+        // Call 3: Mixed positive/negative, sum to 100
+        int v3_1=10, v3_2=20, v3_3=30, v3_4=40, v3_5=50, v3_6=-10, v3_7=-20, v3_8=-30;
+        FFI_Argument args3[] = {
+            { .value_ptr = &v3_1 }, { .value_ptr = &v3_2 }, { .value_ptr = &v3_3 },
+            { .value_ptr = &v3_4 }, { .value_ptr = &v3_5 }, { .value_ptr = &v3_6 },
+            { .value_ptr = &v3_7 }, { .value_ptr = &v3_8 }
+        };
+        bool success3 = invoke_foreign_function(ffi_sum_eight_ints_reentrant, args3, 8, &g_ffi_return_value);
+        ok(success3, "Reentrancy sum_eight_ints Call 3 successful");
+        is_int(g_ret_storage.i_val, 90, "Reentrancy sum_eight_ints Result 3: %d (Expected 90)", g_ret_storage.i_val); // 10+20+30+40+50-10-20-30 = 90
+
+        destroy_ffi_function(ffi_sum_eight_ints_reentrant);
+    } else {
+        fail("Failed to create FFI object for reentrancy sum_eight_ints test.");
+    }
+}
+
+// NEW: Reentrancy test with stack spilling for XMM arguments
+void test_reentrancy_sum_nine_doubles() {
+    FFI_FunctionSignature* ffi_sum_nine_doubles_reentrant = create_ffi_function(
+        "sum_nine_doubles_reentrant", FFI_TYPE_DOUBLE, 9, sum_nine_doubles_params, (GenericFuncPtr)sum_nine_doubles, NULL, 0);
+    if (ffi_sum_nine_doubles_reentrant) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        // Call 1
+        double d1=1.0, d2=2.0, d3=3.0, d4=4.0, d5=5.0, d6=6.0, d7=7.0, d8=8.0, d9=9.0;
+        FFI_Argument args1[] = {
+            { .value_ptr = &d1 }, { .value_ptr = &d2 }, { .value_ptr = &d3 },
+            { .value_ptr = &d4 }, { .value_ptr = &d5 }, { .value_ptr = &d6 },
+            { .value_ptr = &d7 }, { .value_ptr = &d8 }, { .value_ptr = &d9 }
+        };
+        bool success1 = invoke_foreign_function(ffi_sum_nine_doubles_reentrant, args1, 9, &g_ffi_return_value);
+        ok(success1, "Reentrancy Call 1 (9 doubles) successful");
+        is_double(g_ret_storage.d_val, 45.0, "Reentrancy Result 1 (9 doubles): %lf (Expected 45.0)", g_ret_storage.d_val);
+
+        // Call 2
+        double e1=10.0, e2=20.0, e3=30.0, e4=40.0, e5=50.0, e6=60.0, e7=70.0, e8=80.0, e9=90.0;
+        FFI_Argument args2[] = {
+            { .value_ptr = &e1 }, { .value_ptr = &e2 }, { .value_ptr = &e3 },
+            { .value_ptr = &e4 }, { .value_ptr = &e5 }, { .value_ptr = &e6 },
+            { .value_ptr = &e7 }, { .value_ptr = &e8 }, { .value_ptr = &e9 }
+        };
+        bool success2 = invoke_foreign_function(ffi_sum_nine_doubles_reentrant, args2, 9, &g_ffi_return_value);
+        ok(success2, "Reentrancy Call 2 (9 doubles) successful");
+        is_double(g_ret_storage.d_val, 450.0, "Reentrancy Result 2 (9 doubles): %lf (Expected 450.0)", g_ret_storage.d_val);
+
+        destroy_ffi_function(ffi_sum_nine_doubles_reentrant);
+    } else {
+        fail("Failed to create FFI object for reentrancy test (9 doubles).");
+    }
+}
+
+// NEW: Test for mixed GPR and XMM arguments with stack spilling
+void test_mixed_gpr_xmm_stack_spill() {
+    FFI_FunctionSignature* ffi_mixed_spill_test = create_ffi_function(
+        "mixed_gpr_xmm_stack_spill_func", FFI_TYPE_INT, 16, mixed_gpr_xmm_stack_spill_params, (GenericFuncPtr)mixed_gpr_xmm_stack_spill_func, NULL, 0);
+    if (ffi_mixed_spill_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        int i1=1, i2=2, i3=3, i4=4, i5=5, i6=6;
+        float f1=1.0f, f2=2.0f, f3=3.0f, f4=4.0f, f5=5.0f, f6=6.0f, f7=7.0f, f8=8.0f;
+        int i7=7; // This will spill
+        double d9=9.0; // This will spill
+
+        FFI_Argument args[] = {
+            { .value_ptr = &i1 }, { .value_ptr = &i2 }, { .value_ptr = &i3 }, { .value_ptr = &i4 }, { .value_ptr = &i5 }, { .value_ptr = &i6 },
+            { .value_ptr = &f1 }, { .value_ptr = &f2 }, { .value_ptr = &f3 }, { .value_ptr = &f4 }, { .value_ptr = &f5 }, { .value_ptr = &f6 }, { .value_ptr = &f7 }, { .value_ptr = &f8 },
+            { .value_ptr = &i7 },
+            { .value_ptr = &d9 }
+        };
+
+        bool success = invoke_foreign_function(ffi_mixed_spill_test, args, 16, &g_ffi_return_value);
+        ok(success, "Mixed GPR/XMM stack spill call successful");
+
+        // Expected sum:
+        // GPRs: 1+2+3+4+5+6 = 21
+        // XMMs (as ints): 1+2+3+4+5+6+7+8 = 36
+        // Stack: 7 + 9 = 16
+        // Total: 21 + 36 + 16 = 73
+        is_int(g_ret_storage.i_val, 73, "Mixed GPR/XMM with stack spill result: %d (Expected 73)", g_ret_storage.i_val);
+
+        destroy_ffi_function(ffi_mixed_spill_test);
+    } else {
+        fail("Failed to create FFI object for mixed_gpr_xmm_stack_spill_func.");
+    }
+}
+
+// NEW: Test for int_identity_minimal with INT_MIN and INT_MAX
+void test_int_identity_min_max() {
+    FFI_FunctionSignature* ffi_int_identity_test = create_ffi_function(
+        "int_identity_minimal", FFI_TYPE_INT, 1, identity_int_params, (GenericFuncPtr)int_identity_minimal, NULL, 0);
+    if (ffi_int_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        int min_val = INT_MIN;
+        FFI_Argument args_min[] = { { .value_ptr = &min_val } };
+        bool success_min = invoke_foreign_function(ffi_int_identity_test, args_min, 1, &g_ffi_return_value);
+        ok(success_min, "FFI call successful for int_identity_minimal (INT_MIN)");
+        is_int(g_ret_storage.i_val, INT_MIN, "Result (int_MIN): %d (Expected %d)", g_ret_storage.i_val, INT_MIN);
+
+        int max_val = INT_MAX;
+        FFI_Argument args_max[] = { { .value_ptr = &max_val } };
+        bool success_max = invoke_foreign_function(ffi_int_identity_test, args_max, 1, &g_ffi_return_value);
+        ok(success_max, "FFI call successful for int_identity_minimal (INT_MAX)");
+        is_int(g_ret_storage.i_val, INT_MAX, "Result (int_MAX): %d (Expected %d)", g_ret_storage.i_val, INT_MAX);
+
+        destroy_ffi_function(ffi_int_identity_test);
+    } else {
+        fail("Failed to create FFI object for int_identity_min_max.");
+    }
+}
+
+// NEW: Test for float_identity_minimal with FLT_MIN and FLT_MAX
+void test_float_identity_min_max() {
+    FFI_FunctionSignature* ffi_float_identity_test = create_ffi_function(
+        "float_identity_minimal", FFI_TYPE_FLOAT, 1, identity_float_params, (GenericFuncPtr)float_identity_minimal, NULL, 0);
+    if (ffi_float_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        float min_val = FLT_MIN;
+        FFI_Argument args_min[] = { { .value_ptr = &min_val } };
+        bool success_min = invoke_foreign_function(ffi_float_identity_test, args_min, 1, &g_ffi_return_value);
+        ok(success_min, "FFI call successful for float_identity_minimal (FLT_MIN)");
+        is_float(g_ret_storage.f_val, FLT_MIN, "Result (float_MIN): %f (Expected %f)", g_ret_storage.f_val, FLT_MIN);
+
+        float max_val = FLT_MAX;
+        FFI_Argument args_max[] = { { .value_ptr = &max_val } };
+        bool success_max = invoke_foreign_function(ffi_float_identity_test, args_max, 1, &g_ffi_return_value);
+        ok(success_max, "FFI call successful for float_identity_minimal (FLT_MAX)");
+        is_float(g_ret_storage.f_val, FLT_MAX, "Result (float_MAX): %f (Expected %f)", g_ret_storage.f_val, FLT_MAX);
+
+        destroy_ffi_function(ffi_float_identity_test);
+    } else {
+        fail("Failed to create FFI object for float_identity_min_max.");
+    }
+}
+
+// NEW: Test for double_identity_minimal with DBL_MIN and DBL_MAX
+void test_double_identity_min_max() {
+    FFI_FunctionSignature* ffi_double_identity_test = create_ffi_function(
+        "double_identity_minimal", FFI_TYPE_DOUBLE, 1, identity_double_params, (GenericFuncPtr)double_identity_minimal, NULL, 0);
+    if (ffi_double_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        double min_val = DBL_MIN;
+        FFI_Argument args_min[] = { { .value_ptr = &min_val } };
+        bool success_min = invoke_foreign_function(ffi_double_identity_test, args_min, 1, &g_ffi_return_value);
+        ok(success_min, "FFI call successful for double_identity_minimal (DBL_MIN)");
+        is_double(g_ret_storage.d_val, DBL_MIN, "Result (double_MIN): %lf (Expected %lf)", g_ret_storage.d_val, DBL_MIN);
+
+        double max_val = DBL_MAX;
+        FFI_Argument args_max[] = { { .value_ptr = &max_val } };
+        bool success_max = invoke_foreign_function(ffi_double_identity_test, args_max, 1, &g_ffi_return_value);
+        ok(success_max, "FFI call successful for double_identity_minimal (DBL_MAX)");
+        is_double(g_ret_storage.d_val, DBL_MAX, "Result (double_MAX): %lf (Expected %lf)", g_ret_storage.d_val, DBL_MAX);
+
+        destroy_ffi_function(ffi_double_identity_test);
+    } else {
+        fail("Failed to create FFI object for double_identity_min_max.");
+    }
+}
+
+// NEW: Test for return_constant_42 (int, int -> int, no printf)
+void test_return_constant_42() {
+    FFI_FunctionSignature* ffi_return_constant_42_test = create_ffi_function(
+        "return_constant_42", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)return_constant_42, NULL, 0);
+    if (ffi_return_constant_42_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        int val1 = 10, val2 = 20;
+        FFI_Argument args[] = { { .value_ptr = &val1 }, { .value_ptr = &val2 } };
+        bool success = invoke_foreign_function(ffi_return_constant_42_test, args, 2, &g_ffi_return_value);
+        ok(success, "FFI call successful for return_constant_42");
+        is_int(g_ret_storage.i_val, 42, "Result (return_constant_42): %d (Expected 42)", g_ret_storage.i_val);
+        destroy_ffi_function(ffi_return_constant_42_test);
+    } else {
+        fail("Failed to create FFI object for return_constant_42.");
+    }
+}
+
+// NEW: Test for pointer_identity_minimal with NULL
+void test_pointer_identity_null() {
+    FFI_FunctionSignature* ffi_pointer_identity_test = create_ffi_function(
+        "pointer_identity_minimal", FFI_TYPE_POINTER, 1, identity_pointer_params, (GenericFuncPtr)pointer_identity_minimal, NULL, 0);
+    if (ffi_pointer_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+
+        void* null_ptr = NULL;
+        FFI_Argument args[] = { { .value_ptr = &null_ptr } };
+        bool invocation_success = invoke_foreign_function(ffi_pointer_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for pointer_identity_minimal (NULL)");
+        is_ptr(g_ret_storage.ptr_val, NULL, "Result (pointer_NULL): %p (Expected NULL)", g_ret_storage.ptr_val);
+        destroy_ffi_function(ffi_pointer_identity_test);
+    } else {
+        fail("Failed to create FFI object for pointer_identity_null.");
+    }
+}
+
+// NEW: Test for all zero arguments for sum_seven_ints
+void test_all_zero_args_sum_seven_ints() {
+    FFI_FunctionSignature* ffi_sum_seven_ints_test = create_ffi_function(
+        "sum_seven_ints", FFI_TYPE_INT, 7, sum_seven_ints_params, (GenericFuncPtr)sum_seven_ints, NULL, 0);
+    if (ffi_sum_seven_ints_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        int v1=0, v2=0, v3=0, v4=0, v5=0, v6=0, v7=0;
+        FFI_Argument args[] = {
+            { .value_ptr = &v1 }, { .value_ptr = &v2 }, { .value_ptr = &v3 },
+            { .value_ptr = &v4 }, { .value_ptr = &v5 }, { .value_ptr = &v6 },
+            { .value_ptr = &v7 }
+        };
+        bool invocation_success = invoke_foreign_function(ffi_sum_seven_ints_test, args, 7, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for sum_seven_ints (all zeros)");
+        is_int(g_ret_storage.i_val, 0, "Result (sum_seven_ints all zeros): %d (Expected 0)", g_ret_storage.i_val);
+        destroy_ffi_function(ffi_sum_seven_ints_test);
+    } else {
+        fail("Failed to create FFI object for sum_seven_ints (all zeros).");
+    }
+}
+// NEW: Test for wchar_t identity
+void test_wchar_t_identity_minimal() {
+    FFI_FunctionSignature* ffi_wchar_t_identity_test = create_ffi_function(
+        "wchar_t_identity_minimal", FFI_TYPE_WCHAR, 1, identity_wchar_params, (GenericFuncPtr)wchar_t_identity_minimal, NULL, 0);
+    if (ffi_wchar_t_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        wchar_t in_val = L'€'; // Euro sign, typically 3 bytes in UTF-8, but single wchar_t
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool success = invoke_foreign_function(ffi_wchar_t_identity_test, args, 1, &g_ffi_return_value);
+        ok(success, "FFI call successful for wchar_t_identity_minimal");
+        is_wchar_t(g_ret_storage.wc_val, in_val, "Result (wchar_t): %lc (Expected %lc)", g_ret_storage.wc_val, in_val);
+        destroy_ffi_function(ffi_wchar_t_identity_test);
+    } else {
+        fail("Failed to create FFI object for wchar_t_identity_minimal.");
+    }
+}
+
+// NEW: Test for size_t identity
+void test_size_t_identity_minimal() {
+    FFI_FunctionSignature* ffi_size_t_identity_test = create_ffi_function(
+        "size_t_identity_minimal", FFI_TYPE_SIZE_T, 1, identity_size_t_params, (GenericFuncPtr)size_t_identity_minimal, NULL, 0);
+    if (ffi_size_t_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        size_t in_val = (size_t)0xABCD12345678ULL; // Example size_t value
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool success = invoke_foreign_function(ffi_size_t_identity_test, args, 1, &g_ffi_return_value);
+        ok(success, "FFI call successful for size_t_identity_minimal");
+        is_size_t(g_ret_storage.sz_val, in_val, "Result (size_t): %zu (Expected %zu)", g_ret_storage.sz_val, in_val);
+        destroy_ffi_function(ffi_size_t_identity_test);
+    } else {
+        fail("Failed to create FFI object for size_t_identity_minimal.");
+    }
+}
+
+// NEW: Test for signed char identity
+void test_schar_identity_minimal() {
+    FFI_FunctionSignature* ffi_schar_identity_test = create_ffi_function(
+        "schar_identity_minimal", FFI_TYPE_SCHAR, 1, identity_schar_params, (GenericFuncPtr)schar_identity_minimal, NULL, 0);
+    if (ffi_schar_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        signed char in_val = -120;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool success = invoke_foreign_function(ffi_schar_identity_test, args, 1, &g_ffi_return_value);
+        ok(success, "FFI call successful for schar_identity_minimal");
+        is_int(g_ret_storage.sc_val, in_val, "Result (schar): %d (Expected %d)", g_ret_storage.sc_val, in_val);
+        destroy_ffi_function(ffi_schar_identity_test);
+    } else {
+        fail("Failed to create FFI object for schar_identity_minimal.");
+    }
+}
+
+// NEW: Test for signed short identity
+void test_sshort_identity_minimal() {
+    FFI_FunctionSignature* ffi_sshort_identity_test = create_ffi_function(
+        "sshort_identity_minimal", FFI_TYPE_SSHORT, 1, identity_sshort_params, (GenericFuncPtr)sshort_identity_minimal, NULL, 0);
+    if (ffi_sshort_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        signed short in_val = -30000;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool success = invoke_foreign_function(ffi_sshort_identity_test, args, 1, &g_ffi_return_value);
+        ok(success, "FFI call successful for sshort_identity_minimal");
+        is_int(g_ret_storage.ss_val, in_val, "Result (signed short): %hd (Expected %hd)", g_ret_storage.ss_val, in_val);
+        destroy_ffi_function(ffi_sshort_identity_test);
+    } else {
+        fail("Failed to create FFI object for sshort_identity_minimal.");
+    }
+}
+
+// NEW: Test for signed int identity
+void test_sint_identity_minimal() {
+    FFI_FunctionSignature* ffi_sint_identity_test = create_ffi_function(
+        "sint_identity_minimal", FFI_TYPE_SINT, 1, identity_sint_params, (GenericFuncPtr)sint_identity_minimal, NULL, 0);
+    if (ffi_sint_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        signed int in_val = -2000000000;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool success = invoke_foreign_function(ffi_sint_identity_test, args, 1, &g_ffi_return_value);
+        ok(success, "FFI call successful for sint_identity_minimal");
+        is_int(g_ret_storage.si_val, in_val, "Result (signed int): %d (Expected %d)", g_ret_storage.si_val, in_val);
+        destroy_ffi_function(ffi_sint_identity_test);
+    } else {
+        fail("Failed to create FFI object for sint_identity_minimal.");
+    }
+}
+
+// NEW: Test for signed long identity
+void test_slong_identity_minimal() {
+    FFI_FunctionSignature* ffi_slong_identity_test = create_ffi_function(
+        "slong_identity_minimal", FFI_TYPE_SLONG, 1, identity_slong_params, (GenericFuncPtr)slong_identity_minimal, NULL, 0);
+    if (ffi_slong_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        signed long in_val = -9000000000000000000L;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool invocation_success = invoke_foreign_function(ffi_slong_identity_test, args, 1, &g_ffi_return_value);
+        ok(invocation_success, "FFI call successful for slong_identity_minimal");
+        is_int(g_ret_storage.sl_val, in_val, "Result (signed long): %ld (Expected %ld)", g_ret_storage.sl_val, in_val);
+        destroy_ffi_function(ffi_slong_identity_test);
+    } else {
+        fail("Failed to create FFI object for slong_identity_minimal.");
+    }
+}
+
+// NEW: Test for signed long long identity
+void test_sllong_identity_minimal() {
+    FFI_FunctionSignature* ffi_sllong_identity_test = create_ffi_function(
+        "sllong_identity_minimal", FFI_TYPE_SLLONG, 1, identity_sllong_params, (GenericFuncPtr)sllong_identity_minimal, NULL, 0);
+    if (ffi_sllong_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        signed long long in_val = -987654321098765432LL;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool success = invoke_foreign_function(ffi_sllong_identity_test, args, 1, &g_ffi_return_value);
+        ok(success, "FFI call successful for sllong_identity_minimal");
+        is_int(g_ret_storage.sll_val, in_val, "Result (sllong): %lld (Expected %lld)", g_ret_storage.sll_val, in_val);
+        destroy_ffi_function(ffi_sllong_identity_test);
+    } else {
+        fail("Failed to create FFI object for sllong_identity_minimal.");
+    }
+}
+
+// NEW: Test for int128 identity
+void test_int128_identity_minimal() {
+#if defined(__SIZEOF_INT128__) || defined(__GNUC__)
+    FFI_FunctionSignature* ffi_int128_identity_test = create_ffi_function(
+        "int128_identity_minimal", FFI_TYPE_INT128, 1, identity_int128_params, (GenericFuncPtr)int128_identity_minimal, NULL, 0);
+    if (ffi_int128_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        __int128 in_val = (__int128)0x1234567890ABCDEFLL << 64 | 0xFEDCBA9876543210LL;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool success = invoke_foreign_function(ffi_int128_identity_test, args, 1, &g_ffi_return_value);
+        ok(success, "FFI call successful for int128_identity_minimal");
+        is_int128(g_ret_storage.i128_val, in_val, "Result (int128): 0x%llx%016llx (Expected 0x%llx%016llx)",
+                  (unsigned long long)(g_ret_storage.i128_val >> 64), (unsigned long long)g_ret_storage.i128_val,
+                  (unsigned long long)(in_val >> 64), (unsigned long long)in_val);
+        destroy_ffi_function(ffi_int128_identity_test);
+    } else {
+        fail("Failed to create FFI object for int128_identity_minimal.");
+    }
+#else
+    skip("int128_identity_minimal skipped: __int128 not supported on this compiler.");
+#endif
+}
+
+// NEW: Test for uint128 identity
+void test_uint128_identity_minimal() {
+#if defined(__SIZEOF_INT128__) || defined(__GNUC__)
+    FFI_FunctionSignature* ffi_uint128_identity_test = create_ffi_function(
+        "uint128_identity_minimal", FFI_TYPE_UINT128, 1, identity_uint128_params, (GenericFuncPtr)uint128_identity_minimal, NULL, 0);
+    if (ffi_uint128_identity_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        unsigned __int128 in_val = (unsigned __int128)0xFEDCBA9876543210ULL << 64 | 0x1234567890ABCDEFULL;
+        FFI_Argument args[] = { { .value_ptr = &in_val } };
+        bool success = invoke_foreign_function(ffi_uint128_identity_test, args, 1, &g_ffi_return_value);
+        ok(success, "FFI call successful for uint128_identity_minimal");
+        is_uint128(g_ret_storage.ui128_val, in_val, "Result (uint128): 0x%llx%016llx (Expected 0x%llx%016llx)",
+                   (unsigned long long)(g_ret_storage.ui128_val >> 64), (unsigned long long)g_ret_storage.ui128_val,
+                   (unsigned long long)(in_val >> 64), (unsigned long long)in_val);
+        destroy_ffi_function(ffi_uint128_identity_test);
+    } else {
+        fail("Failed to create FFI object for uint128_identity_minimal.");
+    }
+#else
+    skip("uint128_identity_minimal skipped: __int128 not supported on this compiler.");
+#endif
+}
+
+void test_error_case_add_two_ints_wrong_arg_count() {
+    FFI_FunctionSignature* ffi_add_two_ints_test = create_ffi_function(
+        "add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)add_two_ints, NULL, 0);
+    if (ffi_add_two_ints_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
+        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
+        int i_error_val = 5;
+        FFI_Argument args_error1[] = { { .value_ptr = &i_error_val } };
+        bool invocation_success = invoke_foreign_function(ffi_add_two_ints_test, args_error1, 1, &g_ffi_return_value);
+        // This call is expected to fail due to argument count mismatch
+        ok(!invocation_success, "Invocation expected to fail due to incorrect argument count.");
+        destroy_ffi_function(ffi_add_two_ints_test);
+    } else {
+        skip("Skipping error case test for add_two_ints (dependent FFI object not created).");
+    }
+}
+
+// NEW: Raw syscall trampoline tests (x86-64 Linux only)
+void test_syscall_getpid() {
+#if defined(FFI_ARCH_X64) && defined(__linux__)
+    FFI_FunctionSignature* ffi_getpid_test = create_ffi_syscall("sys_getpid", FFI_TYPE_LONG, SYS_getpid, 0, NULL);
+    if (ffi_getpid_test) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_getpid_test, NULL, 0, &g_ffi_return_value);
+        ok(success, "FFI call successful for raw getpid syscall");
+        is_int(g_ret_storage.l_val, (long)getpid(), "Result (getpid): %ld (Expected %ld)", g_ret_storage.l_val, (long)getpid());
+        destroy_ffi_function(ffi_getpid_test);
+    } else {
+        fail("Failed to create FFI object for raw getpid syscall.");
+    }
 #else
-    BAIL_OUT("Unsupported architecture for trampoline generation.");
-    return 0;
+    skip("Raw syscall trampolines are only supported on x86-64 Linux.");
 #endif
 }
 
-/**
- * @brief Creates and initializes an FFI_FunctionSignature object.
- * Allocates memory for the struct and its trampoline code, and generates the assembly.
- *
- * @param debug_name A string name for debugging purposes.
- * @param return_type The return type of the C function.
- * @param num_params The number of parameters the C function expects.
- * @param param_types An array of FFI_Type representing the parameter types, or NULL if num_params is 0.
- * @param func_ptr A pointer to the actual C function implementation.
- * @param manual_trampoline_bytes Optional. Pointer to a byte array for a pre-defined trampoline.
- * @param manual_trampoline_size Optional. Size of the pre-defined trampoline byte array.
- * @return A pointer to the newly created FFI_FunctionSignature object, or NULL on failure.
- */
-FFI_FunctionSignature* create_ffi_function(const char* debug_name, FFI_Type return_type,
-                                            int num_params, FFI_Type* param_types,
-                                            GenericFuncPtr func_ptr,
-                                            unsigned char* manual_trampoline_bytes,
-                                            size_t manual_trampoline_size) {
-    diag("create_ffi_function: Entering for '%s'. func_ptr received: %p", debug_name, (void*)func_ptr);
-    FFI_FunctionSignature* new_ffi_func = (FFI_FunctionSignature*)malloc(sizeof(FFI_FunctionSignature));
-    if (new_ffi_func == NULL) {
-        diag("Failed to allocate FFI_FunctionSignature for '%s'", debug_name);
-        return NULL;
+void test_syscall_pipe_read_write() {
+#if defined(FFI_ARCH_X64) && defined(__linux__)
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        fail("pipe() failed: %s", strerror(errno));
+        return;
     }
-    new_ffi_func->debug_name = debug_name;
-    new_ffi_func->return_type = return_type;
-    new_ffi_func->num_params = num_params;
-    new_ffi_func->param_types = param_types; // Point to static array or dynamically copy if needed
-    new_ffi_func->func_ptr = func_ptr;
-    new_ffi_func->trampoline_size = 512; // Increased size to 512 bytes for more complex trampolines
-    // Cast to void* before assigning to function pointer type to avoid ISO C warning
-    new_ffi_func->trampoline_code = (GenericTrampolinePtr)(void*)ffi_create_executable_memory(new_ffi_func->trampoline_size);
-    if (new_ffi_func->trampoline_code == NULL) {
-        free(new_ffi_func);
-        return NULL;
+    FFI_FunctionSignature* ffi_write_test = create_ffi_syscall("sys_write", FFI_TYPE_LONG, SYS_write, 3, syscall_read_write_params);
+    FFI_FunctionSignature* ffi_read_test = create_ffi_syscall("sys_read", FFI_TYPE_LONG, SYS_read, 3, syscall_read_write_params);
+    if (ffi_write_test && ffi_read_test) {
+        const char message[] = "double tap";
+        const void* write_buf = message;
+        size_t write_len = sizeof(message);
+        long written = 0;
+        FFI_Argument write_ret = { .value_ptr = &written };
+        FFI_Argument write_args[] = { { .value_ptr = &pipe_fds[1] }, { .value_ptr = &write_buf }, { .value_ptr = &write_len } };
+        bool write_success = invoke_foreign_function(ffi_write_test, write_args, 3, &write_ret);
+        ok(write_success, "FFI call successful for raw write syscall");
+        is_int(written, (long)sizeof(message), "write() returned %ld (Expected %zu)", written, sizeof(message));
+
+        char read_storage[32] = {0};
+        void* read_buf = read_storage;
+        size_t read_len = sizeof(read_storage);
+        long bytes_read = 0;
+        FFI_Argument read_ret = { .value_ptr = &bytes_read };
+        FFI_Argument read_args[] = { { .value_ptr = &pipe_fds[0] }, { .value_ptr = &read_buf }, { .value_ptr = &read_len } };
+        bool read_success = invoke_foreign_function(ffi_read_test, read_args, 3, &read_ret);
+        ok(read_success, "FFI call successful for raw read syscall");
+        is_int(bytes_read, (long)sizeof(message), "read() returned %ld (Expected %zu)", bytes_read, sizeof(message));
+        is_str(read_storage, message, "Bytes read back through the pipe match what was written");
+    } else {
+        fail("Failed to create FFI objects for raw read/write syscalls.");
     }
+    destroy_ffi_function(ffi_write_test);
+    destroy_ffi_function(ffi_read_test);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+#else
+    skip("Raw syscall trampolines are only supported on x86-64 Linux.");
+#endif
+}
 
-    size_t actual_code_size;
-    if (manual_trampoline_bytes && manual_trampoline_size > 0) {
-        diag("Using manual trampoline bytes for '%s'. Size: %zu", debug_name, manual_trampoline_size);
-        if (manual_trampoline_size > new_ffi_func->trampoline_size) {
-            diag("ERROR: Manual trampoline size (%zu) exceeds allocated memory (%zu).",
-                    manual_trampoline_size, new_ffi_func->trampoline_size);
-            // Cast to void* for ffi_free_executable_memory
-            ffi_free_executable_memory((void*)new_ffi_func->trampoline_code, new_ffi_func->trampoline_size);
-            free(new_ffi_func);
-            return NULL;
-        }
-        // Cast to void* for memcpy destination
-        memcpy((void*)new_ffi_func->trampoline_code, manual_trampoline_bytes, manual_trampoline_size);
-        actual_code_size = manual_trampoline_size;
+void test_syscall_errno_translation() {
+#if defined(FFI_ARCH_X64) && defined(__linux__)
+    FFI_FunctionSignature* ffi_read_test = create_ffi_syscall("sys_read_badfd", FFI_TYPE_LONG, SYS_read, 3, syscall_read_write_params);
+    if (ffi_read_test) {
+        int bad_fd = -1;
+        char scratch[4];
+        void* buf = scratch;
+        size_t len = sizeof(scratch);
+        long result = 0;
+        FFI_Argument ret = { .value_ptr = &result };
+        FFI_Argument args[] = { { .value_ptr = &bad_fd }, { .value_ptr = &buf }, { .value_ptr = &len } };
+        errno = 0;
+        bool success = invoke_foreign_function(ffi_read_test, args, 3, &ret);
+        int saved_errno = errno;
+        ok(success, "FFI call successful for raw read on a bad fd");
+        is_int(result, -1, "Kernel error translated to -1 in the return buffer (got %ld)", result);
+        is_int(saved_errno, EBADF, "errno set to EBADF (got %d)", saved_errno);
+        destroy_ffi_function(ffi_read_test);
     } else {
-        // Cast to unsigned char* for generate_generic_trampoline
-        actual_code_size = generate_generic_trampoline((unsigned char*)new_ffi_func->trampoline_code, new_ffi_func);
-        if (actual_code_size == 0 || actual_code_size > new_ffi_func->trampoline_size) {
-            diag("ERROR: Trampoline generation issue for '%s': size %zu, allocated %zu. Cleaning up.",
-                    debug_name, actual_code_size, new_ffi_func->trampoline_size);
-            // Cast to void* for ffi_free_executable_memory
-            ffi_free_executable_memory((void*)new_ffi_func->trampoline_code, new_ffi_func->trampoline_size);
-            free(new_ffi_func);
-            return NULL;
-        }
+        fail("Failed to create FFI object for raw read syscall.");
     }
 
-    // Flush instruction cache after writing executable code
-    ffi_flush_instruction_cache((void*)new_ffi_func->trampoline_code, actual_code_size);
-    // Cast to void* for printf %p
-    diag("Generated trampoline for '%s' at %p (size: %zu bytes). Target func: %p",
-           new_ffi_func->debug_name, (void*)new_ffi_func->trampoline_code, actual_code_size, (void*)new_ffi_func->func_ptr);
-    // Print raw bytes for debugging - MODIFIED TO PRINT HEX DUMP
-    diag("Raw trampoline bytes (hex) for '%s':", new_ffi_func->debug_name); // Corrected line
-    char line_buffer[128]; // Buffer for one line of hex dump
-    int offset_in_line = 0;
-    int chars_written;
-
-    // Determine instruction size for hex dump formatting
-    size_t instruction_size = 
-#ifdef FFI_ARCH_ARM64
-    4; // ARM64 instructions are 4 bytes
-#else 
-	1; // Default for x86-64
+    // Floating-point parameters cannot be passed to the kernel and must be rejected up front.
+    FFI_FunctionSignature* ffi_bad_sig = create_ffi_syscall("sys_bad_float", FFI_TYPE_LONG, SYS_getpid, 1, syscall_float_params);
+    ok((ffi_bad_sig == NULL), "Syscall signature with a double parameter is rejected");
+    destroy_ffi_function(ffi_bad_sig);
+#else
+    skip("Raw syscall trampolines are only supported on x86-64 Linux.");
 #endif
+}
 
-    for (size_t i = 0; i < actual_code_size; i += instruction_size) {
-        if (i % (16 / instruction_size * instruction_size) == 0) { // Start of a new line (16 bytes per line)
-            if (i > 0) {
-                diag("%s", line_buffer); // Print the previous line
-            }
-            // Start new line with address
-            chars_written = snprintf(line_buffer + offset_in_line, sizeof(line_buffer), "%p: ", (void*)((uintptr_t)new_ffi_func->trampoline_code + i));
-            offset_in_line = chars_written;
-        }
-        // Append hex byte(s)
-        for (size_t j = 0; j < instruction_size; ++j) {
-            chars_written = snprintf(line_buffer + offset_in_line, sizeof(line_buffer) - offset_in_line, "%02x", ((unsigned char*)(void*)new_ffi_func->trampoline_code)[i + j]);
-            offset_in_line += chars_written;
-        }
-        chars_written = snprintf(line_buffer + offset_in_line, sizeof(line_buffer) - offset_in_line, " ");
-        offset_in_line += chars_written;
-
-        if ((i + instruction_size) % (8 / instruction_size * instruction_size) == 0 && (i + instruction_size) % (16 / instruction_size * instruction_size) != 0) { // Add extra space after 8 bytes (but not at 16)
-            chars_written = snprintf(line_buffer + offset_in_line, sizeof(line_buffer) - offset_in_line, " ");
-            offset_in_line += chars_written;
-        }
+// NEW: Test for a Win64 trampoline calling an ms_abi target from the host
+void test_win64_add_two_ints() {
+#ifdef FFI_HAVE_MS_ABI_TARGETS
+    FFI_FunctionSignature* ffi_ms_add = create_ffi_function_abi("ms_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                                (GenericFuncPtr)ms_add_two_ints, FFI_ABI_WIN64);
+    if (ffi_ms_add) {
+        int a = 40, b = -2;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_ms_add, args, 2, &g_ffi_return_value);
+        ok(success, "FFI call successful for ms_abi add_two_ints");
+        is_int(g_ret_storage.i_val, 38, "Result (ms_add_two_ints): %d (Expected 38)", g_ret_storage.i_val);
+        destroy_ffi_function(ffi_ms_add);
+    } else {
+        fail("Failed to create Win64 FFI object for ms_add_two_ints.");
     }
-    if (offset_in_line > 0) { // Print any remaining bytes on the last line
-        diag("%s", line_buffer);
+#else
+    skip("ms_abi targets require GCC or Clang on x86-64.");
+#endif
+}
+
+// NEW: Test for Win64 positional register pairing and stack arguments above the shadow space
+void test_win64_mixed_positional() {
+#ifdef FFI_HAVE_MS_ABI_TARGETS
+    FFI_FunctionSignature* ffi_ms_mixed = create_ffi_function_abi("ms_mixed_positional", FFI_TYPE_DOUBLE, 7, ms_mixed_positional_params,
+                                                                  (GenericFuncPtr)ms_mixed_positional, FFI_ABI_WIN64);
+    if (ffi_ms_mixed) {
+        int a = 1, c = -3;
+        double b = 2.5, e = 100.25;
+        float d = 4.5f, f = -0.75f;
+        long long g = 1000000000000LL;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b }, { .value_ptr = &c }, { .value_ptr = &d },
+                                { .value_ptr = &e }, { .value_ptr = &f }, { .value_ptr = &g } };
+        double expected = ms_mixed_positional(a, b, c, d, e, f, g);
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_ms_mixed, args, 7, &g_ffi_return_value);
+        ok(success, "FFI call successful for ms_abi mixed_positional");
+        is_double(g_ret_storage.d_val, expected, "Result (ms_mixed_positional): %f (Expected %f)", g_ret_storage.d_val, expected);
+        destroy_ffi_function(ffi_ms_mixed);
+    } else {
+        fail("Failed to create Win64 FFI object for ms_mixed_positional.");
     }
-    diag(""); // Ensure a newline at the very end
+#else
+    skip("ms_abi targets require GCC or Clang on x86-64.");
+#endif
+}
 
-    return new_ffi_func;
+// NEW: Test for Win64 by-reference passing of 128-bit integers (register and stack slots)
+void test_win64_int128_by_reference() {
+#ifdef FFI_HAVE_MS_ABI_TARGETS
+    FFI_FunctionSignature* ffi_ms_i128 = create_ffi_function_abi("ms_int128_sub", FFI_TYPE_INT128, 5, ms_int128_sub_params,
+                                                                 (GenericFuncPtr)ms_int128_sub, FFI_ABI_WIN64);
+    if (ffi_ms_i128) {
+        // Deliberately misaligned source storage: the trampoline must pass an aligned copy.
+        unsigned char raw_a[sizeof(__int128) + 8], raw_b[sizeof(__int128) + 8];
+        __int128 a = ((__int128)0x0123456789ABCDEFLL << 64) | 0x1111111111111111ULL;
+        __int128 b = ((__int128)0x0000000000000001LL << 64) | 0x2222222222222222ULL;
+        memcpy(raw_a + 8, &a, sizeof(a));
+        memcpy(raw_b + 8, &b, sizeof(b));
+        int pad1 = 1, pad2 = 2, pad3 = 3;
+        FFI_Argument args[] = { { .value_ptr = raw_a + 8 }, { .value_ptr = &pad1 }, { .value_ptr = &pad2 },
+                                { .value_ptr = &pad3 }, { .value_ptr = raw_b + 8 } };
+        __int128 expected = a - b + 6;
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_ms_i128, args, 5, &g_ffi_return_value);
+        ok(success, "FFI call successful for ms_abi int128_sub");
+        bool matches = (g_ret_storage.i128_val == expected);
+        ok(matches, "Result (ms_int128_sub) matches a - b + 6");
+        destroy_ffi_function(ffi_ms_i128);
+    } else {
+        fail("Failed to create Win64 FFI object for ms_int128_sub.");
+    }
+#else
+    skip("ms_abi targets require GCC or Clang on x86-64.");
+#endif
 }
 
-/**
- * @brief Destroys an FFI_FunctionSignature object, freeing its associated memory.
- *
- * @param ffi_func A pointer to the FFI_FunctionSignature object to destroy.
- */
-void destroy_ffi_function(FFI_FunctionSignature* ffi_func) {
-    if (ffi_func) {
-        diag("Destroying FFI function: '%s'", ffi_func->debug_name);
-        if (ffi_func->trampoline_code) {
-            // Cast to void* for ffi_free_executable_memory
-            ffi_free_executable_memory((void*)ffi_func->trampoline_code, ffi_func->trampoline_size);
-            ffi_func->trampoline_code = NULL;
-        }
-        free(ffi_func);
+// NEW: Test that a Win64 trampoline keeps RSP 16-byte aligned at the CALL
+void test_win64_stack_alignment() {
+#ifdef FFI_HAVE_MS_ABI_TARGETS
+    FFI_FunctionSignature* ffi_ms_align = create_ffi_function_abi("ms_frame_misalignment", FFI_TYPE_INT, 0, NULL,
+                                                                  (GenericFuncPtr)ms_frame_misalignment, FFI_ABI_WIN64);
+    if (ffi_ms_align) {
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_ms_align, NULL, 0, &g_ffi_return_value);
+        ok(success, "FFI call successful for ms_abi frame_misalignment");
+        is_int(g_ret_storage.i_val, 0, "Callee frame is 16-byte aligned (RBP mod 16 = %d)", g_ret_storage.i_val);
+        destroy_ffi_function(ffi_ms_align);
+    } else {
+        fail("Failed to create Win64 FFI object for ms_frame_misalignment.");
     }
+#else
+    skip("ms_abi targets require GCC or Clang on x86-64.");
+#endif
 }
 
-/**
- * @brief Invokes a foreign C function using its dynamically generated trampoline.
- * This function acts as the "core VM dispatcher".
- *
- * @param sig A pointer to the FFI_FunctionSignature object representing the target function.
- * @param args An array of FFI_Argument structs holding the input arguments. Can be NULL if num_args is 0.
- * @param num_args The number of arguments in the `args` array.
- * @param return_value_out A pointer to an FFI_Argument struct where the return value should be stored.
- * Its `value_ptr` should point to a buffer of appropriate size. Can be NULL for void returns.
- * @return True if the function was invoked successfully, false otherwise.
- */
-bool invoke_foreign_function(FFI_FunctionSignature* sig, FFI_Argument* args, int num_args, FFI_Argument* return_value_out) {
-    void* actual_return_buffer_ptr = NULL;
-    note("\n--- Inside invoke_foreign_function (FFI Gateway / Core VM) ---");
-    note("FFI Gateway: Calling function '%s'. Args array: %p, Num args: %d, Return FFI_Argument: %p.",
-           sig->debug_name, (void*)args, num_args, (void*)return_value_out);
+// NEW: Test for explicit runtime ABI selection through create_ffi_function_abi()
+void test_explicit_abi_selection() {
+#if defined(FFI_ARCH_X64) && !defined(FFI_OS_WIN64)
+    FFI_FunctionSignature* ffi_sysv_add = create_ffi_function_abi("add_two_ints_sysv", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                                  (GenericFuncPtr)add_two_ints, FFI_ABI_SYSV);
+    if (ffi_sysv_add) {
+        int a = 7, b = 35;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_sysv_add, args, 2, &g_ffi_return_value);
+        ok(success, "FFI call successful for explicitly System V add_two_ints");
+        is_int(g_ret_storage.i_val, 42, "Result (add_two_ints via FFI_ABI_SYSV): %d (Expected 42)", g_ret_storage.i_val);
+        destroy_ffi_function(ffi_sysv_add);
+    } else {
+        fail("Failed to create System V FFI object for add_two_ints.");
+    }
+#else
+    skip("FFI_ABI_SYSV is only available on x86-64 System V hosts.");
+#endif
+    FFI_FunctionSignature* ffi_bad_abi = create_ffi_function_abi("add_two_ints_syscall", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                                 (GenericFuncPtr)add_two_ints, FFI_ABI_SYSCALL);
+    ok((ffi_bad_abi == NULL), "FFI_ABI_SYSCALL is rejected by create_ffi_function_abi");
+    destroy_ffi_function(ffi_bad_abi);
+}
 
-    // --- Argument count validation moved to the top ---
-    if (num_args != sig->num_params) {
-        diag("Error: Incorrect number of arguments for function '%s'. Expected %d, got %d.",
-                sig->debug_name, sig->num_params, num_args);
-        return false;
+// NEW: Test for _Float16 arguments and return value through the System V trampoline
+void test_float16_scaled_product() {
+#ifdef FFI_HAVE_FLOAT16_TARGETS
+    FFI_FunctionSignature* ffi_f16 = create_ffi_function("f16_scaled_product", FFI_TYPE_FLOAT16, 3, f16_scaled_product_params,
+                                                         (GenericFuncPtr)f16_scaled_product, NULL, 0);
+    if (ffi_f16) {
+        _Float16 a = (_Float16)1.5f, b = (_Float16)-2.25f;
+        int scale = 2;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b }, { .value_ptr = &scale } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_f16, args, 3, &g_ffi_return_value);
+        ok(success, "FFI call successful for f16_scaled_product");
+        float result = ffi_f16_bits_to_float(g_ret_storage.f16_bits);
+        is_double(result, -6.75, "Result (f16_scaled_product): %f (Expected -6.75)", result);
+        destroy_ffi_function(ffi_f16);
+    } else {
+        fail("Failed to create FFI object for f16_scaled_product.");
     }
-    // --- END Argument count validation ---
+#else
+    skip("Compiler has no _Float16 support on this target.");
+#endif
+}
 
-    if (return_value_out) {
-        actual_return_buffer_ptr = return_value_out->value_ptr;
-        note("FFI Gateway: Return value buffer pointer: %p", actual_return_buffer_ptr);
-        if (!actual_return_buffer_ptr && sig->return_type != FFI_TYPE_VOID) {
-            diag("Error: return_value_out->value_ptr is NULL for non-void return type. Cannot store result.");
-            return false;
+// NEW: Test for _Float16 arguments spilling past XMM7 onto the stack
+void test_float16_stack_spill() {
+#ifdef FFI_HAVE_FLOAT16_TARGETS
+    FFI_FunctionSignature* ffi_f16_sum = create_ffi_function("f16_sum_ten", FFI_TYPE_FLOAT, 10, f16_sum_ten_params,
+                                                             (GenericFuncPtr)f16_sum_ten, NULL, 0);
+    if (ffi_f16_sum) {
+        _Float16 values[10];
+        FFI_Argument args[10];
+        for (int i = 0; i < 10; ++i) {
+            values[i] = (_Float16)((float)i + 0.25f);
+            args[i].value_ptr = &values[i];
         }
-    } else if (sig->return_type != FFI_TYPE_VOID) {
-         diag("Warning: No return_value_out provided for non-void function '%s'. Return value will be lost.", sig->debug_name);
+        // The last argument is weighted by 100 so a swapped or dropped stack slot is visible.
+        float expected = (0.25f + 1.25f + 2.25f + 3.25f + 4.25f + 5.25f + 6.25f + 7.25f + 8.25f) + 9.25f * 100.0f;
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_f16_sum, args, 10, &g_ffi_return_value);
+        ok(success, "FFI call successful for f16_sum_ten");
+        is_double(g_ret_storage.f_val, expected, "Result (f16_sum_ten): %f (Expected %f)", g_ret_storage.f_val, expected);
+        destroy_ffi_function(ffi_f16_sum);
+    } else {
+        fail("Failed to create FFI object for f16_sum_ten.");
     }
+#else
+    skip("Compiler has no _Float16 support on this target.");
+#endif
+}
 
+// NEW: Test for bfloat16 arguments and return value (raw 16-bit patterns)
+void test_bfloat16_scale() {
+#ifdef FFI_HAVE_FLOAT16_TARGETS
+    FFI_FunctionSignature* ffi_bf16 = create_ffi_function("bf16_scale", FFI_TYPE_BFLOAT16, 2, bf16_scale_params,
+                                                          (GenericFuncPtr)bf16_scale, NULL, 0);
+    if (ffi_bf16) {
+        uint16_t x = ffi_float_to_bf16_bits(3.0f);
+        float factor = -0.5f;
+        FFI_Argument args[] = { { .value_ptr = &x }, { .value_ptr = &factor } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_bf16, args, 2, &g_ffi_return_value);
+        ok(success, "FFI call successful for bf16_scale");
+        is_int(g_ret_storage.f16_bits, ffi_float_to_bf16_bits(-1.5f), "Result bits (bf16_scale): 0x%04x (Expected bfloat16 -1.5)", g_ret_storage.f16_bits);
+        destroy_ffi_function(ffi_bf16);
+    } else {
+        fail("Failed to create FFI object for bf16_scale.");
+    }
+#else
+    skip("Compiler has no _Float16 support on this target.");
+#endif
+}
 
-    if (!sig->trampoline_code) {
-        diag("Error: Trampoline code not generated/set for function '%s'.", sig->debug_name);
-        return false;
+// NEW: Test for _Float16 through the Win64 trampoline (integer-class under ms_abi)
+void test_win64_float16() {
+#if defined(FFI_HAVE_MS_ABI_TARGETS) && defined(FFI_HAVE_FLOAT16_TARGETS)
+    FFI_FunctionSignature* ffi_ms_f16 = create_ffi_function_abi("ms_f16_axpy", FFI_TYPE_FLOAT16, 5, ms_f16_axpy_params,
+                                                                (GenericFuncPtr)ms_f16_axpy, FFI_ABI_WIN64);
+    if (ffi_ms_f16) {
+        _Float16 a = (_Float16)2.0f, b = (_Float16)3.5f, c = (_Float16)-1.0f, e = (_Float16)0.125f;
+        double d = 10.0;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b }, { .value_ptr = &c }, { .value_ptr = &d }, { .value_ptr = &e } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_ms_f16, args, 5, &g_ffi_return_value);
+        ok(success, "FFI call successful for ms_f16_axpy");
+        float result = ffi_f16_bits_to_float(g_ret_storage.f16_bits);
+        is_double(result, 16.125, "Result (ms_f16_axpy): %f (Expected 16.125)", result);
+        destroy_ffi_function(ffi_ms_f16);
+    } else {
+        fail("Failed to create Win64 FFI object for ms_f16_axpy.");
     }
+#else
+    skip("ms_abi and _Float16 targets require GCC or Clang on x86-64.");
+#endif
+}
 
-    // --- VERBOSE POINTER DEBUGGING ---
-    note("FFI Gateway: Input FFI_Argument array address: %p", (void*)args);
-    if (num_args > 0 && args != NULL) {
-        for (int i = 0; i < num_args; ++i) {
-            note("FFI Gateway:   args[%d].value_ptr = %p", i, args[i].value_ptr);
-            // Attempt to peek at the value if it's an integer type (using sig->param_types[i])
-            if (sig->param_types && i < sig->num_params) {
-                FFI_Type arg_type = sig->param_types[i];
-                note("FFI Gateway:   args[%d] (param_type %d) value: ", i, arg_type);
-                if (args[i].value_ptr != NULL) {
-                    switch (arg_type) {
-                        case FFI_TYPE_BOOL:    note("%d (bool)", *(bool*)args[i].value_ptr); break;
-                        case FFI_TYPE_CHAR:    note("%d (char)", *(char*)args[i].value_ptr); break;
-                        case FFI_TYPE_UCHAR:   note("%u (uchar)", *(unsigned char*)args[i].value_ptr); break;
-                        case FFI_TYPE_SCHAR:   note("%d (schar)", *(signed char*)args[i].value_ptr); break;
-                        case FFI_TYPE_SHORT:   note("%hd (short)", *(short*)args[i].value_ptr); break;
-                        case FFI_TYPE_USHORT:  note("%hu (ushort)", *(unsigned short*)args[i].value_ptr); break;
-                        case FFI_TYPE_SSHORT:  note("%hd (sshort)", *(signed short*)args[i].value_ptr); break;
-                        case FFI_TYPE_INT:     note("%d (int)", *(int*)args[i].value_ptr); break;
-                        case FFI_TYPE_UINT:    note("%u (uint)", *(unsigned int*)args[i].value_ptr); break;
-                        case FFI_TYPE_SINT:    note("%d (sint)", *(signed int*)args[i].value_ptr); break;
-                        case FFI_TYPE_LONG:    note("%ld (long)", *(long*)args[i].value_ptr); break;
-                        case FFI_TYPE_ULONG:   note("%lu (ulong)", *(unsigned long*)args[i].value_ptr); break;
-                        case FFI_TYPE_SLONG:   note("%ld (slong)", *(signed long*)args[i].value_ptr); break;
-                        case FFI_TYPE_LLONG:   note("%lld (llong)", *(long long*)args[i].value_ptr); break;
-                        case FFI_TYPE_ULLONG:  note("%llu (ullong)", *(unsigned long long*)args[i].value_ptr); break;
-                        case FFI_TYPE_SLLONG:  note("%lld (sllong)", *(signed long long*)args[i].value_ptr); break;
-                        case FFI_TYPE_FLOAT:   note("%f (float)", *(float*)args[i].value_ptr); break;
-                        case FFI_TYPE_DOUBLE:  note("%lf (double)", *(double*)args[i].value_ptr); break;
-                        case FFI_TYPE_POINTER: note("%p (pointer)", *(void**)args[i].value_ptr); break;
-                        case FFI_TYPE_WCHAR:   note("%lc (wchar_t)", *(wchar_t*)args[i].value_ptr); break;
-                        case FFI_TYPE_SIZE_T:  note("%zu (size_t)", *(size_t*)args[i].value_ptr); break;
-#if defined(__SIZEOF_INT128__) || defined(__GNUC__)
-                        case FFI_TYPE_INT128:
-                            {
-                                __int128 val = *(__int128*)args[i].value_ptr;
-                                note("0x%llx%016llx (__int128)", (unsigned long long)(val >> 64), (unsigned long long)val);
-                            }
-                            break;
-                        case FFI_TYPE_UINT128:
-                            {
-                                unsigned __int128 val = *(unsigned __int128*)args[i].value_ptr;
-                                note("0x%llx%016llx (unsigned __int128)", (unsigned long long)(val >> 64), (unsigned long long)val);
-                            }
-                            break;
+// NEW: Test for double complex arguments (two XMMs each) and return value (XMM0:XMM1)
+void test_double_complex_multiply() {
+#if defined(FFI_HAVE_SYSV_EXTENDED_TARGETS) && defined(FFI_HAVE_COMPLEX)
+    FFI_FunctionSignature* ffi_dc = create_ffi_function("dc_multiply", FFI_TYPE_DOUBLE_COMPLEX, 2, dc_multiply_params,
+                                                        (GenericFuncPtr)dc_multiply, NULL, 0);
+    if (ffi_dc) {
+        double _Complex a = 1.5 + 2.0 * I, b = -3.0 + 0.5 * I;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_dc, args, 2, &g_ffi_return_value);
+        ok(success, "FFI call successful for dc_multiply");
+        is_double(creal(g_ret_storage.dc_val), -5.5, "Real part (dc_multiply): %f (Expected -5.5)", creal(g_ret_storage.dc_val));
+        is_double(cimag(g_ret_storage.dc_val), -5.25, "Imaginary part (dc_multiply): %f (Expected -5.25)", cimag(g_ret_storage.dc_val));
+        destroy_ffi_function(ffi_dc);
+    } else {
+        fail("Failed to create FFI object for dc_multiply.");
+    }
 #else
-                        case FFI_TYPE_INT128:
-                            {
-                                int128_struct val = *(int128_struct*)args[i].value_ptr;
-                                note("0x%llx%016llx (int128_struct)", (unsigned long long)val.high, (unsigned long long)val.low);
-                            }
-                            break;
-                        case FFI_TYPE_UINT128:
-                            {
-                                uint128_struct val = *(uint128_struct*)args[i].value_ptr;
-                                note("0x%llx%016llx (uint128_struct)", (unsigned long long)val.high, (unsigned long long)val.low);
-                            }
-                            break;
+    skip("Complex targets require C99 complex support on x86-64 System V.");
 #endif
-                        default: note("Unknown Type (at %p)", args[i].value_ptr); break;
-                    }
-                } else {
-                    note("NULL pointer");
-                }
-            } else {
-                note("FFI Gateway:   args[%d] value (raw ptr): %p", i, args[i].value_ptr);
-            }
-        }
+}
+
+// NEW: Test for float complex (both parts packed into one XMM register)
+void test_float_complex_scale() {
+#if defined(FFI_HAVE_SYSV_EXTENDED_TARGETS) && defined(FFI_HAVE_COMPLEX)
+    FFI_FunctionSignature* ffi_fc = create_ffi_function("fc_scale", FFI_TYPE_FLOAT_COMPLEX, 2, fc_scale_params,
+                                                        (GenericFuncPtr)fc_scale, NULL, 0);
+    if (ffi_fc) {
+        float _Complex z = 2.0f - 3.0f * I;
+        float factor = 0.5f;
+        FFI_Argument args[] = { { .value_ptr = &z }, { .value_ptr = &factor } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_fc, args, 2, &g_ffi_return_value);
+        ok(success, "FFI call successful for fc_scale");
+        is_double(crealf(g_ret_storage.fc_val), 1.0, "Real part (fc_scale): %f (Expected 1.0)", crealf(g_ret_storage.fc_val));
+        is_double(cimagf(g_ret_storage.fc_val), -1.5, "Imaginary part (fc_scale): %f (Expected -1.5)", cimagf(g_ret_storage.fc_val));
+        destroy_ffi_function(ffi_fc);
     } else {
-        note("FFI Gateway:   No arguments to display.");
+        fail("Failed to create FFI object for fc_scale.");
     }
-    // --- END VERBOSE POINTER DEBUGGING ---
+#else
+    skip("Complex targets require C99 complex support on x86-64 System V.");
+#endif
+}
 
-    note("FFI Gateway: Final return buffer ptr passed to trampoline: %p", actual_return_buffer_ptr);
+// NEW: Test for long double (memory-class arguments, ST(0) return) keeping 80-bit precision
+void test_long_double_muladd() {
+#ifdef FFI_HAVE_SYSV_EXTENDED_TARGETS
+    FFI_FunctionSignature* ffi_ld = create_ffi_function("ld_muladd", FFI_TYPE_LONG_DOUBLE, 3, ld_muladd_params,
+                                                        (GenericFuncPtr)ld_muladd, NULL, 0);
+    if (ffi_ld) {
+        // 1 + 2^-60 is not representable as a double; losing precision anywhere drops the low bits.
+        long double a = 1.0L + 0x1p-60L, b = 2.0L, c = 0x1p-61L;
+        long double expected = 2.0L + 0x1p-59L + 0x1p-61L;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b }, { .value_ptr = &c } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_ld, args, 3, &g_ffi_return_value);
+        ok(success, "FFI call successful for ld_muladd");
+        bool exact = (g_ret_storage.ld_val == expected);
+        ok(exact, "Result (ld_muladd): %.21Lg (Expected %.21Lg)", g_ret_storage.ld_val, expected);
+        destroy_ffi_function(ffi_ld);
+    } else {
+        fail("Failed to create FFI object for ld_muladd.");
+    }
+#else
+    skip("long double targets are only exercised on x86-64 System V.");
+#endif
+}
 
-    // CRITICAL VALIDATION POINT: Ensure the return buffer pointer is valid before calling the trampoline
-    if (sig->return_type != FFI_TYPE_VOID && actual_return_buffer_ptr == NULL) {
-        diag("CRITICAL ERROR: Return buffer pointer is NULL for non-void function '%s'. This should have been caught earlier.", sig->debug_name);
-        return false;
+// NEW: Test that a double complex needing two XMMs spills whole, while later doubles still use XMM7
+void test_double_complex_register_straddle() {
+#if defined(FFI_HAVE_SYSV_EXTENDED_TARGETS) && defined(FFI_HAVE_COMPLEX)
+    FFI_FunctionSignature* ffi_straddle = create_ffi_function("dc_straddle", FFI_TYPE_DOUBLE, 10, dc_straddle_params,
+                                                              (GenericFuncPtr)dc_straddle, NULL, 0);
+    if (ffi_straddle) {
+        double d[8] = { 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0 };
+        double _Complex z = 0.25 + 0.5 * I;
+        double tail = 0.125;
+        FFI_Argument args[] = { { .value_ptr = &d[0] }, { .value_ptr = &d[1] }, { .value_ptr = &d[2] }, { .value_ptr = &d[3] },
+                                { .value_ptr = &d[4] }, { .value_ptr = &d[5] }, { .value_ptr = &d[6] }, { .value_ptr = &z },
+                                { .value_ptr = &d[7] }, { .value_ptr = &tail } };
+        double expected = dc_straddle(d[0], d[1], d[2], d[3], d[4], d[5], d[6], z, d[7], tail);
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_straddle, args, 10, &g_ffi_return_value);
+        ok(success, "FFI call successful for dc_straddle");
+        is_double(g_ret_storage.d_val, expected, "Result (dc_straddle): %f (Expected %f)", g_ret_storage.d_val, expected);
+        destroy_ffi_function(ffi_straddle);
+    } else {
+        fail("Failed to create FFI object for dc_straddle.");
     }
+#else
+    skip("Complex targets require C99 complex support on x86-64 System V.");
+#endif
+}
 
-    // (Additional sophisticated checks would involve ensuring it's writable memory, etc., but that's platform-dependent and usually handled by mmap PROT_WRITE)
-    GenericTrampolinePtr trampoline = sig->trampoline_code;
-    note("FFI Gateway: Calling dynamically generated generic trampoline for '%s' at %p...", sig->debug_name, (void*)trampoline);
-    trampoline(args, num_args, actual_return_buffer_ptr);
+// NEW: Test that __int128 stack arguments land on 16-byte aligned slots
+void test_int128_stack_alignment() {
+#if defined(FFI_HAVE_SYSV_EXTENDED_TARGETS) && defined(__SIZEOF_INT128__)
+    FFI_FunctionSignature* ffi_i128 = create_ffi_function("i128_stack_alignment", FFI_TYPE_INT128, 9, i128_stack_alignment_params,
+                                                          (GenericFuncPtr)i128_stack_alignment, NULL, 0);
+    if (ffi_i128) {
+        long a = 1, b = 2, c = 3, d = 4, e = 5, f = 6, g = 7;
+        __int128 v = ((__int128)0x1234 << 64) | 0x10;
+        __int128 w = -((__int128)0x55 << 64);
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b }, { .value_ptr = &c }, { .value_ptr = &d }, { .value_ptr = &e },
+                                { .value_ptr = &v }, { .value_ptr = &f }, { .value_ptr = &g }, { .value_ptr = &w } };
+        __int128 expected = i128_stack_alignment(a, b, c, d, e, v, f, g, w);
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_i128, args, 9, &g_ffi_return_value);
+        ok(success, "FFI call successful for i128_stack_alignment");
+        bool matches = (g_ret_storage.i128_val == expected);
+        ok(matches, "Result (i128_stack_alignment): 0x%llx%016llx (Expected 0x%llx%016llx)",
+           (unsigned long long)(g_ret_storage.i128_val >> 64), (unsigned long long)g_ret_storage.i128_val,
+           (unsigned long long)(expected >> 64), (unsigned long long)expected);
+        destroy_ffi_function(ffi_i128);
+    } else {
+        fail("Failed to create FFI object for i128_stack_alignment.");
+    }
+#else
+    skip("__int128 stack layout is only exercised on x86-64 System V.");
+#endif
+}
 
-    note("FFI Gateway: Trampoline finished. Function '%s' invoked successfully.", sig->debug_name);
+// NEW: Test that a lazily bound handle generates its trampoline exactly once, on first invoke
+void test_lazy_binding_first_invoke() {
+    ffi_set_lazy_binding(true);
+    FFI_FunctionSignature* ffi_lazy = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                          (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ffi_set_lazy_binding(false);
+    if (ffi_lazy) {
+        ok(!ffi_function_is_bound(ffi_lazy), "Lazy handle is unbound after creation");
+        int a = 40, b = 2;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_lazy, args, 2, &g_ffi_return_value);
+        ok(success, "First invoke binds and calls quiet_add_two_ints");
+        is_int(g_ret_storage.i_val, 42, "Result (first invoke): %d (Expected 42)", g_ret_storage.i_val);
+        ok(ffi_function_is_bound(ffi_lazy), "Lazy handle is bound after first invoke");
+
+        GenericTrampolinePtr first_trampoline = ffi_lazy->trampoline_code;
+        a = 7;
+        success = invoke_foreign_function(ffi_lazy, args, 2, &g_ffi_return_value);
+        ok(success, "Second invoke successful");
+        is_int(g_ret_storage.i_val, 9, "Result (second invoke): %d (Expected 9)", g_ret_storage.i_val);
+        bool same_trampoline = (ffi_lazy->trampoline_code == first_trampoline);
+        ok(same_trampoline, "Second invoke reuses the trampoline generated by the first");
+        destroy_ffi_function(ffi_lazy);
+    } else {
+        fail("Failed to create lazy FFI object for quiet_add_two_ints.");
+    }
+}
 
-    return true;
+// NEW: Test that lazy binding defers generation errors to the first invoke
+void test_lazy_binding_deferred_error() {
+    static FFI_Type unsupported_params[] = { FFI_TYPE_UNKNOWN };
+    ffi_set_lazy_binding(true);
+    FFI_FunctionSignature* ffi_bad = create_ffi_function("lazy_unsupported", FFI_TYPE_INT, 1, unsupported_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ffi_set_lazy_binding(false);
+    ok((ffi_bad != NULL), "Lazy creation records an unsupported signature without generating code");
+    if (ffi_bad) {
+        int x = 1;
+        FFI_Argument args[] = { { .value_ptr = &x } };
+        g_ffi_return_value.value_ptr = &g_ret_storage;
+        bool success = invoke_foreign_function(ffi_bad, args, 1, &g_ffi_return_value);
+        ok(!success, "First invoke reports the generation failure");
+        ok(!ffi_function_is_bound(ffi_bad), "Handle stays unbound after a failed resolution");
+        destroy_ffi_function(ffi_bad);
+    }
 }
 
-// --- Main Application ---
-typedef union {
-    bool b_val;
-    char c_val;
-    unsigned char uc_val;
-    signed char sc_val; // For explicit signed char
-    short s_val;
-    unsigned short us_val;
-    signed short ss_val; // For explicit signed short
-    int i_val;
-    unsigned int ui_val;
-    signed int si_val;   // For explicit signed int
-    long l_val;
-    unsigned long ul_val;
-    signed long sl_val;  // For explicit signed long
-    long long ll_val;
-    unsigned long long ull_val;
-    signed long long sll_val; // For explicit signed long long
-    float f_val;
-    double d_val;
-    void* ptr_val;
-    wchar_t wc_val; // For wchar_t
-    size_t sz_val;  // For size_t
-#if defined(__SIZEOF_INT128__) || defined(__GNUC__)
-    __int128 i128_val; // New: 128-bit signed
-    unsigned __int128 ui128_val; // New: 128-bit unsigned
-#else
-    int128_struct i128_val; // Placeholder for 128-bit signed
-    uint128_struct ui128_val; // Placeholder for 128-bit unsigned
+#if FFI_LOG_MAX_LEVEL >= 3
+// Log sink for tests: counts messages per level without formatting them.
+static void counting_log_sink(FFI_LogLevel level, const char* fmt, va_list args, void* user_data) {
+    (void)fmt;
+    (void)args;
+    ((int*)user_data)[level]++;
+}
 #endif
-    // Ensure this union is large enough for the largest possible return type (e.g., double or long long or 128-bit)
-} GenericReturnValue;
-
-// Global return value storage and FFI_Argument for tests
-static FFI_Argument g_ffi_return_value;
-static GenericReturnValue g_ret_storage;
 
+// NEW: Test that log levels filter library messages before they reach the sink
+void test_log_levels_and_sink() {
+#if FFI_LOG_MAX_LEVEL >= 3
+    int counts[4] = { 0, 0, 0, 0 };
+    int a = 1, b = 2;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    g_ffi_return_value.value_ptr = &g_ret_storage;
+    ffi_set_log_sink(counting_log_sink, counts);
+
+    ffi_set_log_level(FFI_LOG_LEVEL_INFO);
+    FFI_FunctionSignature* ffi_add = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    bool created = (ffi_add != NULL);
+    bool success = created && invoke_foreign_function(ffi_add, args, 2, &g_ffi_return_value);
+    int info_count = counts[FFI_LOG_LEVEL_INFO], trace_count = counts[FFI_LOG_LEVEL_TRACE];
+
+    memset(counts, 0, sizeof(counts));
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF);
+    bool success_off = created && invoke_foreign_function(ffi_add, args, 2, &g_ffi_return_value);
+    bool wrong_count_off = created && invoke_foreign_function(ffi_add, args, 1, &g_ffi_return_value);
+    int off_count = counts[0] + counts[1] + counts[2] + counts[3];
+
+    memset(counts, 0, sizeof(counts));
+    ffi_set_log_level(FFI_LOG_LEVEL_ERROR);
+    bool wrong_count_error = created && invoke_foreign_function(ffi_add, args, 1, &g_ffi_return_value);
+    int error_count = counts[FFI_LOG_LEVEL_ERROR];
+
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    ffi_set_log_sink(NULL, NULL);
+    destroy_ffi_function(ffi_add);
+
+    ok(success, "Invoke succeeds at info level");
+    ok((info_count > 0), "Creation reaches the sink at info level (%d messages)", info_count);
+    is_int(trace_count, 0, "No per-invoke trace messages at info level");
+    ok((success_off && !wrong_count_off), "Invoke behaves the same with logging off");
+    is_int(off_count, 0, "Nothing reaches the sink at off level");
+    ok(!wrong_count_error, "Wrong argument count still fails at error level");
+    is_int(error_count, 1, "The failure is reported once at error level");
+#else
+    skip("Library logging compiled out (FFI_LOG_MAX_LEVEL=%d).", FFI_LOG_MAX_LEVEL);
+#endif
+}
 
-// --- Test Functions (for subtest macro) ---
+// NEW: Test that a prepared call owns aligned storage and can be invoked repeatedly
+void test_prepared_call_reuse() {
+    FFI_FunctionSignature* ffi_add = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_PreparedCall* first = prepare_ffi_call(ffi_add);
+    FFI_PreparedCall* second = prepare_ffi_call(ffi_add);
+    if (first && second) {
+        bool aligned = ((uintptr_t)prepared_call_arg(first, 0) % 16 == 0) && ((uintptr_t)prepared_call_arg(first, 1) % 16 == 0) &&
+                       ((uintptr_t)prepared_call_return(first) % 16 == 0);
+        ok(aligned, "Argument and return slots are 16-byte aligned");
+
+        int* a = (int*)prepared_call_arg(first, 0);
+        int* b = (int*)prepared_call_arg(first, 1);
+        int mismatches = 0;
+        for (int i = 0; i < 100; ++i) {
+            *a = i;
+            *b = 3 * i;
+            invoke_prepared_call(first);
+            if (*(int*)prepared_call_return(first) != 4 * i) mismatches++;
+        }
+        is_int(mismatches, 0, "100 reuses of one prepared call return the right sums (%d mismatches)", mismatches);
 
-void test_get_fixed_int_minimal() {
-    FFI_FunctionSignature* ffi_get_fixed_int_test = create_ffi_function(
-        "get_fixed_int_minimal", FFI_TYPE_INT, 0, NULL, (GenericFuncPtr)get_fixed_int_minimal, NULL, 0);
-    if (ffi_get_fixed_int_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        bool invocation_success = invoke_foreign_function(ffi_get_fixed_int_test, NULL, 0, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for get_fixed_int_minimal");
-        is_int(g_ret_storage.i_val, 42, "Result (int): %d (Expected 42)", g_ret_storage.i_val);
-        destroy_ffi_function(ffi_get_fixed_int_test);
+        *(int*)prepared_call_arg(second, 0) = 1000;
+        *(int*)prepared_call_arg(second, 1) = 1;
+        invoke_prepared_call(second);
+        is_int(*(int*)prepared_call_return(second), 1001, "Second prepared call result: %d (Expected 1001)", *(int*)prepared_call_return(second));
+        is_int(*(int*)prepared_call_return(first), 396, "First prepared call keeps its own result: %d (Expected 396)", *(int*)prepared_call_return(first));
     } else {
-        fail("Failed to create FFI object for get_fixed_int_minimal.");
+        fail("Failed to prepare calls for quiet_add_two_ints.");
     }
+    destroy_prepared_call(first);
+    destroy_prepared_call(second);
+    destroy_ffi_function(ffi_add);
 }
 
-void test_int_identity_minimal() {
-    FFI_FunctionSignature* ffi_int_identity_test = create_ffi_function(
-        "int_identity_minimal", FFI_TYPE_INT, 1, identity_int_params, (GenericFuncPtr)int_identity_minimal, NULL, 0);
-    if (ffi_int_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        int identity_in_val = 123;
-        FFI_Argument identity_args[] = { { .value_ptr = &identity_in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_int_identity_test, identity_args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for int_identity_minimal");
-        is_int(g_ret_storage.i_val, identity_in_val, "Result (int): %d (Expected %d)", g_ret_storage.i_val, identity_in_val);
-        destroy_ffi_function(ffi_int_identity_test);
-    } else {
-        fail("Failed to create FFI object for int_identity_minimal.");
+// NEW: Test prepared calls with stack arguments, lazy signatures and validation failures
+void test_prepared_call_validation() {
+    ffi_set_lazy_binding(true);
+    FFI_FunctionSignature* ffi_sum = create_ffi_function("sum_nine_doubles", FFI_TYPE_DOUBLE, 9, sum_nine_doubles_params,
+                                                         (GenericFuncPtr)sum_nine_doubles, NULL, 0);
+    ffi_set_lazy_binding(false);
+    FFI_PreparedCall* call = prepare_ffi_call(ffi_sum);
+    ok((call != NULL), "Prepared a call for a lazily bound sum_nine_doubles");
+    ok((ffi_sum != NULL && ffi_function_is_bound(ffi_sum)), "Preparing resolves the lazy trampoline");
+    if (call) {
+        for (int i = 0; i < 9; ++i) {
+            *(double*)prepared_call_arg(call, i) = (double)(i + 1) * 1.5;
+        }
+        invoke_prepared_call(call);
+        is_double(*(double*)prepared_call_return(call), 67.5, "Result (sum_nine_doubles): %f (Expected 67.5)", *(double*)prepared_call_return(call));
     }
+    destroy_prepared_call(call);
+    destroy_ffi_function(ffi_sum);
+
+    static FFI_Type unsupported_params[] = { FFI_TYPE_UNKNOWN };
+    FFI_FunctionSignature bad_sig = { .debug_name = "prepared_unsupported", .return_type = FFI_TYPE_INT,
+                                      .num_params = 1, .param_types = unsupported_params };
+    ok((prepare_ffi_call(&bad_sig) == NULL), "prepare_ffi_call rejects an unknown parameter type");
+    ok((prepare_ffi_call(NULL) == NULL), "prepare_ffi_call rejects a NULL signature");
 }
 
-void test_bool_identity_minimal() {
-    FFI_FunctionSignature* ffi_bool_identity_test = create_ffi_function(
-        "bool_identity_minimal", FFI_TYPE_BOOL, 1, identity_bool_params, (GenericFuncPtr)bool_identity_minimal, NULL, 0);
-    if (ffi_bool_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        bool in_val = true;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_bool_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for bool_identity_minimal");
-        is_int(g_ret_storage.b_val, in_val, "Result (bool): %d (Expected %d)", g_ret_storage.b_val, in_val);
-        destroy_ffi_function(ffi_bool_identity_test);
+// NEW: Test that _Generic maps C types and expressions onto the right FFI_Type
+void test_typed_signature_mapping() {
+    short s = 0;
+    const char* text = "typed";
+    is_int(FFI_TYPE_OF(s), FFI_TYPE_SHORT, "FFI_TYPE_OF(short variable) is FFI_TYPE_SHORT");
+    is_int(FFI_TYPE_OF(1.0f), FFI_TYPE_FLOAT, "FFI_TYPE_OF(1.0f) is FFI_TYPE_FLOAT");
+    is_int(FFI_TYPE_OF(2ULL), FFI_TYPE_ULLONG, "FFI_TYPE_OF(2ULL) is FFI_TYPE_ULLONG");
+    is_int(FFI_TYPE_OF((char)'a'), FFI_TYPE_CHAR, "FFI_TYPE_OF((char)'a') is FFI_TYPE_CHAR");
+    is_int(FFI_TYPE_OF(text), FFI_TYPE_POINTER, "FFI_TYPE_OF(const char*) is FFI_TYPE_POINTER");
+    is_int(FFI_TYPE_ID(void), FFI_TYPE_VOID, "FFI_TYPE_ID(void) is FFI_TYPE_VOID");
+    is_int(FFI_TYPE_ID(unsigned char), FFI_TYPE_UCHAR, "FFI_TYPE_ID(unsigned char) is FFI_TYPE_UCHAR");
+    is_int(FFI_TYPE_ID(char*), FFI_TYPE_POINTER, "FFI_TYPE_ID(char*) is FFI_TYPE_POINTER");
+    is_int(FFI_TYPE_ID(long double), FFI_TYPE_LONG_DOUBLE, "FFI_TYPE_ID(long double) is FFI_TYPE_LONG_DOUBLE");
+
+    FFI_FunctionSignature* ffi_mixed = FFI_BIND(mixed_int_float_ptr_func, int, int, float, void*);
+    FFI_FunctionSignature* ffi_fixed = FFI_BIND(get_fixed_int_minimal, int, void);
+    if (ffi_mixed && ffi_fixed) {
+        bool types_match = ffi_mixed->num_params == 3 && ffi_mixed->param_types[0] == FFI_TYPE_INT &&
+                           ffi_mixed->param_types[1] == FFI_TYPE_FLOAT && ffi_mixed->param_types[2] == FFI_TYPE_POINTER;
+        ok(types_match, "FFI_BIND derives (int, float, void*) for mixed_int_float_ptr_func");
+        ok((ffi_fixed->num_params == 0 && ffi_fixed->param_types == NULL), "FFI_BIND treats a lone void as an empty parameter list");
+        is_int(ffi_mixed->return_type, FFI_TYPE_INT, "FFI_BIND derives an int return type");
     } else {
-        fail("Failed to create FFI object for bool_identity_minimal.");
+        fail("FFI_BIND failed to create signatures.");
     }
+    destroy_ffi_function(ffi_mixed);
+    destroy_ffi_function(ffi_fixed);
 }
 
-void test_char_identity_minimal() {
-    FFI_FunctionSignature* ffi_char_identity_test = create_ffi_function(
-        "char_identity_minimal", FFI_TYPE_CHAR, 1, identity_char_params, (GenericFuncPtr)char_identity_minimal, NULL, 0);
-    if (ffi_char_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        char in_val = 'X';
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_char_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for char_identity_minimal");
-        is_char(g_ret_storage.c_val, in_val, "Result (char): '%c' (Expected '%c')", g_ret_storage.c_val, in_val);
-        destroy_ffi_function(ffi_char_identity_test);
+// NEW: Test calls through FFI_CALL with stack-built argument frames and typed results
+void test_typed_call() {
+    FFI_FunctionSignature* ffi_add = FFI_BIND(quiet_add_two_ints, int, int, int);
+    FFI_FunctionSignature* ffi_mixed = FFI_BIND(mixed_double_char_int_func, double, double, char, int);
+    FFI_FunctionSignature* ffi_sum = FFI_BIND(sum_nine_doubles, double, double, double, double, double, double, double, double, double, double);
+    FFI_FunctionSignature* ffi_spill = FFI_BIND(mixed_gpr_xmm_stack_spill_func, int, int, int, int, int, int, int,
+                                                float, float, float, float, float, float, float, float, int, double);
+    FFI_FunctionSignature* ffi_identity = FFI_BIND(pointer_identity_minimal, void*, void*);
+    FFI_FunctionSignature* ffi_fixed = FFI_BIND(get_fixed_int_minimal, int, void);
+    FFI_FunctionSignature* ffi_print = FFI_BIND(print_two_ints, void, int, int);
+    if (ffi_add && ffi_mixed && ffi_sum && ffi_spill && ffi_identity && ffi_fixed && ffi_print) {
+        int base = 40;
+        is_int(FFI_CALL(ffi_add, int, base, 2), 42, "FFI_CALL(quiet_add_two_ints, 40, 2): %d (Expected 42)", FFI_CALL(ffi_add, int, base, 2));
+
+        double mixed = FFI_CALL(ffi_mixed, double, 1.5, (char)'A', 10);
+        is_double(mixed, 76.5, "FFI_CALL(mixed_double_char_int_func, 1.5, 'A', 10): %f (Expected 76.5)", mixed);
+
+        double sum = FFI_CALL(ffi_sum, double, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.5);
+        is_double(sum, 45.5, "FFI_CALL with a stack-spilled double: %f (Expected 45.5)", sum);
+
+        int spill = FFI_CALL(ffi_spill, int, 1, 2, 3, 4, 5, 6, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f, 100, 1000.0);
+        is_int(spill, 1157, "FFI_CALL with 16 mixed arguments: %d (Expected 1157)", spill);
+
+        void* echoed = FFI_CALL(ffi_identity, void*, (void*)&base);
+        ok((echoed == (void*)&base), "FFI_CALL returns a typed pointer");
+
+        is_int(FFI_CALL0(ffi_fixed, int), 42, "FFI_CALL0(get_fixed_int_minimal) returns 42");
+        FFI_CALL_VOID(ffi_print, 7, 8);
+        ok(true, "FFI_CALL_VOID(print_two_ints, 7, 8) returned");
     } else {
-        fail("Failed to create FFI object for char_identity_minimal.");
+        fail("FFI_BIND failed to create signatures.");
     }
+    destroy_ffi_function(ffi_add);
+    destroy_ffi_function(ffi_mixed);
+    destroy_ffi_function(ffi_sum);
+    destroy_ffi_function(ffi_spill);
+    destroy_ffi_function(ffi_identity);
+    destroy_ffi_function(ffi_fixed);
+    destroy_ffi_function(ffi_print);
 }
 
-void test_uchar_identity_minimal() {
-    FFI_FunctionSignature* ffi_uchar_identity_test = create_ffi_function(
-        "uchar_identity_minimal", FFI_TYPE_UCHAR, 1, identity_uchar_params, (GenericFuncPtr)uchar_identity_minimal, NULL, 0);
-    if (ffi_uchar_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        unsigned char in_val = 250;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_uchar_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for uchar_identity_minimal");
-        is_int(g_ret_storage.uc_val, in_val, "Result (uchar): %u (Expected %u)", g_ret_storage.uc_val, in_val);
-        destroy_ffi_function(ffi_uchar_identity_test);
+// Future callback for the async tests: counts completions and sums the int results.
+static void count_async_completion(FFI_Future* future, void* user_data) {
+    int64_t* totals = (int64_t*)user_data;
+    FFI_ATOMIC_ADD_I64(&totals[0], 1);
+    FFI_ATOMIC_ADD_I64(&totals[1], *(int*)ffi_future_result(future));
+}
+
+// NEW: Test async invocation: results through wait, poll and callbacks, with work stealing
+void test_async_invoke_futures() {
+    enum { NUM_CALLS = 32 };
+    FFI_ThreadPoolConfig config = { .num_workers = 4, .queue_depth = 16 };
+    FFI_ThreadPool* pool = ffi_thread_pool_create(&config);
+    FFI_FunctionSignature* ffi_add = FFI_BIND(quiet_add_two_ints, int, int, int);
+    FFI_FunctionSignature* ffi_sleep = FFI_BIND(blocking_sleep_ms, int, int);
+    FFI_PreparedCall* calls[NUM_CALLS] = { NULL };
+    FFI_Future* futures[NUM_CALLS] = { NULL };
+    int64_t totals[2] = { 0, 0 }; // completions, sum of results
+    if (pool && ffi_add && ffi_sleep) {
+        for (int i = 0; i < NUM_CALLS; ++i) {
+            // Every fourth call blocks, so the queue it lands on falls behind and gets stolen from.
+            calls[i] = prepare_ffi_call(i % 4 == 0 ? ffi_sleep : ffi_add);
+            if (calls[i] == NULL) continue;
+            *(int*)prepared_call_arg(calls[i], 0) = (i % 4 == 0) ? 5 : i;
+            if (i % 4 != 0) *(int*)prepared_call_arg(calls[i], 1) = 100;
+            futures[i] = ffi_invoke_async(pool, calls[i], count_async_completion, totals);
+        }
+        int submitted = 0, mismatches = 0;
+        int64_t expected_sum = 0;
+        for (int i = 0; i < NUM_CALLS; ++i) {
+            if (futures[i] == NULL) continue;
+            submitted++;
+            int expected = (i % 4 == 0) ? 5 : i + 100;
+            expected_sum += expected;
+            if (*(int*)ffi_future_wait(futures[i]) != expected) mismatches++;
+            if (!ffi_future_poll(futures[i])) mismatches++;
+        }
+        is_int(submitted, NUM_CALLS, "All %d calls were accepted", NUM_CALLS);
+        is_int(mismatches, 0, "Every future completed with the right result (%d mismatches)", mismatches);
+        ok((FFI_ATOMIC_LOAD_I64(&totals[0]) == NUM_CALLS && FFI_ATOMIC_LOAD_I64(&totals[1]) == expected_sum),
+           "Callbacks ran once per call and saw the results (%lld calls, sum %lld)",
+           (long long)FFI_ATOMIC_LOAD_I64(&totals[0]), (long long)FFI_ATOMIC_LOAD_I64(&totals[1]));
+
+        FFI_ThreadPoolStats stats;
+        ffi_thread_pool_get_stats(pool, &stats);
+        ok((stats.num_workers == 4 && stats.queue_depth == 16), "Stats report the configuration (%d workers, depth %d)",
+           stats.num_workers, stats.queue_depth);
+        ok((stats.completed == NUM_CALLS && stats.queued == 0 && stats.running == 0 && stats.rejected == 0),
+           "Stats after draining: %lld completed, %lld queued, %lld running, %lld stolen", (long long)stats.completed,
+           (long long)stats.queued, (long long)stats.running, (long long)stats.stolen);
     } else {
-        fail("Failed to create FFI object for uchar_identity_minimal.");
+        fail("Failed to create the thread pool or signatures.");
+    }
+    for (int i = 0; i < NUM_CALLS; ++i) {
+        ffi_future_destroy(futures[i]);
+        destroy_prepared_call(calls[i]);
     }
+    ffi_thread_pool_destroy(pool);
+    destroy_ffi_function(ffi_add);
+    destroy_ffi_function(ffi_sleep);
 }
 
-void test_short_identity_minimal() {
-    FFI_FunctionSignature* ffi_short_identity_test = create_ffi_function(
-        "short_identity_minimal", FFI_TYPE_SHORT, 1, identity_short_params, (GenericFuncPtr)short_identity_minimal, NULL, 0);
-    if (ffi_short_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        short in_val = -32000;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_short_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for short_identity_minimal");
-        is_int(g_ret_storage.s_val, in_val, "Result (short): %hd (Expected %hd)", g_ret_storage.s_val, in_val);
-        destroy_ffi_function(ffi_short_identity_test);
+// NEW: Test that full queues push back instead of growing, and that destroy drains the queues
+void test_async_invoke_backpressure() {
+    FFI_ThreadPoolConfig config = { .num_workers = 1, .queue_depth = 1 };
+    FFI_ThreadPool* pool = ffi_thread_pool_create(&config);
+    FFI_FunctionSignature* ffi_sleep = FFI_BIND(blocking_sleep_ms, int, int);
+    FFI_PreparedCall* calls[3] = { NULL };
+    FFI_Future* futures[3] = { NULL };
+    if (pool && ffi_sleep) {
+        // One call can run and one can wait, so at least one of three blocking calls is refused.
+        int accepted = 0;
+        for (int i = 0; i < 3; ++i) {
+            calls[i] = prepare_ffi_call(ffi_sleep);
+            if (calls[i] == NULL) continue;
+            *(int*)prepared_call_arg(calls[i], 0) = 30;
+            futures[i] = ffi_invoke_async(pool, calls[i], NULL, NULL);
+            if (futures[i]) accepted++;
+        }
+        FFI_ThreadPoolStats stats;
+        ffi_thread_pool_get_stats(pool, &stats);
+        ok((accepted >= 1 && accepted <= 2), "A 1-worker, depth-1 pool accepted %d of 3 blocking calls", accepted);
+        is_int((int)stats.rejected, 3 - accepted, "Refused submissions are counted (%lld)", (long long)stats.rejected);
+
+        ffi_thread_pool_destroy(pool); // Runs whatever is still queued before returning
+        pool = NULL;
+        int done = 0;
+        for (int i = 0; i < 3; ++i) {
+            if (futures[i] && ffi_future_poll(futures[i]) && *(int*)ffi_future_result(futures[i]) == 30) done++;
+        }
+        is_int(done, accepted, "Every accepted call completed before the pool shut down (%d)", done);
     } else {
-        fail("Failed to create FFI object for short_identity_minimal.");
+        fail("Failed to create the thread pool or signature.");
+    }
+    for (int i = 0; i < 3; ++i) {
+        ffi_future_destroy(futures[i]);
+        destroy_prepared_call(calls[i]);
     }
+    ffi_thread_pool_destroy(pool);
+    destroy_ffi_function(ffi_sleep);
 }
 
-void test_ushort_identity_minimal() {
-    FFI_FunctionSignature* ffi_ushort_identity_test = create_ffi_function(
-        "ushort_identity_minimal", FFI_TYPE_USHORT, 1, identity_ushort_params, (GenericFuncPtr)ushort_identity_minimal, NULL, 0);
-    if (ffi_ushort_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        unsigned short in_val = 65000;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_ushort_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for ushort_identity_minimal");
-        is_int(g_ret_storage.us_val, in_val, "Result (ushort): %hu (Expected %hu)", g_ret_storage.us_val, in_val);
-        destroy_ffi_function(ffi_ushort_identity_test);
-    } else {
-        fail("Failed to create FFI object for ushort_identity_minimal.");
+// Producer thread for the executor tests: issues synchronous calls and records which thread ran them.
+typedef struct {
+    FFI_Executor* exec;
+    FFI_FunctionSignature* sig;
+    int calls;
+    void* marker;    // Thread marker returned by the first call
+    int mismatches;  // Calls that returned a different marker
+} AffineProducer;
+
+FFI_THREAD_FUNC(affine_producer_main, arg) {
+    AffineProducer* producer = (AffineProducer*)arg;
+    FFI_PreparedCall* call = prepare_ffi_call(producer->sig);
+    if (call == NULL) {
+        producer->mismatches = producer->calls;
+        return FFI_THREAD_RETURN;
+    }
+    *(int*)prepared_call_arg(call, 0) = 1;
+    for (int i = 0; i < producer->calls; ++i) {
+        void* marker = *(void**)ffi_executor_invoke(producer->exec, call);
+        if (i == 0) {
+            producer->marker = marker;
+        } else if (marker != producer->marker) {
+            producer->mismatches++;
+        }
     }
+    destroy_prepared_call(call);
+    return FFI_THREAD_RETURN;
 }
 
-void test_long_identity_minimal() {
-    FFI_FunctionSignature* ffi_long_identity_test = create_ffi_function(
-        "long_identity_minimal", FFI_TYPE_LONG, 1, identity_long_params, (GenericFuncPtr)long_identity_minimal, NULL, 0);
-    if (ffi_long_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        long in_val = 9876543210L; // Example long value (32-bit on Win64, 64-bit on Linux/macOS x64/ARM64)
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_long_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for long_identity_minimal");
-        is_int(g_ret_storage.l_val, in_val, "Result (long): %ld (Expected %ld)", g_ret_storage.l_val, in_val);
-        destroy_ffi_function(ffi_long_identity_test);
+// NEW: Test that calls from many producers all run, serialized, on the executor's one thread
+void test_executor_thread_affinity() {
+    enum { NUM_PRODUCERS = 4, CALLS_PER_PRODUCER = 500, NUM_ASYNC = 8 };
+    FFI_ExecutorConfig config = { .ring_capacity = 16, .batch_size = 8 };
+    FFI_Executor* exec = ffi_executor_create(&config);
+    FFI_FunctionSignature* sig = FFI_BIND(affine_thread_marker, void*, int);
+    if (exec && sig) {
+        g_affine_calls = 0;
+        AffineProducer producers[NUM_PRODUCERS];
+        ffi_thread_t threads[NUM_PRODUCERS];
+        int started = 0;
+        for (int i = 0; i < NUM_PRODUCERS; ++i) {
+            producers[i] = (AffineProducer){ .exec = exec, .sig = sig, .calls = CALLS_PER_PRODUCER };
+            if (ffi_thread_start(&threads[i], affine_producer_main, &producers[i])) started++;
+        }
+        for (int i = 0; i < started; ++i) {
+            ffi_thread_join(threads[i]);
+        }
+        is_int(started, NUM_PRODUCERS, "Started %d producer threads", started);
+        int mismatches = 0;
+        for (int i = 0; i < started; ++i) {
+            mismatches += producers[i].mismatches + (producers[i].marker != producers[0].marker);
+        }
+        is_int(mismatches, 0, "Every call ran on the same thread (%d mismatches)", mismatches);
+        ok((producers[0].marker != NULL && producers[0].marker != (void*)&g_affine_thread_marker),
+           "That thread is the executor's, not the test's");
+        is_int(g_affine_calls, NUM_PRODUCERS * CALLS_PER_PRODUCER, "Unsynchronized counter saw every call: %d (Expected %d)",
+               g_affine_calls, NUM_PRODUCERS * CALLS_PER_PRODUCER);
+
+        // Asynchronous submission: queue a batch of records, then poll and wait for them.
+        FFI_ExecRecord records[NUM_ASYNC];
+        FFI_PreparedCall* calls[NUM_ASYNC] = { NULL };
+        int submitted = 0, completed = 0;
+        for (int i = 0; i < NUM_ASYNC; ++i) {
+            calls[i] = prepare_ffi_call(sig);
+            if (calls[i] == NULL) continue;
+            *(int*)prepared_call_arg(calls[i], 0) = 2;
+            if (ffi_executor_submit(exec, &records[i], calls[i])) submitted++;
+        }
+        for (int i = 0; i < submitted; ++i) {
+            if (*(void**)ffi_executor_wait(&records[i]) == producers[0].marker && ffi_exec_record_done(&records[i])) completed++;
+        }
+        is_int(completed, NUM_ASYNC, "Submitted records completed on the executor thread (%d of %d)", completed, NUM_ASYNC);
+        for (int i = 0; i < NUM_ASYNC; ++i) {
+            destroy_prepared_call(calls[i]);
+        }
+
+        FFI_ExecutorStats stats;
+        ffi_executor_get_stats(exec, &stats);
+        int64_t expected = NUM_PRODUCERS * CALLS_PER_PRODUCER + NUM_ASYNC;
+        ok((stats.ring_capacity == 16 && stats.executed == expected && stats.batches > 0 && stats.batches <= expected),
+           "Stats: %lld executed in %lld batches, %lld sleeps, %lld full", (long long)stats.executed,
+           (long long)stats.batches, (long long)stats.sleeps, (long long)stats.full);
     } else {
-        fail("Failed to create FFI object for long_identity_minimal.");
+        fail("Failed to create the executor or signature.");
     }
+    ffi_executor_destroy(exec);
+    destroy_ffi_function(sig);
 }
 
-void test_llong_identity_minimal() {
-    FFI_FunctionSignature* ffi_llong_identity_test = create_ffi_function(
-        "llong_identity_minimal", FFI_TYPE_LLONG, 1, identity_llong_params, (GenericFuncPtr)llong_identity_minimal, NULL, 0);
-    if (ffi_llong_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        long long in_val = -9876543210987654321LL; // Example long long value
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_llong_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for llong_identity_minimal");
-        is_int(g_ret_storage.ll_val, in_val, "Result (long long): %lld (Expected %lld)", g_ret_storage.ll_val, in_val);
-        destroy_ffi_function(ffi_llong_identity_test);
+// NEW: Test that a full ring refuses submissions and that destroy runs what was queued
+void test_executor_ring_full() {
+    enum { NUM_RECORDS = 4 };
+    FFI_ExecutorConfig config = { .ring_capacity = 2, .batch_size = 1 };
+    FFI_Executor* exec = ffi_executor_create(&config);
+    FFI_FunctionSignature* sig = FFI_BIND(blocking_sleep_ms, int, int);
+    FFI_ExecRecord records[NUM_RECORDS];
+    FFI_PreparedCall* calls[NUM_RECORDS] = { NULL };
+    bool accepted[NUM_RECORDS] = { false };
+    if (exec && sig) {
+        // One call may already be running and two can wait, so the fourth submission cannot fit.
+        int num_accepted = 0;
+        for (int i = 0; i < NUM_RECORDS; ++i) {
+            calls[i] = prepare_ffi_call(sig);
+            if (calls[i] == NULL) continue;
+            *(int*)prepared_call_arg(calls[i], 0) = 30;
+            accepted[i] = ffi_executor_submit(exec, &records[i], calls[i]);
+            if (accepted[i]) num_accepted++;
+        }
+        FFI_ExecutorStats stats;
+        ffi_executor_get_stats(exec, &stats);
+        ok((num_accepted >= 2 && num_accepted <= 3), "A 2-record ring accepted %d of %d blocking calls", num_accepted, NUM_RECORDS);
+        is_int((int)stats.full, NUM_RECORDS - num_accepted, "Refused submissions are counted (%lld)", (long long)stats.full);
+
+        ffi_executor_destroy(exec); // Runs whatever is still queued before returning
+        exec = NULL;
+        int done = 0;
+        for (int i = 0; i < NUM_RECORDS; ++i) {
+            if (accepted[i] && ffi_exec_record_done(&records[i]) && *(int*)prepared_call_return(calls[i]) == 30) done++;
+        }
+        is_int(done, num_accepted, "Every accepted call completed before the executor stopped (%d)", done);
     } else {
-        fail("Failed to create FFI object for llong_identity_minimal.");
+        fail("Failed to create the executor or signature.");
     }
+    for (int i = 0; i < NUM_RECORDS; ++i) {
+        destroy_prepared_call(calls[i]);
+    }
+    ffi_executor_destroy(exec);
+    destroy_ffi_function(sig);
 }
 
-void test_ullong_identity_minimal() {
-    FFI_FunctionSignature* ffi_ullong_identity_test = create_ffi_function(
-        "ullong_identity_minimal", FFI_TYPE_ULLONG, 1, identity_ullong_params, (GenericFuncPtr)ullong_identity_minimal, NULL, 0);
-    if (ffi_ullong_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        unsigned long long in_val = 0xFEDCBA9876543210ULL; // Example ullong value
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_ullong_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for ullong_identity_minimal");
-        is_int(g_ret_storage.ull_val, in_val, "Result (ullong): %llu (Expected %llu)", g_ret_storage.ull_val, in_val);
-        destroy_ffi_function(ffi_ullong_identity_test);
+// NEW: Test that destroy inside an epoch section defers the free until the section is left
+void test_epoch_deferred_destroy() {
+    ffi_epoch_synchronize();
+    FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                     (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (sig) {
+        int a = 40, b = 2;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        g_ret_storage.i_val = 0;
+        ffi_epoch_enter();
+        destroy_ffi_function(sig);
+        is_int((int)ffi_epoch_retired_count(), 1, "Destroy inside a critical section retires the signature without freeing it");
+        bool invoked = invoke_foreign_function(sig, args, 2, &g_ffi_return_value);
+        ok((invoked && g_ret_storage.i_val == 42), "The retired signature is still callable in the section: %d (Expected 42)", g_ret_storage.i_val);
+        ffi_epoch_leave();
+        ffi_epoch_synchronize();
+        is_int((int)ffi_epoch_retired_count(), 0, "Leaving the section lets the grace period complete");
     } else {
-        fail("Failed to create FFI object for ullong_identity_minimal.");
+        fail("Failed to create FFI object for quiet_add_two_ints.");
     }
+
+    FFI_FunctionSignature* unshared = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                          (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    destroy_ffi_function(unshared);
+    is_int((int)ffi_epoch_retired_count(), 0, "With no thread in a section, destroy frees immediately");
 }
 
-void test_float_identity_minimal() {
-    FFI_FunctionSignature* ffi_float_identity_test = create_ffi_function(
-        "float_identity_minimal", FFI_TYPE_FLOAT, 1, identity_float_params, (GenericFuncPtr)float_identity_minimal, NULL, 0);
-    if (ffi_float_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        float in_val = 3.14159f;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_float_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for float_identity_minimal");
-        is_float(g_ret_storage.f_val, in_val, "Result (float): %f (Expected %f)", g_ret_storage.f_val, in_val);
-        destroy_ffi_function(ffi_float_identity_test);
-    } else {
-        fail("Failed to create FFI object for float_identity_minimal.");
+// Invoker thread for the reclamation stress test: calls whatever signature each slot holds.
+typedef struct {
+    FFI_FunctionSignature** slots;
+    int num_slots;
+    int64_t* stop;
+    long calls;
+    long failures;
+} EpochInvoker;
+
+FFI_THREAD_FUNC(epoch_invoker_main, arg) {
+    EpochInvoker* invoker = (EpochInvoker*)arg;
+    int a = 40, b = 2, result = 0;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    FFI_Argument ret = { .value_ptr = &result };
+    for (long i = 0; !FFI_ATOMIC_LOAD_I64(invoker->stop); ++i) {
+        // The load of the shared handle belongs in the section too, or it could be freed before the call.
+        ffi_epoch_enter();
+        FFI_FunctionSignature* sig = (FFI_FunctionSignature*)FFI_ATOMIC_LOAD_PTR((void**)&invoker->slots[i % invoker->num_slots]);
+        result = 0;
+        if (!invoke_foreign_function(sig, args, 2, &ret) || result != 42) invoker->failures++;
+        ffi_epoch_leave();
+        invoker->calls++;
     }
+    ffi_epoch_thread_detach();
+    return FFI_THREAD_RETURN;
 }
 
-void test_double_identity_minimal() {
-    FFI_FunctionSignature* ffi_double_identity_test = create_ffi_function(
-        "double_identity_minimal", FFI_TYPE_DOUBLE, 1, identity_double_params, (GenericFuncPtr)double_identity_minimal, NULL, 0);
-    if (ffi_double_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        double in_val = 2.718281828;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_double_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for double_identity_minimal");
-        is_double(g_ret_storage.d_val, in_val, "Result (double): %lf (Expected %lf)", g_ret_storage.d_val, in_val);
-        destroy_ffi_function(ffi_double_identity_test);
+// NEW: Stress test: invokers race with a thread that keeps replacing and destroying the signatures
+void test_epoch_concurrent_destroy() {
+    enum { NUM_INVOKERS = 4, NUM_SLOTS = 4, NUM_REPLACEMENTS = 400 };
+    FFI_FunctionSignature* slots[NUM_SLOTS];
+    int created = 0;
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF); // The TAP diagnostic stream is written from this thread only
+    for (int i = 0; i < NUM_SLOTS; ++i) {
+        slots[i] = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                       (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+        if (slots[i]) created++;
+    }
+    if (created == NUM_SLOTS) {
+        int64_t stop = 0;
+        EpochInvoker invokers[NUM_INVOKERS];
+        ffi_thread_t threads[NUM_INVOKERS];
+        int started = 0;
+        for (int i = 0; i < NUM_INVOKERS; ++i) {
+            invokers[i] = (EpochInvoker){ .slots = slots, .num_slots = NUM_SLOTS, .stop = &stop };
+            if (ffi_thread_start(&threads[i], epoch_invoker_main, &invokers[i])) started++;
+        }
+
+        int replaced = 0;
+        for (int r = 0; r < NUM_REPLACEMENTS && started == NUM_INVOKERS; ++r) {
+            ffi_set_lazy_binding(r % 2 == 0); // Half the replacements also race on lazy resolution
+            FFI_FunctionSignature* fresh = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                               (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+            ffi_set_lazy_binding(false);
+            if (fresh == NULL) break;
+            void* old = FFI_ATOMIC_LOAD_PTR((void**)&slots[r % NUM_SLOTS]);
+            FFI_ATOMIC_CAS_PTR((void**)&slots[r % NUM_SLOTS], old, (void*)fresh); // Only this thread writes the slots
+            destroy_ffi_function((FFI_FunctionSignature*)old);
+            replaced++;
+            ffi_thread_yield();
+        }
+        FFI_ATOMIC_STORE_I64(&stop, 1);
+        long calls = 0, failures = 0;
+        for (int i = 0; i < started; ++i) {
+            ffi_thread_join(threads[i]);
+            calls += invokers[i].calls;
+            failures += invokers[i].failures;
+        }
+        ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+        is_int(started, NUM_INVOKERS, "Started %d invoker threads", started);
+        is_int(replaced, NUM_REPLACEMENTS, "Replaced and destroyed %d signatures under the invokers", replaced);
+        ok((calls > 0 && failures == 0), "%ld concurrent invocations, %ld wrong or failed", calls, failures);
     } else {
-        fail("Failed to create FFI object for double_identity_minimal.");
+        ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+        fail("Failed to create the initial signatures.");
     }
+    for (int i = 0; i < NUM_SLOTS; ++i) {
+        destroy_ffi_function(i < created ? slots[i] : NULL);
+    }
+    ffi_epoch_synchronize();
+    is_int((int)ffi_epoch_retired_count(), 0, "Every retired signature was eventually freed");
 }
 
+// Sink for the concurrency test: a plain counter next to an atomic one. They only agree if
+// the library never runs the sink on two threads at once.
+typedef struct {
+    long unsynchronized;
+    int64_t atomic;
+} SerializedSinkCounts;
+
+static void serialized_counting_log_sink(FFI_LogLevel level, const char* fmt, va_list args, void* user_data) {
+    (void)level; (void)fmt; (void)args;
+    SerializedSinkCounts* counts = (SerializedSinkCounts*)user_data;
+    long seen = counts->unsynchronized;
+    ffi_thread_yield(); // Widen the window a racing second call would need
+    counts->unsynchronized = seen + 1;
+    FFI_ATOMIC_ADD_I64(&counts->atomic, 1);
+}
 
-void test_pointer_identity_minimal() {
-    FFI_FunctionSignature* ffi_pointer_identity_test = create_ffi_function(
-        "pointer_identity_minimal", FFI_TYPE_POINTER, 1, identity_pointer_params, (GenericFuncPtr)pointer_identity_minimal, NULL, 0);
-    if (ffi_pointer_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        void* in_val = (void*)0xDEADBEEF; // Example pointer value
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_pointer_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for pointer_identity_minimal");
-        is_ptr(g_ret_storage.ptr_val, in_val, "Result (pointer): %p (Expected %p)", g_ret_storage.ptr_val, in_val);
-        destroy_ffi_function(ffi_pointer_identity_test);
-    } else {
-        fail("Failed to create FFI object for pointer_identity_minimal.");
+// Worker for the runtime thread-safety test: creates, invokes and destroys its own signatures.
+typedef struct {
+    int iterations;
+    int failures;
+} RuntimeStressWorker;
+
+FFI_THREAD_FUNC(runtime_stress_main, arg) {
+    RuntimeStressWorker* worker = (RuntimeStressWorker*)arg;
+    for (int i = 0; i < worker->iterations; ++i) {
+        ffi_set_lazy_binding(i % 2 == 0);
+        FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+        if (sig == NULL) {
+            worker->failures++;
+            continue;
+        }
+        int a = i, b = 2, result = 0;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        FFI_Argument ret = { .value_ptr = &result };
+        if (!invoke_foreign_function(sig, args, 2, &ret) || result != i + 2) worker->failures++;
+        destroy_ffi_function(sig);
     }
+    ffi_epoch_thread_detach();
+    return FFI_THREAD_RETURN;
 }
 
-void test_print_two_ints() {
-    FFI_FunctionSignature* ffi_print_two_ints_test = create_ffi_function(
-        "print_two_ints", FFI_TYPE_VOID, 2, print_two_ints_params, (GenericFuncPtr)print_two_ints, NULL, 0);
-    if (ffi_print_two_ints_test) {
-        // No return value to clear for void function
-        int int1_void = 50;
-        int int2_void = 75;
-        FFI_Argument two_ints_void_args[] = {
-            { .value_ptr = &int1_void },
-            { .value_ptr = &int2_void }
-        };
-        bool invocation_success = invoke_foreign_function(ffi_print_two_ints_test, two_ints_void_args, 2, NULL);
-        ok(invocation_success, "FFI call successful for print_two_ints");
-        destroy_ffi_function(ffi_print_two_ints_test);
-    } else {
-        fail("Failed to create FFI object for print_two_ints.");
+// NEW: Test that creation, invocation, destruction and logging are safe from many threads at once
+void test_runtime_thread_safety() {
+    enum { NUM_WORKERS = 8, ITERATIONS = 50 };
+    SerializedSinkCounts counts = { 0, 0 };
+    RuntimeStressWorker workers[NUM_WORKERS];
+    ffi_thread_t threads[NUM_WORKERS];
+    int started = 0, failures = 0;
+    ffi_set_log_sink(serialized_counting_log_sink, &counts);
+    ffi_set_log_level(FFI_LOG_LEVEL_INFO);
+    for (int i = 0; i < NUM_WORKERS; ++i) {
+        workers[i] = (RuntimeStressWorker){ .iterations = ITERATIONS };
+        if (ffi_thread_start(&threads[i], runtime_stress_main, &workers[i])) started++;
+    }
+    for (int i = 0; i < started; ++i) {
+        ffi_thread_join(threads[i]);
+        failures += workers[i].failures;
     }
+    ffi_set_lazy_binding(false);
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    ffi_set_log_sink(NULL, NULL);
+
+    is_int(started, NUM_WORKERS, "Started %d threads creating, invoking and destroying signatures", started);
+    is_int(failures, 0, "Every concurrent create/invoke/destroy round trip succeeded (%d failures)", failures);
+    ok((counts.atomic > 0), "Workers logged through the sink (%lld messages)", (long long)counts.atomic);
+    is_int((int)counts.unsynchronized, (int)counts.atomic, "Sink calls never overlapped: %ld unsynchronized vs %lld atomic counts",
+           counts.unsynchronized, (long long)counts.atomic);
+    ffi_epoch_synchronize();
+    is_int((int)ffi_epoch_retired_count(), 0, "No signature is left waiting for reclamation");
 }
 
-void test_print_float_and_double() {
-    FFI_FunctionSignature* ffi_print_float_and_double_test = create_ffi_function(
-        "print_float_and_double", FFI_TYPE_VOID, 2, print_float_double_params, (GenericFuncPtr)print_float_and_double, NULL, 0);
-    if (ffi_print_float_and_double_test) {
-        // No return value to clear for void function
-        float f_test = 3.14f;
-        double d_test = 2.718;
-        FFI_Argument float_double_args[] = {
-            { .value_ptr = &f_test },
-            { .value_ptr = &d_test }
-        };
-        bool invocation_success = invoke_foreign_function(ffi_print_float_and_double_test, float_double_args, 2, NULL);
-        ok(invocation_success, "FFI call successful for print_float_and_double");
-        destroy_ffi_function(ffi_print_float_and_double_test);
+// NEW: Test that tier-0 handles run through precompiled shims and get promoted to JIT code
+void test_tiered_promotion() {
+    ffi_set_tiered_execution(4, true);
+    FFI_FunctionSignature* add = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                     (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_FunctionSignature* mixed = create_ffi_function("mixed_double_char_int_func", FFI_TYPE_DOUBLE, 3, mixed_double_char_int_params,
+                                                       (GenericFuncPtr)mixed_double_char_int_func, NULL, 0);
+    FFI_FunctionSignature* with_float = create_ffi_function("mixed_int_float_ptr_func", FFI_TYPE_INT, 3, mixed_int_float_ptr_params,
+                                                            (GenericFuncPtr)mixed_int_float_ptr_func, NULL, 0);
+    FFI_FunctionSignature* float_ret = create_ffi_function("float_identity_minimal", FFI_TYPE_FLOAT, 1, identity_float_params,
+                                                           (GenericFuncPtr)float_identity_minimal, NULL, 0);
+    FFI_FunctionSignature* short_ret = create_ffi_function("short_identity_minimal", FFI_TYPE_SHORT, 1, identity_short_params,
+                                                           (GenericFuncPtr)short_identity_minimal, NULL, 0);
+    ffi_set_tiered_execution(0, true);
+    if (add && mixed && with_float && float_ret && short_ret) {
+#ifdef FFI_HAVE_TIER0
+        ok((ffi_function_tier(add) == 0 && !ffi_function_is_bound(add)), "A register-only handle starts at tier 0 without JIT code");
+#else
+        ok((ffi_function_tier(add) == 1), "Without tier-0 shims on this ABI, handles start with JIT code");
+#endif
+        int a = 40, b = 2;
+        FFI_Argument add_args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        int sum_errors = 0;
+        for (int i = 0; i < 3; ++i) {
+            g_ret_storage.i_val = 0;
+            if (!invoke_foreign_function(add, add_args, 2, &g_ffi_return_value) || g_ret_storage.i_val != 42) sum_errors++;
+        }
+        is_int(sum_errors, 0, "Calls below the threshold return the right result (%d errors)", sum_errors);
+
+        double d = 1.5; char c = 'A'; int i3 = -3;
+        FFI_Argument mixed_args[] = { { .value_ptr = &d }, { .value_ptr = &c }, { .value_ptr = &i3 } };
+        g_ret_storage.d_val = 0.0;
+        invoke_foreign_function(mixed, mixed_args, 3, &g_ffi_return_value);
+        is_double(g_ret_storage.d_val, 63.5, "Shim with a double before two integers: %f", g_ret_storage.d_val);
+
+        int iv = 10; float fv = 2.75f; void* pv = &iv;
+        FFI_Argument float_args[] = { { .value_ptr = &iv }, { .value_ptr = &fv }, { .value_ptr = &pv } };
+        g_ret_storage.i_val = 0;
+        invoke_foreign_function(with_float, float_args, 3, &g_ffi_return_value);
+        is_int(g_ret_storage.i_val, 13, "Shim passes a float between integer arguments");
+
+        float fin = -0.15625f;
+        FFI_Argument fin_arg[] = { { .value_ptr = &fin } };
+        g_ret_storage.f_val = 0.0f;
+        invoke_foreign_function(float_ret, fin_arg, 1, &g_ffi_return_value);
+        is_float(g_ret_storage.f_val, -0.15625f, "Shim returns a float: %f", g_ret_storage.f_val);
+
+        short sin_val = -1234;
+        FFI_Argument sin_arg[] = { { .value_ptr = &sin_val } };
+        g_ret_storage.s_val = 0;
+        invoke_foreign_function(short_ret, sin_arg, 1, &g_ffi_return_value);
+        is_int(g_ret_storage.s_val, -1234, "Shim sign-extends and truncates a short");
+
+        for (int i = 0; i < 4; ++i) {
+            g_ret_storage.i_val = 0;
+            if (!invoke_foreign_function(add, add_args, 2, &g_ffi_return_value) || g_ret_storage.i_val != 42) sum_errors++;
+        }
+        ffi_tier_up_wait();
+        is_int(ffi_function_tier(add), 1, "Reaching the threshold promotes the handle to JIT code");
+        ok(ffi_function_is_bound(add), "The promoted handle has its trampoline");
+        g_ret_storage.i_val = 0;
+        invoke_foreign_function(add, add_args, 2, &g_ffi_return_value);
+        is_int(g_ret_storage.i_val, 42, "Promoted handle still returns %d (Expected 42)", g_ret_storage.i_val);
     } else {
-        fail("Failed to create FFI object for print_float_and_double.");
+        fail("Failed to create the tier-0 handles.");
     }
+    destroy_ffi_function(add);
+    destroy_ffi_function(mixed);
+    destroy_ffi_function(with_float);
+    destroy_ffi_function(float_ret);
+    destroy_ffi_function(short_ret);
+    ffi_tier_up_shutdown();
 }
-
-void test_get_float_value() {
-    FFI_FunctionSignature* ffi_get_float_value_test = create_ffi_function(
-        "get_float_value", FFI_TYPE_FLOAT, 0, NULL, (GenericFuncPtr)get_float_value, NULL, 0);
-    if (ffi_get_float_value_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        bool invocation_success = invoke_foreign_function(ffi_get_float_value_test, NULL, 0, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for get_float_value");
-        is_float(g_ret_storage.f_val, 123.45f, "Result (float): %f (Expected 123.45)", g_ret_storage.f_val);
-        destroy_ffi_function(ffi_get_float_value_test);
+
+// NEW: Test which shapes skip tier 0, inline promotion, and destroy racing the compiler thread
+void test_tiered_fallbacks() {
+    ffi_set_tiered_execution(2, false);
+    FFI_FunctionSignature* seven = create_ffi_function("sum_seven_ints", FFI_TYPE_INT, 7, sum_seven_ints_params,
+                                                       (GenericFuncPtr)sum_seven_ints, NULL, 0);
+    FFI_FunctionSignature* wide = create_ffi_function("int128_identity_minimal", FFI_TYPE_INT128, 1, identity_int128_params,
+                                                      (GenericFuncPtr)int128_identity_minimal, NULL, 0);
+    FFI_FunctionSignature* inline_sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                            (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_FunctionSignature* prepared_sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                              (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (seven && wide && inline_sig && prepared_sig) {
+        ok((ffi_function_tier(seven) == 1 && ffi_function_is_bound(seven)), "Stack arguments need JIT code from the start");
+        ok((ffi_function_tier(wide) == 1 && ffi_function_is_bound(wide)), "__int128 needs JIT code from the start");
+
+        int a = 40, b = 2;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        invoke_foreign_function(inline_sig, args, 2, &g_ffi_return_value);
+        invoke_foreign_function(inline_sig, args, 2, &g_ffi_return_value);
+        is_int(ffi_function_tier(inline_sig), 1, "Without the compiler thread, the call reaching the threshold promotes inline");
+
+        FFI_PreparedCall* call = prepare_ffi_call(prepared_sig);
+        ok((call != NULL && ffi_function_tier(prepared_sig) == 1), "Preparing a call promotes a tier-0 handle immediately");
+        destroy_prepared_call(call);
     } else {
-        fail("Failed to create FFI object for get_float_value.");
+        fail("Failed to create the fallback handles.");
     }
+    destroy_ffi_function(seven);
+    destroy_ffi_function(wide);
+    destroy_ffi_function(inline_sig);
+    destroy_ffi_function(prepared_sig);
+
+    // Handles promoted on their first call and destroyed right away: some are still queued,
+    // some mid-compilation, some done.
+    ffi_set_tiered_execution(1, true);
+    int failures = 0;
+    for (int i = 0; i < 64; ++i) {
+        FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+        int a = i, b = 1, result = 0;
+        FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        FFI_Argument ret = { .value_ptr = &result };
+        if (sig == NULL || !invoke_foreign_function(sig, args, 2, &ret) || result != i + 1) failures++;
+        destroy_ffi_function(sig);
+    }
+    ffi_set_tiered_execution(0, true);
+    ffi_tier_up_shutdown();
+    ffi_epoch_synchronize();
+    is_int(failures, 0, "Destroying handles with promotions in flight is safe (%d failures)", failures);
+    is_int((int)ffi_epoch_retired_count(), 0, "Every destroyed handle was freed");
 }
 
-void test_get_double_value() {
-    FFI_FunctionSignature* ffi_get_double_value_test = create_ffi_function(
-        "get_double_value", FFI_TYPE_DOUBLE, 0, NULL, (GenericFuncPtr)get_double_value, NULL, 0);
-    if (ffi_get_double_value_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        bool invocation_success = invoke_foreign_function(ffi_get_double_value_test, NULL, 0, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for get_double_value");
-        is_double(g_ret_storage.d_val, 987.654, "Result (double): %lf (Expected 987.654)", g_ret_storage.d_val);
-        destroy_ffi_function(ffi_get_double_value_test);
+// NEW: Test the signature grammar, its canonical form and interning
+void test_signature_parsing() {
+    size_t before = ffi_signature_count();
+    const FFI_SignatureDesc* compact = ffi_intern_signature("i(ifp)");
+    const FFI_SignatureDesc* spaced = ffi_intern_signature(" i ( i, f ,p ) ");
+    if (compact && spaced) {
+        is_ptr(spaced, compact, "Equivalent spellings intern to one descriptor");
+        is_str(compact->text, "i(ifp)", "Canonical text drops separators");
+        ok((compact->return_type == FFI_TYPE_INT && compact->num_params == 3 && compact->param_types[0] == FFI_TYPE_INT &&
+            compact->param_types[1] == FFI_TYPE_FLOAT && compact->param_types[2] == FFI_TYPE_POINTER && !compact->variadic),
+           "Return and parameter types decoded");
     } else {
-        fail("Failed to create FFI object for get_double_value.");
+        fail("Failed to parse \"i(ifp)\".");
     }
+    is_int((int)(ffi_signature_count() - before), 1, "Only the first spelling allocated a descriptor");
+
+    const FFI_SignatureDesc* none = ffi_intern_signature("v()");
+    ok((none && none->return_type == FFI_TYPE_VOID && none->num_params == 0), "\"v()\" takes no parameters");
+    const FFI_SignatureDesc* prototype = ffi_intern_signature("v(d,d,...)");
+    ok((prototype && prototype->variadic && prototype->num_fixed_params == 2 && prototype->num_params == 2 &&
+        strcmp(prototype->text, "v(dd...)") == 0), "Variadic prototype: 2 fixed parameters, no call-site types");
+    const FFI_SignatureDesc* call_site = ffi_intern_signature("i(p...id)");
+    ok((call_site && call_site->variadic && call_site->num_fixed_params == 1 && call_site->num_params == 3 &&
+        call_site->param_types[2] == FFI_TYPE_DOUBLE), "Variadic call site: 1 fixed parameter plus int and double");
+
+    const char* malformed[] = { "i(q)", "i(ii", "iii", "i(v)", "v(p...f)", "i()x", "i(i....)", "" };
+    int rejected = 0;
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+        if (ffi_intern_signature(malformed[i]) == NULL) rejected++;
+    }
+    is_int(rejected, (int)(sizeof(malformed) / sizeof(malformed[0])), "Every malformed signature is rejected");
 }
 
-void test_sum_seven_ints() {
-    FFI_FunctionSignature* ffi_sum_seven_ints_test = create_ffi_function(
-        "sum_seven_ints", FFI_TYPE_INT, 7, sum_seven_ints_params, (GenericFuncPtr)sum_seven_ints, NULL, 0);
-    if (ffi_sum_seven_ints_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        int v1=1, v2=2, v3=3, v4=4, v5=5, v6=6, v7=7;
-        FFI_Argument args[] = {
-            { .value_ptr = &v1 }, { .value_ptr = &v2 }, { .value_ptr = &v3 },
-            { .value_ptr = &v4 }, { .value_ptr = &v5 }, { .value_ptr = &v6 },
-            { .value_ptr = &v7 }
-        };
-        bool invocation_success = invoke_foreign_function(ffi_sum_seven_ints_test, args, 7, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for sum_seven_ints");
-        is_int(g_ret_storage.i_val, 28, "Result (sum_seven_ints): %d (Expected 28)", g_ret_storage.i_val);
-        destroy_ffi_function(ffi_sum_seven_ints_test);
+// NEW: Test creating and calling handles from signature strings, including a variadic call site
+void test_signature_create() {
+    FFI_FunctionSignature* add = create_ffi_function_from_signature("quiet_add_two_ints", "i(ii)", (GenericFuncPtr)quiet_add_two_ints);
+    FFI_FunctionSignature* mixed = create_ffi_function_from_signature("mixed_double_char_int_func", "d(d, c, i)",
+                                                                      (GenericFuncPtr)mixed_double_char_int_func);
+    if (add && mixed) {
+        int a = 40, b = 2;
+        FFI_Argument add_args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+        g_ret_storage.i_val = 0;
+        invoke_foreign_function(add, add_args, 2, &g_ffi_return_value);
+        is_int(g_ret_storage.i_val, 42, "\"i(ii)\" handle returns %d (Expected 42)", g_ret_storage.i_val);
+
+        double d = 1.5; char c = 'A'; int i3 = -3;
+        FFI_Argument mixed_args[] = { { .value_ptr = &d }, { .value_ptr = &c }, { .value_ptr = &i3 } };
+        g_ret_storage.d_val = 0.0;
+        invoke_foreign_function(mixed, mixed_args, 3, &g_ffi_return_value);
+        is_double(g_ret_storage.d_val, 63.5, "\"d(d, c, i)\" handle returns %f (Expected 63.5)", g_ret_storage.d_val);
     } else {
-        fail("Failed to create FFI object for sum_seven_ints.");
+        fail("Failed to create handles from signature strings.");
     }
+    destroy_ffi_function(add);
+    destroy_ffi_function(mixed);
+
+#if defined(FFI_ARCH_X64) && !defined(FFI_OS_WIN64)
+    FFI_FunctionSignature* average = create_ffi_function_from_signature("variadic_average", "d(i...ddd)", (GenericFuncPtr)variadic_average);
+    if (average) {
+        int count = 3;
+        double x = 1.0, y = 2.5, z = 5.5;
+        FFI_Argument args[] = { { .value_ptr = &count }, { .value_ptr = &x }, { .value_ptr = &y }, { .value_ptr = &z } };
+        g_ret_storage.d_val = 0.0;
+        invoke_foreign_function(average, args, 4, &g_ffi_return_value);
+        is_double(g_ret_storage.d_val, 3.0, "Variadic call site \"d(i...ddd)\" returns %f (Expected 3.0)", g_ret_storage.d_val);
+    } else {
+        fail("Failed to create the variadic call site.");
+    }
+    destroy_ffi_function(average);
+#else
+    skip("Variadic call sites need the System V x86-64 convention");
+#endif
+    ok((create_ffi_function_from_signature("variadic_average", "d(i,...)", (GenericFuncPtr)variadic_average) == NULL),
+       "A variadic prototype without call-site types cannot be bound");
+    ok((create_ffi_function_from_signature("bad", "i(i", (GenericFuncPtr)quiet_add_two_ints) == NULL),
+       "A malformed signature string creates nothing");
 }
 
-// NEW: Test for reentrancy of trampoline
-void test_reentrancy_add_two_ints() {
-    FFI_FunctionSignature* ffi_add_two_ints_reentrant = create_ffi_function(
-        "add_two_ints_reentrant", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)add_two_ints, NULL, 0);
-    if (ffi_add_two_ints_reentrant) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+// The C math library, present on every supported host, stands in for a third-party library.
+#if defined(FFI_OS_WIN64)
+#define FFI_TEST_MATH_LIBRARY "msvcrt.dll"
+#elif defined(FFI_OS_MACOS)
+#define FFI_TEST_MATH_LIBRARY "/usr/lib/libSystem.B.dylib"
+#else
+#define FFI_TEST_MATH_LIBRARY "libm.so.6"
+#endif
 
-        // Call 1
-        int a1 = 10, b1 = 20;
-        FFI_Argument args1[] = { { .value_ptr = &a1 }, { .value_ptr = &b1 } };
-        bool success1 = invoke_foreign_function(ffi_add_two_ints_reentrant, args1, 2, &g_ffi_return_value);
-        ok(success1, "Reentrancy Call 1 successful");
-        is_int(g_ret_storage.i_val, 30, "Reentrancy Result 1: %d (Expected 30)", g_ret_storage.i_val);
+static const FFI_LibraryBinding g_test_math_bindings[] = {
+    { "cos", "d(d)" },
+    { "pow", "d(dd)" },
+    { "ldexp", "d(di)" },
+    { "ffi_no_such_symbol", "v()" },
+    { "fabs", "d(d" }, // Malformed signature: only reported if fabs is called
+};
 
-        // Call 2
-        int a2 = -5, b2 = 15;
-        FFI_Argument args2[] = { { .value_ptr = &a2 }, { .value_ptr = &b2 } };
-        bool success2 = invoke_foreign_function(ffi_add_two_ints_reentrant, args2, 2, &g_ffi_return_value);
-        ok(success2, "Reentrancy Call 2 successful");
-        is_int(g_ret_storage.i_val, 10, "Reentrancy Result 2: %d (Expected 10)", g_ret_storage.i_val);
+// NEW: Test binding a shared library lazily from a (symbol, signature) table
+void test_library_lazy_binding() {
+    FFI_Library* lib = ffi_library_open(FFI_TEST_MATH_LIBRARY, g_test_math_bindings, 5, false);
+    if (lib == NULL) {
+        fail("Could not open %s.", FFI_TEST_MATH_LIBRARY);
+        return;
+    }
+    is_int(ffi_library_resolved_count(lib), 0, "Opening the library resolves nothing");
+
+    double x = 0.0, y = 10.0, result = 0.0;
+    int exponent = 3;
+    FFI_Argument ret = { .value_ptr = &result };
+    FFI_Argument cos_args[] = { { .value_ptr = &x } };
+    bool invoked = ffi_library_invoke(lib, ffi_library_index(lib, "cos"), cos_args, 1, &ret);
+    ok((invoked && result == 1.0), "cos(0.0) through the resolver: %f", result);
+    is_int(ffi_library_resolved_count(lib), 1, "The first call resolved exactly one symbol");
+    FFI_FunctionSignature* cos_sig = ffi_library_function(lib, 0);
+    x = 0.0;
+    ffi_library_invoke(lib, 0, cos_args, 1, &ret);
+    ok((ffi_library_function(lib, 0) == cos_sig && ffi_library_resolved_count(lib) == 1), "Later calls reuse the resolved handle");
+
+    x = 2.0;
+    FFI_Argument pow_args[] = { { .value_ptr = &x }, { .value_ptr = &y } };
+    ffi_library_invoke(lib, 1, pow_args, 2, &ret);
+    is_double(result, 1024.0, "pow(2.0, 10.0) = %f", result);
+    x = 1.5;
+    FFI_Argument ldexp_args[] = { { .value_ptr = &x }, { .value_ptr = &exponent } };
+    ffi_library_invoke(lib, 2, ldexp_args, 2, &ret);
+    is_double(result, 12.0, "ldexp(1.5, 3) = %f", result);
+
+    invoked = ffi_library_invoke(lib, 3, NULL, 0, NULL);
+    ok(!invoked, "A missing symbol fails at its first call");
+    invoked = ffi_library_invoke(lib, 4, cos_args, 1, &ret);
+    ok(!invoked, "A malformed signature fails at its first call");
+    is_int(ffi_library_index(lib, "sin"), -1, "Symbols outside the table have no index");
+    is_int(ffi_library_resolved_count(lib), 3, "Three of five entries were resolved");
+    ffi_library_close(lib);
+
+    ok((ffi_library_open(FFI_TEST_MATH_LIBRARY, g_test_math_bindings, 4, true) == NULL), "Binding now reports the missing symbol at open");
+    ok((ffi_library_open("ffi_no_such_library.so", g_test_math_bindings, 1, false) == NULL), "A missing library fails to open");
+}
 
-        // Call 3
-        int a3 = 100, b3 = -200;
-        FFI_Argument args3[] = { { .value_ptr = &a3 }, { .value_ptr = &b3 } };
-        bool success3 = invoke_foreign_function(ffi_add_two_ints_reentrant, args3, 2, &g_ffi_return_value);
-        ok(success3, "Reentrancy Call 3 successful");
-        is_int(g_ret_storage.i_val, -100, "Reentrancy Result 3: %d (Expected -100)", g_ret_storage.i_val);
+/**
+ * @brief Looks up the perf map line starting at `code`; fills its size and symbol name.
+ * @return False if no line has that start address or a line does not parse.
+ */
+static bool test_perf_map_lookup(const char* path, const void* code, unsigned long* size, char* name, size_t name_size) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    char line[512];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file)) {
+        unsigned long start = 0, length = 0;
+        int name_offset = 0;
+        if (sscanf(line, "%lx %lx %n", &start, &length, &name_offset) != 2 || name_offset == 0) {
+            break; // Malformed line
+        }
+        if (start == (unsigned long)(uintptr_t)code) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(name, name_size, "%s", line + name_offset);
+            *size = length;
+            found = true;
+        }
+    }
+    fclose(file);
+    return found;
+}
 
-        destroy_ffi_function(ffi_add_two_ints_reentrant);
-    } else {
-        fail("Failed to create FFI object for reentrancy test.");
+// NEW: Test that generated trampolines are described in /tmp/perf-<pid>.map
+void test_perf_map_entries() {
+#ifdef FFI_OS_LINUX
+    bool enabled = ffi_set_perf_map(true);
+    ok(enabled, "Perf map mode enabled");
+    const char* path = ffi_perf_map_path();
+    char expected_path[64];
+    snprintf(expected_path, sizeof(expected_path), "/tmp/perf-%ld.map", (long)getpid());
+    is_str(path, expected_path, "Entries go to %s", expected_path);
+
+    FFI_FunctionSignature* add = create_ffi_function("perf_add", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_FunctionSignature* average = create_ffi_function_from_signature("perf_average", "d(i...dd)", (GenericFuncPtr)variadic_average);
+    if (add == NULL || average == NULL) {
+        fail("Failed to create the profiled handles.");
+        destroy_ffi_function(add);
+        destroy_ffi_function(average);
+        ffi_set_perf_map(false);
+        return;
+    }
+    ffi_perf_map_flush();
+
+    unsigned long size = 0;
+    char name[256] = "";
+    bool found = test_perf_map_lookup(path, (const void*)add->trampoline_code, &size, name, sizeof(name));
+    ok(found, "The trampoline of perf_add has an entry");
+    ok((size > 0 && size <= add->trampoline_size), "Its size covers the generated code: %lu bytes", size);
+    is_str(name, "ffi:perf_add i(ii)", "Its name combines the debug name and the signature");
+    found = test_perf_map_lookup(path, (const void*)average->trampoline_code, &size, name, sizeof(name));
+    ok((found && strcmp(name, "ffi:perf_average d(i...dd)") == 0), "Variadic call sites keep their \"...\": %s", name);
+
+    // Destroyed code stays reserved, so no new trampoline can reuse an address the map names.
+    void* old_code = (void*)add->trampoline_code;
+    destroy_ffi_function(add);
+    ffi_epoch_synchronize();
+    FFI_FunctionSignature* again = create_ffi_function("perf_add_again", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ok((again != NULL && (void*)again->trampoline_code != old_code), "A destroyed trampoline's address is not recycled");
+    destroy_ffi_function(again);
+    destroy_ffi_function(average);
+
+    bool disabled = ffi_set_perf_map(false);
+    ok(disabled, "Perf map mode disabled");
+    FFI_RuntimeStats stats;
+    ffi_runtime_stats(&stats, NULL);
+    is_int((int)stats.bytes_quarantined, 0, "Disabling releases the quarantined pages");
+    FFI_FunctionSignature* unrecorded = create_ffi_function("perf_unrecorded", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    // The released quarantine lets it reuse an address the map names; no line may name it, though.
+    bool named = false;
+    FILE* map = fopen(path, "r");
+    char line[512];
+    while (map != NULL && !named && fgets(line, sizeof(line), map)) {
+        named = strstr(line, "ffi:perf_unrecorded") != NULL;
     }
+    if (map) fclose(map);
+    ok((unrecorded != NULL && !named), "Trampolines created after disabling are not recorded");
+    destroy_ffi_function(unrecorded);
+    remove(path);
+#else
+    bool enabled = ffi_set_perf_map(true);
+    ok(!enabled, "Perf map files are Linux-only");
+#endif
 }
 
-// NEW: Test for mixed arguments: int, float, pointer
-void test_mixed_args_int_float_ptr() {
-    FFI_FunctionSignature* ffi_mixed_test1 = create_ffi_function(
-        "mixed_int_float_ptr_func", FFI_TYPE_INT, 3, mixed_int_float_ptr_params, (GenericFuncPtr)mixed_int_float_ptr_func, NULL, 0);
-    if (ffi_mixed_test1) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+// NEW: Test the jitdump stream: header, one load record per trampoline with its bytes, close
+void test_jitdump_records() {
+#ifdef FFI_OS_LINUX
+    bool enabled = ffi_set_jitdump(true);
+    ok(enabled, "jitdump mode enabled");
+    FFI_FunctionSignature* add = create_ffi_function("jit_add", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    bool disabled = ffi_set_jitdump(false);
+    ok(disabled, "jitdump mode disabled");
+    const char* path = ffi_jitdump_path();
+    FILE* file = path ? fopen(path, "rb") : NULL;
+    if (add == NULL || file == NULL) {
+        fail("Missing handle or jitdump file '%s'.", path ? path : "(none)");
+        if (file) fclose(file);
+        destroy_ffi_function(add);
+        return;
+    }
 
-        int i_val = 10;
-        float f_val = 5.5f;
-        void* ptr_val = (void*)0x12345678; // Non-NULL pointer
-        FFI_Argument args[] = {
-            { .value_ptr = &i_val },
-            { .value_ptr = &f_val },
-            { .value_ptr = &ptr_val }
-        };
-        bool success = invoke_foreign_function(ffi_mixed_test1, args, 3, &g_ffi_return_value);
-        ok(success, "Mixed args (int,float,ptr) call successful");
-        // Expected: 10 + (int)5.5f + (1 if ptr_val != NULL) = 10 + 5 + 1 = 16
-        is_int(g_ret_storage.i_val, 16, "Mixed args (int,float,ptr) result: %d (Expected 16)", g_ret_storage.i_val);
+    FFI_JitdumpHeader header;
+    bool have_header = fread(&header, sizeof(header), 1, file) == 1;
+    ok((have_header && header.magic == FFI_JITDUMP_MAGIC && header.version == FFI_JITDUMP_VERSION &&
+        header.total_size == sizeof(header) && header.elf_mach == FFI_JITDUMP_ELF_MACH &&
+        header.pid == (uint32_t)getpid()), "The header identifies a version 1 dump of this process");
+
+    // Walk the records: find the load record of jit_add and check the stream ends with CLOSE.
+    int loads = 0;
+    bool found = false, bytes_match = false, timestamps_ordered = true;
+    uint32_t last_id = UINT32_MAX;
+    uint64_t last_timestamp = have_header ? header.timestamp : 0;
+    unsigned char* record = NULL;
+    FFI_JitdumpRecordPrefix prefix;
+    while (fread(&prefix, sizeof(prefix), 1, file) == 1 && prefix.total_size >= sizeof(prefix)) {
+        record = (unsigned char*)realloc(record, prefix.total_size);
+        memcpy(record, &prefix, sizeof(prefix));
+        if (fread(record + sizeof(prefix), 1, prefix.total_size - sizeof(prefix), file) != prefix.total_size - sizeof(prefix)) {
+            break;
+        }
+        timestamps_ordered = timestamps_ordered && prefix.timestamp >= last_timestamp;
+        last_timestamp = prefix.timestamp;
+        last_id = prefix.id;
+        if (prefix.id == FFI_JITDUMP_CODE_LOAD) {
+            FFI_JitdumpCodeLoad load;
+            memcpy(&load, record, sizeof(load));
+            const char* name = (const char*)record + sizeof(load);
+            loads++;
+            if (load.code_addr == (uint64_t)(uintptr_t)add->trampoline_code) {
+                found = strcmp(name, "ffi:jit_add i(ii)") == 0 && load.vma == load.code_addr &&
+                        load.pid == (uint32_t)getpid() && load.code_size > 0 &&
+                        sizeof(load) + strlen(name) + 1 + load.code_size == prefix.total_size;
+                bytes_match = found && memcmp(name + strlen(name) + 1, (const void*)add->trampoline_code, load.code_size) == 0;
+            }
+        }
+    }
+    free(record);
+    fclose(file);
+    ok(found, "A load record names jit_add and covers its trampoline");
+    ok(bytes_match, "The record carries the trampoline's code bytes");
+    is_int(loads, 1, "Exactly one trampoline was generated while recording");
+    ok((last_id == FFI_JITDUMP_CODE_CLOSE && timestamps_ordered), "Records are time-ordered and end with JIT_CODE_CLOSE");
+    destroy_ffi_function(add);
+    remove(path);
+#else
+    bool enabled = ffi_set_jitdump(true);
+    ok(!enabled, "jitdump files are Linux-only");
+#endif
+}
 
-        destroy_ffi_function(ffi_mixed_test1);
-    } else {
-        fail("Failed to create FFI object for mixed_int_float_ptr_func.");
+#ifdef FFI_HAVE_GDB_JIT
+/**
+ * @brief Searches the objects registered with the GDB JIT interface for a symbol, reading them
+ * the way a debugger would.
+ * @param[out] addr The symbol's address, if found.
+ * @param[out] objects The number of registered objects.
+ * @return True if some object defines `name` as a valid ELF function symbol.
+ */
+static bool test_gdb_jit_lookup(const char* name, uintptr_t* addr, int* objects) {
+    bool found = false;
+    *objects = 0;
+    for (const FFI_GdbJitCodeEntry* entry = __jit_debug_descriptor.first_entry; entry; entry = entry->next_entry) {
+        (*objects)++;
+        const char* image = entry->symfile_addr;
+        const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)(const void*)image;
+        if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_type != ET_REL ||
+            ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr) > entry->symfile_size) {
+            return false;
+        }
+        const Elf64_Shdr* shdrs = (const Elf64_Shdr*)(const void*)(image + ehdr->e_shoff);
+        for (int s = 0; s < ehdr->e_shnum; s++) {
+            if (shdrs[s].sh_type != SHT_SYMTAB) {
+                continue;
+            }
+            const Elf64_Sym* syms = (const Elf64_Sym*)(const void*)(image + shdrs[s].sh_offset);
+            const char* strtab = image + shdrs[shdrs[s].sh_link].sh_offset;
+            for (size_t i = 1; i < shdrs[s].sh_size / sizeof(Elf64_Sym); i++) {
+                if (strcmp(strtab + syms[i].st_name, name) == 0 && ELF64_ST_TYPE(syms[i].st_info) == STT_FUNC &&
+                    syms[i].st_shndx < ehdr->e_shnum && shdrs[syms[i].st_shndx].sh_size == syms[i].st_size) {
+                    *addr = (uintptr_t)(shdrs[syms[i].st_shndx].sh_addr + syms[i].st_value);
+                    found = true;
+                }
+            }
+        }
     }
+    return found;
 }
+#endif
 
-// NEW: Test for mixed arguments: double, char, int
-void test_mixed_args_double_char_int() {
-    FFI_FunctionSignature* ffi_mixed_test2 = create_ffi_function(
-        "mixed_double_char_int_func", FFI_TYPE_DOUBLE, 3, mixed_double_char_int_params, (GenericFuncPtr)mixed_double_char_int_func, NULL, 0);
-    if (ffi_mixed_test2) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+// NEW: Test batched registration of trampolines with the GDB JIT interface
+void test_gdb_jit_registration() {
+#ifdef FFI_HAVE_GDB_JIT
+    uintptr_t addr = 0;
+    int base_objects = 0, objects = 0;
+    test_gdb_jit_lookup("", &addr, &base_objects);
+    bool enabled = ffi_set_gdb_jit(true, 3);
+    ok(enabled, "GDB JIT registration enabled with batches of 3");
+
+    FFI_FunctionSignature* first = create_ffi_function("gdb_first", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_FunctionSignature* second = create_ffi_function("gdb_second", FFI_TYPE_INT, 1, identity_int_params, (GenericFuncPtr)int_identity_minimal, NULL, 0);
+    bool early = test_gdb_jit_lookup("ffi:gdb_first i(ii)", &addr, &objects);
+    ok((!early && objects == base_objects), "A partial batch is not registered yet");
+    FFI_FunctionSignature* third = create_ffi_function("gdb_third", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (first == NULL || second == NULL || third == NULL) {
+        fail("Failed to create the registered handles.");
+        destroy_ffi_function(first);
+        destroy_ffi_function(second);
+        destroy_ffi_function(third);
+        ffi_set_gdb_jit(false, 0);
+        return;
+    }
+    bool found = test_gdb_jit_lookup("ffi:gdb_first i(ii)", &addr, &objects);
+    ok((found && addr == (uintptr_t)first->trampoline_code), "The full batch is registered; gdb_first resolves to its trampoline");
+    found = test_gdb_jit_lookup("ffi:gdb_second i(i)", &addr, &objects);
+    ok((found && addr == (uintptr_t)second->trampoline_code && objects == base_objects + 1),
+       "All three trampolines share one object (%d registered)", objects - base_objects);
+
+    const char* image = __jit_debug_descriptor.first_entry->symfile_addr;
+    destroy_ffi_function(second);
+    ffi_epoch_synchronize();
+    ok((__jit_debug_descriptor.first_entry->symfile_addr == image), "Freeing a trampoline leaves its object alone until the next flush");
+    ffi_gdb_jit_flush();
+    found = test_gdb_jit_lookup("ffi:gdb_second i(i)", &addr, &objects);
+    ok(!found, "The flush withdraws the freed trampoline's symbol");
+    found = test_gdb_jit_lookup("ffi:gdb_third i(ii)", &addr, &objects);
+    ok((found && addr == (uintptr_t)third->trampoline_code && objects == base_objects + 1),
+       "Its batch is re-registered with the remaining trampolines");
+
+    FFI_FunctionSignature* fourth = create_ffi_function("gdb_fourth", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ffi_gdb_jit_flush();
+    found = test_gdb_jit_lookup("ffi:gdb_fourth i(ii)", &addr, &objects);
+    ok((fourth != NULL && found && objects == base_objects + 2), "Flushing registers a partial batch as its own object");
+
+    destroy_ffi_function(first);
+    destroy_ffi_function(third);
+    destroy_ffi_function(fourth);
+    ffi_epoch_synchronize();
+    test_gdb_jit_lookup("", &addr, &objects);
+    is_int(objects, base_objects, "Objects are unregistered once all of their trampolines are freed");
+
+    // A queue emptied by frees must not keep its array when the batch grows.
+    ffi_set_gdb_jit(true, 2);
+    destroy_ffi_function(create_ffi_function("gdb_small", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0));
+    ffi_epoch_synchronize();
+    ffi_set_gdb_jit(true, 16);
+    FFI_FunctionSignature* grown[8];
+    for (int i = 0; i < 8; i++) {
+        grown[i] = create_ffi_function("gdb_grown", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    }
+    ffi_gdb_jit_flush();
+    found = test_gdb_jit_lookup("ffi:gdb_grown i(ii)", &addr, &objects);
+    ok((found && objects == base_objects + 1), "Growing the batch after the queue emptied sizes a new queue");
+    for (int i = 0; i < 8; i++) {
+        destroy_ffi_function(grown[i]);
+    }
+    ffi_epoch_synchronize();
+    bool disabled = ffi_set_gdb_jit(false, 0);
+    ok(disabled, "GDB JIT registration disabled");
+#else
+    bool enabled = ffi_set_gdb_jit(true, 0);
+    ok(!enabled, "The GDB JIT interface is Linux-only");
+#endif
+}
 
-        double d_val = 10.5;
-        char c_val = 'A'; // ASCII 65
-        int i_val = 20;
-        FFI_Argument args[] = {
-            { .value_ptr = &d_val },
-            { .value_ptr = &c_val },
-            { .value_ptr = &i_val }
-        };
-        bool success = invoke_foreign_function(ffi_mixed_test2, args, 3, &g_ffi_return_value);
-        ok(success, "Mixed args (double,char,int) call successful");
-        // Expected: 10.5 + 65.0 + 20.0 = 95.5
-        is_double(g_ret_storage.d_val, 95.5, "Mixed args (double,char,int) result: %lf (Expected 95.5)", g_ret_storage.d_val);
+#ifdef FFI_HAVE_UNWIND_INFO
+// Where a backtrace taken inside a foreign call found the trampoline, and how far it got.
+typedef struct {
+    uintptr_t trampoline_lo, trampoline_hi;
+    int frames;
+    int trampoline_frame; // Index of the trampoline's frame, -1 if not seen
+    bool reached_caller;  // Some frame belongs to `caller`
+    void* caller;
+} UnwindProbe;
+
+static UnwindProbe* g_unwind_probe = NULL;
+
+static _Unwind_Reason_Code unwind_probe_step(struct _Unwind_Context* context, void* arg) {
+    UnwindProbe* probe = (UnwindProbe*)arg;
+    uintptr_t ip = (uintptr_t)_Unwind_GetIP(context);
+    if (probe->trampoline_frame < 0 && ip > probe->trampoline_lo && ip <= probe->trampoline_hi) {
+        probe->trampoline_frame = probe->frames;
+    }
+    if (_Unwind_FindEnclosingFunction((void*)(ip - 1)) == probe->caller) {
+        probe->reached_caller = true;
+    }
+    return ++probe->frames < 64 ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
 
-        destroy_ffi_function(ffi_mixed_test2);
-    } else {
-        fail("Failed to create FFI object for mixed_double_char_int_func.");
+/**
+ * @brief Foreign function that records a DWARF backtrace of its callers into g_unwind_probe.
+ */
+__attribute__((noinline)) int unwind_probe_target(int x) {
+    _Unwind_Backtrace(unwind_probe_step, g_unwind_probe);
+    return x + 1;
+}
+
+static FFI_Type unwind_probe_params[] = { FFI_TYPE_INT };
+
+/**
+ * @brief Calls unwind_probe_target() through a new handle and returns what the unwinder saw.
+ * @param[out] code_out The handle's trampoline address (the handle is destroyed on return).
+ */
+static UnwindProbe unwind_probe_through_trampoline(void* caller, const void** code_out) {
+    UnwindProbe probe = { .trampoline_frame = -1, .caller = caller };
+    FFI_FunctionSignature* sig = create_ffi_function("unwind_probe_target", FFI_TYPE_INT, 1, unwind_probe_params,
+                                                     (GenericFuncPtr)unwind_probe_target, NULL, 0);
+    if (sig == NULL) {
+        return probe;
+    }
+    probe.trampoline_lo = (uintptr_t)sig->trampoline_code;
+    probe.trampoline_hi = probe.trampoline_lo + sig->trampoline_size;
+    int x = 41;
+    FFI_Argument args[] = { { .value_ptr = &x } };
+    g_unwind_probe = &probe;
+    invoke_foreign_function(sig, args, 1, &g_ffi_return_value);
+    g_unwind_probe = NULL;
+    *code_out = (const void*)sig->trampoline_code;
+    destroy_ffi_function(sig);
+    if (ffi_log_enabled(FFI_LOG_LEVEL_INFO)) {
+        ffi_log_info("Unwind probe: %d frames, trampoline at frame %d.", probe.frames, probe.trampoline_frame);
     }
+    return probe;
 }
+#endif
 
-// NEW: Reentrancy test with stack spilling for GPR arguments
-void test_reentrancy_sum_eight_ints() {
-    FFI_FunctionSignature* ffi_sum_eight_ints_reentrant = create_ffi_function(
-        "sum_eight_ints_reentrant", FFI_TYPE_INT, 8, sum_eight_ints_params, (GenericFuncPtr)sum_eight_ints, NULL, 0);
-    if (ffi_sum_eight_ints_reentrant) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+// NEW: Test that registered unwind info lets DWARF unwinders walk through trampolines
+void test_unwind_info_backtrace() {
+#ifdef FFI_HAVE_UNWIND_INFO
+    const void* code = NULL;
+    UnwindProbe plain = unwind_probe_through_trampoline((void*)test_unwind_info_backtrace, &code);
+    ok((plain.trampoline_frame >= 0 && plain.frames == plain.trampoline_frame + 1 && !plain.reached_caller),
+       "Without unwind info the backtrace ends at the trampoline (frame %d of %d)", plain.trampoline_frame, plain.frames);
+
+    bool enabled = ffi_set_unwind_info(true);
+    ok(enabled, "Unwind info enabled");
+    FFI_FunctionSignature* sig = create_ffi_function("unwind_add", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (sig == NULL) {
+        fail("Failed to create unwind_add.");
+        ffi_set_unwind_info(false);
+        return;
+    }
+    const void* add_code = (const void*)sig->trampoline_code;
+    ok((_Unwind_FindEnclosingFunction((char*)(uintptr_t)add_code + 10) == add_code),
+       "The unwinder finds an FDE covering the trampoline");
+
+    UnwindProbe described = unwind_probe_through_trampoline((void*)test_unwind_info_backtrace, &code);
+    ok((described.trampoline_frame >= 0 && described.frames > described.trampoline_frame + 1),
+       "With unwind info the backtrace continues past the trampoline (%d frames)", described.frames);
+    ok(described.reached_caller, "It reaches the test function that made the foreign call");
+
+    destroy_ffi_function(sig);
+    ffi_epoch_synchronize();
+    ok((_Unwind_FindEnclosingFunction((char*)(uintptr_t)add_code + 10) == NULL),
+       "Freeing the trampoline deregisters its FDE");
+    bool disabled = ffi_set_unwind_info(false);
+    ok(disabled, "Unwind info disabled");
+#else
+    bool enabled = ffi_set_unwind_info(true);
+    ok(!enabled, "Trampoline unwind info needs x86-64 Linux with libgcc");
+#endif
+}
 
-        // Call 1: All args sum to 36
-        int v1_1=1, v1_2=2, v1_3=3, v1_4=4, v1_5=5, v1_6=6, v1_7=7, v1_8=8;
-        FFI_Argument args1[] = {
-            { .value_ptr = &v1_1 }, { .value_ptr = &v1_2 }, { .value_ptr = &v1_3 },
-            { .value_ptr = &v1_4 }, { .value_ptr = &v1_5 }, { .value_ptr = &v1_6 },
-            { .value_ptr = &v1_7 }, { .value_ptr = &v1_8 }
-        };
-        bool success1 = invoke_foreign_function(ffi_sum_eight_ints_reentrant, args1, 8, &g_ffi_return_value);
-        ok(success1, "Reentrancy sum_eight_ints Call 1 successful");
-        is_int(g_ret_storage.i_val, 36, "Reentrancy sum_eight_ints Result 1: %d (Expected 36)", g_ret_storage.i_val);
+// NEW: Test per-handle call counters and latency histograms emitted into trampolines
+typedef struct {
+    FFI_FunctionSignature* sig;
+    int calls;
+} InstrumentedCaller;
+
+FFI_THREAD_FUNC(instrumented_caller_main, arg) {
+    InstrumentedCaller* caller = (InstrumentedCaller*)arg;
+    int a = 1, b = 2;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    GenericReturnValue ret;
+    for (int i = 0; i < caller->calls; ++i) {
+        caller->sig->trampoline_code(args, 2, &ret);
+    }
+    return FFI_THREAD_RETURN;
+}
 
-        // Call 2: All args sum to 0
-        int v2_1=0, v2_2=0, v2_3=0, v2_4=0, v2_5=0, v2_6=0, v2_7=0, v2_8=0;
-        FFI_Argument args2[] = {
-            { .value_ptr = &v2_1 }, { .value_ptr = &v2_2 }, { .value_ptr = &v2_3 },
-            { .value_ptr = &v2_4 }, { .value_ptr = &v2_5 }, { .value_ptr = &v2_6 },
-            { .value_ptr = &v2_7 }, { .value_ptr = &v2_8 }
-        };
-        bool success2 = invoke_foreign_function(ffi_sum_eight_ints_reentrant, args2, 8, &g_ffi_return_value);
-        ok(success2, "Reentrancy sum_eight_ints Call 2 successful");
-        is_int(g_ret_storage.i_val, 0, "Reentrancy sum_eight_ints Result 2: %d (Expected 0)", g_ret_storage.i_val);
+void test_call_instrumentation() {
+    int a = 40, b = 2;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    FFI_FunctionSignature* plain = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                       (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_COUNT);
+    FFI_FunctionSignature* counted = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_TIME);
+    FFI_FunctionSignature* timed = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                       (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_OFF);
+    if (plain == NULL || counted == NULL || timed == NULL) {
+        fail("Failed to create instrumented handles.");
+        destroy_ffi_function(plain);
+        destroy_ffi_function(counted);
+        destroy_ffi_function(timed);
+        return;
+    }
+    ok((plain->call_stats == NULL && ffi_call_count(plain) == -1), "Handles created with instrumentation off carry no counters");
 
-        // Call 3: Mixed positive/negative, sum to 100
-        int v3_1=10, v3_2=20, v3_3=30, v3_4=40, v3_5=50, v3_6=-10, v3_7=-20, v3_8=-30;
-        FFI_Argument args3[] = {
-            { .value_ptr = &v3_1 }, { .value_ptr = &v3_2 }, { .value_ptr = &v3_3 },
-            { .value_ptr = &v3_4 }, { .value_ptr = &v3_5 }, { .value_ptr = &v3_6 },
-            { .value_ptr = &v3_7 }, { .value_ptr = &v3_8 }
-        };
-        bool success3 = invoke_foreign_function(ffi_sum_eight_ints_reentrant, args3, 8, &g_ffi_return_value);
-        ok(success3, "Reentrancy sum_eight_ints Call 3 successful");
-        is_int(g_ret_storage.i_val, 90, "Reentrancy sum_eight_ints Result 3: %d (Expected 90)", g_ret_storage.i_val); // 10+20+30+40+50-10-20-30 = 90
+#if defined(FFI_ARCH_X64) && !defined(FFI_OS_WIN64)
+    int sum = 0;
+    for (int i = 0; i < 10; ++i) {
+        invoke_foreign_function(counted, args, 2, &g_ffi_return_value);
+        sum += *(int*)g_ffi_return_value.value_ptr;
+    }
+    is_int(sum, 420, "Counted calls still return the right results");
+    is_int((int)ffi_call_count(counted), 10, "The counter sees every call");
+    FFI_CallHistogram histogram;
+    ok(!ffi_call_histogram_snapshot(counted, &histogram), "Count-only handles keep no histogram");
+
+    InstrumentedCaller caller = { timed, 5000 };
+    ffi_thread_t thread;
+    bool started = ffi_thread_start(&thread, instrumented_caller_main, &caller);
+    for (int i = 0; i < 3000; ++i) {
+        invoke_foreign_function(timed, args, 2, &g_ffi_return_value);
+    }
+    if (started) {
+        ffi_thread_join(thread);
+    }
+    is_int(*(int*)g_ffi_return_value.value_ptr, 42, "Timed calls still return the right result");
+    int expected = 3000 + (started ? caller.calls : 0);
+    is_int((int)ffi_call_count(timed), expected, "The timed handle counts calls from both threads");
+    ok(ffi_call_histogram_snapshot(timed, &histogram), "Timed handles can be snapshotted");
+    is_int((int)histogram.count, expected, "The merged histogram holds one sample per call");
+    uint64_t p50 = ffi_call_histogram_percentile(&histogram, 50.0);
+    uint64_t p99 = ffi_call_histogram_percentile(&histogram, 99.0);
+    ok(((uint64_t)histogram.min_ticks <= p50 && p50 <= p99 && p99 <= (uint64_t)histogram.max_ticks),
+       "Percentiles are ordered: min %lld <= p50 %llu <= p99 %llu <= max %lld ticks", (long long)histogram.min_ticks,
+       (unsigned long long)p50, (unsigned long long)p99, (long long)histogram.max_ticks);
+
+    FFI_CallHistogram doubled = histogram;
+    ffi_call_histogram_merge(&doubled, &histogram);
+    ok((doubled.count == 2 * histogram.count && ffi_call_histogram_percentile(&doubled, 50.0) == p50),
+       "Merging a histogram with itself doubles the counts and keeps the percentiles");
+
+    // Some hypervisors hide RDTSCP; timed trampolines then fence and read the TSC with RDTSC.
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_TIME);
+    uint32_t had_rdtscp = FFI_ATOMIC_XCHG_U32(&g_ffi_instr_rdtscp, 0u);
+    FFI_FunctionSignature* fenced = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                        (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_ATOMIC_XCHG_U32(&g_ffi_instr_rdtscp, had_rdtscp);
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_OFF);
+    sum = 0;
+    for (int i = 0; fenced != NULL && i < 10; ++i) {
+        invoke_foreign_function(fenced, args, 2, &g_ffi_return_value);
+        sum += *(int*)g_ffi_return_value.value_ptr;
+    }
+    ok((fenced != NULL && sum == 420 && ffi_call_histogram_snapshot(fenced, &histogram) && histogram.count == 10),
+       "Without RDTSCP, LFENCE; RDTSC timing still records every call");
+    destroy_ffi_function(fenced);
+
+    int out_of_bucket = 0;
+    for (uint64_t v = 1; v < (1u << 20); v = v * 3 + 1) {
+        int bucket = ffi_hist_bucket(v);
+        if (v < ffi_hist_bucket_lower(bucket) || v >= ffi_hist_bucket_lower(bucket + 1)) out_of_bucket++;
+    }
+    is_int(out_of_bucket, 0, "Every value falls inside its bucket's bounds");
+#else
+    invoke_foreign_function(counted, args, 2, &g_ffi_return_value);
+    is_int((int)ffi_call_count(counted), -1, "Trampolines of this ABI carry no counters");
+#endif
+#ifdef FFI_HAVE_MS_ABI_TARGETS
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_COUNT);
+    FFI_FunctionSignature* win64 = create_ffi_function_abi("ms_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                           (GenericFuncPtr)ms_add_two_ints, FFI_ABI_WIN64);
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_OFF);
+    ok((win64 != NULL && ffi_call_count(win64) == -1), "Win64-convention handles report no count rather than 0");
+    destroy_ffi_function(win64);
+#endif
+    destroy_ffi_function(plain);
+    destroy_ffi_function(counted);
+    destroy_ffi_function(timed);
+    ffi_epoch_synchronize();
+}
 
-        destroy_ffi_function(ffi_sum_eight_ints_reentrant);
+// NEW: Test the runtime statistics snapshot and its JSON form
+void test_runtime_stats() {
+    FFI_RuntimeStats before, after, freed;
+    ffi_epoch_synchronize();
+    ffi_runtime_stats(&before, NULL);
+    ok((before.handles_live >= 0 && before.bytes_reserved >= before.code_bytes_live &&
+        before.fragmentation >= 0.0 && before.fragmentation <= 1.0),
+       "A baseline snapshot is self-consistent (%lld live handles, %lld bytes reserved)",
+       (long long)before.handles_live, (long long)before.bytes_reserved);
+
+    FFI_FunctionSignature* handles[3];
+    int64_t code_bytes = 0;
+    for (int i = 0; i < 3; ++i) {
+        handles[i] = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+        code_bytes += handles[i] ? handles[i]->code_size : 0;
+    }
+    ffi_set_lazy_binding(true);
+    FFI_FunctionSignature* lazy = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                      (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ffi_set_lazy_binding(false);
+    FFI_Library* lib = ffi_library_open(FFI_TEST_MATH_LIBRARY, g_test_math_bindings, 5, false);
+    if (lib != NULL) {
+        ffi_library_function(lib, 0);
+    }
+    ffi_runtime_stats(&after, &before);
+
+    is_int((int)(after.handles_created - before.handles_created), 5, "Three eager, one lazy and one library handle were created");
+    is_int((int)(after.handles_live - before.handles_live), 5, "All five are live");
+    is_int((int)(after.trampolines_live - before.trampolines_live), 4, "Three eager trampolines and one library binding are mapped");
+    ok((code_bytes > 0 && after.code_bytes_emitted - before.code_bytes_emitted >= code_bytes &&
+        after.code_bytes_live - before.code_bytes_live >= code_bytes),
+       "Emitted and live code grow by at least the eager handles' %lld bytes", (long long)code_bytes);
+    ok((after.bytes_reserved - before.bytes_reserved >= 4 * 4096 && after.fragmentation > 0.5),
+       "Each trampoline reserves at least a page, so most of the heap is slack (fragmentation %.3f)", after.fragmentation);
+    ok((after.icache_flushes - before.icache_flushes >= 4), "Every generated trampoline flushed the icache");
+    ok((after.abi_trampolines[FFI_ABI_DEFAULT] - before.abi_trampolines[FFI_ABI_DEFAULT] == 4 &&
+        after.abi_average_size[FFI_ABI_DEFAULT] > 0.0),
+       "Trampolines are counted under their ABI (average %.1f bytes)", after.abi_average_size[FFI_ABI_DEFAULT]);
+    ok((after.creations_per_second > 0.0 && after.interval_seconds > 0.0),
+       "Creation rate over the interval: %.0f/s", after.creations_per_second);
+    if (lib != NULL) {
+        ok((after.libraries_open - before.libraries_open == 1 && after.library_bindings - before.library_bindings == 5 &&
+            after.library_resolved - before.library_resolved == 1),
+           "The binding registry counts the open library, its entries and the resolved one");
     } else {
-        fail("Failed to create FFI object for reentrancy sum_eight_ints test.");
+        skip("Test math library unavailable.");
     }
-}
 
-// NEW: Reentrancy test with stack spilling for XMM arguments
-void test_reentrancy_sum_nine_doubles() {
-    FFI_FunctionSignature* ffi_sum_nine_doubles_reentrant = create_ffi_function(
-        "sum_nine_doubles_reentrant", FFI_TYPE_DOUBLE, 9, sum_nine_doubles_params, (GenericFuncPtr)sum_nine_doubles, NULL, 0);
-    if (ffi_sum_nine_doubles_reentrant) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+    char json[2048];
+    int len = ffi_runtime_stats_json(&after, json, sizeof(json));
+    ok((len > 0 && (size_t)len < sizeof(json) && json[0] == '{' && strstr(json, "\"code_heap\"") != NULL &&
+        strstr(json, "\"sysv\": {\"count\"") != NULL && strstr(json, "\"libraries_open\"") != NULL),
+       "The snapshot formats as JSON (%d bytes)", len);
+    int depth = 0, unbalanced = 0;
+    for (int i = 0; i < len; ++i) {
+        depth += (json[i] == '{') - (json[i] == '}');
+        if (depth < 0) unbalanced++;
+    }
+    ok((depth == 0 && unbalanced == 0), "Its braces balance");
+    char small[16];
+    is_int(ffi_runtime_stats_json(&after, small, sizeof(small)), len, "A short buffer reports the full length");
 
-        // Call 1
-        double d1=1.0, d2=2.0, d3=3.0, d4=4.0, d5=5.0, d6=6.0, d7=7.0, d8=8.0, d9=9.0;
-        FFI_Argument args1[] = {
-            { .value_ptr = &d1 }, { .value_ptr = &d2 }, { .value_ptr = &d3 },
-            { .value_ptr = &d4 }, { .value_ptr = &d5 }, { .value_ptr = &d6 },
-            { .value_ptr = &d7 }, { .value_ptr = &d8 }, { .value_ptr = &d9 }
-        };
-        bool success1 = invoke_foreign_function(ffi_sum_nine_doubles_reentrant, args1, 9, &g_ffi_return_value);
-        ok(success1, "Reentrancy Call 1 (9 doubles) successful");
-        is_double(g_ret_storage.d_val, 45.0, "Reentrancy Result 1 (9 doubles): %lf (Expected 45.0)", g_ret_storage.d_val);
+    for (int i = 0; i < 3; ++i) {
+        destroy_ffi_function(handles[i]);
+    }
+    destroy_ffi_function(lazy);
+    ffi_library_close(lib);
+    ffi_epoch_synchronize();
+    ffi_runtime_stats(&freed, &after);
+    ok((freed.handles_live == before.handles_live && freed.trampolines_live == before.trampolines_live &&
+        freed.code_bytes_live == before.code_bytes_live && freed.bytes_reserved == before.bytes_reserved &&
+        freed.libraries_open == before.libraries_open && freed.handles_pending_free == 0),
+       "Destroying everything returns the live counters to the baseline");
+    ok((freed.destructions_per_second > 0.0), "Destruction rate over the interval: %.0f/s", freed.destructions_per_second);
+}
 
-        // Call 2
-        double e1=10.0, e2=20.0, e3=30.0, e4=40.0, e5=50.0, e6=60.0, e7=70.0, e8=80.0, e9=90.0;
-        FFI_Argument args2[] = {
-            { .value_ptr = &e1 }, { .value_ptr = &e2 }, { .value_ptr = &e3 },
-            { .value_ptr = &e4 }, { .value_ptr = &e5 }, { .value_ptr = &e6 },
-            { .value_ptr = &e7 }, { .value_ptr = &e8 }, { .value_ptr = &e9 }
-        };
-        bool success2 = invoke_foreign_function(ffi_sum_nine_doubles_reentrant, args2, 9, &g_ffi_return_value);
-        ok(success2, "Reentrancy Call 2 (9 doubles) successful");
-        is_double(g_ret_storage.d_val, 450.0, "Reentrancy Result 2 (9 doubles): %lf (Expected 450.0)", g_ret_storage.d_val);
+// NEW: Test the trampoline disassembler on known encodings and on generated code
+typedef struct {
+    unsigned char bytes[12];
+    size_t length;
+    const char* text;
+} DisasmCase;
+
+void test_trampoline_disassembler() {
+    static const DisasmCase x86_cases[] = {
+        { { 0xF3, 0x0F, 0x1E, 0xFA }, 4, "endbr64" },
+        { { 0x0F, 0xAE, 0xE8 }, 3, "lfence" },
+        { { 0x41, 0x54 }, 2, "push r12" },
+        { { 0x5D }, 1, "pop rbp" },
+        { { 0x48, 0x81, 0xEC, 0x10, 0x01, 0x00, 0x00 }, 7, "sub rsp, 0x110" },
+        { { 0x48, 0x83, 0xC4, 0x20 }, 4, "add rsp, 0x20" },
+        { { 0x4D, 0x8B, 0x55, 0x08 }, 4, "mov r10, qword [r13+0x8]" },
+        { { 0x4C, 0x89, 0x5C, 0x24, 0x28 }, 5, "mov qword [rsp+0x28], r11" },
+        { { 0x4D, 0x0F, 0xBF, 0x1A }, 4, "movsx r11, word [r10]" },
+        { { 0x49, 0x0F, 0xB6, 0x3A }, 4, "movzx rdi, byte [r10]" },
+        { { 0x49, 0x63, 0x0A }, 3, "movsxd rcx, dword [r10]" },
+        { { 0xF3, 0x41, 0x0F, 0x10, 0x1A }, 5, "movss xmm3, dword [r10]" },
+        { { 0xF2, 0x41, 0x0F, 0x11, 0x04, 0x24 }, 6, "movsd qword [r12], xmm0" },
+        { { 0x66, 0x48, 0x0F, 0x6E, 0xC0 }, 5, "movq xmm0, rax" },
+        { { 0x49, 0xBB, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11 }, 10, "movabs r11, 0x1122334455667788" },
+        { { 0x41, 0xFF, 0xD3 }, 3, "call r11" },
+        { { 0xF0, 0x49, 0xFF, 0x03 }, 4, "lock inc qword [r11]" },
+        { { 0x41, 0xDB, 0x3C, 0x24 }, 4, "fstp tword [r12]" },
+        { { 0x66, 0x49, 0x0F, 0xB7, 0x32 }, 5, "data16 movzx rsi, word [r10]" },
+        { { 0xC3 }, 1, "ret" },
+    };
+    static const struct { uint32_t word; const char* text; } arm64_cases[] = {
+        { 0xA9BF7BFD, "stp x29, x30, [sp, #-16]!" },
+        { 0xA8C17BFD, "ldp x29, x30, [sp], #16" },
+        { 0x910003FD, "mov x29, sp" },
+        { 0xD10043FF, "sub sp, sp, #16" },
+        { 0xAA0003F3, "mov x19, x0" },
+        { 0xF9400508, "ldr x8, [x8, #8]" },
+        { 0xF9000BE9, "str x9, [sp, #16]" },
+        { 0x39800100, "ldrsb x0, [x8]" },
+        { 0xFD400100, "ldr d0, [x8]" },
+        { 0xF85F83A0, "ldur x0, [x29, #-8]" },
+        { 0xD2824690, "movz x16, #0x1234" },
+        { 0xF2A00210, "movk x16, #0x10, lsl #16" },
+        { 0xD63F0200, "blr x16" },
+        { 0xD65F03C0, "ret" },
+    };
+    char text[96];
+    int x86_mismatches = 0, arm64_mismatches = 0;
+    for (size_t i = 0; i < sizeof(x86_cases) / sizeof(x86_cases[0]); ++i) {
+        size_t length = ffi_disasm_x86_64(x86_cases[i].bytes, x86_cases[i].length, text, sizeof(text));
+        if (length != x86_cases[i].length || strcmp(text, x86_cases[i].text) != 0) {
+            diag("x86-64 case %zu: got '%s' (%zu bytes), expected '%s'", i, length ? text : "", length, x86_cases[i].text);
+            x86_mismatches++;
+        }
+    }
+    for (size_t i = 0; i < sizeof(arm64_cases) / sizeof(arm64_cases[0]); ++i) {
+        if (!ffi_disasm_arm64(arm64_cases[i].word, text, sizeof(text)) || strcmp(text, arm64_cases[i].text) != 0) {
+            diag("AArch64 case %08x: got '%s', expected '%s'", arm64_cases[i].word, text, arm64_cases[i].text);
+            arm64_mismatches++;
+        }
+    }
+    is_int(x86_mismatches, 0, "x86-64 encodings decode as expected");
+    is_int(arm64_mismatches, 0, "AArch64 encodings decode as expected");
+    ok((ffi_disasm_x86_64((const unsigned char*)"\x49\xBB\x01", 3, text, sizeof(text)) == 0), "A truncated instruction is rejected");
+    ok(!ffi_disasm_arm64(0xBC200000, text, sizeof(text)), "An AArch64 word outside the subset prints as %s", text);
+
+    FFI_FunctionSignature* add = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                     (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FILE* listing = tmpfile();
+    if (add == NULL || listing == NULL) {
+        fail("Failed to create the handle or the listing file.");
+        destroy_ffi_function(add);
+        if (listing) fclose(listing);
+        return;
+    }
+    FFI_DisasmSummary summary = ffi_dump_trampoline(add, listing);
+    char dump[4096];
+    rewind(listing);
+    size_t dump_len = fread(dump, 1, sizeof(dump) - 1, listing);
+    dump[dump_len] = '\0';
+    fclose(listing);
+    ok((summary.bytes == (size_t)add->code_size && summary.instructions > 0 && summary.unknown == 0),
+       "The dump covers all %zu bytes in %d instructions", summary.bytes, summary.instructions);
+#ifdef FFI_ARCH_X64
+    ok((strstr(dump, "endbr64") != NULL && strstr(dump, "ret") != NULL && strstr(dump, "instructions,") != NULL),
+       "It lists mnemonics and ends with the counts");
+#else
+    ok((strstr(dump, "ret") != NULL && strstr(dump, "instructions,") != NULL), "It lists mnemonics and ends with the counts");
+#endif
+    destroy_ffi_function(add);
 
-        destroy_ffi_function(ffi_sum_nine_doubles_reentrant);
+#ifdef FFI_ARCH_X64
+    // Every shape the x86-64 generators produce should decode without unknown bytes.
+    static const char* const signatures[] = { "v()", "i(ii)", "d(fdfdfdfdfd)", "c(csCSiIlLaB)", "f(iiiiiiiii)", "d(i...dd)",
+                                              "p(pppppppppp)", "g(gKkeEx)", "x(xixxx)", "K(KKKKKKKK)", "e(eeeeeeeeeeee)" };
+    FFI_FunctionSignature* handles[16];
+    int count = 0;
+    for (size_t i = 0; i < sizeof(signatures) / sizeof(signatures[0]); ++i) {
+        handles[count++] = create_ffi_function_from_signature(signatures[i], signatures[i], (GenericFuncPtr)quiet_add_two_ints);
+    }
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_TIME);
+    handles[count++] = create_ffi_function_from_signature("timed", "f(iiiiiiiii)", (GenericFuncPtr)quiet_add_two_ints);
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_OFF);
+#ifdef FFI_HAVE_MS_ABI_TARGETS
+    handles[count++] = create_ffi_function_abi("ms_mixed_positional", FFI_TYPE_DOUBLE, 7, ms_mixed_positional_params,
+                                               (GenericFuncPtr)ms_mixed_positional, FFI_ABI_WIN64);
+    handles[count++] = create_ffi_function_abi("ms_int128_sub", FFI_TYPE_INT128, 5, ms_int128_sub_params,
+                                               (GenericFuncPtr)quiet_add_two_ints, FFI_ABI_WIN64);
+#endif
+    int unknown = 0, undecoded = 0, instructions = 0;
+    for (int i = 0; i < count; ++i) {
+        if (handles[i] == NULL) {
+            undecoded++;
+            continue;
+        }
+        FFI_DisasmSummary s = ffi_disassemble((const void*)handles[i]->trampoline_code, (size_t)handles[i]->code_size, NULL);
+        unknown += s.unknown;
+        instructions += s.instructions;
+        if (s.bytes != (size_t)handles[i]->code_size) undecoded++;
+        destroy_ffi_function(handles[i]);
+    }
+    ok((unknown == 0 && undecoded == 0),
+       "%d generated trampolines decode fully (%d instructions, %d unknown bytes)", count, instructions, unknown);
+#endif
+
+    ffi_set_lazy_binding(true);
+    FFI_FunctionSignature* lazy = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                      (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    ffi_set_lazy_binding(false);
+    listing = tmpfile();
+    if (lazy != NULL && listing != NULL) {
+        summary = ffi_dump_trampoline(lazy, listing);
+        ok((summary.instructions == 0 && summary.bytes == 0), "A handle without generated code dumps nothing");
     } else {
-        fail("Failed to create FFI object for reentrancy test (9 doubles).");
+        fail("Failed to create the lazy handle or the listing file.");
     }
+    if (listing) fclose(listing);
+    destroy_ffi_function(lazy);
+    ffi_epoch_synchronize();
 }
 
-// NEW: Test for mixed GPR and XMM arguments with stack spilling
-void test_mixed_gpr_xmm_stack_spill() {
-    FFI_FunctionSignature* ffi_mixed_spill_test = create_ffi_function(
-        "mixed_gpr_xmm_stack_spill_func", FFI_TYPE_INT, 16, mixed_gpr_xmm_stack_spill_params, (GenericFuncPtr)mixed_gpr_xmm_stack_spill_func, NULL, 0);
-    if (ffi_mixed_spill_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-
-        int i1=1, i2=2, i3=3, i4=4, i5=5, i6=6;
-        float f1=1.0f, f2=2.0f, f3=3.0f, f4=4.0f, f5=5.0f, f6=6.0f, f7=7.0f, f8=8.0f;
-        int i7=7; // This will spill
-        double d9=9.0; // This will spill
+#if defined(FFI_HAVE_USDT) && defined(__linux__)
+// The note's base field is the link-time address of this symbol; comparing it with the runtime
+// address gives the load bias a tracer applies to each probe location.
+extern const char g_ffi_sdt_base __asm__("_.stapsdt.base");
 
-        FFI_Argument args[] = {
-            { .value_ptr = &i1 }, { .value_ptr = &i2 }, { .value_ptr = &i3 }, { .value_ptr = &i4 }, { .value_ptr = &i5 }, { .value_ptr = &i6 },
-            { .value_ptr = &f1 }, { .value_ptr = &f2 }, { .value_ptr = &f3 }, { .value_ptr = &f4 }, { .value_ptr = &f5 }, { .value_ptr = &f6 }, { .value_ptr = &f7 }, { .value_ptr = &f8 },
-            { .value_ptr = &i7 },
-            { .value_ptr = &d9 }
-        };
+typedef struct {
+    const char* name;
+    int expected_args;
+    int sites;
+    int nop_sites;
+    int arg_mismatches;
+} UsdtProbeCheck;
+
+// Walks the `.note.stapsdt` section of our own executable, counting sites per probe and
+// checking that each one is a nop in the loaded image.
+static bool usdt_scan_notes(UsdtProbeCheck* checks, int num_checks) {
+    FILE* file = fopen("/proc/self/exe", "rb");
+    if (file == NULL) {
+        return false;
+    }
+    bool found = false;
+    Elf64_Ehdr ehdr;
+    Elf64_Shdr* shdrs = NULL;
+    char* names = NULL;
+    unsigned char* notes = NULL;
+    if (fread(&ehdr, sizeof(ehdr), 1, file) != 1 || ehdr.e_shentsize != sizeof(Elf64_Shdr)) {
+        goto out;
+    }
+    shdrs = (Elf64_Shdr*)calloc(ehdr.e_shnum, sizeof(Elf64_Shdr));
+    if (shdrs == NULL || fseek(file, (long)ehdr.e_shoff, SEEK_SET) != 0 ||
+        fread(shdrs, sizeof(Elf64_Shdr), ehdr.e_shnum, file) != ehdr.e_shnum) {
+        goto out;
+    }
+    const Elf64_Shdr* strtab = &shdrs[ehdr.e_shstrndx];
+    names = (char*)malloc(strtab->sh_size + 1);
+    if (names == NULL || fseek(file, (long)strtab->sh_offset, SEEK_SET) != 0 ||
+        fread(names, 1, strtab->sh_size, file) != strtab->sh_size) {
+        goto out;
+    }
+    names[strtab->sh_size] = '\0';
+    for (int s = 0; s < ehdr.e_shnum; ++s) {
+        if (shdrs[s].sh_name >= strtab->sh_size || strcmp(names + shdrs[s].sh_name, ".note.stapsdt") != 0) {
+            continue;
+        }
+        notes = (unsigned char*)malloc(shdrs[s].sh_size);
+        if (notes == NULL || fseek(file, (long)shdrs[s].sh_offset, SEEK_SET) != 0 ||
+            fread(notes, 1, shdrs[s].sh_size, file) != shdrs[s].sh_size) {
+            goto out;
+        }
+        found = true;
+        size_t pos = 0;
+        while (pos + sizeof(Elf64_Nhdr) <= shdrs[s].sh_size) {
+            Elf64_Nhdr nhdr;
+            memcpy(&nhdr, notes + pos, sizeof(nhdr));
+            const unsigned char* desc = notes + pos + sizeof(nhdr) + ((nhdr.n_namesz + 3) & ~3u);
+            pos += sizeof(nhdr) + ((nhdr.n_namesz + 3) & ~3u) + ((nhdr.n_descsz + 3) & ~3u);
+            if (nhdr.n_type != 3 || nhdr.n_descsz < 3 * sizeof(uint64_t) + 3) {
+                continue;
+            }
+            uint64_t pc, base;
+            memcpy(&pc, desc, sizeof(pc));
+            memcpy(&base, desc + 8, sizeof(base));
+            const char* provider = (const char*)desc + 24;
+            const char* probe = provider + strlen(provider) + 1;
+            const char* args = probe + strlen(probe) + 1;
+            if (strcmp(provider, "ffi") != 0) {
+                continue;
+            }
+            int arg_count = 0;
+            for (const char* c = args; *c; ++c) {
+                arg_count += (*c == '@');
+            }
+            const unsigned char* site = (const unsigned char*)(uintptr_t)(pc + ((uintptr_t)&g_ffi_sdt_base - base));
+#if defined(FFI_ARCH_X64)
+            bool is_nop = site[0] == 0x90;
+#else
+            uint32_t word;
+            memcpy(&word, site, sizeof(word));
+            bool is_nop = word == 0xD503201F;
+#endif
+            for (int c = 0; c < num_checks; ++c) {
+                if (strcmp(probe, checks[c].name) == 0) {
+                    checks[c].sites++;
+                    checks[c].nop_sites += is_nop;
+                    checks[c].arg_mismatches += (arg_count != checks[c].expected_args);
+                }
+            }
+        }
+        break;
+    }
+out:
+    free(notes);
+    free(names);
+    free(shdrs);
+    fclose(file);
+    return found;
+}
+#endif
 
-        bool success = invoke_foreign_function(ffi_mixed_spill_test, args, 16, &g_ffi_return_value);
-        ok(success, "Mixed GPR/XMM stack spill call successful");
+// NEW: Test that the USDT probes are present in the ELF notes, sit on nops, and that handles get distinct ids
+void test_usdt_probes() {
+#if defined(FFI_HAVE_USDT) && defined(__linux__)
+    FFI_FunctionSignature* first = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                       (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_FunctionSignature* second = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                        (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (first == NULL || second == NULL) {
+        fail("Failed to create FFI objects for the USDT probe test.");
+        destroy_ffi_function(first);
+        destroy_ffi_function(second);
+        return;
+    }
+    ok((first->id > 0 && second->id > first->id), "Handles get increasing ids (%lld, %lld)",
+       (long long)first->id, (long long)second->id);
+
+    UsdtProbeCheck checks[] = {
+        { "trampoline_create", 4, 0, 0, 0 },
+        { "invoke_entry", 2, 0, 0, 0 },
+        { "invoke_exit", 2, 0, 0, 0 },
+        { "trampoline_destroy", 3, 0, 0, 0 },
+    };
+    int num_checks = (int)(sizeof(checks) / sizeof(checks[0]));
+    ok(usdt_scan_notes(checks, num_checks), "The executable has a .note.stapsdt section");
+    for (int c = 0; c < num_checks; ++c) {
+        ok((checks[c].sites > 0 && checks[c].nop_sites == checks[c].sites && checks[c].arg_mismatches == 0),
+           "ffi:%s has %d site(s), all nops, each with %d arguments", checks[c].name, checks[c].sites,
+           checks[c].expected_args);
+    }
 
-        // Expected sum:
-        // GPRs: 1+2+3+4+5+6 = 21
-        // XMMs (as ints): 1+2+3+4+5+6+7+8 = 36
-        // Stack: 7 + 9 = 16
-        // Total: 21 + 36 + 16 = 73
-        is_int(g_ret_storage.i_val, 73, "Mixed GPR/XMM with stack spill result: %d (Expected 73)", g_ret_storage.i_val);
+    int a = 20, b = 22;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    int result = 0;
+    FFI_Argument ret = { .value_ptr = &result };
+    ok((invoke_foreign_function(second, args, 2, &ret) && result == 42), "Calls pass straight through the probes");
+    destroy_ffi_function(first);
+    destroy_ffi_function(second);
+#else
+    skip("USDT probes need an ELF target on Linux.");
+#endif
+}
 
-        destroy_ffi_function(ffi_mixed_spill_test);
-    } else {
-        fail("Failed to create FFI object for mixed_gpr_xmm_stack_spill_func.");
+typedef struct {
+    FFI_FunctionSignature* sig;
+    int calls;
+} TraceWorker;
+
+FFI_THREAD_FUNC(trace_worker_main, arg) {
+    TraceWorker* worker = (TraceWorker*)arg;
+    int a = 1, b = 2, result = 0;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    FFI_Argument ret = { .value_ptr = &result };
+    for (int i = 0; i < worker->calls; ++i) {
+        invoke_foreign_function(worker->sig, args, 2, &ret);
     }
+    return FFI_THREAD_RETURN;
 }
 
-// NEW: Test for int_identity_minimal with INT_MIN and INT_MAX
-void test_int_identity_min_max() {
-    FFI_FunctionSignature* ffi_int_identity_test = create_ffi_function(
-        "int_identity_minimal", FFI_TYPE_INT, 1, identity_int_params, (GenericFuncPtr)int_identity_minimal, NULL, 0);
-    if (ffi_int_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+// NEW: Test the per-thread call-trace rings, the binary dump and the Chrome trace_event conversion
+void test_call_tracing() {
+    bool was_tracing = ffi_call_tracing_enabled();
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF);
+    FFI_FunctionSignature* traced = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                        (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_FunctionSignature* wrapped = create_ffi_function("trace \"wrapped\"", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_PreparedCall* prepared = traced ? prepare_ffi_call(traced) : NULL;
+    if (traced == NULL || wrapped == NULL || prepared == NULL) {
+        ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+        fail("Failed to create FFI objects for the call tracing test.");
+        destroy_prepared_call(prepared);
+        destroy_ffi_function(traced);
+        destroy_ffi_function(wrapped);
+        return;
+    }
+    int a = 40, b = 2, result = 0;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    FFI_Argument ret = { .value_ptr = &result };
+
+    ffi_set_call_tracing(false);
+    invoke_foreign_function(traced, args, 2, &ret);
+    ffi_set_call_tracing(true);
+    for (int i = 0; i < 3; ++i) {
+        invoke_foreign_function(traced, args, 2, &ret);
+    }
+    *(int*)prepared_call_arg(prepared, 0) = a;
+    *(int*)prepared_call_arg(prepared, 1) = b;
+    invoke_prepared_call(prepared);
+    // More calls than a ring holds, so the worker's ring wraps
+    TraceWorker worker = { wrapped, FFI_TRACE_RING_EVENTS + 100 };
+    ffi_thread_t thread;
+    bool started = ffi_thread_start(&thread, trace_worker_main, &worker);
+    if (started) {
+        ffi_thread_join(thread);
+    }
+    ffi_set_call_tracing(was_tracing);
+
+    size_t available = ffi_call_trace_snapshot(NULL, 0);
+    FFI_TraceRecord* events = (FFI_TraceRecord*)malloc((available + 16) * sizeof(FFI_TraceRecord));
+    size_t count = events ? ffi_call_trace_snapshot(events, available + 16) : 0;
+    int traced_calls = 0, wrapped_calls = 0, ordered = 1;
+    uint32_t main_thread = 0, worker_thread = 0;
+    for (size_t i = 0; i < count && i < available + 16; ++i) {
+        ordered &= events[i].end_ns >= events[i].start_ns;
+        if (events[i].sig_id == traced->id) {
+            traced_calls++;
+            main_thread = events[i].thread_id;
+        } else if (events[i].sig_id == wrapped->id) {
+            wrapped_calls++;
+            worker_thread = events[i].thread_id;
+        }
+    }
+    is_int(traced_calls, 4, "Three invokes and one prepared call were traced, the untraced call was not");
+    ok((started && wrapped_calls == FFI_TRACE_RING_EVENTS), "The worker's ring wrapped and holds its last %d calls",
+       FFI_TRACE_RING_EVENTS);
+    ok((main_thread != 0 && worker_thread != 0 && main_thread != worker_thread && ordered),
+       "Events carry their thread (%u, %u) and end after they start", main_thread, worker_thread);
+
+    const char* bin_path = "ffi_call_trace_test.bin";
+    const char* json_path = "ffi_call_trace_test.json";
+    int64_t written = ffi_call_trace_write(bin_path);
+    ok((written >= traced_calls + wrapped_calls), "The binary trace holds %lld events", (long long)written);
+    FILE* file = fopen(bin_path, "rb");
+    FFI_TraceFileHeader header;
+    bool header_ok = file && fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "FFITRACE", 8) == 0 &&
+                     header.version == FFI_TRACE_FILE_VERSION && (int64_t)header.event_count == written;
+    if (file) {
+        fclose(file);
+    }
+    ok(header_ok, "The binary trace starts with its header");
+
+    int64_t converted = ffi_call_trace_to_chrome_json(bin_path, json_path);
+    is_int((int)converted, (int)written, "Every event was converted to Chrome JSON");
+    char* json = NULL;
+    long json_size = 0;
+    file = fopen(json_path, "rb");
+    if (file && fseek(file, 0, SEEK_END) == 0 && (json_size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        json = (char*)malloc((size_t)json_size + 1);
+        if (json && fread(json, 1, (size_t)json_size, file) == (size_t)json_size) {
+            json[json_size] = '\0';
+        } else {
+            free(json);
+            json = NULL;
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+    ok((json != NULL && strncmp(json, "{\"displayTimeUnit\"", 18) == 0 &&
+        strstr(json, "{\"name\": \"quiet_add_two_ints\", \"cat\": \"ffi\", \"ph\": \"X\", \"ts\": ") != NULL &&
+        strstr(json, "\"name\": \"trace \\\"wrapped\\\"\"") != NULL),
+       "The Chrome trace has complete events named after their handles, with names escaped");
+    int depth = 0, min_depth = 0;
+    for (long i = 0; json && i < json_size; ++i) {
+        depth += (json[i] == '{' || json[i] == '[') - (json[i] == '}' || json[i] == ']');
+        min_depth = depth < min_depth ? depth : min_depth;
+    }
+    ok((json != NULL && depth == 0 && min_depth == 0), "Brackets and braces balance");
+    ok((ffi_call_trace_to_chrome_json(json_path, "ffi_call_trace_bad.json") == -1),
+       "A file that is not a call trace is rejected");
+    // A forged count is rejected before it sizes an allocation (128 GiB here).
+    FFI_TraceFileHeader forged = { .version = FFI_TRACE_FILE_VERSION, .name_count = 0, .event_count = 1ull << 32 };
+    memcpy(forged.magic, "FFITRACE", 8);
+    FFI_TraceRecord spill[2] = { { 0 } };
+    file = fopen(bin_path, "wb");
+    if (file) {
+        fwrite(&forged, sizeof(forged), 1, file);
+        fwrite(spill, sizeof(spill), 1, file);
+        fclose(file);
+    }
+    ok((ffi_call_trace_to_chrome_json(bin_path, "ffi_call_trace_bad.json") == -1),
+       "A header claiming more events than the file holds is rejected");
+    free(json);
+    free(events);
+    remove(bin_path);
+    remove(json_path);
+    remove("ffi_call_trace_bad.json");
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    destroy_prepared_call(prepared);
+    destroy_ffi_function(traced);
+    destroy_ffi_function(wrapped);
+}
 
-        int min_val = INT_MIN;
-        FFI_Argument args_min[] = { { .value_ptr = &min_val } };
-        bool success_min = invoke_foreign_function(ffi_int_identity_test, args_min, 1, &g_ffi_return_value);
-        ok(success_min, "FFI call successful for int_identity_minimal (INT_MIN)");
-        is_int(g_ret_storage.i_val, INT_MIN, "Result (int_MIN): %d (Expected %d)", g_ret_storage.i_val, INT_MIN);
+// Resolves recorded handles to real targets by name; `*user_data` set to 1 swaps the adder for
+// return_constant_42 so results differ from the recording.
+static GenericFuncPtr replay_test_resolver(const char* name, const char* signature, void* user_data) {
+    (void)signature;
+    if (strcmp(name, "quiet_add_two_ints") == 0) {
+        return *(int*)user_data ? (GenericFuncPtr)return_constant_42 : (GenericFuncPtr)quiet_add_two_ints;
+    }
+#if defined(FFI_HAVE_SYSV_EXTENDED_TARGETS)
+    if (strcmp(name, "ld_muladd") == 0) {
+        return (GenericFuncPtr)ld_muladd;
+    }
+#ifdef FFI_HAVE_COMPLEX
+    if (strcmp(name, "dc_multiply") == 0) {
+        return (GenericFuncPtr)dc_multiply;
+    }
+#endif
+#endif
+    return NULL;
+}
 
-        int max_val = INT_MAX;
-        FFI_Argument args_max[] = { { .value_ptr = &max_val } };
-        bool success_max = invoke_foreign_function(ffi_int_identity_test, args_max, 1, &g_ffi_return_value);
-        ok(success_max, "FFI call successful for int_identity_minimal (INT_MAX)");
-        is_int(g_ret_storage.i_val, INT_MAX, "Result (int_MAX): %d (Expected %d)", g_ret_storage.i_val, INT_MAX);
+// NEW: Test recording sampled calls into a mapped log and replaying it against real, wrong and stub targets
+void test_call_record_replay() {
+#if defined(FFI_OS_LINUX) || defined(FFI_OS_MACOS)
+    const char* path = "ffi_call_log_test.bin";
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF);
+    FFI_FunctionSignature* add = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                     (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_FunctionSignature* worker_add = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                            (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_PreparedCall* prepared = add ? prepare_ffi_call(add) : NULL;
+    if (add == NULL || worker_add == NULL || prepared == NULL) {
+        ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+        fail("Failed to create FFI objects for the record/replay test.");
+        destroy_prepared_call(prepared);
+        destroy_ffi_function(add);
+        destroy_ffi_function(worker_add);
+        return;
+    }
+    int expected_calls = 0, expected_signatures = 2;
+    bool started = ffi_call_recorder_start(path, 1 << 20, 1);
+    ok(started, "Recording into a 1 MiB log starts");
+    started = ffi_call_recorder_start(path, 1 << 20, 1);
+    ok(!started, "A second recording is refused while one is running");
+
+    int a = 0, b = 0, result = 0;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    FFI_Argument ret = { .value_ptr = &result };
+    for (int i = 0; i < 10; ++i) {
+        a = i;
+        b = 2 * i;
+        invoke_foreign_function(add, args, 2, &ret);
+        expected_calls++;
+    }
+    for (int i = 0; i < 5; ++i) {
+        *(int*)prepared_call_arg(prepared, 0) = 40;
+        *(int*)prepared_call_arg(prepared, 1) = 2;
+        invoke_prepared_call(prepared);
+        expected_calls++;
+    }
+    TraceWorker worker = { worker_add, 100 };
+    ffi_thread_t thread;
+    if (ffi_thread_start(&thread, trace_worker_main, &worker)) {
+        ffi_thread_join(thread);
+        expected_calls += worker.calls;
+    }
+#if defined(FFI_HAVE_SYSV_EXTENDED_TARGETS)
+    FFI_Type ld_params[] = { FFI_TYPE_LONG_DOUBLE, FFI_TYPE_LONG_DOUBLE, FFI_TYPE_LONG_DOUBLE };
+    FFI_FunctionSignature* ld = create_ffi_function("ld_muladd", FFI_TYPE_LONG_DOUBLE, 3, ld_params,
+                                                    (GenericFuncPtr)ld_muladd, NULL, 0);
+    if (ld != NULL) {
+        long double x = 1.5L, y = 3.0L, z = 0.1L, ld_result = 0.0L;
+        FFI_Argument ld_args[] = { { .value_ptr = &x }, { .value_ptr = &y }, { .value_ptr = &z } };
+        FFI_Argument ld_ret = { .value_ptr = &ld_result };
+        for (int i = 0; i < 3; ++i, x += 1.0L) {
+            invoke_foreign_function(ld, ld_args, 3, &ld_ret);
+            expected_calls++;
+        }
+        expected_signatures++;
+        destroy_ffi_function(ld);
+    }
+#ifdef FFI_HAVE_COMPLEX
+    FFI_Type dc_params[] = { FFI_TYPE_DOUBLE_COMPLEX, FFI_TYPE_DOUBLE_COMPLEX };
+    FFI_FunctionSignature* dc = create_ffi_function("dc_multiply", FFI_TYPE_DOUBLE_COMPLEX, 2, dc_params,
+                                                    (GenericFuncPtr)dc_multiply, NULL, 0);
+    if (dc != NULL) {
+        double _Complex p = 1.0 + 2.0 * I, q = -0.5 + 4.0 * I, dc_result = 0.0;
+        FFI_Argument dc_args[] = { { .value_ptr = &p }, { .value_ptr = &q } };
+        FFI_Argument dc_ret = { .value_ptr = &dc_result };
+        for (int i = 0; i < 2; ++i, p *= 2.0) {
+            invoke_foreign_function(dc, dc_args, 2, &dc_ret);
+            expected_calls++;
+        }
+        expected_signatures++;
+        destroy_ffi_function(dc);
+    }
+#endif
+#endif
+    FFI_RecordLogHeader stats;
+    bool stopped = ffi_call_recorder_stop(&stats);
+    ok(stopped, "Recording stops");
+    ok((stats.calls == expected_calls && stats.signatures == expected_signatures && stats.dropped == 0),
+       "The log holds %lld calls of %lld signatures (expected %d of %d), none dropped", (long long)stats.calls,
+       (long long)stats.signatures, expected_calls, expected_signatures);
+    a = 1;
+    invoke_foreign_function(add, args, 2, &ret);
+    stopped = ffi_call_recorder_stop(NULL);
+    ok(!stopped, "Calls after stopping are not recorded, and stopping twice fails");
+
+    FFI_ReplayReport report;
+    int wrong = 0;
+    bool replayed = ffi_replay_call_log(path, replay_test_resolver, &wrong, 3, &report);
+    ok(replayed, "The log replays against the real targets");
+    ok((report.signatures == expected_signatures && report.stubbed == 0 && report.calls == expected_calls &&
+        report.skipped == 0 && report.compared == expected_calls && report.mismatches == 0),
+       "All %lld replayed results match the recording", (long long)report.compared);
+    ok((report.passes == 3 && report.calls_per_second > 0.0), "Throughput: %.0f calls/s over %d passes",
+       report.calls_per_second, report.passes);
+    ffi_set_lazy_binding(true);
+    replayed = ffi_replay_call_log(path, replay_test_resolver, &wrong, 1, &report);
+    ffi_set_lazy_binding(false);
+    ok((replayed && report.calls == expected_calls && report.skipped == 0 && report.mismatches == 0),
+       "The log replays with lazy binding on");
+    ffi_set_tiered_execution(INT64_MAX, true); // Tier-0 handles that never promote on their own
+    replayed = ffi_replay_call_log(path, replay_test_resolver, &wrong, 1, &report);
+    ffi_set_tiered_execution(0, true);
+    ok((replayed && report.calls == expected_calls && report.skipped == 0 && report.mismatches == 0),
+       "The log replays with tiered execution on");
+    wrong = 1;
+    ffi_replay_call_log(path, replay_test_resolver, &wrong, 0, &report);
+    is_int((int)report.mismatches, 110, "A changed target shows up as mismatches (all but the five 40 + 2 calls)");
+    ffi_replay_call_log(path, NULL, NULL, 1, &report);
+    ok((report.stubbed == expected_signatures && report.calls == expected_calls && report.compared == 0),
+       "Without a resolver every handle replays against the stub, uncompared");
+
+    started = ffi_call_recorder_start(path, 1 << 16, 4);
+    ok(started, "Recording one call in four starts");
+    for (int i = 0; i < 100; ++i) {
+        invoke_foreign_function(add, args, 2, &ret);
+    }
+    ffi_call_recorder_stop(&stats);
+    is_int((int)stats.calls, 25, "A quarter of the calls were sampled");
+    started = ffi_call_recorder_start(path, sizeof(FFI_RecordLogHeader) + 200, 1);
+    ok(started, "Recording into a 200-byte log starts");
+    for (int i = 0; i < 50; ++i) {
+        invoke_foreign_function(add, args, 2, &ret);
+    }
+    ffi_call_recorder_stop(&stats);
+    int kept = (int)stats.calls;
+    ok((stats.dropped > 0 && stats.calls + stats.dropped == 50 && stats.used <= stats.capacity),
+       "A full log drops calls (%lld kept, %lld dropped)", (long long)stats.calls, (long long)stats.dropped);
+    ffi_replay_call_log(path, replay_test_resolver, &wrong, 0, &report);
+    is_int((int)report.calls, kept, "The calls that fit still replay");
+    // Damage the first record (a signature) in each way a reader must not trust
+    static const struct { size_t offset; uint32_t value; } damage[] = {
+        { offsetof(FFI_RecordSignature, prefix.size), 24 },          // Not a multiple of 16
+        { offsetof(FFI_RecordSignature, prefix.size), 0x7FFFFFF0u }, // Past the end of the log
+        { offsetof(FFI_RecordSignature, name_length), 0x7FFFFFF0u }, // Name runs past the record
+        { offsetof(FFI_RecordSignature, text_length), 1 },           // No NUL after the text
+    };
+    unsigned char log_bytes[sizeof(FFI_RecordLogHeader) + 200];
+    FILE* log_file = fopen(path, "rb");
+    size_t log_size = log_file ? fread(log_bytes, 1, sizeof(log_bytes), log_file) : 0;
+    if (log_file != NULL) {
+        fclose(log_file);
+    }
+    int rejected = 0;
+    for (size_t i = 0; log_size == sizeof(log_bytes) && i < sizeof(damage) / sizeof(damage[0]); ++i) {
+        unsigned char damaged[sizeof(log_bytes)];
+        memcpy(damaged, log_bytes, sizeof(damaged));
+        memcpy(damaged + sizeof(FFI_RecordLogHeader) + damage[i].offset, &damage[i].value, sizeof(uint32_t));
+        log_file = fopen(path, "wb");
+        if (log_file != NULL) {
+            fwrite(damaged, 1, sizeof(damaged), log_file);
+            fclose(log_file);
+        }
+        replayed = ffi_replay_call_log(path, NULL, NULL, 0, &report);
+        rejected += !replayed;
+    }
+    is_int(rejected, 4, "Logs with a bad record size or unterminated strings are rejected");
+    FILE* junk = fopen(path, "wb");
+    if (junk != NULL) {
+        for (size_t i = 0; i < 2 * sizeof(FFI_RecordLogHeader); ++i) {
+            fputc('x', junk);
+        }
+        fclose(junk);
+    }
+    replayed = ffi_replay_call_log(path, NULL, NULL, 0, &report);
+    ok((junk != NULL && !replayed), "A file that is not a call log is rejected");
+
+    remove(path);
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    destroy_prepared_call(prepared);
+    destroy_ffi_function(add);
+    destroy_ffi_function(worker_add);
+#else
+    skip("Call recording needs mmap (Linux or macOS).");
+#endif
+}
 
-        destroy_ffi_function(ffi_int_identity_test);
-    } else {
-        fail("Failed to create FFI object for int_identity_min_max.");
+// NEW: Test that the bulk (SIMD-dispatched) converters agree with the scalar helpers bit-for-bit
+void test_half_bulk_conversion() {
+    float inputs[37];
+    const float specials[] = { 0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 65520.0f, -70000.0f, 6.0e-5f, 1.0e-7f, 3.0e-8f,
+                               1.0f + 1.0f / 2048.0f, 1.0f + 3.0f / 2048.0f, 1.0e-40f, 3.3895314e38f, 1.00390625f };
+    size_t num_specials = sizeof(specials) / sizeof(specials[0]);
+    for (size_t i = 0; i < 37; ++i) {
+        inputs[i] = (i < num_specials) ? specials[i] : (float)i * 0.37f - 5.0f;
     }
+    inputs[35] = INFINITY;
+    inputs[36] = NAN;
+
+    uint16_t f16[37], bf16[37];
+    float f16_back[37], bf16_back[37];
+    ffi_f32_to_f16_array(inputs, f16, 37);
+    ffi_f32_to_bf16_array(inputs, bf16, 37);
+    ffi_f16_to_f32_array(f16, f16_back, 37);
+    ffi_bf16_to_f32_array(bf16, bf16_back, 37);
+
+    int f16_mismatches = 0, bf16_mismatches = 0, widen_mismatches = 0;
+    for (size_t i = 0; i < 37; ++i) {
+        if (f16[i] != ffi_float_to_f16_bits(inputs[i])) f16_mismatches++;
+        if (bf16[i] != ffi_float_to_bf16_bits(inputs[i])) bf16_mismatches++;
+        float f16_ref = ffi_f16_bits_to_float(f16[i]), bf16_ref = ffi_bf16_bits_to_float(bf16[i]);
+        if (memcmp(&f16_back[i], &f16_ref, sizeof(float)) != 0 || memcmp(&bf16_back[i], &bf16_ref, sizeof(float)) != 0) widen_mismatches++;
+    }
+    is_int(f16_mismatches, 0, "Bulk float -> binary16 matches scalar rounding (%d mismatches)", f16_mismatches);
+    is_int(bf16_mismatches, 0, "Bulk float -> bfloat16 matches scalar rounding (%d mismatches)", bf16_mismatches);
+    is_int(widen_mismatches, 0, "Bulk widening to float matches scalar (%d mismatches)", widen_mismatches);
+    is_int(ffi_float_to_f16_bits(1.0f + 1.0f / 2048.0f), 0x3C00, "binary16 tie rounds to even (down)");
+    is_int(ffi_float_to_f16_bits(1.0f + 3.0f / 2048.0f), 0x3C02, "binary16 tie rounds to even (up)");
+#ifdef FFI_HAVE_FLOAT16_TARGETS
+    // Cross-check the scalar converter against the compiler's own conversion.
+    int compiler_mismatches = 0;
+    for (size_t i = 0; i < 36; ++i) { // Skip NaN: payload propagation is implementation-specific
+        _Float16 h = (_Float16)inputs[i];
+        uint16_t h_bits;
+        memcpy(&h_bits, &h, sizeof(h_bits));
+        if (h_bits != f16[i]) compiler_mismatches++;
+    }
+    is_int(compiler_mismatches, 0, "Scalar binary16 conversion matches the compiler's _Float16 (%d mismatches)", compiler_mismatches);
+#else
+    skip("Compiler has no _Float16 support on this target.");
+#endif
 }
 
-// NEW: Test for float_identity_minimal with FLT_MIN and FLT_MAX
-void test_float_identity_min_max() {
-    FFI_FunctionSignature* ffi_float_identity_test = create_ffi_function(
-        "float_identity_minimal", FFI_TYPE_FLOAT, 1, identity_float_params, (GenericFuncPtr)float_identity_minimal, NULL, 0);
-    if (ffi_float_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+// --- Benchmarks (run with `./cross --bench`) ---
 
-        float min_val = FLT_MIN;
-        FFI_Argument args_min[] = { { .value_ptr = &min_val } };
-        bool success_min = invoke_foreign_function(ffi_float_identity_test, args_min, 1, &g_ffi_return_value);
-        ok(success_min, "FFI call successful for float_identity_minimal (FLT_MIN)");
-        is_float(g_ret_storage.f_val, FLT_MIN, "Result (float_MIN): %f (Expected %f)", g_ret_storage.f_val, FLT_MIN);
+/**
+ * @brief Reads a monotonic clock for benchmarking.
+ * @return The current time in nanoseconds from an arbitrary fixed origin.
+ */
+static uint64_t ffi_bench_now_ns(void) {
+#ifdef FFI_OS_WIN64
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
 
-        float max_val = FLT_MAX;
-        FFI_Argument args_max[] = { { .value_ptr = &max_val } };
-        bool success_max = invoke_foreign_function(ffi_float_identity_test, args_max, 1, &g_ffi_return_value);
-        ok(success_max, "FFI call successful for float_identity_minimal (FLT_MAX)");
-        is_float(g_ret_storage.f_val, FLT_MAX, "Result (float_MAX): %f (Expected %f)", g_ret_storage.f_val, FLT_MAX);
+/**
+ * @brief Times repeated calls straight through a signature's trampoline and prints ns/call.
+ * The trampoline is called directly so the numbers measure the generated code, not the
+ * argument logging done by invoke_foreign_function().
+ * @param label Name printed in the result line.
+ * @param sig The signature to call (skipped with a diagnostic if NULL).
+ * @param args The argument array passed on every call.
+ * @param num_args Number of entries in `args`.
+ * @param iterations Number of timed calls.
+ */
+static void bench_trampoline(const char* label, FFI_FunctionSignature* sig, FFI_Argument* args, int num_args, long iterations) {
+    if (sig == NULL) {
+        diag("bench: '%s' unavailable, skipping.", label);
+        return;
+    }
+    GenericReturnValue ret;
+    for (long i = 0; i < iterations / 10; ++i) { // Warm-up
+        sig->trampoline_code(args, num_args, &ret);
+    }
+    uint64_t start = ffi_bench_now_ns();
+    for (long i = 0; i < iterations; ++i) {
+        sig->trampoline_code(args, num_args, &ret);
+    }
+    uint64_t elapsed = ffi_bench_now_ns() - start;
+    note("bench %-44s %10ld calls %8.2f ns/call", label, iterations, (double)elapsed / (double)iterations);
+}
 
-        destroy_ffi_function(ffi_float_identity_test);
-    } else {
-        fail("Failed to create FFI object for float_identity_min_max.");
+/**
+ * @brief Times creating (and destroying) many handles with eager vs. lazy binding.
+ * Startup cost is dominated by one executable mapping plus code generation per handle,
+ * which lazy binding skips for functions that are never called.
+ * @param count Number of handles created per mode.
+ */
+static void bench_lazy_binding(int count) {
+    FFI_FunctionSignature** handles = (FFI_FunctionSignature**)malloc((size_t)count * sizeof(*handles));
+    if (handles == NULL) {
+        diag("bench: out of memory for %d handles, skipping.", count);
+        return;
+    }
+    for (int lazy = 0; lazy <= 1; ++lazy) {
+        ffi_set_lazy_binding(lazy != 0);
+        uint64_t start = ffi_bench_now_ns();
+        for (int i = 0; i < count; ++i) {
+            handles[i] = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                             (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        int bound = 0;
+        for (int i = 0; i < count; ++i) {
+            if (handles[i] && ffi_function_is_bound(handles[i])) bound++;
+            destroy_ffi_function(handles[i]);
+        }
+        note("bench %-44s %10d handles %8.2f us/handle (%d with executable pages)",
+             lazy ? "create_ffi_function (lazy binding)" : "create_ffi_function (eager binding)",
+             count, (double)elapsed / 1000.0 / (double)count, bound);
     }
+    ffi_set_lazy_binding(false);
+    free(handles);
 }
 
-// NEW: Test for double_identity_minimal with DBL_MIN and DBL_MAX
-void test_double_identity_min_max() {
-    FFI_FunctionSignature* ffi_double_identity_test = create_ffi_function(
-        "double_identity_minimal", FFI_TYPE_DOUBLE, 1, identity_double_params, (GenericFuncPtr)double_identity_minimal, NULL, 0);
-    if (ffi_double_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+// Log sink for benchmarks: formats every message like a real sink would, then drops it.
+static void formatting_discard_log_sink(FFI_LogLevel level, const char* fmt, va_list args, void* user_data) {
+    (void)level;
+    char message[1024];
+    *(size_t*)user_data += (size_t)vsnprintf(message, sizeof(message), fmt, args);
+}
 
-        double min_val = DBL_MIN;
-        FFI_Argument args_min[] = { { .value_ptr = &min_val } };
-        bool success_min = invoke_foreign_function(ffi_double_identity_test, args_min, 1, &g_ffi_return_value);
-        ok(success_min, "FFI call successful for double_identity_minimal (DBL_MIN)");
-        is_double(g_ret_storage.d_val, DBL_MIN, "Result (double_MIN): %lf (Expected %lf)", g_ret_storage.d_val, DBL_MIN);
+/**
+ * @brief Times invoke_foreign_function() itself at each log level.
+ * Trace output is formatted by a discarding sink so only the formatting cost is measured.
+ * @param iterations Number of timed calls per level.
+ */
+static void bench_invoke_logging(long iterations) {
+    FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                     (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (sig == NULL) {
+        diag("bench: quiet_add_two_ints unavailable, skipping.");
+        return;
+    }
+    int a = 40, b = 2;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    GenericReturnValue ret;
+    FFI_Argument ret_arg = { .value_ptr = &ret };
+    size_t formatted_bytes = 0;
+    const FFI_LogLevel levels[] = { FFI_LOG_LEVEL_TRACE, FFI_LOG_LEVEL_ERROR, FFI_LOG_LEVEL_OFF };
+    const char* labels[] = { "invoke_foreign_function (trace, formatted)", "invoke_foreign_function (error level)",
+                             "invoke_foreign_function (logging off)" };
+
+    ffi_set_log_sink(formatting_discard_log_sink, &formatted_bytes);
+    for (int l = 0; l < 3; ++l) {
+        ffi_set_log_level(levels[l]);
+        uint64_t start = ffi_bench_now_ns();
+        for (long i = 0; i < iterations; ++i) {
+            invoke_foreign_function(sig, args, 2, &ret_arg);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+        note("bench %-44s %10ld calls %8.2f ns/call", labels[l], iterations, (double)elapsed / (double)iterations);
+    }
+    ffi_set_log_sink(NULL, NULL);
+    destroy_ffi_function(sig);
+}
 
-        double max_val = DBL_MAX;
-        FFI_Argument args_max[] = { { .value_ptr = &max_val } };
-        bool success_max = invoke_foreign_function(ffi_double_identity_test, args_max, 1, &g_ffi_return_value);
-        ok(success_max, "FFI call successful for double_identity_minimal (DBL_MAX)");
-        is_double(g_ret_storage.d_val, DBL_MAX, "Result (double_MAX): %lf (Expected %lf)", g_ret_storage.d_val, DBL_MAX);
+/**
+ * @brief Times invoke_foreign_function() with call tracing off and on.
+ * With tracing on, each call adds two clock reads and one ring store.
+ */
+static void bench_call_tracing(long iterations) {
+    FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                     (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (sig == NULL) {
+        diag("bench: quiet_add_two_ints unavailable, skipping.");
+        return;
+    }
+    int a = 40, b = 2;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    GenericReturnValue ret;
+    FFI_Argument ret_arg = { .value_ptr = &ret };
+    const char* labels[] = { "invoke_foreign_function (tracing off)", "invoke_foreign_function (tracing on)" };
+    bool was_tracing = ffi_call_tracing_enabled();
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF);
+    for (int traced = 0; traced <= 1; ++traced) {
+        ffi_set_call_tracing(traced != 0);
+        uint64_t start = ffi_bench_now_ns();
+        for (long i = 0; i < iterations; ++i) {
+            invoke_foreign_function(sig, args, 2, &ret_arg);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        note("bench %-44s %10ld calls %8.2f ns/call", labels[traced], iterations, (double)elapsed / (double)iterations);
+    }
+    ffi_set_call_tracing(was_tracing);
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    destroy_ffi_function(sig);
+}
 
-        destroy_ffi_function(ffi_double_identity_test);
-    } else {
-        fail("Failed to create FFI object for double_identity_min_max.");
+/**
+ * @brief Times invoke_foreign_function() while recording every call, then replays the log.
+ * @param iterations Calls recorded; the replay runs the resulting stream ten times.
+ */
+static void bench_call_record_replay(long iterations) {
+    const char* path = "ffi_call_log_bench.bin";
+    FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                     (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (sig == NULL) {
+        diag("bench: quiet_add_two_ints unavailable, skipping.");
+        return;
+    }
+    int a = 40, b = 2;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    GenericReturnValue ret;
+    FFI_Argument ret_arg = { .value_ptr = &ret };
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF);
+    if (ffi_call_recorder_start(path, (size_t)iterations * 48 + 4096, 1)) {
+        uint64_t start = ffi_bench_now_ns();
+        for (long i = 0; i < iterations; ++i) {
+            a = (int)i;
+            invoke_foreign_function(sig, args, 2, &ret_arg);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        ffi_call_recorder_stop(NULL);
+        note("bench %-44s %10ld calls %8.2f ns/call", "invoke_foreign_function (recording all)", iterations,
+             (double)elapsed / (double)iterations);
+        FFI_ReplayReport report;
+        if (ffi_replay_call_log(path, replay_test_resolver, &(int){ 0 }, 10, &report)) {
+            note("bench %-44s %10lld calls %8.2f ns/call (%lld mismatches)", "replay of the recorded stream",
+                 (long long)(report.calls * report.passes), 1e9 / report.calls_per_second, (long long)report.mismatches);
+        }
+        remove(path);
     }
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    destroy_ffi_function(sig);
 }
 
-// NEW: Test for return_constant_42 (int, int -> int, no printf)
-void test_return_constant_42() {
-    FFI_FunctionSignature* ffi_return_constant_42_test = create_ffi_function(
-        "return_constant_42", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)return_constant_42, NULL, 0);
-    if (ffi_return_constant_42_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        int val1 = 10, val2 = 20;
-        FFI_Argument args[] = { { .value_ptr = &val1 }, { .value_ptr = &val2 } };
-        bool success = invoke_foreign_function(ffi_return_constant_42_test, args, 2, &g_ffi_return_value);
-        ok(success, "FFI call successful for return_constant_42");
-        is_int(g_ret_storage.i_val, 42, "Result (return_constant_42): %d (Expected 42)", g_ret_storage.i_val);
-        destroy_ffi_function(ffi_return_constant_42_test);
-    } else {
-        fail("Failed to create FFI object for return_constant_42.");
+/**
+ * @brief Measures async throughput for many concurrent blocking calls at several pool sizes.
+ * Each call sleeps for `sleep_ms`, so ideal throughput scales with the worker count.
+ * @param num_calls Calls submitted per pool size (all in flight at once).
+ * @param sleep_ms How long each call blocks.
+ */
+static void bench_async_blocking(int num_calls, int sleep_ms) {
+    FFI_FunctionSignature* sig = FFI_BIND(blocking_sleep_ms, int, int);
+    FFI_PreparedCall** calls = (FFI_PreparedCall**)calloc((size_t)num_calls, sizeof(*calls));
+    FFI_Future** futures = (FFI_Future**)calloc((size_t)num_calls, sizeof(*futures));
+    if (sig == NULL || calls == NULL || futures == NULL) {
+        diag("bench: async setup failed, skipping.");
+        free(futures);
+        free(calls);
+        destroy_ffi_function(sig);
+        return;
+    }
+    for (int i = 0; i < num_calls; ++i) {
+        calls[i] = prepare_ffi_call(sig);
+        if (calls[i]) *(int*)prepared_call_arg(calls[i], 0) = sleep_ms;
     }
+    const int worker_counts[] = { 1, 4, 16, 64 };
+    for (size_t w = 0; w < sizeof(worker_counts) / sizeof(worker_counts[0]); ++w) {
+        FFI_ThreadPoolConfig config = { .num_workers = worker_counts[w], .queue_depth = num_calls };
+        FFI_ThreadPool* pool = ffi_thread_pool_create(&config);
+        if (pool == NULL) {
+            diag("bench: could not start %d workers, skipping.", worker_counts[w]);
+            continue;
+        }
+        uint64_t start = ffi_bench_now_ns();
+        for (int i = 0; i < num_calls; ++i) {
+            futures[i] = calls[i] ? ffi_invoke_async(pool, calls[i], NULL, NULL) : NULL;
+        }
+        for (int i = 0; i < num_calls; ++i) {
+            ffi_future_destroy(futures[i]);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        FFI_ThreadPoolStats stats;
+        ffi_thread_pool_get_stats(pool, &stats);
+        char label[64];
+        snprintf(label, sizeof(label), "async blocking_sleep_ms(%d), %d workers", sleep_ms, worker_counts[w]);
+        note("bench %-44s %10d calls %8.0f calls/s (%lld stolen)", label, num_calls,
+             (double)num_calls * 1e9 / (double)elapsed, (long long)stats.stolen);
+        ffi_thread_pool_destroy(pool);
+    }
+    for (int i = 0; i < num_calls; ++i) {
+        destroy_prepared_call(calls[i]);
+    }
+    free(futures);
+    free(calls);
+    destroy_ffi_function(sig);
 }
 
-// NEW: Test for pointer_identity_minimal with NULL
-void test_pointer_identity_null() {
-    FFI_FunctionSignature* ffi_pointer_identity_test = create_ffi_function(
-        "pointer_identity_minimal", FFI_TYPE_POINTER, 1, identity_pointer_params, (GenericFuncPtr)pointer_identity_minimal, NULL, 0);
-    if (ffi_pointer_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
+// Producer thread for bench_executor_producers(): synchronous calls through the executor.
+typedef struct {
+    FFI_Executor* exec;
+    FFI_PreparedCall* call;
+    long calls;
+    uint64_t elapsed_ns;
+} BenchExecutorProducer;
+
+FFI_THREAD_FUNC(bench_executor_producer_main, arg) {
+    BenchExecutorProducer* producer = (BenchExecutorProducer*)arg;
+    uint64_t start = ffi_bench_now_ns();
+    for (long i = 0; i < producer->calls; ++i) {
+        ffi_executor_invoke(producer->exec, producer->call);
+    }
+    producer->elapsed_ns = ffi_bench_now_ns() - start;
+    return FFI_THREAD_RETURN;
+}
 
-        void* null_ptr = NULL;
-        FFI_Argument args[] = { { .value_ptr = &null_ptr } };
-        bool invocation_success = invoke_foreign_function(ffi_pointer_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for pointer_identity_minimal (NULL)");
-        is_ptr(g_ret_storage.ptr_val, NULL, "Result (pointer_NULL): %p (Expected NULL)", g_ret_storage.ptr_val);
-        destroy_ffi_function(ffi_pointer_identity_test);
-    } else {
-        fail("Failed to create FFI object for pointer_identity_null.");
+/**
+ * @brief Measures dedicated-executor throughput and round-trip latency as producers are added.
+ * Every call funnels through the one executor thread, so throughput should hold roughly steady
+ * while per-call latency grows with the queue the producers build up.
+ * @param calls_per_producer Synchronous calls issued by each producer thread.
+ */
+static void bench_executor_producers(long calls_per_producer) {
+    enum { MAX_PRODUCERS = 8 };
+    FFI_FunctionSignature* sig = FFI_BIND(quiet_add_two_ints, int, int, int);
+    if (sig == NULL) {
+        diag("bench: quiet_add_two_ints unavailable, skipping.");
+        return;
+    }
+    for (int num_producers = 1; num_producers <= MAX_PRODUCERS; num_producers *= 2) {
+        FFI_Executor* exec = ffi_executor_create(NULL);
+        BenchExecutorProducer producers[MAX_PRODUCERS];
+        ffi_thread_t threads[MAX_PRODUCERS];
+        int started = 0;
+        uint64_t start = ffi_bench_now_ns();
+        for (int i = 0; exec && i < num_producers; ++i) {
+            producers[i] = (BenchExecutorProducer){ .exec = exec, .call = prepare_ffi_call(sig), .calls = calls_per_producer };
+            if (producers[i].call == NULL) break;
+            *(int*)prepared_call_arg(producers[i].call, 0) = 40;
+            *(int*)prepared_call_arg(producers[i].call, 1) = 2;
+            if (!ffi_thread_start(&threads[i], bench_executor_producer_main, &producers[i])) {
+                destroy_prepared_call(producers[i].call);
+                break;
+            }
+            started++;
+        }
+        double latency_ns = 0.0;
+        for (int i = 0; i < started; ++i) {
+            ffi_thread_join(threads[i]);
+            latency_ns += (double)producers[i].elapsed_ns / (double)calls_per_producer;
+            destroy_prepared_call(producers[i].call);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        if (started == num_producers) {
+            FFI_ExecutorStats stats;
+            ffi_executor_get_stats(exec, &stats);
+            char label[64];
+            snprintf(label, sizeof(label), "executor quiet_add_two_ints, %d producers", num_producers);
+            note("bench %-44s %10ld calls %8.0f calls/s %8.0f ns/round trip (batch %.1f)", label,
+                 calls_per_producer * num_producers, (double)(calls_per_producer * num_producers) * 1e9 / (double)elapsed,
+                 latency_ns / (double)started, stats.batches ? (double)stats.executed / (double)stats.batches : 0.0);
+        } else {
+            diag("bench: could not start %d executor producers, skipping.", num_producers);
+        }
+        ffi_executor_destroy(exec);
     }
+    destroy_ffi_function(sig);
 }
 
-// NEW: Test for all zero arguments for sum_seven_ints
-void test_all_zero_args_sum_seven_ints() {
-    FFI_FunctionSignature* ffi_sum_seven_ints_test = create_ffi_function(
-        "sum_seven_ints", FFI_TYPE_INT, 7, sum_seven_ints_params, (GenericFuncPtr)sum_seven_ints, NULL, 0);
-    if (ffi_sum_seven_ints_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        int v1=0, v2=0, v3=0, v4=0, v5=0, v6=0, v7=0;
-        FFI_Argument args[] = {
-            { .value_ptr = &v1 }, { .value_ptr = &v2 }, { .value_ptr = &v3 },
-            { .value_ptr = &v4 }, { .value_ptr = &v5 }, { .value_ptr = &v6 },
-            { .value_ptr = &v7 }
-        };
-        bool invocation_success = invoke_foreign_function(ffi_sum_seven_ints_test, args, 7, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for sum_seven_ints (all zeros)");
-        is_int(g_ret_storage.i_val, 0, "Result (sum_seven_ints all zeros): %d (Expected 0)", g_ret_storage.i_val);
-        destroy_ffi_function(ffi_sum_seven_ints_test);
-    } else {
-        fail("Failed to create FFI object for sum_seven_ints (all zeros).");
+// Thread for bench_thread_scaling(): runs one operation in a loop once the start flag flips.
+typedef struct {
+    FFI_FunctionSignature* sig; // Shared signature for invoke runs, NULL for create runs
+    long iterations;
+    int64_t* start_flag;
+    int64_t* ready;
+    uint64_t elapsed_ns;
+} BenchScalingThread;
+
+FFI_THREAD_FUNC(bench_scaling_main, arg) {
+    BenchScalingThread* self = (BenchScalingThread*)arg;
+    int a = 40, b = 2, result = 0;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    FFI_Argument ret = { .value_ptr = &result };
+    FFI_ATOMIC_ADD_I64(self->ready, 1);
+    while (!FFI_ATOMIC_LOAD_I64(self->start_flag)) {
+        ffi_thread_yield();
     }
-}
-// NEW: Test for wchar_t identity
-void test_wchar_t_identity_minimal() {
-    FFI_FunctionSignature* ffi_wchar_t_identity_test = create_ffi_function(
-        "wchar_t_identity_minimal", FFI_TYPE_WCHAR, 1, identity_wchar_params, (GenericFuncPtr)wchar_t_identity_minimal, NULL, 0);
-    if (ffi_wchar_t_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        wchar_t in_val = L'€'; // Euro sign, typically 3 bytes in UTF-8, but single wchar_t
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool success = invoke_foreign_function(ffi_wchar_t_identity_test, args, 1, &g_ffi_return_value);
-        ok(success, "FFI call successful for wchar_t_identity_minimal");
-        is_wchar_t(g_ret_storage.wc_val, in_val, "Result (wchar_t): %lc (Expected %lc)", g_ret_storage.wc_val, in_val);
-        destroy_ffi_function(ffi_wchar_t_identity_test);
-    } else {
-        fail("Failed to create FFI object for wchar_t_identity_minimal.");
+    uint64_t start = ffi_bench_now_ns();
+    for (long i = 0; i < self->iterations; ++i) {
+        if (self->sig) {
+            invoke_foreign_function(self->sig, args, 2, &ret);
+        } else {
+            destroy_ffi_function(create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                     (GenericFuncPtr)quiet_add_two_ints, NULL, 0));
+        }
     }
+    self->elapsed_ns = ffi_bench_now_ns() - start;
+    ffi_epoch_thread_detach();
+    return FFI_THREAD_RETURN;
 }
 
-// NEW: Test for size_t identity
-void test_size_t_identity_minimal() {
-    FFI_FunctionSignature* ffi_size_t_identity_test = create_ffi_function(
-        "size_t_identity_minimal", FFI_TYPE_SIZE_T, 1, identity_size_t_params, (GenericFuncPtr)size_t_identity_minimal, NULL, 0);
-    if (ffi_size_t_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        size_t in_val = (size_t)0xABCD12345678ULL; // Example size_t value
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool success = invoke_foreign_function(ffi_size_t_identity_test, args, 1, &g_ffi_return_value);
-        ok(success, "FFI call successful for size_t_identity_minimal");
-        is_size_t(g_ret_storage.sz_val, in_val, "Result (size_t): %zu (Expected %zu)", g_ret_storage.sz_val, in_val);
-        destroy_ffi_function(ffi_size_t_identity_test);
-    } else {
-        fail("Failed to create FFI object for size_t_identity_minimal.");
-    }
+/**
+ * @brief Number of CPUs currently online, at least 1.
+ */
+static int ffi_bench_online_cpus(void) {
+#if defined(FFI_OS_WIN64)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+#endif
 }
 
-// NEW: Test for signed char identity
-void test_schar_identity_minimal() {
-    FFI_FunctionSignature* ffi_schar_identity_test = create_ffi_function(
-        "schar_identity_minimal", FFI_TYPE_SCHAR, 1, identity_schar_params, (GenericFuncPtr)schar_identity_minimal, NULL, 0);
-    if (ffi_schar_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        signed char in_val = -120;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool success = invoke_foreign_function(ffi_schar_identity_test, args, 1, &g_ffi_return_value);
-        ok(success, "FFI call successful for schar_identity_minimal");
-        is_int(g_ret_storage.sc_val, in_val, "Result (schar): %d (Expected %d)", g_ret_storage.sc_val, in_val);
-        destroy_ffi_function(ffi_schar_identity_test);
-    } else {
-        fail("Failed to create FFI object for schar_identity_minimal.");
+/**
+ * @brief Measures invoke and create/destroy throughput at 1, 2, 4, ... threads up to the
+ * online CPU count. Each thread does the same amount of work, so with no shared cache lines
+ * the aggregate rate grows linearly; "eff" reports it as a fraction of 1-thread rate x threads.
+ * @param invoke_iterations Calls per thread on one shared signature.
+ * @param create_iterations create/destroy pairs per thread.
+ */
+static void bench_thread_scaling(long invoke_iterations, long create_iterations) {
+    enum { MAX_THREADS = 256 };
+    int max_threads = ffi_bench_online_cpus();
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+    FFI_FunctionSignature* shared = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                        (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    if (shared == NULL) {
+        diag("bench: quiet_add_two_ints unavailable, skipping.");
+        return;
+    }
+    BenchScalingThread* threads = (BenchScalingThread*)calloc(MAX_THREADS, sizeof(BenchScalingThread));
+    ffi_thread_t* handles = (ffi_thread_t*)calloc(MAX_THREADS, sizeof(ffi_thread_t));
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF); // Creation logs at INFO; keep the sink out of the measurement
+    for (int mode = 0; mode < 2 && threads && handles; ++mode) {
+        long iterations = mode == 0 ? invoke_iterations : create_iterations;
+        double single_rate = 0.0;
+        for (int n = 1; ; n = (n * 2 > max_threads && n < max_threads) ? max_threads : n * 2) {
+            int64_t start_flag = 0, ready = 0;
+            int started = 0;
+            for (int i = 0; i < n; ++i) {
+                threads[i] = (BenchScalingThread){ .sig = mode == 0 ? shared : NULL, .iterations = iterations,
+                                                   .start_flag = &start_flag, .ready = &ready };
+                if (!ffi_thread_start(&handles[i], bench_scaling_main, &threads[i])) break;
+                started++;
+            }
+            while (FFI_ATOMIC_LOAD_I64(&ready) < started) {
+                ffi_thread_yield();
+            }
+            uint64_t start = ffi_bench_now_ns();
+            FFI_ATOMIC_STORE_I64(&start_flag, 1);
+            for (int i = 0; i < started; ++i) {
+                ffi_thread_join(handles[i]);
+            }
+            uint64_t elapsed = ffi_bench_now_ns() - start;
+            if (started != n) {
+                diag("bench: could not start %d scaling threads, skipping.", n);
+                break;
+            }
+            double rate = (double)iterations * (double)n * 1e9 / (double)elapsed;
+            if (n == 1) single_rate = rate;
+            char label[64];
+            snprintf(label, sizeof(label), "%s, %d threads", mode == 0 ? "invoke_foreign_function shared sig" : "create+destroy quiet_add_two_ints", n);
+            note("bench %-44s %10ld calls %12.0f calls/s (eff %.2f)", label, iterations * n, rate,
+                 single_rate > 0.0 ? rate / (single_rate * n) : 0.0);
+            if (n >= max_threads) break;
+        }
     }
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    free(handles);
+    free(threads);
+    destroy_ffi_function(shared);
 }
 
-// NEW: Test for signed short identity
-void test_sshort_identity_minimal() {
-    FFI_FunctionSignature* ffi_sshort_identity_test = create_ffi_function(
-        "sshort_identity_minimal", FFI_TYPE_SSHORT, 1, identity_sshort_params, (GenericFuncPtr)sshort_identity_minimal, NULL, 0);
-    if (ffi_sshort_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        signed short in_val = -30000;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool success = invoke_foreign_function(ffi_sshort_identity_test, args, 1, &g_ffi_return_value);
-        ok(success, "FFI call successful for sshort_identity_minimal");
-        is_int(g_ret_storage.ss_val, in_val, "Result (signed short): %hd (Expected %hd)", g_ret_storage.ss_val, in_val);
-        destroy_ffi_function(ffi_sshort_identity_test);
-    } else {
-        fail("Failed to create FFI object for sshort_identity_minimal.");
+/**
+ * @brief Compares tier 0 with JIT code: the cost of a handle that is called once (create, one
+ * call, destroy) and the steady-state cost per call. Tier 0 should win the first and lose
+ * the second, which is what the promotion threshold trades off.
+ * @param count Handles created per mode.
+ * @param iterations Calls timed per mode for the steady state.
+ */
+static void bench_tiered_execution(int count, long iterations) {
+    int a = 40, b = 2, result = 0;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    FFI_Argument ret = { .value_ptr = &result };
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF); // Measure the calls, not the trace output
+    for (int tiered = 0; tiered <= 1; ++tiered) {
+        ffi_set_tiered_execution(tiered ? INT64_MAX : 0, true); // Never promote during the measurement
+        uint64_t start = ffi_bench_now_ns();
+        for (int i = 0; i < count; ++i) {
+            FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                             (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+            invoke_foreign_function(sig, args, 2, &ret);
+            destroy_ffi_function(sig);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        note("bench %-44s %10d handles %8.2f us/handle", tiered ? "create+call+destroy (tier 0)" : "create+call+destroy (JIT)",
+             count, (double)elapsed / 1000.0 / (double)count);
+
+        FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+        start = ffi_bench_now_ns();
+        for (long i = 0; sig && i < iterations; ++i) {
+            invoke_foreign_function(sig, args, 2, &ret);
+        }
+        elapsed = ffi_bench_now_ns() - start;
+        note("bench %-44s %10ld calls %8.2f ns/call", tiered ? "invoke_foreign_function (tier 0)" : "invoke_foreign_function (JIT)",
+             iterations, (double)elapsed / (double)iterations);
+        destroy_ffi_function(sig);
     }
+    ffi_set_tiered_execution(0, true);
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
 }
 
-// NEW: Test for signed int identity
-void test_sint_identity_minimal() {
-    FFI_FunctionSignature* ffi_sint_identity_test = create_ffi_function(
-        "sint_identity_minimal", FFI_TYPE_SINT, 1, identity_sint_params, (GenericFuncPtr)sint_identity_minimal, NULL, 0);
-    if (ffi_sint_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        signed int in_val = -2000000000;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool success = invoke_foreign_function(ffi_sint_identity_test, args, 1, &g_ffi_return_value);
-        ok(success, "FFI call successful for sint_identity_minimal");
-        is_int(g_ret_storage.si_val, in_val, "Result (signed int): %d (Expected %d)", g_ret_storage.si_val, in_val);
-        destroy_ffi_function(ffi_sint_identity_test);
-    } else {
-        fail("Failed to create FFI object for sint_identity_minimal.");
+/**
+ * @brief Parses and interns `count` signature strings twice: once while the table fills
+ * (mostly distinct signatures, each allocated once) and once more when every lookup hits.
+ * @param count Number of signature strings.
+ */
+static void bench_signature_interning(int count) {
+    static const char codes[] = "BcCasSiIjJlLzwpfdg";
+    char (*texts)[24] = (char (*)[24])malloc((size_t)count * sizeof(*texts));
+    if (texts == NULL) {
+        diag("bench: out of memory for %d signature strings, skipping.", count);
+        return;
+    }
+    // Deterministic mix: 1-6 parameters drawn from the codes, written with and without commas.
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (int i = 0; i < count; ++i) {
+        char* out = texts[i];
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        int num_params = 1 + (int)((state >> 33) % 6);
+        *out++ = codes[(state >> 40) % (sizeof(codes) - 1)];
+        *out++ = '(';
+        for (int p = 0; p < num_params; ++p) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            if (p > 0 && (i & 1)) *out++ = ',';
+            *out++ = codes[(state >> 33) % (sizeof(codes) - 1)];
+        }
+        *out++ = ')';
+        *out = '\0';
     }
+    ffi_signature_table_reset();
+    for (int pass = 0; pass < 2; ++pass) {
+        uint64_t start = ffi_bench_now_ns();
+        int failures = 0;
+        for (int i = 0; i < count; ++i) {
+            if (ffi_intern_signature(texts[i]) == NULL) failures++;
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        note("bench %-44s %10d sigs %8.2f ns/sig (%zu distinct, %d failed)",
+             pass == 0 ? "ffi_intern_signature (filling table)" : "ffi_intern_signature (all hits)",
+             count, (double)elapsed / (double)count, ffi_signature_count(), failures);
+    }
+    ffi_signature_table_reset();
+    free(texts);
 }
 
-// NEW: Test for signed long identity
-void test_slong_identity_minimal() {
-    FFI_FunctionSignature* ffi_slong_identity_test = create_ffi_function(
-        "slong_identity_minimal", FFI_TYPE_SLONG, 1, identity_slong_params, (GenericFuncPtr)slong_identity_minimal, NULL, 0);
-    if (ffi_slong_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        signed long in_val = -9000000000000000000L;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool invocation_success = invoke_foreign_function(ffi_slong_identity_test, args, 1, &g_ffi_return_value);
-        ok(invocation_success, "FFI call successful for slong_identity_minimal");
-        is_int(g_ret_storage.sl_val, in_val, "Result (signed long): %ld (Expected %ld)", g_ret_storage.sl_val, in_val);
-        destroy_ffi_function(ffi_slong_identity_test);
-    } else {
-        fail("Failed to create FFI object for slong_identity_minimal.");
+/**
+ * @brief Times opening a library with a large binding table, lazily and with every entry
+ * bound up front. The lazy cost should not grow with the table beyond one pointer per entry.
+ * @param count Entries in the table (cycling through a few real math functions).
+ */
+static void bench_library_binding(int count) {
+    static const FFI_LibraryBinding pool[] = {
+        { "cos", "d(d)" }, { "sin", "d(d)" }, { "tan", "d(d)" }, { "exp", "d(d)" },
+        { "log", "d(d)" }, { "sqrt", "d(d)" }, { "pow", "d(dd)" }, { "atan2", "d(dd)" },
+    };
+    FFI_LibraryBinding* table = (FFI_LibraryBinding*)malloc((size_t)count * sizeof(FFI_LibraryBinding));
+    if (table == NULL) {
+        diag("bench: out of memory for %d bindings, skipping.", count);
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        table[i] = pool[i % (int)(sizeof(pool) / sizeof(pool[0]))];
     }
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF);
+    for (int bind_now = 0; bind_now <= 1; ++bind_now) {
+        uint64_t start = ffi_bench_now_ns();
+        FFI_Library* lib = ffi_library_open(FFI_TEST_MATH_LIBRARY, table, count, bind_now != 0);
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        if (lib == NULL) {
+            diag("bench: could not open %s, skipping.", FFI_TEST_MATH_LIBRARY);
+            break;
+        }
+        note("bench %-44s %10d symbols %8.2f ms total (%d resolved)",
+             bind_now ? "ffi_library_open (bind now)" : "ffi_library_open (lazy)", count, (double)elapsed / 1e6,
+             ffi_library_resolved_count(lib));
+        ffi_library_close(lib);
+    }
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    free(table);
 }
 
-// NEW: Test for signed long long identity
-void test_sllong_identity_minimal() {
-    FFI_FunctionSignature* ffi_sllong_identity_test = create_ffi_function(
-        "sllong_identity_minimal", FFI_TYPE_SLLONG, 1, identity_sllong_params, (GenericFuncPtr)sllong_identity_minimal, NULL, 0);
-    if (ffi_sllong_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        signed long long in_val = -987654321098765432LL;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool success = invoke_foreign_function(ffi_sllong_identity_test, args, 1, &g_ffi_return_value);
-        ok(success, "FFI call successful for sllong_identity_minimal");
-        is_int(g_ret_storage.sll_val, in_val, "Result (sllong): %lld (Expected %lld)", g_ret_storage.sll_val, in_val);
-        destroy_ffi_function(ffi_sllong_identity_test);
-    } else {
-        fail("Failed to create FFI object for sllong_identity_minimal.");
+/**
+ * @brief Times eager handle creation with and without the jitdump writer, which adds one
+ * buffered load record per trampoline.
+ * @param count Handles created per configuration.
+ */
+static void bench_jitdump_overhead(int count) {
+    FFI_FunctionSignature** handles = (FFI_FunctionSignature**)malloc((size_t)count * sizeof(*handles));
+    if (handles == NULL) {
+        diag("bench: out of memory for %d handles, skipping.", count);
+        return;
+    }
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF);
+    for (int recording = 0; recording <= 1; ++recording) {
+        if (recording && !ffi_set_jitdump(true)) {
+            diag("bench: jitdump unavailable, skipping.");
+            break;
+        }
+        uint64_t start = ffi_bench_now_ns();
+        for (int i = 0; i < count; ++i) {
+            handles[i] = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                             (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        for (int i = 0; i < count; ++i) {
+            destroy_ffi_function(handles[i]);
+        }
+        note("bench %-44s %10d handles %8.2f us/handle",
+             recording ? "create_ffi_function (jitdump on)" : "create_ffi_function (jitdump off)",
+             count, (double)elapsed / 1000.0 / (double)count);
+    }
+    if (ffi_jitdump_path() != NULL) {
+        ffi_set_jitdump(false);
+        remove(ffi_jitdump_path());
     }
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
+    free(handles);
 }
 
-// NEW: Test for int128 identity
-void test_int128_identity_minimal() {
-#if defined(__SIZEOF_INT128__) || defined(__GNUC__)
-    FFI_FunctionSignature* ffi_int128_identity_test = create_ffi_function(
-        "int128_identity_minimal", FFI_TYPE_INT128, 1, identity_int128_params, (GenericFuncPtr)int128_identity_minimal, NULL, 0);
-    if (ffi_int128_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        __int128 in_val = (__int128)0x1234567890ABCDEFLL << 64 | 0xFEDCBA9876543210LL;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool success = invoke_foreign_function(ffi_int128_identity_test, args, 1, &g_ffi_return_value);
-        ok(success, "FFI call successful for int128_identity_minimal");
-        is_int128(g_ret_storage.i128_val, in_val, "Result (int128): 0x%llx%016llx (Expected 0x%llx%016llx)",
-                  (unsigned long long)(g_ret_storage.i128_val >> 64), (unsigned long long)g_ret_storage.i128_val,
-                  (unsigned long long)(in_val >> 64), (unsigned long long)in_val);
-        destroy_ffi_function(ffi_int128_identity_test);
-    } else {
-        fail("Failed to create FFI object for int128_identity_minimal.");
+/**
+ * @brief Times calls through the same function with each instrumentation mode, to show the
+ * cost of the `lock inc` counter and of the timestamp pair plus histogram update.
+ * @param iterations Calls per mode.
+ */
+static void bench_call_instrumentation(long iterations) {
+    static const char* labels[] = { "quiet_add_two_ints (instrumentation off)", "quiet_add_two_ints (call counter)",
+                                    "quiet_add_two_ints (latency histogram)" };
+    int a = 40, b = 2;
+    FFI_Argument args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+    ffi_set_log_level(FFI_LOG_LEVEL_OFF);
+    for (int mode = FFI_INSTRUMENT_OFF; mode <= FFI_INSTRUMENT_TIME; ++mode) {
+        ffi_set_call_instrumentation((FFI_InstrumentMode)mode);
+        FFI_FunctionSignature* sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                         (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+        bench_trampoline(labels[mode], sig, args, 2, iterations);
+        destroy_ffi_function(sig);
     }
-#else
-    skip("int128_identity_minimal skipped: __int128 not supported on this compiler.");
-#endif
+    ffi_set_call_instrumentation(FFI_INSTRUMENT_OFF);
+    ffi_set_log_level((FFI_LogLevel)FFI_LOG_MAX_LEVEL);
 }
 
-// NEW: Test for uint128 identity
-void test_uint128_identity_minimal() {
-#if defined(__SIZEOF_INT128__) || defined(__GNUC__)
-    FFI_FunctionSignature* ffi_uint128_identity_test = create_ffi_function(
-        "uint128_identity_minimal", FFI_TYPE_UINT128, 1, identity_uint128_params, (GenericFuncPtr)uint128_identity_minimal, NULL, 0);
-    if (ffi_uint128_identity_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage));
-        g_ffi_return_value.value_ptr = &g_ret_storage;
-        unsigned __int128 in_val = (unsigned __int128)0xFEDCBA9876543210ULL << 64 | 0x1234567890ABCDEFULL;
-        FFI_Argument args[] = { { .value_ptr = &in_val } };
-        bool success = invoke_foreign_function(ffi_uint128_identity_test, args, 1, &g_ffi_return_value);
-        ok(success, "FFI call successful for uint128_identity_minimal");
-        is_uint128(g_ret_storage.ui128_val, in_val, "Result (uint128): 0x%llx%016llx (Expected 0x%llx%016llx)",
-                   (unsigned long long)(g_ret_storage.ui128_val >> 64), (unsigned long long)g_ret_storage.ui128_val,
-                   (unsigned long long)(in_val >> 64), (unsigned long long)in_val);
-        destroy_ffi_function(ffi_uint128_identity_test);
-    } else {
-        fail("Failed to create FFI object for uint128_identity_minimal.");
+/**
+ * @brief Runs the trampoline benchmarks (System V vs. Win64 on the same host).
+ */
+void run_benchmarks(void) {
+    const long iterations = 5000000;
+    int a = 40, b = 2;
+    FFI_Argument add_args[] = { { .value_ptr = &a }, { .value_ptr = &b } };
+
+    note("--- Trampoline Benchmarks ---");
+    FFI_FunctionSignature* native_add = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                            (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    bench_trampoline("native quiet_add_two_ints(int, int)", native_add, add_args, 2, iterations);
+    destroy_ffi_function(native_add);
+
+    bench_lazy_binding(1000);
+    bench_tiered_execution(1000, 2000000);
+    bench_signature_interning(100000);
+    bench_library_binding(5000);
+    bench_jitdump_overhead(2000);
+    bench_call_instrumentation(5000000);
+    bench_invoke_logging(200000);
+    bench_call_tracing(5000000);
+    bench_call_record_replay(1000000);
+
+    FFI_FunctionSignature* prepared_sig = create_ffi_function("quiet_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                              (GenericFuncPtr)quiet_add_two_ints, NULL, 0);
+    FFI_PreparedCall* prepared = prepare_ffi_call(prepared_sig);
+    if (prepared) {
+        *(int*)prepared_call_arg(prepared, 0) = a;
+        *(int*)prepared_call_arg(prepared, 1) = b;
+        for (long i = 0; i < iterations / 10; ++i) { // Warm-up
+            invoke_prepared_call(prepared);
+        }
+        uint64_t start = ffi_bench_now_ns();
+        for (long i = 0; i < iterations; ++i) {
+            invoke_prepared_call(prepared);
+        }
+        uint64_t elapsed = ffi_bench_now_ns() - start;
+        note("bench %-44s %10ld calls %8.2f ns/call", "invoke_prepared_call quiet_add_two_ints", iterations, (double)elapsed / (double)iterations);
     }
-#else
-    skip("uint128_identity_minimal skipped: __int128 not supported on this compiler.");
+    destroy_prepared_call(prepared);
+    destroy_ffi_function(prepared_sig);
+
+    bench_async_blocking(256, 2);
+    bench_executor_producers(200000);
+    bench_thread_scaling(2000000, 2000);
+
+#ifdef FFI_HAVE_MS_ABI_TARGETS
+    FFI_FunctionSignature* win64_add = create_ffi_function_abi("ms_add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params,
+                                                               (GenericFuncPtr)ms_add_two_ints, FFI_ABI_WIN64);
+    bench_trampoline("win64 ms_add_two_ints(int, int)", win64_add, add_args, 2, iterations);
+    destroy_ffi_function(win64_add);
+
+    int ia = 1, ic = -3;
+    double db = 2.5, de = 100.25;
+    float fd = 4.5f, ff = -0.75f;
+    long long lg = 1000LL;
+    FFI_Argument mixed_args[] = { { .value_ptr = &ia }, { .value_ptr = &db }, { .value_ptr = &ic }, { .value_ptr = &fd },
+                                  { .value_ptr = &de }, { .value_ptr = &ff }, { .value_ptr = &lg } };
+    FFI_FunctionSignature* win64_mixed = create_ffi_function_abi("ms_mixed_positional", FFI_TYPE_DOUBLE, 7, ms_mixed_positional_params,
+                                                                 (GenericFuncPtr)ms_mixed_positional, FFI_ABI_WIN64);
+    bench_trampoline("win64 ms_mixed_positional(7 args, 3 on stack)", win64_mixed, mixed_args, 7, iterations);
+    destroy_ffi_function(win64_mixed);
 #endif
 }
 
-void test_error_case_add_two_ints_wrong_arg_count() {
-    FFI_FunctionSignature* ffi_add_two_ints_test = create_ffi_function(
-        "add_two_ints", FFI_TYPE_INT, 2, add_two_ints_params, (GenericFuncPtr)add_two_ints, NULL, 0);
-    if (ffi_add_two_ints_test) {
-        memset(&g_ret_storage, 0, sizeof(g_ret_storage)); // Clear return storage
-        g_ffi_return_value.value_ptr = &g_ret_storage; // Ensure return value pointer is set
-        int i_error_val = 5;
-        FFI_Argument args_error1[] = { { .value_ptr = &i_error_val } };
-        bool invocation_success = invoke_foreign_function(ffi_add_two_ints_test, args_error1, 1, &g_ffi_return_value);
-        // This call is expected to fail due to argument count mismatch
-        ok(!invocation_success, "Invocation expected to fail due to incorrect argument count.");
-        destroy_ffi_function(ffi_add_two_ints_test);
-    } else {
-        skip("Skipping error case test for add_two_ints (dependent FFI object not created).");
+/**
+ * @brief Writes the call trace to `path` and its Chrome JSON conversion to `path`.json.
+ */
+static bool ffi_write_call_trace_files(const char* path) {
+    size_t length = strlen(path);
+    char* json_path = (char*)malloc(length + sizeof(".json"));
+    if (json_path == NULL) {
+        return false;
     }
+    memcpy(json_path, path, length);
+    memcpy(json_path + length, ".json", sizeof(".json"));
+    bool written = ffi_call_trace_write(path) >= 0 && ffi_call_trace_to_chrome_json(path, json_path) >= 0;
+    free(json_path);
+    return written;
 }
 
-int main() {
-    plan(54); // Total number of subtests
+int main(int argc, char** argv) {
+    bool bench = false;
+    const char* stats_json_path = NULL; // --stats-json <file>: write ffi_runtime_stats() at exit
+    const char* call_trace_path = NULL; // --call-trace <file>: trace every call, write <file> and <file>.json
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        } else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            stats_json_path = argv[++i];
+        } else if (strcmp(argv[i], "--call-trace") == 0 && i + 1 < argc) {
+            call_trace_path = argv[++i];
+            ffi_set_call_tracing(true);
+        }
+    }
+    if (bench) {
+        run_benchmarks();
+        bool written = !stats_json_path || ffi_runtime_stats_write_json(stats_json_path);
+        return (written && (!call_trace_path || ffi_write_call_trace_files(call_trace_path))) ? 0 : 1;
+    }
+
+    plan(101); // Total number of subtests
 
     note("Starting main application with runtime assembly generation example (object-oriented FFI).");
     note("sizeof(FFI_Argument): %zu", sizeof(FFI_Argument)); // Should be 8 on x86-64 now
@@ -3288,7 +12708,105 @@ int main() {
     subtest("__int128 int128_in_out(__int128)", test_int128_identity_minimal); // New 128-bit test
     subtest("unsigned __int128 uint128_in_out(unsigned __int128)", test_uint128_identity_minimal); // New 128-bit test
 
+    note("\n--- Running Raw Syscall Tests ---\n");
+    subtest("long sys_getpid(void) via raw syscall", test_syscall_getpid);
+    subtest("long sys_read/sys_write(int, void*, size_t) on a pipe", test_syscall_pipe_read_write);
+    subtest("Raw syscall errno translation", test_syscall_errno_translation);
+
+    note("\n--- Running Win64 ABI Tests ---\n");
+    subtest("Win64 ABI: int ms_add_two_ints(int, int)", test_win64_add_two_ints);
+    subtest("Win64 ABI: positional GPR/XMM pairing and stack arguments", test_win64_mixed_positional);
+    subtest("Win64 ABI: __int128 passed by reference", test_win64_int128_by_reference);
+    subtest("Win64 ABI: 16-byte stack alignment at the call", test_win64_stack_alignment);
+    subtest("Explicit runtime ABI selection", test_explicit_abi_selection);
+
+    note("\n--- Running Half-Precision Tests ---\n");
+    subtest("_Float16 f16_scaled_product(_Float16, _Float16, int)", test_float16_scaled_product);
+    subtest("float f16_sum_ten(10 x _Float16, 2 on the stack)", test_float16_stack_spill);
+    subtest("bfloat16 bf16_scale(bfloat16, float)", test_bfloat16_scale);
+    subtest("Win64 ABI: _Float16 in GPRs and on the stack", test_win64_float16);
+    subtest("Half/bfloat16 bulk conversion helpers", test_half_bulk_conversion);
+
+    note("\n--- Running Complex and long double Tests ---\n");
+    subtest("double complex dc_multiply(double complex, double complex)", test_double_complex_multiply);
+    subtest("float complex fc_scale(float complex, float)", test_float_complex_scale);
+    subtest("long double ld_muladd(long double, long double, long double)", test_long_double_muladd);
+    subtest("double complex spilled whole when only XMM7 is left", test_double_complex_register_straddle);
+    subtest("__int128 stack arguments on 16-byte aligned slots", test_int128_stack_alignment);
+
+    note("\n--- Running Lazy Binding Tests ---\n");
+    subtest("Lazy binding: trampoline generated once, on first invoke", test_lazy_binding_first_invoke);
+    subtest("Lazy binding: generation errors surface at first invoke", test_lazy_binding_deferred_error);
+
+    note("\n--- Running Logging Tests ---\n");
+    subtest("Log levels filter messages before the sink", test_log_levels_and_sink);
+
+    note("\n--- Running Prepared Call Tests ---\n");
+    subtest("Prepared call: aligned storage reused across invocations", test_prepared_call_reuse);
+    subtest("Prepared call: stack arguments, lazy binding and validation", test_prepared_call_validation);
+
+    note("\n--- Running Typed Binding Tests ---\n");
+    subtest("Typed bindings: _Generic type mapping and FFI_BIND", test_typed_signature_mapping);
+    subtest("Typed bindings: FFI_CALL argument frames and typed results", test_typed_call);
+
+    note("\n--- Running Async Invocation Tests ---\n");
+    subtest("Async invoke: futures, callbacks and work stealing", test_async_invoke_futures);
+    subtest("Async invoke: bounded queues and draining shutdown", test_async_invoke_backpressure);
 
-    return done_testing(); // Marks the end of tests
+    note("\n--- Running Dedicated Executor Tests ---\n");
+    subtest("Executor: many producers, one thread-affine consumer", test_executor_thread_affinity);
+    subtest("Executor: bounded ring and draining shutdown", test_executor_ring_full);
+
+    note("\n--- Running Safe Reclamation Tests ---\n");
+    subtest("Epochs: destroy inside a critical section is deferred", test_epoch_deferred_destroy);
+    subtest("Epochs: concurrent create, invoke and destroy", test_epoch_concurrent_destroy);
+
+    note("\n--- Running Thread Safety Tests ---\n");
+    subtest("Runtime: concurrent create, invoke, destroy and logging", test_runtime_thread_safety);
+
+    note("\n--- Running Tiered Execution Tests ---\n");
+    subtest("Tiering: tier-0 shims and background promotion", test_tiered_promotion);
+    subtest("Tiering: JIT-only shapes, inline promotion and destroy races", test_tiered_fallbacks);
+
+    note("\n--- Running Signature String Tests ---\n");
+    subtest("Signature strings: grammar, canonical form and interning", test_signature_parsing);
+    subtest("Signature strings: creating and calling handles", test_signature_create);
+
+    note("\n--- Running Library Binding Tests ---\n");
+    subtest("Library bindings: lazy PLT-style resolution", test_library_lazy_binding);
+
+    note("\n--- Running Profiler Integration Tests ---\n");
+    subtest("Perf map: symbols for generated trampolines", test_perf_map_entries);
+    subtest("jitdump: load records with code bytes for perf inject", test_jitdump_records);
+    subtest("GDB JIT interface: batched in-memory ELF symbols", test_gdb_jit_registration);
+    subtest("Unwind info: DWARF CFI registered with __register_frame", test_unwind_info_backtrace);
+
+    note("\n--- Running Call Instrumentation Tests ---\n");
+    subtest("Call instrumentation: counters and latency histograms", test_call_instrumentation);
+
+    note("\n--- Running Runtime Statistics Tests ---\n");
+    subtest("Runtime statistics: code heap and binding registry", test_runtime_stats);
+
+    note("\n--- Running Disassembler Tests ---\n");
+    subtest("Disassembler: x86-64 and AArch64 trampoline listings", test_trampoline_disassembler);
+
+    note("\n--- Running USDT Probe Tests ---\n");
+    subtest("USDT: probe notes, nop sites and handle ids", test_usdt_probes);
+
+    note("\n--- Running Call Tracing Tests ---\n");
+    subtest("Call tracing: per-thread rings, binary dump and Chrome JSON", test_call_tracing);
+
+    note("\n--- Running Call Record and Replay Tests ---\n");
+    subtest("Record and replay: sampled call log, result comparison and throughput", test_call_record_replay);
+
+
+    int status = done_testing(); // Marks the end of tests
+    if (stats_json_path && !ffi_runtime_stats_write_json(stats_json_path)) {
+        status = 1;
+    }
+    if (call_trace_path && !ffi_write_call_trace_files(call_trace_path)) {
+        status = 1;
+    }
+    return status;
 
 }